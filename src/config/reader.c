@@ -295,6 +295,41 @@ static SrnRet read_application_config_from_cfg(config_t *cfg,
     config_lookup_bool_ex(cfg, "server-visibility",
             &app_cfg->ui->window.server_visibility);
 
+    /* Read chat log config */
+    const char *overflow_policy = NULL;
+    const char *log_format = NULL;
+    config_lookup_int(cfg, "chat-log.queue-size",
+            &app_cfg->chat_log.queue_size);
+    config_lookup_string(cfg, "chat-log.overflow-policy", &overflow_policy);
+    if (overflow_policy){
+        SrnRet ret;
+
+        ret = srn_chat_log_overflow_policy_from_string(overflow_policy,
+                &app_cfg->chat_log.overflow_policy);
+        if (!RET_IS_OK(ret)){
+            return ret;
+        }
+    }
+    config_lookup_string(cfg, "chat-log.format", &log_format);
+    if (log_format){
+        SrnRet ret;
+
+        ret = srn_chat_log_format_from_string(log_format,
+                &app_cfg->chat_log.format);
+        if (!RET_IS_OK(ret)){
+            return ret;
+        }
+    }
+
+    config_lookup_int(cfg, "chat-log.compress-after",
+            &app_cfg->chat_log.compress_after);
+
+    /* Read preview cache config */
+    config_lookup_int(cfg, "preview-cache.memory-size",
+            &app_cfg->ui->preview_cache.memory_size);
+    config_lookup_int(cfg, "preview-cache.disk-size",
+            &app_cfg->ui->preview_cache.disk_size);
+
     /* Read auto connect server list */
     config_setting_t *auto_connect;
     auto_connect = config_lookup(cfg, "auto-connect");
@@ -418,6 +453,23 @@ static SrnRet read_server_config_from_server(config_setting_t *server,
         }
     }
 
+    /* Read watch list */
+    config_setting_t *watch;
+    watch = config_setting_lookup(server, "watch-list");
+    if (watch){
+        for (int i = 0; i < config_setting_length(watch); i++){
+            const char *val;
+            config_setting_t *nick;
+
+            nick = config_setting_get_elem(watch, i);
+            if (!nick) continue;
+            val = config_setting_get_string(nick);
+            if (!val) continue;
+
+            cfg->watch_list = g_list_append(cfg->watch_list, g_strdup(val));
+        }
+    }
+
     /* Read autorun command list */
     config_setting_t *cmds;
     cmds = config_setting_lookup(server, "auto-run");
@@ -494,6 +546,7 @@ static SrnRet read_chat_config_from_chat(config_setting_t *chat, SrnChatConfig *
     config_setting_lookup_bool_ex(chat, "show-avatar", &cfg->ui->show_avatar);
     config_setting_lookup_bool_ex(chat, "show-user-list", &cfg->ui->show_user_list);
     config_setting_lookup_bool_ex(chat, "render-mirc-color", &cfg->render_mirc_color);
+    config_setting_lookup_int(chat, "history-size", &cfg->history_size);
     config_setting_lookup_bool_ex(chat, "preview-url", &cfg->ui->preview_url);
     config_setting_lookup_bool_ex(chat, "auto-preview-url", &cfg->ui->auto_preview_url);
     config_setting_lookup_string_ex(chat, "nick-completion-suffix", &cfg->ui->nick_completion_suffix);
@@ -622,6 +675,7 @@ static SrnRet read_user_config_from_user(config_setting_t *user, SrnUserConfig *
         cfg->login->method = srn_login_method_from_string(method);
 
         config_setting_lookup_string_ex(login, "certificate", &cfg->login->cert_file);
+        config_setting_lookup_int(login, "timeout", &cfg->login->timeout);
     }
 
     config_setting_lookup_string_ex(user, "nickname", &cfg->nick);
@@ -124,6 +124,8 @@ void srn_application_run(SrnApplication *app, int argc, char *argv[]){
 
 void srn_application_set_config(SrnApplication *app, SrnApplicationConfig  *cfg){
     sui_application_set_config(app->ui, cfg->ui);
+    srn_chat_log_set_config(&cfg->chat_log);
+    srn_chat_log_compress_set_config(&cfg->chat_log);
     app->cfg = cfg;
 }
 
@@ -314,7 +316,7 @@ SrnRet srn_application_add_server_with_config(SrnApplication *app,
             return ret;
         }
 
-        g_autoptr(SircMessageContext) context = sirc_message_context_new(NULL);
+        g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
 
         if (RET_IS_OK(ret)){
             if (ret != SRN_OK) { // Has OK message
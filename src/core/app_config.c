@@ -16,5 +16,14 @@ void srn_application_config_free(SrnApplicationConfig *cfg){
 }
 
 SrnRet srn_application_config_check(SrnApplicationConfig *cfg){
+    if (cfg->chat_log.queue_size <= 0){
+        return RET_ERR(_("Invalid value of chat-log.queue-size: %1$d"),
+                cfg->chat_log.queue_size);
+    }
+    if (cfg->chat_log.compress_after < 0){
+        return RET_ERR(_("Invalid value of chat-log.compress-after: %1$d"),
+                cfg->chat_log.compress_after);
+    }
+
     return SRN_OK;
 }
@@ -45,7 +45,22 @@ static gboolean do_period_ping(gpointer user_data);
 static void add_numeric_error_message(SrnChat *chat, int event, const char
         *origin, const char **params, int count, const SircMessageContext *context);
 static void rejoin_all_channels(SrnServer *srv);
+static void rejoin_all_channels_if_waiting(SrnServer *srv);
 static gboolean rejoin_all_channels_cb(gpointer user_data);
+static gboolean drop_stale_users_cb(gpointer user_data);
+static bool is_nickserv_login_reply(const char *msg);
+static bool is_login_echo(SircSession *sirc, const char *target,
+        const char *msg);
+static bool count_netsplit_user(SrnServer *srv, SrnChat *chat,
+        const SircMessageContext *context);
+static void report_netsplit(SrnServer *srv, const SircBatch *batch,
+        const SircMessageContext *context);
+static void thaw_netsplit(SrnServer *srv, GHashTable *counts);
+static void end_playback(SrnServer *srv, const SircBatch *batch);
+static bool is_provisional_echo(SrnServer *srv,
+        const SircMessageContext *context);
+static SrnChat* get_reply_chat(SrnServer *srv,
+        const SircMessageContext *context, SrnChat *fallback);
 
 static void irc_event_connect(SircSession *sirc, const char *event,
         const SircMessageContext *context);
@@ -101,12 +116,26 @@ static void irc_event_warn(SircSession *sirc, const char *event,
 static void irc_event_note(SircSession *sirc, const char *event,
         const char *origin, const char *params[], int count,
         const SircMessageContext *context);
+static void irc_event_batch(SircSession *sirc, const char *event,
+        const char *origin, const char *params[], int count,
+        const SircMessageContext *context);
+static void irc_event_reply(SircSession *sirc, const char *event,
+        const SircMessageContext *context);
 static void irc_event_channel_notice(SircSession *sirc, const char *event,
         const char *origin, const char *params[], int count,
         const SircMessageContext *context);
 static void irc_event_invite(SircSession *sirc, const char *event,
         const char *origin, const char *params[], int count,
         const SircMessageContext *context);
+static void irc_event_away(SircSession *sirc, const char *event,
+        const char *origin, const char *params[], int count,
+        const SircMessageContext *context);
+static void irc_event_account(SircSession *sirc, const char *event,
+        const char *origin, const char *params[], int count,
+        const SircMessageContext *context);
+static void irc_event_chghost(SircSession *sirc, const char *event,
+        const char *origin, const char *params[], int count,
+        const SircMessageContext *context);
 static void irc_event_ctcp_req(SircSession *sirc, const char *event,
         const char *origin, const char *params[], int count,
         const SircMessageContext *context);
@@ -156,8 +185,13 @@ void srn_application_init_irc_event(SrnApplication *app) {
     app->irc_events.fail = irc_event_fail;
     app->irc_events.warn = irc_event_warn;
     app->irc_events.note = irc_event_note;
+    app->irc_events.batch = irc_event_batch;
+    app->irc_events.reply = irc_event_reply;
     app->irc_events.channel_notice = irc_event_channel_notice;
     app->irc_events.invite = irc_event_invite;
+    app->irc_events.away = irc_event_away;
+    app->irc_events.account = irc_event_account;
+    app->irc_events.chghost = irc_event_chghost;
     app->irc_events.ctcp_req = irc_event_ctcp_req;
     app->irc_events.ctcp_rsp = irc_event_ctcp_rsp;
     app->irc_events.cap = irc_event_cap;
@@ -320,6 +354,33 @@ static void irc_event_disconnect(SircSession *sirc, const char *event,
         g_source_remove(srv->ping_timer);
         srv->ping_timer = 0;
     }
+    /* Stop waiting for login */
+    if (srv->rejoin_timer){
+        g_source_remove(srv->rejoin_timer);
+        srv->rejoin_timer = 0;
+    }
+    if (srv->stale_timer){
+        g_source_remove(srv->stale_timer);
+        srv->stale_timer = 0;
+    }
+    srn_server_reset_isupport(srv);
+    /* Unfinished batches never end */
+    {
+        GHashTableIter iter;
+        GHashTable *counts;
+
+        g_hash_table_iter_init(&iter, srv->netsplits);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&counts)){
+            thaw_netsplit(srv, counts);
+        }
+        g_hash_table_remove_all(srv->netsplits);
+    }
+    /* Labeled commands are never replied */
+    srn_server_cancel_requests(srv, NULL);
+    srn_server_cancel_who(srv);
+    srn_server_stop_monitor(srv);
+    /* Host may be changed when reconnected */
+    srn_server_user_set_hostname(srv->user, NULL);
 
     ret = srn_server_state_transfrom(srv, SRN_SERVER_ACTION_DISCONNECT_FINISH);
     g_return_if_fail(RET_IS_OK(ret));
@@ -342,8 +403,15 @@ static void irc_event_disconnect(SircSession *sirc, const char *event,
         SrnChat *chat;
 
         chat = list->data;
-        // Mark all chats as unjoined
-        srn_chat_set_is_joined(chat, FALSE);
+        // Show messages of unfinished playback batch
+        srn_chat_end_batch(chat);
+        // Response of CHATHISTORY request is never received
+        chat->history_pending = FALSE;
+        str_assign(&chat->history_label, NULL);
+        str_assign(&chat->history_batch, NULL);
+        // Mark all chats as unjoined, but keep their user lists for
+        // reconciling with NAMES reply after reconnecting
+        srn_chat_mark_stale(chat);
         // Only report error message to server chat
         srn_chat_add_misc_message_fmt(chat, context,
                 _("Disconnected from %1$s(%2$s:%3$d): %4$s"),
@@ -360,6 +428,7 @@ static void irc_event_disconnect(SircSession *sirc, const char *event,
         list = g_list_next(list);
     }
 
+    srn_chat_end_batch(srv->chat);
     srn_chat_add_error_message_fmt(srv->chat, context,
             _("Disconnected from %1$s(%2$s:%3$d): %4$s"),
             srv->name, srv->addr->host, srv->addr->port, msg);
@@ -439,12 +508,21 @@ static void irc_event_welcome(SircSession *sirc, int event,
 
     if (try_login){
         if (nick_match) {
+            int timeout;
+
             srn_chat_add_misc_message_fmt(srv->chat, context,
                     _("Logging in with %1$s..."),
                     srn_login_method_to_string(srv->cfg->user->login->method));
-            // Rejoin after 8s, We hope to complete the auth within it
-            g_timeout_add(8 * 1000, rejoin_all_channels_cb, srv);
-            return;
+            // Rejoin when logged in, or when it is timeout
+            timeout = srv->cfg->user->login->timeout;
+            if (timeout > 0){
+                if (srv->rejoin_timer){
+                    g_source_remove(srv->rejoin_timer);
+                }
+                srv->rejoin_timer = g_timeout_add_seconds(timeout,
+                        rejoin_all_channels_cb, srv);
+                return;
+            }
         } else {
             srn_chat_add_error_message(srv->chat,
                     _("The assigned nickname does not match the requested nickname, login skipped"),
@@ -524,7 +602,10 @@ static void irc_event_quit(SircSession *sirc, const char *event,
 
         // TODO: dialog support
         chat_user = lst->data;
-        srn_chat_add_misc_message_with_user(chat_user->chat, chat_user, buf, context);
+        if (!count_netsplit_user(srv, chat_user->chat, context)){
+            srn_chat_add_misc_message_with_user(chat_user->chat, chat_user,
+                    buf, context);
+        }
         lst = g_list_next(lst);
     }
 
@@ -543,6 +624,7 @@ static void irc_event_join(SircSession *sirc, const char *event,
         const char *origin, const char **params, int count,
         const SircMessageContext *context){
     char buf[512];
+    bool netjoin;
     const char *chan;
     SrnServer *srv;
     SrnChat *chat;
@@ -557,6 +639,18 @@ static void irc_event_join(SircSession *sirc, const char *event,
 
     srv_user = srn_server_add_and_get_user(srv, origin);
     srn_server_user_set_is_online(srv_user, TRUE);
+    if (context->user && context->host){
+        // Also tells the prefix of ourselves, see sirc_set_prefix_len()
+        srn_server_user_set_username(srv_user, context->user);
+        srn_server_user_set_hostname(srv_user, context->host);
+    }
+    if (srv->cap->client_enabled.extended_join && count >= 3){
+        // "JOIN <channel> <account> :<realname>", see
+        // https://ircv3.net/specs/extensions/extended-join
+        srn_server_user_set_loginname(srv_user,
+                strcmp(params[1], "*") == 0 ? NULL : params[1]);
+        srn_server_user_set_realname(srv_user, params[2]);
+    }
     if (srv_user->is_me) {
         /* You has join a channel */
         srn_server_add_chat(srv, chan);
@@ -565,19 +659,27 @@ static void irc_event_join(SircSession *sirc, const char *event,
     chat = srn_server_get_chat(srv, chan);
     g_return_if_fail(chat);
 
+    // Count it before touching user list, which is frozen during netjoin
+    netjoin = count_netsplit_user(srv, chat, context);
+
     if (srv_user->is_me) {
         snprintf(buf, sizeof(buf), _("You have joined the channel"));
         srn_chat_set_is_joined(chat, TRUE);
         chat_user = chat->user;
+        if (!chat->history_fetched){
+            srn_chat_fetch_history(chat);
+        }
     } else {
         snprintf(buf, sizeof(buf), _("%1$s has joined"), origin);
         chat_user = srn_chat_add_and_get_user(chat, srv_user);
     }
 
-    g_return_if_fail(!chat_user->is_joined);
+    // User may be kept from last connection, see srn_chat_mark_stale()
     srn_chat_user_set_is_joined(chat_user, TRUE);
 
-    srn_chat_add_misc_message_with_user(chat, chat_user, buf, context);
+    if (!netjoin){
+        srn_chat_add_misc_message_with_user(chat, chat_user, buf, context);
+    }
 }
 
 static void irc_event_part(SircSession *sirc, const char *event,
@@ -841,6 +943,13 @@ static void irc_event_channel(SircSession *sirc, const char *event,
 
     srv_user = srn_server_add_and_get_user(srv, origin);
     g_return_if_fail(srv_user);
+    if (srv_user->is_me){
+        // Echo of message sent by us, see echo-message
+        if (!is_provisional_echo(srv, context)){
+            srn_chat_add_sent_message(chat, msg, context);
+        }
+        return;
+    }
     chat_user = srn_chat_add_and_get_user(chat, srv_user);
     g_return_if_fail(chat_user);
 
@@ -863,6 +972,19 @@ static void irc_event_privmsg(SircSession *sirc, const char *event,
     g_return_if_fail(srn_server_is_valid(srv));
     srv_user = srn_server_add_and_get_user(srv, origin);
     g_return_if_fail(srv_user);
+    if (srv_user->is_me){
+        // Echo of message sent by us, see echo-message
+        if (is_login_echo(sirc, params[0], msg)){
+            // Never show or log the password
+            return;
+        }
+        if (!is_provisional_echo(srv, context)){
+            chat = srn_server_add_and_get_chat(srv, params[0]);
+            g_return_if_fail(chat);
+            srn_chat_add_sent_message(chat, msg, context);
+        }
+        return;
+    }
     if (sirc_target_is_servername(sirc, origin)
             || sirc_target_is_service(sirc, origin)){
         chat = srn_server_get_chat(srv, origin);
@@ -909,6 +1031,13 @@ static void irc_event_notice(SircSession *sirc, const char *event,
     g_return_if_fail(chat_user);
 
     srn_chat_add_notice_message(chat, chat_user, msg, context);
+
+    // Some services do not send RPL_LOGGEDIN, recognize their replies
+    if (srv->rejoin_timer
+            && g_ascii_strcasecmp(origin, "NickServ") == 0
+            && is_nickserv_login_reply(msg)){
+        rejoin_all_channels_if_waiting(srv);
+    }
 }
 
 static void irc_event_tagmsg(SircSession *sirc, const char *event,
@@ -927,7 +1056,16 @@ static void irc_event_fail(SircSession *sirc, const char *event,
     /* context = params[2]...params[count-2] */
     const char *description = params[count-1];
     SrnServer *srv = sirc_get_ctx(sirc);
-    srn_chat_add_error_message_fmt(srv->chat, context, _("FAIL[%1$s] %2$s: %3$s"), command, code, description);
+    srn_server_reject_request(srv, context->label);
+    srn_chat_add_error_message_fmt(get_reply_chat(srv, context, srv->chat),
+            context, _("FAIL[%1$s] %2$s: %3$s"), command, code, description);
+
+    if (g_ascii_strcasecmp(command, "CHATHISTORY") == 0){
+        /* Target of request is not always known, stop all requests */
+        for (GList *lst = srv->chat_list; lst; lst = g_list_next(lst)){
+            srn_chat_end_history(lst->data);
+        }
+    }
 }
 
 static void irc_event_warn(SircSession *sirc, const char *event,
@@ -957,6 +1095,56 @@ static void irc_event_note(SircSession *sirc, const char *event,
     srn_chat_add_misc_message_fmt(chat, context, _("NOTE[%1$s] %2$s: %3$s"), command, code, description);
 }
 
+static void irc_event_batch(SircSession *sirc, const char *event,
+        const char *origin, const char **params, int count,
+        const SircMessageContext *context){
+    const SircBatch *batch;
+    SrnServer *srv;
+
+    g_return_if_fail(count >= 1);
+    batch = context->batch;
+    g_return_if_fail(batch);
+
+    srv = sirc_get_ctx(sirc);
+    g_return_if_fail(srn_server_is_valid(srv));
+
+    if (params[0][0] == '+'){
+        if (g_strcmp0(batch->type, "netsplit") == 0
+                || g_strcmp0(batch->type, "netjoin") == 0){
+            g_hash_table_replace(srv->netsplits, g_strdup(batch->ref),
+                    g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL));
+        }
+        return;
+    }
+
+    /* Batch ends */
+    if (g_strcmp0(batch->type, "netsplit") == 0
+            || g_strcmp0(batch->type, "netjoin") == 0){
+        report_netsplit(srv, batch, context);
+    } else if (g_strcmp0(batch->type, "chathistory") == 0
+            || g_strcmp0(batch->type, "znc.in/playback") == 0){
+        if (g_strcmp0(batch->type, "chathistory") == 0 && batch->params[0]){
+            SrnChat *chat;
+
+            chat = srn_server_get_chat(srv, batch->params[0]);
+            if (chat && srn_chat_is_history_batch(chat, batch)){
+                srn_chat_end_history(chat);
+            }
+        }
+        end_playback(srv, batch);
+    }
+}
+
+static void irc_event_reply(SircSession *sirc, const char *event,
+        const SircMessageContext *context){
+    SrnServer *srv;
+
+    srv = sirc_get_ctx(sirc);
+    g_return_if_fail(srn_server_is_valid(srv));
+
+    srn_server_finish_request(srv, context->label);
+}
+
 static void irc_event_channel_notice(SircSession *sirc, const char *event,
         const char *origin, const char **params, int count,
         const SircMessageContext *context){
@@ -1025,6 +1213,63 @@ static void irc_event_invite(SircSession *sirc, const char *event,
 
 }
 
+static void irc_event_away(SircSession *sirc, const char *event,
+        const char *origin, const char **params, int count,
+        const SircMessageContext *context){
+    SrnServer *srv;
+    SrnServerUser *srv_user;
+
+    srv = sirc_get_ctx(sirc);
+    g_return_if_fail(srn_server_is_valid(srv));
+    srv_user = srn_server_get_user(srv, origin);
+    if (!srv_user){
+        // Only users in our channels are notified
+        return;
+    }
+
+    // "AWAY :<message>" if user is away, or "AWAY" if user is back
+    srn_server_user_set_is_away(srv_user, count >= 1 && !str_is_empty(params[0]));
+}
+
+static void irc_event_account(SircSession *sirc, const char *event,
+        const char *origin, const char **params, int count,
+        const SircMessageContext *context){
+    SrnServer *srv;
+    SrnServerUser *srv_user;
+
+    g_return_if_fail(count >= 1);
+
+    srv = sirc_get_ctx(sirc);
+    g_return_if_fail(srn_server_is_valid(srv));
+    srv_user = srn_server_get_user(srv, origin);
+    if (!srv_user){
+        return;
+    }
+
+    // "*" means user has logged out
+    srn_server_user_set_loginname(srv_user,
+            strcmp(params[0], "*") == 0 ? NULL : params[0]);
+}
+
+static void irc_event_chghost(SircSession *sirc, const char *event,
+        const char *origin, const char **params, int count,
+        const SircMessageContext *context){
+    SrnServer *srv;
+    SrnServerUser *srv_user;
+
+    g_return_if_fail(count >= 2);
+
+    srv = sirc_get_ctx(sirc);
+    g_return_if_fail(srn_server_is_valid(srv));
+    srv_user = srn_server_get_user(srv, origin);
+    if (!srv_user){
+        return;
+    }
+
+    srn_server_user_set_username(srv_user, params[0]);
+    srn_server_user_set_hostname(srv_user, params[1]);
+}
+
 static void irc_event_ctcp_req(SircSession *sirc, const char *event,
         const char *origin, const char **params, int count,
         const SircMessageContext *context){
@@ -1041,6 +1286,23 @@ static void irc_event_ctcp_req(SircSession *sirc, const char *event,
 
     srv = sirc_get_ctx(sirc);
     g_return_if_fail(srn_server_is_valid(srv));
+    srv_user = srn_server_add_and_get_user(srv, origin);
+    g_return_if_fail(srv_user);
+    if (srv_user->is_me){
+        // Echo of CTCP request sent by us, see echo-message, only ACTION
+        // message is shown
+        if (strcmp(event, "ACTION") != 0 || is_provisional_echo(srv, context)){
+            return;
+        }
+        if (sirc_target_is_channel(sirc, target)){
+            chat = srn_server_get_chat(srv, target);
+        } else {
+            chat = srn_server_add_and_get_chat(srv, target);
+        }
+        g_return_if_fail(chat);
+        srn_chat_add_action_message(chat, chat->user, msg, context);
+        return;
+    }
     if (sirc_target_is_channel(sirc, target)){
         chat = srn_server_get_chat(srv, target);
     } else {
@@ -1052,8 +1314,6 @@ static void irc_event_ctcp_req(SircSession *sirc, const char *event,
         }
     }
     g_return_if_fail(chat);
-    srv_user = srn_server_add_and_get_user(srv, origin);
-    g_return_if_fail(srv_user);
     chat_user = srn_chat_add_and_get_user(chat, srv_user);
     g_return_if_fail(chat_user);
 
@@ -1527,6 +1787,7 @@ static void irc_event_numeric(SircSession *sirc, int event,
     SrnServer *srv;
     SrnServerUser *srv_user;
     SrnChatUser *chat_user;
+    SrnChat *reply_chat; // Where replies of our command are shown
 
     srv = sirc_get_ctx(sirc);
     g_return_if_fail(srn_server_is_valid(srv));
@@ -1534,6 +1795,35 @@ static void irc_event_numeric(SircSession *sirc, int event,
     g_return_if_fail(srv_user);
     chat_user = srn_chat_add_and_get_user(srv->chat, srv_user);
     g_return_if_fail(chat_user);
+    reply_chat = get_reply_chat(srv, context, srv->cur_chat);
+
+    if (event >= 400 && event < 600){
+        srn_server_reject_request(srv, context->label);
+    }
+    // RPL_ENDOFWHO never arrives if WHO is rejected. Only errors replying
+    // WHO count, other errors of the channel (such as ERR_CANNOTSENDTOCHAN)
+    // must not abort it
+    if (count >= 2){
+        switch (event){
+            case SIRC_RFC_ERR_NOSUCHSERVER:
+                // 402 <mask> :No such server
+                srn_server_abort_who(srv, params[1]);
+                break;
+            case SIRC_RFC_RPL_TRYAGAIN:
+            case SIRC_RFC_ERR_TOOMANYMATCHES:
+            case SIRC_RFC_ERR_UNKNOWNCOMMAND:
+            case SIRC_RFC_ERR_NEEDMOREPARAMS:
+                // <command> :<reason>
+                if (g_ascii_strcasecmp(params[1], "WHO") == 0){
+                    srn_server_abort_who(srv, NULL);
+                }
+                break;
+        }
+    }
+    if (event == SIRC_RFC_RPL_ENDOFMOTD || event == SIRC_RFC_ERR_NOMOTD){
+        // RPL_ISUPPORT has been received, MONITOR is known
+        srn_server_start_monitor(srv);
+    }
 
     switch (event) {
         case SIRC_RFC_RPL_ISUPPORT:
@@ -1555,6 +1845,7 @@ static void irc_event_numeric(SircSession *sirc, int event,
                         /* https://ircv3.net/specs/extensions/utf8-only */
                         str_assign(&srv->cfg->irc->encoding, "utf-8");
                     }
+                    srn_server_set_isupport(srv, key, value);
 
                     g_free(key);
                     g_free(value);
@@ -1623,8 +1914,6 @@ static void irc_event_numeric(SircSession *sirc, int event,
                 const char *chan;
                 const char *names;
                 SrnChat *chat;
-                SrnServerUser *srv_user;
-                SrnChatUser *chat_user;
                 SrnChatUserType type;
 
                 g_return_if_fail(count >= 4);
@@ -1634,50 +1923,61 @@ static void irc_event_numeric(SircSession *sirc, int event,
                 chat = srn_server_get_chat(srv, chan);
                 g_return_if_fail(chat);
 
+                // Users are staged and applied at RPL_ENDOFNAMES
                 dup_names = g_strdup(names);
                 for (nickptr = strtok(dup_names, " ");
                         nickptr;
                         nickptr = strtok(NULL, " ")){
-                    switch (nickptr[0]){
-                        case '~':
-                            nickptr++;
-                            type = SRN_CHAT_USER_TYPE_OWNER;
-                            break;
-                        case '&':
-                            nickptr++;
-                            type = SRN_CHAT_USER_TYPE_ADMIN;
-                            break;
-                        case '@':
-                            nickptr++;
-                            type = SRN_CHAT_USER_TYPE_FULL_OP;
-                            break;
-                        case '%':
-                            nickptr++;
-                            type = SRN_CHAT_USER_TYPE_HALF_OP;
-                            break;
-                        case '+':
-                            nickptr++;
-                            type = SRN_CHAT_USER_TYPE_VOICED;
-                            break;
-                        default:
-                            type = SRN_CHAT_USER_TYPE_CHIGUA;
+                    char *user;
+                    char *host;
+
+                    // All prefixes are sent if multi-prefix is enabled
+                    nickptr += srn_server_parse_prefix(srv, nickptr, &type);
+
+                    // "nick!user@host" if userhost-in-names is enabled
+                    user = strchr(nickptr, '!');
+                    if (user){
+                        SrnServerUser *names_user;
+
+                        *user++ = '\0';
+                        host = strchr(user, '@');
+                        if (host){
+                            *host++ = '\0';
+                        }
+                        // Avoid updating UI of unchanged users
+                        names_user = srn_server_add_and_get_user(srv, nickptr);
+                        if (names_user
+                                && g_strcmp0(names_user->username, user) != 0){
+                            srn_server_user_set_username(names_user, user);
+                        }
+                        if (names_user && host
+                                && g_strcmp0(names_user->hostname, host) != 0){
+                            srn_server_user_set_hostname(names_user, host);
+                        }
                     }
-                    srv_user = srn_server_add_and_get_user(srv, nickptr);
-                    g_warn_if_fail(srv_user);
-                    if (!srv_user) continue;
-                    srn_server_user_set_is_online(srv_user, TRUE);
-
-                    chat_user = srn_chat_add_and_get_user(chat, srv_user);
-                    g_warn_if_fail(chat_user);
-                    if (!chat_user) continue;
-                    srn_chat_user_set_is_joined(chat_user, TRUE);
-                    srn_chat_user_set_type(chat_user, type);
+                    srn_chat_stage_names_user(chat, nickptr, type);
                 }
                 g_free(dup_names);
                 break;
             }
         case SIRC_RFC_RPL_ENDOFNAMES:
             {
+                const char *chan;
+                SrnChat *chat;
+
+                g_return_if_fail(count >= 2);
+                chan = params[1];
+
+                chat = srn_server_get_chat(srv, chan);
+                if (!chat) {
+                    // NAMES of a channel which we are not in
+                    break;
+                }
+                srn_chat_commit_names(chat);
+                // Fetch realname, account and away state of members
+                if (chat->type == SRN_CHAT_TYPE_CHANNEL){
+                    srn_server_sync_who(srv, chat);
+                }
                 break;
             }
         case SIRC_RFC_RPL_NOTOPIC:
@@ -1755,7 +2055,7 @@ static void irc_event_numeric(SircSession *sirc, int event,
                 realname = params[4];
 
                 // TODO: dont show WHOIS message in message list
-                srn_chat_add_misc_message_fmt(srv->cur_chat, context,
+                srn_chat_add_misc_message_fmt(reply_chat, context,
                         _("%1$s <%2$s@%3$s> %4$s"),
                         nickname, username, hostname, realname);
                 break;
@@ -1768,7 +2068,7 @@ static void irc_event_numeric(SircSession *sirc, int event,
                 msg = params[2];
 
                 // TODO: dont show WHOIS message in message list
-                srn_chat_add_misc_message_fmt(srv->cur_chat, context,
+                srn_chat_add_misc_message_fmt(reply_chat, context,
                         _("%1$s is a member of %2$s"), params[1], msg);
                 break;
             }
@@ -1780,7 +2080,7 @@ static void irc_event_numeric(SircSession *sirc, int event,
                 msg = params[3];
 
                 // TODO: dont show WHOIS message in message list
-                srn_chat_add_misc_message_fmt(srv->cur_chat, context,
+                srn_chat_add_misc_message_fmt(reply_chat, context,
                         _("%1$s is attached to %2$s at \"%3$s\""),
                         params[1], params[2], msg);
                 break;
@@ -1799,7 +2099,7 @@ static void irc_event_numeric(SircSession *sirc, int event,
 
                 // TODO: dont show WHOIS message in message list
                 time_to_str(since, timestr, sizeof(timestr), _("%Y-%m-%d %T"));
-                srn_chat_add_misc_message_fmt(srv->cur_chat, context,
+                srn_chat_add_misc_message_fmt(reply_chat, context,
                         _("%1$s is idle for %2$s seconds since %3$s"),
                         who, sec, timestr);
                 break;
@@ -1812,7 +2112,7 @@ static void irc_event_numeric(SircSession *sirc, int event,
                 msg = params[3];
 
                 // TODO: dont show WHOIS message in message list
-                srn_chat_add_misc_message_fmt(srv->cur_chat, context,
+                srn_chat_add_misc_message_fmt(reply_chat, context,
                         _("%1$s %2$s %3$s"), params[1], msg, params[2]);
                 break;
             }
@@ -1825,7 +2125,7 @@ static void irc_event_numeric(SircSession *sirc, int event,
                 msg = params[2];
 
                 // TODO: dont show WHOIS message in message list
-                srn_chat_add_misc_message_fmt(srv->cur_chat, context,
+                srn_chat_add_misc_message_fmt(reply_chat, context,
                         _("%1$s %2$s"), params[1], msg);
                 break;
             }
@@ -1837,26 +2137,44 @@ static void irc_event_numeric(SircSession *sirc, int event,
                 msg = params[2];
 
                 // TODO: dont show WHOIS message in message list
-                srn_chat_add_misc_message(srv->cur_chat, msg, context);
+                srn_chat_add_misc_message(reply_chat, msg, context);
                 break;
             }
 
             /************************ WHO message ************************/
         case SIRC_RFC_RPL_WHOREPLY:
             {
-                // const char *nick;
-                // const char *realname;
+                const char *realname;
 
-                g_return_if_fail(count >= 7);
-                // nick = params[5];
-                // params[count - 1] = "<hopcount> <realname>", Skip ' '
-                // realname = strchr(params[6], ' ');
+                g_return_if_fail(count >= 8);
+                // params[7] = "<hopcount> <realname>", Skip ' '
+                realname = strchr(params[7], ' ');
+                realname = realname ? realname + 1 : "";
+
+                // "<channel> <user> <host> <server> <nick> <flags>"
+                srn_server_stage_who(srv, params[1], params[5], params[2],
+                        params[3], realname, NULL, params[6]);
+                break;
+            }
+        case SIRC_RFC_RPL_WHOSPCRPL:
+            {
+                g_return_if_fail(count >= 2);
+                if (strcmp(params[1], SRN_SERVER_WHOX_TOKEN) != 0){
+                    // Not requested by srn_server_sync_who()
+                    break;
+                }
 
-                // TODO
+                g_return_if_fail(count >= 9);
+                // "<token> <channel> <user> <host> <nick> <flags> <account>
+                // <realname>"
+                srn_server_stage_who(srv, params[2], params[5], params[3],
+                        params[4], params[8], params[7], params[6]);
                 break;
             }
         case SIRC_RFC_RPL_ENDOFWHO:
             {
+                g_return_if_fail(count >= 2);
+                srn_server_commit_who(srv, params[1]);
                 break;
             }
             /************************ BANLIST message ************************/
@@ -1940,6 +2258,7 @@ static void irc_event_numeric(SircSession *sirc, int event,
 
                 srv->loggedin = TRUE;
                 srn_chat_add_recv_message(srv->chat, chat_user, msg, context);
+                rejoin_all_channels_if_waiting(srv);
                 break;
             }
         case SIRC_RFC_RPL_SASLSUCCESS:
@@ -1952,6 +2271,7 @@ static void irc_event_numeric(SircSession *sirc, int event,
                 // See also: https://github.com/SrainApp/srain/issues/371
                 sirc_cmd_cap_end(sirc); // End negotiation
                 srn_chat_add_recv_message(srv->chat, chat_user, msg, context);
+                rejoin_all_channels_if_waiting(srv);
                 break;
             }
         case SIRC_RFC_RPL_LOGGEDOUT:
@@ -1995,6 +2315,7 @@ static void irc_event_numeric(SircSession *sirc, int event,
 
                 srv_user = srn_server_add_and_get_user(srv, nick);
                 g_return_if_fail(srv_user);
+                srn_server_user_set_is_away(srv_user, TRUE);
                 chat = srn_server_get_chat(srv, nick);
                 if (!chat) {
                     chat = srv->chat;
@@ -2014,6 +2335,7 @@ static void irc_event_numeric(SircSession *sirc, int event,
                 g_return_if_fail(count >= 2);
                 msg = params[1];
 
+                srn_server_user_set_is_away(srv->user, TRUE);
                 srn_chat_add_misc_message(srv->chat, msg, context);
                 break;
             }
@@ -2024,9 +2346,69 @@ static void irc_event_numeric(SircSession *sirc, int event,
                 g_return_if_fail(count >= 2);
                 msg = params[1];
 
+                srn_server_user_set_is_away(srv->user, FALSE);
                 srn_chat_add_misc_message(srv->chat, msg, context);
                 break;
             }
+        case SIRC_RFC_RPL_VISIBLEHOST:
+            {
+                const char *host;
+                const char *msg;
+
+                // "<nick> <host> :is now your displayed host"
+                g_return_if_fail(count >= 3);
+                host = params[1];
+                msg = params[2];
+
+                srn_server_user_set_hostname(srv->user, host);
+                srn_chat_add_misc_message_fmt(srv->chat, context, "%s %s",
+                        host, msg);
+                break;
+            }
+            /************************ MONITOR message ************************/
+        case SIRC_RFC_RPL_ISON:
+            {
+                g_return_if_fail(count >= 2);
+                srn_server_finish_ison(srv, params[1], context);
+                break;
+            }
+        case SIRC_RFC_RPL_MONONLINE:
+        case SIRC_RFC_RPL_MONOFFLINE:
+            {
+                char **targets;
+
+                g_return_if_fail(count >= 2);
+
+                // "nick!user@host,..." for RPL_MONONLINE, "nick,..." for
+                // RPL_MONOFFLINE
+                targets = g_strsplit(params[1], ",", 0);
+                for (int i = 0; targets[i]; i++){
+                    char *delim;
+
+                    delim = strchr(targets[i], '!');
+                    if (delim){
+                        *delim = '\0';
+                    }
+                    srn_server_set_presence(srv, targets[i],
+                            event == SIRC_RFC_RPL_MONONLINE, context);
+                }
+                g_strfreev(targets);
+                break;
+            }
+        case SIRC_RFC_RPL_MONLIST:
+        case SIRC_RFC_RPL_ENDOFMONLIST:
+            {
+                // We never request the monitor list
+                break;
+            }
+        case SIRC_RFC_ERR_MONLISTFULL:
+            {
+                g_return_if_fail(count >= 3);
+                srn_chat_add_error_message_fmt(srv->chat, context,
+                        _("Failed to monitor %1$s: monitor list is full"),
+                        params[2]);
+                break;
+            }
             /************************ MISC message ************************/
         case SIRC_RFC_RPL_CHANNEL_URL:
             {
@@ -2073,9 +2455,27 @@ static void irc_event_numeric(SircSession *sirc, int event,
                 chat = srn_server_get_chat(srv, chan);
                 if (!chat) {
                     // Fallback to general numeric error if no such channel
-                    add_numeric_error_message(srv->chat, event, origin, params, count, context);
+                    add_numeric_error_message(get_reply_chat(srv, context, srv->chat),
+                            event, origin, params, count, context);
                     break;
                 }
+                switch (event) {
+                    case SIRC_RFC_ERR_NOSUCHCHANNEL:
+                    case SIRC_RFC_ERR_TOOMANYCHANNELS:
+                    case SIRC_RFC_ERR_CHANNELISFULL:
+                    case SIRC_RFC_ERR_INVITEONLYCHAN:
+                    case SIRC_RFC_ERR_BANNEDFROMCHAN:
+                    case SIRC_RFC_ERR_BADCHANNELKEY:
+                    case SIRC_RFC_ERR_BADCHANMASK:
+                        // Failed to rejoin, drop users kept from last
+                        // connection
+                        if (chat->is_stale) {
+                            srn_chat_set_is_joined(chat, FALSE);
+                        }
+                        break;
+                    default:
+                        break;
+                }
                 srn_chat_add_error_message_fmt(chat, context,
                         _("ERROR[%1$3d] %2$s"), event, msg);
                 break;
@@ -2084,7 +2484,8 @@ static void irc_event_numeric(SircSession *sirc, int event,
             {
                 // Error message
                 if (event >= 400 && event < 600){
-                    add_numeric_error_message(srv->chat, event, origin, params, count, context);
+                    add_numeric_error_message(get_reply_chat(srv, context, srv->chat),
+                            event, origin, params, count, context);
                     break;
                 }
 
@@ -2181,25 +2582,319 @@ static void add_numeric_error_message(SrnChat *chat, int event, const char
 }
 
 /**
- * @brief Rejoin all channels already exist
+ * @brief Rejoin all channels already exist. Channels are packed into as few
+ * JOIN commands as possible, limited by the length of IRC line and the
+ * TARGMAX and CHANLIMIT tokens of RPL_ISUPPORT.
  */
 static void rejoin_all_channels(SrnServer *srv) {
+    int max_targets;
+    int ntarget;
+    GList *chans;
+    GString *targets;
+    GString *keys;
+
     DBG_FR("Rejoining all channels already exist....");
 
-    GList *list = srv->chat_list;
-    while (list){
-        SrnChat *chat = list->data;
-        if (sirc_target_is_channel(srv->irc, chat->name)){
-            sirc_cmd_join(srv->irc, chat->name, chat->cfg->password);
+    // Channels with key must come first, their keys are matched in order
+    chans = NULL;
+    for (GList *lst = srv->chat_list; lst; lst = g_list_next(lst)){
+        SrnChat *chat = lst->data;
+
+        if (!sirc_target_is_channel(srv->irc, chat->name)){
+            continue;
         }
-        list = g_list_next(list);
+        if (chat->cfg->password){
+            chans = g_list_prepend(chans, chat);
+        } else {
+            chans = g_list_append(chans, chat);
+        }
+    }
+
+    max_targets = srn_server_get_targmax(srv, "JOIN");
+    if (max_targets <= 0){
+        max_targets = G_MAXINT;
+    }
+    if (srv->chanlimit > 0){
+        max_targets = MIN(max_targets, srv->chanlimit);
+    }
+
+    ntarget = 0;
+    targets = g_string_new(NULL);
+    keys = g_string_new(NULL);
+    for (GList *lst = chans; lst; lst = g_list_next(lst)){
+        gsize len;
+        SrnChat *chat = lst->data;
+        const char *key = chat->cfg->password;
+
+        // Length of "JOIN <targets> :<keys>" after adding this channel
+        len = strlen("JOIN ") + targets->len + 1 + strlen(chat->name);
+        if (keys->len || key){
+            len += strlen(" :") + keys->len + 1 + (key ? strlen(key) : 0);
+        }
+        if (ntarget > 0 && (ntarget >= max_targets
+                    || len > SRN_SERVER_MAX_LINE_LEN)){
+            sirc_cmd_join(srv->irc, targets->str, keys->len ? keys->str : NULL);
+            g_string_truncate(targets, 0);
+            g_string_truncate(keys, 0);
+            ntarget = 0;
+        }
+
+        if (ntarget > 0){
+            g_string_append_c(targets, ',');
+        }
+        g_string_append(targets, chat->name);
+        if (key){
+            if (keys->len){
+                g_string_append_c(keys, ',');
+            }
+            g_string_append(keys, key);
+        }
+        ntarget++;
+    }
+    if (ntarget > 0){
+        sirc_cmd_join(srv->irc, targets->str, keys->len ? keys->str : NULL);
+    }
+
+    g_string_free(keys, TRUE);
+    g_string_free(targets, TRUE);
+    g_list_free(chans);
+
+    // Users kept from last connection are dropped if a channel is not
+    // rejoined in time
+    if (srv->stale_timer){
+        g_source_remove(srv->stale_timer);
     }
+    srv->stale_timer = g_timeout_add(SRN_SERVER_STALE_TIMEOUT,
+            drop_stale_users_cb, srv);
+}
+
+/**
+ * @brief Rejoin all channels if we are waiting for login.
+ */
+static void rejoin_all_channels_if_waiting(SrnServer *srv) {
+    if (!srv->rejoin_timer){
+        return;
+    }
+    g_source_remove(srv->rejoin_timer);
+    srv->rejoin_timer = 0;
+
+    rejoin_all_channels(srv);
 }
 
 /**
  * @brief Timer callback wrapper for rejoin_all_channels.
  */
 static gboolean rejoin_all_channels_cb(gpointer user_data) {
-    rejoin_all_channels(user_data);
+    SrnServer *srv = user_data;
+
+    srv->rejoin_timer = 0;
+    rejoin_all_channels(srv);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Timer callback which drops users of channels failed to rejoin,
+ * see ``srn_chat_mark_stale()``.
+ */
+static gboolean drop_stale_users_cb(gpointer user_data) {
+    SrnServer *srv = user_data;
+
+    srv->stale_timer = 0;
+    for (GList *lst = srv->chat_list; lst; lst = g_list_next(lst)){
+        SrnChat *chat = lst->data;
+
+        if (chat->is_stale && sirc_target_is_channel(srv->irc, chat->name)){
+            srn_chat_set_is_joined(chat, FALSE);
+        }
+    }
+
     return G_SOURCE_REMOVE;
 }
+
+/**
+ * @brief Whether the NOTICE from NickServ is a reply of IDENTIFY, no matter
+ * it succeeded or not.
+ */
+static bool is_nickserv_login_reply(const char *msg) {
+    static const char *words[] = {
+        "identified", "recognized", "accepted", // Succeeded
+        "invalid", "incorrect", // Failed
+        NULL,
+    };
+    bool match;
+    char *lower;
+
+    match = FALSE;
+    lower = g_ascii_strdown(msg, -1);
+    for (int i = 0; words[i]; i++){
+        if (strstr(lower, words[i])){
+            match = TRUE;
+            break;
+        }
+    }
+    g_free(lower);
+
+    return match;
+}
+
+/**
+ * @brief Whether the message sent by us is an IDENTIFY command to services,
+ * its echo carries the password in plaintext.
+ */
+static bool is_login_echo(SircSession *sirc, const char *target,
+        const char *msg){
+    if (!sirc_target_is_service(sirc, target)){
+        return FALSE;
+    }
+    return g_ascii_strncasecmp(msg, "IDENTIFY ", strlen("IDENTIFY ")) == 0;
+}
+
+/**
+ * @brief Count a user who quit or joined in a netsplit/netjoin batch instead
+ * of reporting it immediately, see ``report_netsplit()``. User list of the
+ * chat is frozen when it is first affected by the batch, and thawed when the
+ * batch ends.
+ *
+ * @return FALSE if the event does not belong to any netsplit/netjoin batch.
+ */
+static bool count_netsplit_user(SrnServer *srv, SrnChat *chat,
+        const SircMessageContext *context){
+    int count;
+    const SircBatch *batch;
+    GHashTable *counts;
+
+    batch = sirc_message_context_get_batch(context, "netsplit");
+    if (!batch){
+        batch = sirc_message_context_get_batch(context, "netjoin");
+    }
+    if (!batch){
+        return FALSE;
+    }
+    counts = g_hash_table_lookup(srv->netsplits, batch->ref);
+    if (!counts){
+        return FALSE;
+    }
+
+    count = GPOINTER_TO_INT(g_hash_table_lookup(counts, chat->name));
+    if (count == 0 && chat->type != SRN_CHAT_TYPE_SERVER){
+        sui_freeze_user_list(chat->ui);
+    }
+    g_hash_table_replace(counts, g_strdup(chat->name), GINT_TO_POINTER(count + 1));
+
+    return TRUE;
+}
+
+/**
+ * @brief Report users counted by ``count_netsplit_user()`` with one message
+ * per chat.
+ */
+static void report_netsplit(SrnServer *srv, const SircBatch *batch,
+        const SircMessageContext *context){
+    const char *server1;
+    const char *server2;
+    const char *name;
+    gpointer count;
+    GHashTable *counts;
+    GHashTableIter iter;
+
+    counts = g_hash_table_lookup(srv->netsplits, batch->ref);
+    g_return_if_fail(counts);
+
+    // Both of netsplit and netjoin batch have two server parameters
+    server1 = batch->params[0] ? batch->params[0] : "";
+    server2 = batch->params[0] && batch->params[1] ? batch->params[1] : "";
+
+    g_hash_table_iter_init(&iter, counts);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&name, &count)){
+        SrnChat *chat;
+
+        chat = srn_server_get_chat(srv, name);
+        if (!chat){
+            // Chat has been removed during the batch
+            continue;
+        }
+        if (g_strcmp0(batch->type, "netjoin") == 0){
+            srn_chat_add_misc_message_fmt(chat, context,
+                    ngettext("Netsplit between %1$s and %2$s is over, %3$d user has rejoined",
+                        "Netsplit between %1$s and %2$s is over, %3$d users have rejoined",
+                        GPOINTER_TO_INT(count)),
+                    server1, server2, GPOINTER_TO_INT(count));
+        } else {
+            srn_chat_add_misc_message_fmt(chat, context,
+                    ngettext("Netsplit between %1$s and %2$s, %3$d user has quit",
+                        "Netsplit between %1$s and %2$s, %3$d users have quit",
+                        GPOINTER_TO_INT(count)),
+                    server1, server2, GPOINTER_TO_INT(count));
+        }
+    }
+
+    thaw_netsplit(srv, counts);
+    g_hash_table_remove(srv->netsplits, batch->ref);
+}
+
+/**
+ * @brief Thaw user lists frozen by ``count_netsplit_user()``.
+ */
+static void thaw_netsplit(SrnServer *srv, GHashTable *counts){
+    const char *name;
+    GHashTableIter iter;
+
+    g_hash_table_iter_init(&iter, counts);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&name, NULL)){
+        SrnChat *chat;
+
+        chat = srn_server_get_chat(srv, name);
+        if (chat){
+            sui_thaw_user_list(chat->ui);
+        }
+    }
+}
+
+/**
+ * @brief Add messages of ended playback batch to UI, only for chats which
+ * collected messages in the batch.
+ */
+static void end_playback(SrnServer *srv, const SircBatch *batch){
+    GList *lst;
+
+    if (g_strcmp0(srv->chat->batch_ref, batch->ref) == 0){
+        srn_chat_end_batch(srv->chat);
+    }
+    for (lst = srv->chat_list; lst; lst = g_list_next(lst)){
+        SrnChat *chat;
+
+        chat = lst->data;
+        if (g_strcmp0(chat->batch_ref, batch->ref) == 0){
+            srn_chat_end_batch(chat);
+        }
+    }
+}
+
+/**
+ * @brief Whether the message is an echo of message which has been shown as
+ * provisional message, see ``srn_chat_add_provisional_message()``.
+ */
+static bool is_provisional_echo(SrnServer *srv,
+        const SircMessageContext *context){
+    SrnServerRequest *req;
+
+    req = srn_server_get_request(srv, context->label);
+
+    return req && req->msg;
+}
+
+/**
+ * @brief Get the chat where the labeled command replied by the message is
+ * sent from.
+ *
+ * @return ``fallback`` if the message is not a reply of labeled command
+ */
+static SrnChat* get_reply_chat(SrnServer *srv,
+        const SircMessageContext *context, SrnChat *fallback){
+    SrnServerRequest *req;
+
+    req = srn_server_get_request(srv, context->label);
+
+    return req ? req->chat : fallback;
+}
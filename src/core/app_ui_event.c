@@ -59,6 +59,7 @@ static SrnRet ui_event_whois(SuiBuffer *sui, SuiEvent event, GVariantDict *param
 static SrnRet ui_event_ignore(SuiBuffer *sui, SuiEvent event, GVariantDict *params);
 static SrnRet ui_event_cutover(SuiBuffer *sui, SuiEvent event, GVariantDict *params);
 static SrnRet ui_event_chan_list(SuiBuffer *sui, SuiEvent event, GVariantDict *params);
+static SrnRet ui_event_history(SuiBuffer *sui, SuiEvent event, GVariantDict *params);
 
 void srn_application_init_ui_event(SrnApplication *app){
     app->ui_app_events.open = ui_event_open;
@@ -82,6 +83,7 @@ void srn_application_init_ui_event(SrnApplication *app){
     app->ui_events.ignore = ui_event_ignore;
     app->ui_events.cutover = ui_event_cutover;
     app->ui_events.chan_list = ui_event_chan_list;
+    app->ui_events.history = ui_event_history;
 }
 
 static SrnRet ui_event_open(SuiApplication *app, SuiEvent event, GVariantDict *params){
@@ -149,7 +151,7 @@ static SrnRet ui_event_disconnect(SuiBuffer *sui, SuiEvent event, GVariantDict *
     chat = ctx_get_chat(sui);
     g_return_val_if_fail(srn_server_is_valid(srv), SRN_ERR);
 
-    g_autoptr(SircMessageContext) context = sirc_message_context_new(NULL);
+    g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
 
     prev_state = srv->state;
     ret = srn_server_disconnect(srv);
@@ -174,7 +176,7 @@ static SrnRet ui_event_reconnect(SuiBuffer *sui, SuiEvent event, GVariantDict *p
     chat = ctx_get_chat(sui);
     g_return_val_if_fail(srn_server_is_valid(srv), SRN_ERR);
 
-    g_autoptr(SircMessageContext) context = sirc_message_context_new(NULL);
+    g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
 
     prev_state = srv->state;
     if (prev_state == SRN_SERVER_STATE_RECONNECTING) {
@@ -200,7 +202,7 @@ static SrnRet ui_event_quit(SuiBuffer *sui, SuiEvent event, GVariantDict *params
     chat = ctx_get_chat(sui);
     g_return_val_if_fail(srn_server_is_valid(srv), SRN_ERR);
 
-    g_autoptr(SircMessageContext) context = sirc_message_context_new(NULL);
+    g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
 
     ret = srn_server_quit(srv, srv->cfg->user->quit_message);
     if (!RET_IS_OK(ret)){
@@ -220,6 +222,7 @@ static SrnRet ui_event_send(SuiBuffer *sui, SuiEvent event, GVariantDict *params
     SrnRet ret = SRN_ERR;
     SrnServer *srv;
     SrnChat *chat;
+    SrnServerRequest *req;
 
     srv = ctx_get_server(sui);
     chat = ctx_get_chat(sui);
@@ -241,12 +244,18 @@ static SrnRet ui_event_send(SuiBuffer *sui, SuiEvent event, GVariantDict *params
         }
     }
 
-    g_autoptr(SircMessageContext) context = sirc_message_context_new(NULL);
+    g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
 
     if (is_cmd){
+        // Replies of commands are shown in current chat
+        srn_server_begin_request(srv, chat);
         ret = srn_chat_run_command(chat, msg);
         // NOTE: The server and chat may be invlid after running command
-        if (!srn_server_is_valid(srv) || !srn_server_is_chat_valid(srv, chat)){
+        if (!srn_server_is_valid(srv)){
+            return ret;
+        }
+        srn_server_end_request(srv);
+        if (!srn_server_is_chat_valid(srv, chat)){
             return ret;
         }
         if (RET_IS_OK(ret)){
@@ -263,9 +272,17 @@ static SrnRet ui_event_send(SuiBuffer *sui, SuiEvent event, GVariantDict *params
             return ret;
         }
 
-        srn_chat_add_sent_message(chat, msg, context); // Show on UI first
+        req = srn_server_begin_request(srv, chat);
+        if (req){
+            // Show on UI first, it is confirmed by echo or ACK of server
+            req->msg = srn_chat_add_provisional_message(chat,
+                    SRN_MESSAGE_TYPE_SENT, msg, context);
+        } else if (!srv->cap->client_enabled.echo_message){
+            srn_chat_add_sent_message(chat, msg, context); // Show on UI first
+        }
 
         ret = sirc_cmd_msg(chat->srv->irc, chat->name, msg);
+        srn_server_end_request(srv);
         if (!RET_IS_OK(ret)){
             srn_chat_add_error_message_fmt(chat, context,
                     _("Failed to send message: %1$s"), RET_MSG(ret));
@@ -393,7 +410,7 @@ static SrnRet ui_event_ignore(SuiBuffer *sui, SuiEvent event, GVariantDict *para
 
     srn_server_user_set_is_ignored(user, !user->is_ignored);
 
-    g_autoptr(SircMessageContext) context = sirc_message_context_new(NULL);
+    g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
 
     if(user->is_ignored){
         srn_chat_add_misc_message_with_user_fmt(chat, chat->user, context,
@@ -420,6 +437,9 @@ static SrnRet ui_event_cutover(SuiBuffer *sui, SuiEvent event, GVariantDict *par
     app->cur_srv = srv;
     srv->cur_chat = chat;
 
+    // Messages restored from chat log are rendered when chat becomes visible
+    srn_chat_show_history(chat);
+
     return SRN_OK;
 }
 
@@ -432,6 +452,22 @@ static SrnRet ui_event_chan_list(SuiBuffer *sui, SuiEvent event, GVariantDict *p
     return sirc_cmd_list(srv->irc, NULL, NULL);
 }
 
+static SrnRet ui_event_history(SuiBuffer *sui, SuiEvent event, GVariantDict *params){
+    SrnServer *srv;
+    SrnChat *chat;
+
+    srv = ctx_get_server(sui);
+    g_return_val_if_fail(srn_server_is_valid(srv), SRN_ERR);
+    chat = ctx_get_chat(sui);
+    g_return_val_if_fail(chat, SRN_ERR);
+
+    // Requests are ignored if server does not support chathistory or a
+    // request is in flight
+    srn_chat_fetch_history(chat);
+
+    return SRN_OK;
+}
+
 /* Get a SrnServer object from SuiBuffer context (sui->ctx) */
 static SrnServer* ctx_get_server(SuiBuffer *sui){
     SrnChat *chat;
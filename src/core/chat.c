@@ -29,10 +29,34 @@
 #include "utils.h"
 #include "config/config.h"
 #include "extra_data.h"
+#include "chat_log.h"
 
 #include "sirc/sirc.h"
 
-static void add_message(SrnChat *self, SrnMessage *msg);
+#define HISTORY_PAGE_SIZE   50 // Messages per CHATHISTORY request
+
+typedef struct _HistoryTaskData {
+    char *srv_name;
+    char *chat_name;
+    gint64 before;
+    int count;
+} HistoryTaskData;
+
+static void add_message(SrnChat *self, SrnMessage *msg,
+        const SircMessageContext *context);
+static const SircBatch* get_playback_batch(const SircMessageContext *context);
+static bool is_history_of(SrnChat *self, const SircMessageContext *context);
+static bool send_history_request(SrnChat *self, const char *subcmd,
+        const char *ref, int limit);
+static bool is_visible(SrnChat *self);
+static void load_history(SrnChat *self);
+static void load_history_task(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable);
+static void load_history_ready(GObject *source_object, GAsyncResult *res,
+        gpointer user_data);
+static void history_task_data_free(HistoryTaskData *data);
+static void free_history(GList *history);
+static void add_history_message(SrnChat *self, SrnChatLogEntry *entry);
 
 SrnChat* srn_chat_new(SrnServer *srv, const char *name, SrnChatType type,
         SrnChatConfig *cfg){
@@ -46,6 +70,7 @@ SrnChat* srn_chat_new(SrnServer *srv, const char *name, SrnChatType type,
     self->cfg = cfg;
     self->is_joined = FALSE;
     self->srv = srv;
+    self->history_before = g_get_real_time() / G_USEC_PER_SEC;
     self->user = srn_chat_add_and_get_user(self, srv->user);
     self->_user = srn_chat_add_and_get_user(self, srv->_user);
     self->extra_data = srn_extra_data_new();
@@ -67,14 +92,37 @@ SrnChat* srn_chat_new(SrnServer *srv, const char *name, SrnChatType type,
             g_warn_if_reached();
     }
 
+    if (self->cfg->history_size > 0){
+        load_history(self);
+    }
+
     return self;
 }
 
 void srn_chat_free(SrnChat *self){
+    srn_chat_log_close(self->srv->name, self->name);
+
+    if (self->history_cancel){
+        g_cancellable_cancel(self->history_cancel);
+        g_object_unref(self->history_cancel);
+    }
+    free_history(self->history);
+    g_list_free_full(self->history_msg_list, (GDestroyNotify)srn_message_free);
+    str_assign(&self->history_page_msgid, NULL);
+    str_assign(&self->history_msgid, NULL);
+    str_assign(&self->history_label, NULL);
+    str_assign(&self->history_batch, NULL);
+    g_list_free(self->batch_msg_list);
+    str_assign(&self->batch_ref, NULL);
+
     str_assign(&self->name, NULL);
 
     srn_extra_data_free(self->extra_data);
 
+    if (self->names_staging){
+        g_hash_table_destroy(self->names_staging);
+    }
+
     // Free user list, self->user and self->_user also in this list
     g_list_free_full(self->user_list, (GDestroyNotify)srn_chat_user_free);
 
@@ -91,12 +139,16 @@ void srn_chat_set_config(SrnChat *self, SrnChatConfig *cfg){
 void srn_chat_set_is_joined(SrnChat *self, bool joined){
     GList *lst;
 
-    if (self->is_joined == joined){
+    // Users of a stale chat are still joined, see srn_chat_mark_stale()
+    if (self->is_joined == joined && !(self->is_stale && !joined)){
         return;
     }
     self->is_joined = joined;
+    self->is_stale = FALSE;
 
     if (!joined){
+        srn_chat_log_close(self->srv->name, self->name);
+
         lst = self->user_list;
         while (lst){
             SrnChatUser *user;
@@ -108,14 +160,294 @@ void srn_chat_set_is_joined(SrnChat *self, bool joined){
     }
 }
 
+/**
+ * @brief ``srn_chat_mark_stale`` marks a chat as unjoined because of the
+ * connection is lost, unlike ``srn_chat_set_is_joined()``, the user list is
+ * kept and will be reconciled by ``srn_chat_commit_names()`` after rejoining,
+ * so users who did not change are not touched at all.
+ *
+ * If the rejoining fails or times out, the kept users are dropped by
+ * ``srn_chat_set_is_joined(self, FALSE)``.
+ *
+ * @param self
+ */
+void srn_chat_mark_stale(SrnChat *self){
+    self->is_joined = FALSE;
+    self->is_stale = TRUE;
+    srn_chat_log_close(self->srv->name, self->name);
+
+    // Discard incomplete NAMES reply
+    if (self->names_staging){
+        g_hash_table_destroy(self->names_staging);
+        self->names_staging = NULL;
+    }
+}
+
+/**
+ * @brief ``srn_chat_stage_names_user`` records a user of RPL_NAMREPLY, the
+ * staged users are applied at once by ``srn_chat_commit_names()``.
+ *
+ * @param self
+ * @param nick
+ * @param type
+ */
+void srn_chat_stage_names_user(SrnChat *self, const char *nick,
+        SrnChatUserType type){
+    g_return_if_fail(nick);
+
+    if (!self->names_staging){
+        self->names_staging = g_hash_table_new_full(
+                g_str_hash, g_str_equal, g_free, NULL);
+    }
+    g_hash_table_insert(self->names_staging, g_strdup(nick),
+            GINT_TO_POINTER(type));
+}
+
+/**
+ * @brief ``srn_chat_commit_names`` diffs the staged NAMES reply against the
+ * current membership, and applies the result to UI in one batch.
+ *
+ * @param self
+ */
+void srn_chat_commit_names(SrnChat *self){
+    GList *lst;
+    GHashTable *seen;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+
+    if (!self->names_staging){
+        return;
+    }
+
+    seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+    sui_freeze_user_list(self->ui);
+
+    g_hash_table_iter_init(&iter, self->names_staging);
+    while (g_hash_table_iter_next(&iter, &key, &value)){
+        SrnServerUser *srv_user;
+        SrnChatUser *user;
+
+        srv_user = srn_server_add_and_get_user(self->srv, key);
+        g_warn_if_fail(srv_user);
+        if (!srv_user) continue;
+        srn_server_user_set_is_online(srv_user, TRUE);
+
+        user = srn_chat_add_and_get_user(self, srv_user);
+        g_warn_if_fail(user);
+        if (!user) continue;
+        // Set type before joining, so new user is added to UI only once
+        srn_chat_user_set_type(user, GPOINTER_TO_INT(value));
+        srn_chat_user_set_is_joined(user, TRUE);
+        g_hash_table_add(seen, user);
+    }
+
+    /* Remove users who have gone while we are not in the chat */
+    lst = self->user_list;
+    while (lst){
+        SrnChatUser *user;
+
+        user = lst->data;
+        if (user->is_joined && !g_hash_table_contains(seen, user)){
+            srn_chat_user_set_is_joined(user, FALSE);
+        }
+        lst = g_list_next(lst);
+    }
+
+    sui_thaw_user_list(self->ui);
+    g_hash_table_destroy(seen);
+
+    g_hash_table_destroy(self->names_staging);
+    self->names_staging = NULL;
+}
+
+/**
+ * @brief ``srn_chat_show_history`` renders the messages restored from chat
+ * log and received from server, they are placed before all other messages.
+ * It should be called when the chat becomes visible.
+ *
+ * Messages from both sources are merged by time, a message from chat log is
+ * dropped if server has one with the same time and sender.
+ *
+ * @param self
+ */
+void srn_chat_show_history(SrnChat *self){
+    GList *entries;
+    GList *msgs;
+
+    if (self->history_cancel || self->history_pending){
+        // Wait for all sources to keep messages in order
+        return;
+    }
+    if (!self->history && !self->history_msg_list){
+        return;
+    }
+
+    // Prepend from the newest one
+    entries = g_list_last(self->history);
+    msgs = self->history_msg_list;
+    while (entries || msgs){
+        SrnMessage *msg;
+        SrnChatLogEntry *entry;
+
+        msg = msgs ? msgs->data : NULL;
+        entry = entries ? entries->data : NULL;
+        if (msg && (!entry || msg->time >= entry->time)){
+            msgs = g_list_next(msgs);
+            if (msg->time >= self->history_before){
+                // Received after the chat is shown
+                srn_message_free(msg);
+                continue;
+            }
+            if (entry && entry->time == msg->time
+                    && g_strcmp0(entry->sender, msg->sender->srv_user->nick) == 0){
+                // Same message in chat log
+                entries = g_list_previous(entries);
+            }
+            self->msg_list = g_list_prepend(self->msg_list, msg);
+            if (!self->last_msg){
+                self->last_msg = msg;
+            }
+            sui_buffer_prepend_message(self->ui, msg->ui);
+            self->history_before = msg->time;
+            str_assign(&self->history_msgid,
+                    msgs ? NULL : self->history_page_msgid);
+        } else {
+            entries = g_list_previous(entries);
+            if (entry->time > self->history_before){
+                continue;
+            }
+            add_history_message(self, entry);
+            self->history_before = entry->time;
+            str_assign(&self->history_msgid, NULL);
+        }
+    }
+
+    free_history(self->history);
+    self->history = NULL;
+    g_list_free(self->history_msg_list);
+    self->history_msg_list = NULL;
+    str_assign(&self->history_page_msgid, NULL);
+}
+
+/**
+ * @brief ``srn_chat_fetch_history`` requests messages older than the shown
+ * ones from server via IRCv3 chathistory, the latest messages are requested
+ * at first. At most one request is in flight.
+ *
+ * @param self
+ */
+void srn_chat_fetch_history(SrnChat *self){
+    int limit;
+    char *ref;
+    SrnServer *srv;
+
+    srv = self->srv;
+    if (!srv->cap->client_enabled.chathistory
+            || self->type == SRN_CHAT_TYPE_SERVER){
+        return;
+    }
+    if (self->history_pending || self->history_complete){
+        return;
+    }
+
+    limit = HISTORY_PAGE_SIZE;
+    if (srv->chathistory > 0 && srv->chathistory < limit){
+        limit = srv->chathistory;
+    }
+
+    if (!self->history_fetched){
+        if (send_history_request(self, "LATEST", "*", limit)){
+            self->history_fetched = TRUE;
+        }
+        return;
+    }
+
+    if (self->history_msgid){
+        ref = g_strdup_printf("msgid=%s", self->history_msgid);
+    } else {
+        GDateTime *time;
+
+        time = g_date_time_new_from_unix_utc(self->history_before);
+        ref = g_date_time_format(time, "timestamp=%Y-%m-%dT%H:%M:%S.000Z");
+        g_date_time_unref(time);
+    }
+    send_history_request(self, "BEFORE", ref, limit);
+    g_free(ref);
+}
+
+/**
+ * @brief ``srn_chat_is_history_batch`` checks whether the chathistory batch
+ * replies the CHATHISTORY request in flight of the chat. The batch is
+ * matched by label of the request, or by target if labeled-response is not
+ * supported, then it is remembered until the request ends.
+ *
+ * @param self
+ * @param batch
+ *
+ * @return TRUE if the batch is the response of request.
+ */
+bool srn_chat_is_history_batch(SrnChat *self, const SircBatch *batch){
+    g_return_val_if_fail(batch, FALSE);
+
+    if (!self->history_pending){
+        return FALSE;
+    }
+    if (self->history_batch){
+        return g_strcmp0(self->history_batch, batch->ref) == 0;
+    }
+
+    if (!batch->params[0] || !sirc_target_equal(batch->params[0], self->name)){
+        return FALSE;
+    }
+    if (self->history_label){
+        size_t len;
+
+        // Label may have a ".<n>" suffix, see sirc_begin_label()
+        len = strlen(self->history_label);
+        if (!batch->label
+                || strncmp(batch->label, self->history_label, len) != 0
+                || (batch->label[len] != '\0' && batch->label[len] != '.')){
+            return FALSE;
+        }
+    }
+    str_assign(&self->history_batch, batch->ref);
+
+    return TRUE;
+}
+
+/**
+ * @brief ``srn_chat_end_history`` should be called when the response of
+ * CHATHISTORY request is received.
+ *
+ * @param self
+ */
+void srn_chat_end_history(SrnChat *self){
+    if (!self->history_pending){
+        return;
+    }
+
+    self->history_pending = FALSE;
+    str_assign(&self->history_label, NULL);
+    str_assign(&self->history_batch, NULL);
+    if (!self->history_msg_list){
+        self->history_complete = TRUE;
+    }
+    if (is_visible(self)){
+        srn_chat_show_history(self);
+    }
+}
+
 SrnRet srn_chat_add_user(SrnChat *self, SrnServerUser *srv_user){
     GList *lst;
     SrnChatUser *user;
 
-    lst = self->user_list;
+    // A server user has only a few chat users, it is much cheaper than
+    // scanning the user list of chat
+    lst = srv_user->chat_user_list;
     while (lst) {
         user = lst->data;
-        if (user->srv_user == srv_user){
+        if (user->chat == self){
             return SRN_ERR;
         }
         lst = g_list_next(lst);
@@ -128,8 +460,22 @@ SrnRet srn_chat_add_user(SrnChat *self, SrnServerUser *srv_user){
 }
 
 SrnChatUser* srn_chat_add_and_get_user(SrnChat *self, SrnServerUser *srv_user){
+    GList *lst;
+
     srn_chat_add_user(self, srv_user);
-    return srn_chat_get_user(self, srv_user->nick);
+
+    lst = srv_user->chat_user_list;
+    while (lst) {
+        SrnChatUser *user;
+
+        user = lst->data;
+        if (user->chat == self){
+            return user;
+        }
+        lst = g_list_next(lst);
+    }
+
+    return NULL;
 }
 
 SrnRet srn_chat_rm_user(SrnChat *self, SrnChatUser *user){
@@ -181,7 +527,7 @@ void srn_chat_add_sent_message(SrnChat *self, const char *content,
         goto cleanup;
     }
 
-    add_message(self, msg);
+    add_message(self, msg, context);
 
     return;
 
@@ -189,6 +535,68 @@ cleanup:
     srn_message_free(msg);
 }
 
+/**
+ * @brief ``srn_chat_add_provisional_message`` shows a message sent by us
+ * before server accepts it. The message is not logged until it is confirmed
+ * by ``srn_chat_confirm_message``.
+ *
+ * @param self
+ * @param type SRN_MESSAGE_TYPE_SENT or SRN_MESSAGE_TYPE_ACTION
+ * @param content
+ * @param context
+ *
+ * @return The added message, or NULL if failed
+ */
+SrnMessage* srn_chat_add_provisional_message(SrnChat *self, SrnMessageType type,
+        const char *content, const SircMessageContext *context){
+    SrnMessage *msg;
+    SrnRenderFlags rflags;
+
+    g_return_val_if_fail(type == SRN_MESSAGE_TYPE_SENT
+            || type == SRN_MESSAGE_TYPE_ACTION, NULL);
+
+    rflags = SRN_RENDER_FLAG_URL;
+    if (type == SRN_MESSAGE_TYPE_ACTION){
+        if (self->cfg->render_mirc_color) {
+            rflags |= SRN_RENDER_FLAG_MIRC_COLORIZE;
+        } else {
+            rflags |= SRN_RENDER_FLAG_MIRC_STRIP;
+        }
+    }
+
+    msg = srn_message_new(self, self->user, content, type, context);
+    msg->pending = TRUE;
+    if (srn_render_message(msg, rflags) != SRN_OK || !msg->ui){
+        srn_message_free(msg);
+        return NULL;
+    }
+
+    add_message(self, msg, context);
+
+    return msg;
+}
+
+/**
+ * @brief ``srn_chat_confirm_message`` updates a provisional message when
+ * server replies it.
+ *
+ * @param self
+ * @param msg Returned by ``srn_chat_add_provisional_message``
+ * @param accepted Whether the message is accepted by server
+ */
+void srn_chat_confirm_message(SrnChat *self, SrnMessage *msg, bool accepted){
+    g_return_if_fail(msg && msg->chat == self);
+    g_return_if_fail(msg->pending);
+
+    msg->pending = FALSE;
+    if (accepted){
+        srn_filter_message(msg, SRN_FILTER_FLAG_LOG);
+    } else {
+        msg->rejected = TRUE;
+    }
+    sui_update_message(msg->ui);
+}
+
 void srn_chat_add_recv_message(SrnChat *self, SrnChatUser *user,
         const char *content, const SircMessageContext *context){
     SrnMessage *msg;
@@ -211,7 +619,7 @@ void srn_chat_add_recv_message(SrnChat *self, SrnChatUser *user,
         goto cleanup;
     }
 
-    add_message(self, msg);
+    add_message(self, msg, context);
 
     return;
 
@@ -241,7 +649,7 @@ void srn_chat_add_notice_message(SrnChat *self, SrnChatUser *user,
         goto cleanup;
     }
 
-    add_message(self, msg);
+    add_message(self, msg, context);
 
     return;
 
@@ -279,7 +687,7 @@ void srn_chat_add_action_message(SrnChat *self, SrnChatUser *user,
         goto cleanup;
     }
 
-    add_message(self, msg);
+    add_message(self, msg, context);
 
     return;
 
@@ -311,7 +719,7 @@ void srn_chat_add_misc_message(SrnChat *self, const char *content,
         goto cleanup;
     }
 
-    add_message(self, msg);
+    add_message(self, msg, context);
     return;
 
 cleanup:
@@ -352,7 +760,7 @@ void srn_chat_add_misc_message_with_user(SrnChat *self, SrnChatUser *user,
         goto cleanup;
     }
 
-    add_message(self, msg);
+    add_message(self, msg, context);
     return;
 
 cleanup:
@@ -387,7 +795,7 @@ void srn_chat_add_error_message(SrnChat *self, const char *content, const SircMe
         goto cleanup;
     }
 
-    add_message(self, msg);
+    add_message(self, msg, context);
     return;
 
 cleanup:
@@ -429,7 +837,7 @@ void srn_chat_add_error_message_with_user(SrnChat *self, SrnChatUser *user,
         goto cleanup;
     }
 
-    add_message(self, msg);
+    add_message(self, msg, context);
 
     return;
 
@@ -472,11 +880,59 @@ void srn_chat_set_topic_setter(SrnChat *self, const char *setter){
     sui_set_topic_setter(self->ui, setter);
 }
 
-static void add_message(SrnChat *self, SrnMessage *msg){
+/**
+ * @brief ``srn_chat_end_batch`` adds messages of ended playback batch to UI
+ * at once.
+ */
+void srn_chat_end_batch(SrnChat *self){
+    str_assign(&self->batch_ref, NULL);
+    if (!self->batch_msg_list){
+        return;
+    }
+
+    self->batch_msg_list = g_list_reverse(self->batch_msg_list);
+    sui_buffer_add_messages(self->ui, self->batch_msg_list);
+    g_list_free(self->batch_msg_list);
+    self->batch_msg_list = NULL;
+}
+
+static void add_message(SrnChat *self, SrnMessage *msg,
+        const SircMessageContext *context){
+    const SircBatch *batch;
+
+    if (is_history_of(self, context)){
+        // Requested by srn_chat_fetch_history(), shown by
+        // srn_chat_show_history()
+        if (!self->history_msg_list){
+            str_assign(&self->history_page_msgid, context->msgid);
+        }
+        self->history_msg_list = g_list_prepend(self->history_msg_list, msg);
+        return;
+    }
+
     self->msg_list = g_list_append(self->msg_list, msg);
     self->last_msg = msg;
 
+    batch = get_playback_batch(context);
+    if (batch){
+        if (self->batch_msg_list && g_strcmp0(self->batch_ref, batch->ref) != 0){
+            // Messages of another playback batch go first
+            srn_chat_end_batch(self);
+        }
+        str_assign(&self->batch_ref, batch->ref);
+        // Played back messages are not fresh, do not notify or touch users
+        self->batch_msg_list = g_list_prepend(self->batch_msg_list, msg->ui);
+        return;
+    }
+
     sui_buffer_add_message(self->ui, msg->ui);
+    if ((msg->type == SRN_MESSAGE_TYPE_RECV
+                || msg->type == SRN_MESSAGE_TYPE_ACTION)
+            && self->type == SRN_CHAT_TYPE_CHANNEL
+            && msg->sender->is_joined){
+        // Recent speakers are preferred by nickname completion
+        sui_touch_user(self->ui, msg->sender->ui);
+    }
     if (msg->mentioned
             || self->type == SRN_CHAT_TYPE_DIALOG
             || msg->type == SRN_MESSAGE_TYPE_NOTICE
@@ -484,3 +940,224 @@ static void add_message(SrnChat *self, SrnMessage *msg){
         sui_notify_message(msg->ui);
     }
 }
+
+/**
+ * @brief Get the batch which plays back messages sent while we were away.
+ *
+ * @return NULL if the message does not belong to any playback batch.
+ */
+static const SircBatch* get_playback_batch(const SircMessageContext *context){
+    const SircBatch *batch;
+
+    if (!context || !context->batch){
+        return NULL;
+    }
+
+    batch = sirc_message_context_get_batch(context, "chathistory");
+    if (!batch){
+        batch = sirc_message_context_get_batch(context, "znc.in/playback");
+    }
+
+    return batch;
+}
+
+/**
+ * @brief Whether the message is a response of CHATHISTORY request of the chat.
+ */
+static bool is_history_of(SrnChat *self, const SircMessageContext *context){
+    const SircBatch *batch;
+
+    if (!context || !context->batch){
+        return FALSE;
+    }
+    batch = sirc_message_context_get_batch(context, "chathistory");
+    if (!batch){
+        return FALSE;
+    }
+
+    return srn_chat_is_history_batch(self, batch);
+}
+
+/**
+ * @brief Send a CHATHISTORY request of the chat, it is labeled so that its
+ * response can be told from other chathistory batches of the same target.
+ *
+ * @return TRUE if the request is sent.
+ */
+static bool send_history_request(SrnChat *self, const char *subcmd,
+        const char *ref, int limit){
+    char *label;
+    SrnRet ret;
+    SrnServer *srv;
+    SrnServerRequest *req;
+
+    srv = self->srv;
+    req = srn_server_begin_request(srv, self);
+    // Request is freed by srn_server_end_request() if nothing is sent
+    label = req ? g_strdup(req->label) : NULL;
+    ret = sirc_cmd_chathistory(srv->irc, subcmd, self->name, ref, limit);
+    srn_server_end_request(srv);
+
+    if (!RET_IS_OK(ret)){
+        g_free(label);
+        return FALSE;
+    }
+
+    self->history_pending = TRUE;
+    str_assign(&self->history_label, NULL);
+    self->history_label = label;
+    str_assign(&self->history_batch, NULL);
+
+    return TRUE;
+}
+
+static bool is_visible(SrnChat *self){
+    SrnApplication *app;
+
+    app = srn_application_get_default();
+    return app->cur_srv == self->srv && self->srv->cur_chat == self;
+}
+
+/**
+ * @brief Read the last messages from chat log in a worker thread, messages
+ * logged after the chat is created are excluded because they are already
+ * shown.
+ */
+static void load_history(SrnChat *self){
+    GTask *task;
+    HistoryTaskData *data;
+
+    data = g_malloc0(sizeof(HistoryTaskData));
+    data->srv_name = g_strdup(self->srv->name);
+    data->chat_name = g_strdup(self->name);
+    data->before = self->history_before;
+    data->count = self->cfg->history_size;
+
+    self->history_cancel = g_cancellable_new();
+    task = g_task_new(NULL, self->history_cancel, load_history_ready, self);
+    g_task_set_task_data(task, data, (GDestroyNotify)history_task_data_free);
+    g_task_run_in_thread(task, load_history_task);
+    g_object_unref(task);
+}
+
+static void load_history_task(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable){
+    GList *history;
+    HistoryTaskData *data;
+
+    data = task_data;
+    history = srn_chat_log_get_history(data->srv_name, data->chat_name,
+            data->before, data->count);
+    g_task_return_pointer(task, history, (GDestroyNotify)free_history);
+}
+
+static void load_history_ready(GObject *source_object, GAsyncResult *res,
+        gpointer user_data){
+    GList *history;
+    GError *err;
+    SrnChat *self;
+
+    err = NULL;
+    history = g_task_propagate_pointer(G_TASK(res), &err);
+    if (err){
+        // The chat has been freed if the task is cancelled
+        g_error_free(err);
+        return;
+    }
+
+    self = user_data;
+    g_clear_object(&self->history_cancel);
+    self->history = history;
+
+    if (is_visible(self)){
+        srn_chat_show_history(self);
+    }
+}
+
+static void history_task_data_free(HistoryTaskData *data){
+    g_free(data->srv_name);
+    g_free(data->chat_name);
+    g_free(data);
+}
+
+static void free_history(GList *history){
+    g_list_free_full(history, (GDestroyNotify)srn_chat_log_entry_free);
+}
+
+/**
+ * @brief Add a message restored from chat log, it is never logged and
+ * notified again.
+ */
+static void add_history_message(SrnChat *self, SrnChatLogEntry *entry){
+    SrnChatUser *user;
+    SrnMessage *msg;
+    SrnMessageType type;
+    SrnRenderFlags rflags;
+    SrnFilterFlags fflags;
+    SircMessageContext context;
+
+    rflags = SRN_RENDER_FLAG_URL;
+    fflags = 0;
+    switch (entry->type){
+        case SRN_CHAT_LOG_MESSAGE_TYPE_RECV:
+            type = SRN_MESSAGE_TYPE_RECV;
+            rflags |= SRN_RENDER_FLAG_PATTERN;
+            fflags |= SRN_FILTER_FLAG_USER | SRN_FILTER_FLAG_PATTERN;
+            break;
+        case SRN_CHAT_LOG_MESSAGE_TYPE_SENT:
+            type = SRN_MESSAGE_TYPE_SENT;
+            break;
+        case SRN_CHAT_LOG_MESSAGE_TYPE_ACTION:
+            type = SRN_MESSAGE_TYPE_ACTION;
+            fflags |= SRN_FILTER_FLAG_USER | SRN_FILTER_FLAG_PATTERN;
+            break;
+        case SRN_CHAT_LOG_MESSAGE_TYPE_MISC:
+            type = SRN_MESSAGE_TYPE_MISC;
+            break;
+        case SRN_CHAT_LOG_MESSAGE_TYPE_ERROR:
+            type = SRN_MESSAGE_TYPE_ERROR;
+            break;
+        default:
+            g_warn_if_reached();
+            return;
+    }
+    if (type == SRN_MESSAGE_TYPE_RECV || type == SRN_MESSAGE_TYPE_ACTION){
+        if (self->cfg->render_mirc_color) {
+            rflags |= SRN_RENDER_FLAG_MIRC_COLORIZE;
+        } else {
+            rflags |= SRN_RENDER_FLAG_MIRC_STRIP;
+        }
+    }
+
+    if (type == SRN_MESSAGE_TYPE_SENT){
+        user = self->user;
+    } else if (entry->sender){
+        user = srn_chat_add_and_get_user(self,
+                srn_server_add_and_get_user(self->srv, entry->sender));
+    } else {
+        user = self->_user;
+    }
+    g_return_if_fail(user);
+
+    sirc_message_context_init(&context, entry->time * G_USEC_PER_SEC);
+    msg = srn_message_new(self, user, entry->content, type, &context);
+    msg->history = TRUE;
+
+    if (srn_render_message(msg, rflags) != SRN_OK){
+        goto cleanup;
+    }
+    if (fflags && !srn_filter_message(msg, fflags)){
+        goto cleanup;
+    }
+
+    self->msg_list = g_list_prepend(self->msg_list, msg);
+    if (!self->last_msg){
+        self->last_msg = msg;
+    }
+    sui_buffer_prepend_message(self->ui, msg->ui);
+
+    return;
+
+cleanup:
+    srn_message_free(msg);
+}
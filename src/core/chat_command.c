@@ -43,6 +43,7 @@
 #include "filter/filter.h"
 #include "utils.h"
 #include "pattern_set.h"
+#include "chat_log.h"
 #include "chat_command.h"
 
 typedef struct _SrnChatCommandContext {
@@ -51,6 +52,36 @@ typedef struct _SrnChatCommandContext {
     SrnChat *chat;
 } SrnChatCommandContext;
 
+typedef struct _SearchTaskData {
+    char *srv_name;
+    char *chat_name; // Chat whose logs are searched, NULL for all chats
+    char *reply_chat_name; // Chat where results are shown, NULL for server
+    char *query;
+    int limit;
+} SearchTaskData;
+
+typedef struct _DiskUsageTaskData {
+    char *srv_name;
+    char *reply_chat_name; // Chat where usage is shown, NULL for server
+} DiskUsageTaskData;
+
+/* Max time to wait for indexing messages logged recently */
+#define SEARCH_INDEX_TIMEOUT    (3 * G_TIME_SPAN_SECOND)
+
+static void search_task(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable);
+static void search_ready(GObject *source_object, GAsyncResult *res,
+        gpointer user_data);
+static void search_task_data_free(SearchTaskData *data);
+static void free_search_results(GList *results);
+static void disk_usage_task(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable);
+static void disk_usage_ready(GObject *source_object, GAsyncResult *res,
+        gpointer user_data);
+static void disk_usage_task_data_free(DiskUsageTaskData *data);
+static void free_disk_usages(GList *usages);
+static SrnChat* find_reply_chat(const char *srv_name, const char *chat_name);
+
 static SrnApplication* ctx_get_app(SrnChatCommandContext *cctx);
 static SrnServer* ctx_get_server(SrnChatCommandContext *cctx);
 static SrnChat* ctx_get_chat(SrnChatCommandContext *cctx);
@@ -553,8 +584,11 @@ SrnRet on_command_topic(SrnCommand *cmd, void *user_data){
 }
 
 SrnRet on_command_msg(SrnCommand *cmd, void *user_data){
+    int max_targets;
+    char **targets;
     const char *target;
     const char *msg;
+    SrnRet ret;
     SrnServer *srv;
 
     srv = ctx_get_server(user_data);
@@ -565,11 +599,36 @@ SrnRet on_command_msg(SrnCommand *cmd, void *user_data){
     g_return_val_if_fail(msg, SRN_ERR);
     g_return_val_if_fail(target, SRN_ERR);
 
-    if (sirc_cmd_msg(srv->irc, target, msg) == SRN_OK){
-        return RET_OK(_("A message has been sent to \"%1$s\""), target);
-    } else {
+    // Targets are separated by comma, such as "#a,#b,nick"
+    targets = g_strsplit(target, ",", 0);
+    max_targets = srn_server_get_targmax(srv, "PRIVMSG");
+    if (max_targets < 0){
+        // Not advertised, only one target is safe
+        max_targets = 1;
+    }
+    ret = sirc_cmd_msg_multi(srv->irc, "PRIVMSG", (const char **)targets,
+            max_targets, msg);
+    if (ret != SRN_OK){
+        g_strfreev(targets);
         return SRN_ERR;
     }
+
+    // Show the message in every opened target, or wait for echo-message
+    if (!srv->cap->client_enabled.echo_message){
+        g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
+
+        for (int i = 0; targets[i]; i++){
+            SrnChat *chat;
+
+            chat = srn_server_get_chat(srv, targets[i]);
+            if (chat){
+                srn_chat_add_sent_message(chat, msg, context);
+            }
+        }
+    }
+    g_strfreev(targets);
+
+    return RET_OK(_("A message has been sent to \"%1$s\""), target);
 }
 
 SrnRet on_command_me(SrnCommand *cmd, void *user_data){
@@ -577,6 +636,7 @@ SrnRet on_command_me(SrnCommand *cmd, void *user_data){
     SrnRet ret;
     SrnServer *srv;
     SrnChat *chat;
+    SrnServerRequest *req;
 
     srv = ctx_get_server(user_data);
     g_return_val_if_fail(srn_server_is_valid(srv), SRN_ERR);
@@ -589,14 +649,23 @@ SrnRet on_command_me(SrnCommand *cmd, void *user_data){
         return RET_ERR(_("Cannot send message directly to a server"));
     }
 
+    g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
+
+    // Labeled by ui_event_send() if the command is typed by user
+    req = srv->cur_request;
+    if (req && req->chat == chat && !req->msg){
+        req->msg = srn_chat_add_provisional_message(chat,
+                SRN_MESSAGE_TYPE_ACTION, msg, context);
+    }
+
     ret = sirc_cmd_action(chat->srv->irc, chat->name, msg);
     if (!RET_IS_OK(ret)){
         return RET_ERR(_("Failed to send action message: %1$s"), RET_MSG(ret));
     }
 
-    g_autoptr(SircMessageContext) context = sirc_message_context_new(NULL);
-
-    srn_chat_add_action_message(chat, chat->user, msg, context);
+    if (!req && !srv->cap->client_enabled.echo_message){
+        srn_chat_add_action_message(chat, chat->user, msg, context);
+    }
 
     return SRN_OK;
 }
@@ -922,10 +991,244 @@ SrnRet on_command_clear(SrnCommand *cmd, void *user_data){
     return SRN_OK;
 }
 
+SrnRet on_command_search(SrnCommand *cmd, void *user_data){
+    int limit;
+    const char *query;
+    const char *limit_str;
+    GTask *task;
+    SearchTaskData *data;
+    SrnChat *chat;
+
+    chat = ctx_get_chat(user_data);
+    g_return_val_if_fail(chat, SRN_ERR);
+    query = srn_command_get_arg(cmd, 0);
+    g_return_val_if_fail(query, SRN_ERR);
+
+    limit_str = NULL;
+    srn_command_get_opt(cmd, "-limit", &limit_str);
+    limit = limit_str ? atoi(limit_str) : 0;
+    if (limit <= 0){
+        return RET_ERR(_("Invalid limit: %1$s"), limit_str);
+    }
+
+    data = g_malloc0(sizeof(SearchTaskData));
+    data->srv_name = g_strdup(chat->srv->name);
+    if (chat->type != SRN_CHAT_TYPE_SERVER){
+        data->reply_chat_name = g_strdup(chat->name);
+        if (!srn_command_get_opt(cmd, "-all", NULL)){
+            data->chat_name = g_strdup(chat->name);
+        }
+    }
+    data->query = g_strdup(query);
+    data->limit = limit;
+
+    // Searching may read a lot of (compressed) log files
+    task = g_task_new(NULL, NULL, search_ready, NULL);
+    g_task_set_task_data(task, data, (GDestroyNotify)search_task_data_free);
+    g_task_run_in_thread(task, search_task);
+    g_object_unref(task);
+
+    return SRN_OK;
+}
+
+SrnRet on_command_logs(SrnCommand *cmd, void *user_data){
+    GTask *task;
+    DiskUsageTaskData *data;
+    SrnChat *chat;
+
+    chat = ctx_get_chat(user_data);
+    g_return_val_if_fail(chat, SRN_ERR);
+
+    data = g_malloc0(sizeof(DiskUsageTaskData));
+    data->srv_name = g_strdup(chat->srv->name);
+    if (chat->type != SRN_CHAT_TYPE_SERVER){
+        data->reply_chat_name = g_strdup(chat->name);
+    }
+
+    // Every log file is stated
+    task = g_task_new(NULL, NULL, disk_usage_ready, NULL);
+    g_task_set_task_data(task, data, (GDestroyNotify)disk_usage_task_data_free);
+    g_task_run_in_thread(task, disk_usage_task);
+    g_object_unref(task);
+
+    return SRN_OK;
+}
+
 /*******************************************************************************
  * Misc
  ******************************************************************************/
 
+static void search_task(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable){
+    GList *results;
+    GError *err;
+    SearchTaskData *data;
+
+    data = task_data;
+
+    // Messages logged recently may not be indexed yet
+    srn_chat_log_flush();
+    srn_chat_log_index_sync(SEARCH_INDEX_TIMEOUT);
+
+    err = NULL;
+    results = srn_chat_log_search(data->srv_name, data->chat_name,
+            data->query, data->limit, &err);
+    if (err){
+        g_task_return_error(task, err);
+        return;
+    }
+    g_task_return_pointer(task, results, (GDestroyNotify)free_search_results);
+}
+
+static void search_ready(GObject *source_object, GAsyncResult *res,
+        gpointer user_data){
+    GList *results;
+    GString *str;
+    GError *err;
+    SearchTaskData *data;
+    SrnChat *chat;
+
+    data = g_task_get_task_data(G_TASK(res));
+    err = NULL;
+    results = g_task_propagate_pointer(G_TASK(res), &err);
+
+    chat = find_reply_chat(data->srv_name, data->reply_chat_name);
+    if (!chat){
+        g_clear_error(&err);
+        free_search_results(results);
+        return;
+    }
+
+    g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
+
+    if (err){
+        srn_chat_add_error_message_fmt(chat, context,
+                _("Failed to search chat logs: %1$s"), err->message);
+        g_error_free(err);
+        return;
+    }
+    if (!results){
+        srn_chat_add_misc_message(chat, _("No message found"), context);
+        return;
+    }
+
+    str = g_string_new(NULL);
+    g_string_printf(str, _("%1$d message(s) found:"), g_list_length(results));
+    for (GList *lst = results; lst; lst = g_list_next(lst)){
+        char *time;
+        GDateTime *dt;
+        SrnChatLogSearchResult *result;
+
+        result = lst->data;
+        dt = g_date_time_new_from_unix_utc(result->entry.time
+                + result->entry.utc_offset);
+        time = g_date_time_format(dt, "%Y-%m-%d %H:%M:%S");
+        g_string_append_printf(str, "\n  [%s] %s <%s> %s",
+                time, result->chat_name,
+                result->entry.sender ? result->entry.sender : "",
+                result->entry.content);
+        g_free(time);
+        g_date_time_unref(dt);
+    }
+    free_search_results(results);
+
+    srn_chat_add_misc_message(chat, str->str, context);
+    g_string_free(str, TRUE);
+}
+
+static void search_task_data_free(SearchTaskData *data){
+    g_free(data->srv_name);
+    g_free(data->chat_name);
+    g_free(data->reply_chat_name);
+    g_free(data->query);
+    g_free(data);
+}
+
+static void free_search_results(GList *results){
+    g_list_free_full(results, (GDestroyNotify)srn_chat_log_search_result_free);
+}
+
+static void disk_usage_task(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable){
+    g_task_return_pointer(task, srn_chat_log_get_disk_usage(),
+            (GDestroyNotify)free_disk_usages);
+}
+
+static void disk_usage_ready(GObject *source_object, GAsyncResult *res,
+        gpointer user_data){
+    GList *usages;
+    GString *str;
+    DiskUsageTaskData *data;
+    SrnChat *chat;
+
+    data = g_task_get_task_data(G_TASK(res));
+    usages = g_task_propagate_pointer(G_TASK(res), NULL);
+
+    chat = find_reply_chat(data->srv_name, data->reply_chat_name);
+    if (!chat){
+        free_disk_usages(usages);
+        return;
+    }
+
+    g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
+
+    if (!usages){
+        srn_chat_add_misc_message(chat, _("No chat log found"), context);
+        return;
+    }
+
+    str = g_string_new(_("Disk usage of chat logs:"));
+    for (GList *lst = usages; lst; lst = g_list_next(lst)){
+        char *size;
+        char *original_size;
+        SrnChatLogDiskUsage *usage;
+
+        usage = lst->data;
+        size = g_format_size(usage->size);
+        original_size = g_format_size(usage->original_size);
+        g_string_append_printf(str,
+                _("\n  %1$s: %2$s (%3$s uncompressed), %4$d file(s), %5$d compressed"),
+                usage->srv_name, size, original_size,
+                usage->file_count, usage->compressed_file_count);
+        g_free(original_size);
+        g_free(size);
+    }
+    free_disk_usages(usages);
+
+    srn_chat_add_misc_message(chat, str->str, context);
+    g_string_free(str, TRUE);
+}
+
+static void disk_usage_task_data_free(DiskUsageTaskData *data){
+    g_free(data->srv_name);
+    g_free(data->reply_chat_name);
+    g_free(data);
+}
+
+static void free_disk_usages(GList *usages){
+    g_list_free_full(usages, (GDestroyNotify)srn_chat_log_disk_usage_free);
+}
+
+/**
+ * @brief Find the chat where the result of an asynchronous command is shown,
+ * the chat may have been closed before the command finishes.
+ *
+ * @param srv_name
+ * @param chat_name NULL for server chat
+ *
+ * @return NULL if not found.
+ */
+static SrnChat* find_reply_chat(const char *srv_name, const char *chat_name){
+    SrnServer *srv;
+
+    srv = srn_application_get_server(srn_application_get_default(), srv_name);
+    if (!srv){
+        return NULL;
+    }
+
+    return chat_name ? srn_server_get_chat(srv, chat_name) : srv->chat;
+}
+
 static SrnApplication* ctx_get_app(SrnChatCommandContext *cctx){
     g_return_val_if_fail(cctx, NULL);
     g_return_val_if_fail(cctx->app, NULL);
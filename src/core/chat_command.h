@@ -49,6 +49,8 @@ SrnRet on_command_render(SrnCommand *cmd, void *user_data);
 SrnRet on_command_unrender(SrnCommand *cmd, void *user_data);
 SrnRet on_command_quote(SrnCommand *cmd, void *user_data);
 SrnRet on_command_clear(SrnCommand *cmd, void *user_data);
+SrnRet on_command_search(SrnCommand *cmd, void *user_data);
+SrnRet on_command_logs(SrnCommand *cmd, void *user_data);
 
 static SrnCommandBinding cmd_bindings[] = {
     {
@@ -258,6 +260,22 @@ static SrnCommandBinding cmd_bindings[] = {
         .opt = { SRN_COMMAND_EMPTY_OPT },
         .cb = on_command_clear,
     },
+    {
+        .name = "/search",
+        .argc = 1, // <query>
+        .opt = {
+            {.key = "-all", .val = SRN_COMMAND_OPT_NO_VAL },
+            {.key = "-limit", .val = "20" },
+            SRN_COMMAND_EMPTY_OPT,
+        },
+        .cb = on_command_search,
+    },
+    {
+        .name = "/logs",
+        .argc = 0,
+        .opt = { SRN_COMMAND_EMPTY_OPT },
+        .cb = on_command_logs,
+    },
     SRN_COMMAND_EMPTY,
 };
 
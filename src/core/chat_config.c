@@ -37,6 +37,10 @@ SrnRet srn_chat_config_check(SrnChatConfig *cfg){
     if (!cfg){
         return RET_ERR(_("Invalid chat config instance"));
     }
+    if (cfg->history_size < 0){
+        return RET_ERR(_("Invalid value of history-size: %1$d"),
+                cfg->history_size);
+    }
     return sui_buffer_config_check(cfg->ui);
 }
 
@@ -36,6 +36,7 @@ SrnLoginConfig* srn_login_config_new(void){
 
     self = g_malloc0(sizeof(SrnLoginConfig));
     self->method = SRN_LOGIN_METHOD_NONE;
+    self->timeout = 15;
 
     return self;
 }
@@ -53,6 +54,10 @@ SrnRet srn_login_config_check(SrnLoginConfig *self){
     const char *unknown = _("Unknown login method");
     const char *method_str = srn_login_method_to_string(self->method);
 
+    if (self->timeout < 0){
+        return RET_ERR(_("Invalid value of login timeout: %1$d"), self->timeout);
+    }
+
     switch (self->method) {
         case SRN_LOGIN_METHOD_NONE:
             break;
@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
 #include <glib.h>
 
 #include "core/core.h"
@@ -23,8 +24,21 @@
 #include "srain.h"
 #include "utils.h"
 
+typedef struct _PooledMarkup PooledMarkup;
+
+/* Markup shared by messages and freed with the last message using it */
+struct _PooledMarkup {
+    unsigned ref;
+    char markup[];
+};
+
+static GHashTable *markup_pool = NULL;
+
+static void markup_assign(const char **ptr, const char *markup);
+
 SrnMessage* srn_message_new(SrnChat *chat, SrnChatUser *user,
         const char *content, SrnMessageType type, const SircMessageContext *context){
+    char *sender;
     SrnMessage *self;
 
     g_return_val_if_fail(chat, NULL);
@@ -42,21 +56,17 @@ SrnMessage* srn_message_new(SrnChat *chat, SrnChatUser *user,
     self->sender = user;
     self->chat = chat;
     self->content = g_strdup(content);
-    self->time = g_date_time_ref(sirc_message_context_get_time(context));
+    self->time = sirc_message_context_get_time(context) / G_USEC_PER_SEC;
 
-    // Inital render
-    self->rendered_sender = g_markup_escape_text(user->srv_user->nick, -1);
-    self->rendered_remark = g_markup_escape_text("", -1);
+    // Inital render, times are formatted when they are shown
+    sender = g_markup_escape_text(user->srv_user->nick, -1);
+    srn_message_set_rendered_sender(self, sender);
+    g_free(sender);
     self->rendered_content = g_markup_escape_text(content, -1);
-    self->rendered_short_time = g_date_time_format(self->time, "%R");
-#ifdef G_OS_WIN32
-    // FIXME: g_date_time_format(xxx, "%c") does not work on MS Windows
-    self->rendered_full_time = g_date_time_format(self->time, "%F %R");
-#else
-    self->rendered_full_time = g_date_time_format(self->time, "%c");
-#endif
 
     self->mentioned = FALSE;
+    // Messages received from server history are old as well
+    self->history = sirc_message_context_get_batch(context, "chathistory") != NULL;
 
     switch (self->type){
         case SRN_MESSAGE_TYPE_SENT:
@@ -88,8 +98,11 @@ SrnMessage* srn_message_new(SrnChat *chat, SrnChatUser *user,
 char* srn_message_to_string(const SrnMessage *self){
     char *time_str;
     char *msg_str;
+    GDateTime *time;
 
-    time_str = g_date_time_format(self->time, "%T");
+    time = g_date_time_new_from_unix_local(self->time);
+    time_str = g_date_time_format(time, "%T");
+    g_date_time_unref(time);
     g_return_val_if_fail(time_str, NULL);
 
     switch (self->type){
@@ -128,14 +141,166 @@ char* srn_message_to_string(const SrnMessage *self){
 
 void srn_message_free(SrnMessage *self){
     str_assign(&self->content, NULL);
-    g_date_time_unref(self->time);
-
-    str_assign(&self->rendered_sender, NULL);
-    str_assign(&self->rendered_remark, NULL);
     str_assign(&self->rendered_content, NULL);
-    str_assign(&self->rendered_short_time, NULL);
-    str_assign(&self->rendered_full_time, NULL);
-    g_list_free_full(self->urls, g_free);
+    markup_assign(&self->rendered_sender, NULL);
+    markup_assign(&self->rendered_remark, NULL);
+    markup_assign(&self->rendered_time, NULL);
+    g_strfreev(self->urls);
 
     g_free(self);
 }
+
+/**
+ * @brief ``srn_message_get_short_time`` returns the time of message in short
+ * format, or the rendered one if any.
+ *
+ * Messages usually come in order, so the last formatted minute is cached.
+ * It should be called from main thread.
+ *
+ * @param self
+ *
+ * @return Time string, only valid until the next call
+ */
+const char* srn_message_get_short_time(const SrnMessage *self){
+    static gint64 cached_minute = -1;
+    static char cached_time[32];
+    gint64 minute;
+    char *time_str;
+    GDateTime *time;
+
+    if (self->rendered_time){
+        return self->rendered_time;
+    }
+
+    minute = self->time / 60;
+    if (minute != cached_minute){
+        time = g_date_time_new_from_unix_local(self->time);
+        time_str = g_date_time_format(time, "%R");
+        g_date_time_unref(time);
+        g_return_val_if_fail(time_str, NULL);
+
+        cached_minute = minute;
+        g_strlcpy(cached_time, time_str, sizeof(cached_time));
+        g_free(time_str);
+    }
+
+    return cached_time;
+}
+
+/**
+ * @brief ``srn_message_get_full_time`` returns the time of message in full
+ * format, which is rarely shown so it is not cached.
+ *
+ * @param self
+ *
+ * @return Newly allocated time string, should be freed by ``g_free()``
+ */
+char* srn_message_get_full_time(const SrnMessage *self){
+    char *time_str;
+    GDateTime *time;
+
+    time = g_date_time_new_from_unix_local(self->time);
+#ifdef G_OS_WIN32
+    // FIXME: g_date_time_format(xxx, "%c") does not work on MS Windows
+    time_str = g_date_time_format(time, "%F %R");
+#else
+    time_str = g_date_time_format(time, "%c");
+#endif
+    g_date_time_unref(time);
+
+    return time_str;
+}
+
+/**
+ * @brief ``srn_message_add_url`` appends an URL to message.
+ *
+ * @param self
+ * @param url Ownership is transferred to message
+ */
+void srn_message_add_url(SrnMessage *self, char *url){
+    guint len;
+
+    g_return_if_fail(url);
+
+    len = self->urls ? g_strv_length(self->urls) : 0;
+    self->urls = g_renew(char *, self->urls, len + 2);
+    self->urls[len] = url;
+    self->urls[len + 1] = NULL;
+}
+
+/**
+ * @brief ``srn_message_set_rendered_sender`` sets the rendered sender of
+ * message, the markup is shared with other messages.
+ *
+ * @param self
+ * @param markup Valid XML markup, never be NULL
+ */
+void srn_message_set_rendered_sender(SrnMessage *self, const char *markup){
+    g_return_if_fail(markup);
+
+    markup_assign(&self->rendered_sender, markup);
+}
+
+/**
+ * @brief ``srn_message_set_rendered_remark`` sets the rendered remark of
+ * message, the markup is shared with other messages.
+ *
+ * @param self
+ * @param markup Valid XML markup, can be NULL
+ */
+void srn_message_set_rendered_remark(SrnMessage *self, const char *markup){
+    markup_assign(&self->rendered_remark, markup);
+}
+
+/**
+ * @brief ``srn_message_set_rendered_time`` sets the rendered time of
+ * message, the markup is shared with other messages.
+ *
+ * @param self
+ * @param markup Valid XML markup, can be NULL
+ */
+void srn_message_set_rendered_time(SrnMessage *self, const char *markup){
+    markup_assign(&self->rendered_time, markup);
+}
+
+/**
+ * @brief Replace the pooled markup pointed by ``ptr``, the old one is freed
+ * if no message uses it anymore. It should be called from main thread.
+ */
+static void markup_assign(const char **ptr, const char *markup){
+    PooledMarkup *pooled;
+
+    if (markup == *ptr){
+        return;
+    }
+
+    if (!markup_pool){
+        markup_pool = g_hash_table_new_full(g_str_hash, g_str_equal,
+                NULL, g_free);
+    }
+
+    if (markup){
+        pooled = g_hash_table_lookup(markup_pool, markup);
+        if (!pooled){
+            size_t len;
+
+            len = strlen(markup);
+            pooled = g_malloc(sizeof(PooledMarkup) + len + 1);
+            pooled->ref = 0;
+            memcpy(pooled->markup, markup, len + 1);
+            g_hash_table_insert(markup_pool, pooled->markup, pooled);
+        }
+        pooled->ref++;
+        markup = pooled->markup;
+    }
+
+    if (*ptr){
+        pooled = g_hash_table_lookup(markup_pool, *ptr);
+        g_warn_if_fail(pooled && pooled->markup == *ptr);
+        if (pooled && --pooled->ref == 0){
+            g_hash_table_remove(markup_pool, *ptr);
+        }
+    }
+
+    *ptr = markup;
+}
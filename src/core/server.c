@@ -25,6 +25,7 @@
  */
 
 
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
@@ -64,6 +65,19 @@ SrnServer* srn_server_new(const char *name, SrnServerConfig *cfg){
     /* srv->delay = 0; */ // by g_malloc0()
     /* srv->ping_timer = 0; */ // by g_malloc0()
     /* srv->reconn_timer = 0; */ // by g_malloc0()
+    /* srv->rejoin_timer = 0; */ // by g_malloc0()
+
+    srv->targmax = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    /* srv->chanlimit = 0; */ // by g_malloc0()
+    /* srv->chathistory = 0; */ // by g_malloc0()
+    str_assign(&srv->prefix_modes, SRN_SERVER_PREFIX_MODES);
+    str_assign(&srv->prefix_symbols, SRN_SERVER_PREFIX_SYMBOLS);
+    srv->netsplits = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify)g_hash_table_destroy);
+    srn_server_init_requests(srv);
+    srn_server_init_who(srv);
+    srv->monitor = -1;
+    srn_server_init_monitor(srv);
 
     /* Server user */
     srv->user_table = g_hash_table_new_full(
@@ -103,6 +117,19 @@ void srn_server_free(SrnServer *srv){
     g_hash_table_remove_all(srv->user_table);
 
     srn_server_cap_free(srv->cap);
+    g_hash_table_destroy(srv->targmax);
+    str_assign(&srv->prefix_modes, NULL);
+    str_assign(&srv->prefix_symbols, NULL);
+    g_hash_table_destroy(srv->netsplits);
+    srn_server_finalize_requests(srv);
+    srn_server_finalize_who(srv);
+    srn_server_finalize_monitor(srv);
+    if (srv->rejoin_timer){
+        g_source_remove(srv->rejoin_timer);
+    }
+    if (srv->stale_timer){
+        g_source_remove(srv->stale_timer);
+    }
 
     str_assign(&srv->name, NULL);
 
@@ -154,6 +181,161 @@ ERR:
     return SRN_OK;
 }
 
+/**
+ * @brief ``srn_server_set_isupport`` records a RPL_ISUPPORT token which
+ * affects how commands are sent.
+ *
+ * @param srv
+ * @param key
+ * @param value Value of token, can be empty
+ */
+void srn_server_set_isupport(SrnServer *srv, const char *key, const char *value){
+    if (g_ascii_strcasecmp(key, "TARGMAX") == 0){
+        char **limits;
+
+        // For example: "PRIVMSG:4,NOTICE:4,JOIN:,KICK:1"
+        g_hash_table_remove_all(srv->targmax);
+        limits = g_strsplit(value, ",", 0);
+        for (int i = 0; limits[i]; i++){
+            char *delim;
+
+            delim = strchr(limits[i], ':');
+            if (!delim){
+                continue;
+            }
+            g_hash_table_insert(srv->targmax,
+                    g_ascii_strup(limits[i], delim - limits[i]),
+                    GINT_TO_POINTER(atoi(delim + 1)));
+        }
+        g_strfreev(limits);
+    } else if (g_ascii_strcasecmp(key, "CHANLIMIT") == 0){
+        char **limits;
+
+        // For example: "#&:100,+:10", the smallest one is used
+        srv->chanlimit = 0;
+        limits = g_strsplit(value, ",", 0);
+        for (int i = 0; limits[i]; i++){
+            int limit;
+            char *delim;
+
+            delim = strchr(limits[i], ':');
+            limit = delim ? atoi(delim + 1) : 0;
+            if (limit > 0 && (srv->chanlimit == 0 || limit < srv->chanlimit)){
+                srv->chanlimit = limit;
+            }
+        }
+        g_strfreev(limits);
+    } else if (g_ascii_strcasecmp(key, "WHOX") == 0){
+        srv->whox = TRUE;
+    } else if (g_ascii_strcasecmp(key, "MONITOR") == 0){
+        // Empty value means no limit
+        srv->monitor = MAX(atoi(value), 0);
+    } else if (g_ascii_strcasecmp(key, "CHATHISTORY") == 0){
+        srv->chathistory = MAX(atoi(value), 0);
+    } else if (g_ascii_strcasecmp(key, "PREFIX") == 0){
+        const char *delim;
+
+        // For example: "(qaohv)~&@%+", empty value means no prefix
+        delim = strchr(value, ')');
+        if (value[0] == '(' && delim
+                && delim - value - 1 == (ptrdiff_t)strlen(delim + 1)){
+            g_free(srv->prefix_modes);
+            srv->prefix_modes = g_strndup(value + 1, delim - value - 1);
+            str_assign(&srv->prefix_symbols, delim + 1);
+        } else if (value[0] == '\0'){
+            str_assign(&srv->prefix_modes, "");
+            str_assign(&srv->prefix_symbols, "");
+        }
+    }
+}
+
+/**
+ * @brief ``srn_server_reset_isupport`` forgets all RPL_ISUPPORT tokens,
+ * they are sent again after reconnecting.
+ *
+ * @param srv
+ */
+void srn_server_reset_isupport(SrnServer *srv){
+    g_hash_table_remove_all(srv->targmax);
+    srv->chanlimit = 0;
+    srv->chathistory = 0;
+    srv->whox = FALSE;
+    srv->monitor = -1;
+    str_assign(&srv->prefix_modes, SRN_SERVER_PREFIX_MODES);
+    str_assign(&srv->prefix_symbols, SRN_SERVER_PREFIX_SYMBOLS);
+}
+
+/**
+ * @brief ``srn_server_get_targmax`` returns the max number of targets
+ * accepted by a command.
+ *
+ * @param srv
+ * @param cmd Upper case command, such as "JOIN", "PRIVMSG"
+ *
+ * @return 0 if there is no limit, -1 if server does not advertise it.
+ */
+int srn_server_get_targmax(SrnServer *srv, const char *cmd){
+    gpointer limit;
+
+    if (!g_hash_table_lookup_extended(srv->targmax, cmd, NULL, &limit)){
+        return -1;
+    }
+
+    return GPOINTER_TO_INT(limit);
+}
+
+/**
+ * @brief ``srn_server_parse_prefix`` parses nick prefixes of a name in
+ * RPL_NAMREPLY. There may be more than one prefixes if multi-prefix is
+ * enabled, they are ordered from the highest to lowest.
+ *
+ * @param srv
+ * @param name Such as "@+nick" or "@+nick!user@host"
+ * @param type Returns type of the highest known prefix
+ *
+ * @return Length of prefixes
+ */
+int srn_server_parse_prefix(SrnServer *srv, const char *name,
+        SrnChatUserType *type){
+    int len;
+
+    *type = SRN_CHAT_USER_TYPE_CHIGUA;
+    for (len = 0; name[len]; len++){
+        const char *symbol;
+        SrnChatUserType mode_type;
+
+        symbol = strchr(srv->prefix_symbols, name[len]);
+        if (!symbol){
+            break;
+        }
+        switch (srv->prefix_modes[symbol - srv->prefix_symbols]){
+            case 'q':
+                mode_type = SRN_CHAT_USER_TYPE_OWNER;
+                break;
+            case 'a':
+                mode_type = SRN_CHAT_USER_TYPE_ADMIN;
+                break;
+            case 'o':
+                mode_type = SRN_CHAT_USER_TYPE_FULL_OP;
+                break;
+            case 'h':
+                mode_type = SRN_CHAT_USER_TYPE_HALF_OP;
+                break;
+            case 'v':
+                mode_type = SRN_CHAT_USER_TYPE_VOICED;
+                break;
+            default:
+                // Unknown mode, skip it
+                continue;
+        }
+        if (mode_type < *type){
+            *type = mode_type;
+        }
+    }
+
+    return len;
+}
+
 bool srn_server_is_valid(SrnServer *srv){
     SrnApplication *app;
 
@@ -263,6 +445,16 @@ SrnRet srn_server_add_chat(SrnServer *srv, const char *name){
                 SRN_CHAT_TYPE_CHANNEL : SRN_CHAT_TYPE_DIALOG,
                 chat_cfg);
         srv->chat_list = g_list_append(srv->chat_list, chat);
+        if (chat->type == SRN_CHAT_TYPE_DIALOG){
+            SrnServerUser *srv_user;
+
+            srn_server_monitor_user(srv, chat->name);
+            // Later updates are only shown when the state changes
+            srv_user = srn_server_get_user(srv, chat->name);
+            if (srv_user){
+                sui_set_online(chat->ui, srv_user->is_online);
+            }
+        }
     }
 
     /* Run chat auto run commands */
@@ -278,7 +470,7 @@ SrnRet srn_server_add_chat(SrnServer *srv, const char *name){
             return ret;
         }
 
-        g_autoptr(SircMessageContext) context = sirc_message_context_new(NULL);
+        g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
 
         if (RET_IS_OK(ret)){
             if (ret != SRN_OK) { // Has OK message
@@ -309,6 +501,10 @@ SrnRet srn_server_rm_chat(SrnServer *srv, SrnChat *chat){
     if (srv->cur_chat == chat){
         srv->cur_chat = srv->chat;
     }
+    srn_server_cancel_requests(srv, chat);
+    if (chat->type == SRN_CHAT_TYPE_DIALOG){
+        srn_server_unmonitor_user(srv, chat->name);
+    }
     chat_cfg = chat->cfg;
     srn_chat_free(chat);
     srn_chat_config_free(chat_cfg);
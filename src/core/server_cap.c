@@ -55,23 +55,23 @@ static ServerCapSupport supported_caps[] = {
     //     .offset = offsetof(EnabledCap, identify_msg),
     // },
 
-    // /* IRCv3 */
-    // {
-    //     .name = "multi-prefix",
-    //     .offset = offsetof(EnabledCap, mulit_prefix),
-    // },
-    // {
-    //     .name = "away-notify",
-    //     .offset = offsetof(EnabledCap, away_notify),
-    // },
-    // {
-    //     .name = "account-notify",
-    //     .offset = offsetof(EnabledCap, account_notify),
-    // },
-    // {
-    //     .name = "extended-join",
-    //     .offset = offsetof(EnabledCap, extended_join),
-    // },
+    /* IRCv3 */
+    {
+        .name = "multi-prefix",
+        .offset = offsetof(EnabledCap, mulit_prefix),
+    },
+    {
+        .name = "away-notify",
+        .offset = offsetof(EnabledCap, away_notify),
+    },
+    {
+        .name = "account-notify",
+        .offset = offsetof(EnabledCap, account_notify),
+    },
+    {
+        .name = "extended-join",
+        .offset = offsetof(EnabledCap, extended_join),
+    },
     {
         .name = "sasl",
         .offset = offsetof(EnabledCap, sasl),
@@ -86,23 +86,41 @@ static ServerCapSupport supported_caps[] = {
         .name = "server-time",
         .offset = offsetof(EnabledCap, server_time),
     },
-    // {
-    //     .name = "userhost-in-names",
-    //     .offset = offsetof(EnabledCap, userhost_in_names),
-    // },
+    {
+        .name = "userhost-in-names",
+        .offset = offsetof(EnabledCap, userhost_in_names),
+    },
     {
         // Auto enabled on IRCv3.2 and aboved
         .name = "cap-notify",
         .offset = offsetof(EnabledCap, cap_notify),
     },
-    // {
-    //     .name = "chghost",
-    //     .offset = offsetof(EnabledCap, chghost),
-    // },
+    {
+        .name = "chghost",
+        .offset = offsetof(EnabledCap, chghost),
+    },
     {
         .name = "invite-notify",
         .offset = offsetof(EnabledCap, invite_notify),
     },
+    {
+        .name = "batch",
+        .offset = offsetof(EnabledCap, batch),
+    },
+    {
+        // Requires batch and server-time
+        .name = "draft/chathistory",
+        .offset = offsetof(EnabledCap, chathistory),
+    },
+    {
+        .name = "echo-message",
+        .offset = offsetof(EnabledCap, echo_message),
+    },
+    {
+        // Requires batch
+        .name = "labeled-response",
+        .offset = offsetof(EnabledCap, labeled_response),
+    },
 
     // /* ZNC */
     // {
@@ -0,0 +1,335 @@
+/* Copyright (C) 2016-2017 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file server_monitor.c
+ * @brief Track online state of dialog peers and watched nicks
+ *
+ * ref:
+ *  - https://ircv3.net/specs/extensions/monitor
+ *
+ * Nicks are monitored by MONITOR if server advertises it in RPL_ISUPPORT,
+ * otherwise they are polled by ISON periodically.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "core/core.h"
+#include "sirc/sirc.h"
+#include "srain.h"
+#include "log.h"
+#include "i18n.h"
+#include "utils.h"
+
+static GList* find_nick(GList *list, const char *nick);
+static void send_monitor(SrnServer *srv);
+static gboolean poll_ison(gpointer user_data);
+
+void srn_server_init_monitor(SrnServer *srv){
+    for (GList *lst = srv->cfg->watch_list; lst; lst = g_list_next(lst)){
+        srn_server_monitor_user(srv, lst->data);
+    }
+}
+
+void srn_server_finalize_monitor(SrnServer *srv){
+    srn_server_stop_monitor(srv);
+    g_list_free_full(srv->monitor_list, g_free);
+    srv->monitor_list = NULL;
+}
+
+/**
+ * @brief ``srn_server_start_monitor`` sends the whole monitor list to
+ * server, or starts ISON polling. It should be called after RPL_ISUPPORT
+ * is received.
+ *
+ * @param srv
+ */
+void srn_server_start_monitor(SrnServer *srv){
+    g_return_if_fail(srn_server_is_valid(srv));
+
+    if (srv->monitoring){
+        return;
+    }
+    srv->monitoring = TRUE;
+
+    if (srv->monitor >= 0){
+        send_monitor(srv);
+    } else {
+        srv->ison_offset = 0;
+        srv->ison_timer = g_timeout_add(SRN_SERVER_ISON_INTERVAL,
+                poll_ison, srv);
+        poll_ison(srv);
+    }
+}
+
+/**
+ * @brief ``srn_server_stop_monitor`` is called when server is disconnected,
+ * server forgets the MONITOR list of a disconnected client.
+ *
+ * @param srv
+ */
+void srn_server_stop_monitor(SrnServer *srv){
+    g_return_if_fail(srv);
+
+    srv->monitoring = FALSE;
+    if (srv->ison_timer){
+        g_source_remove(srv->ison_timer);
+        srv->ison_timer = 0;
+    }
+    g_strfreev(srv->ison_query);
+    srv->ison_query = NULL;
+}
+
+void srn_server_monitor_user(SrnServer *srv, const char *nick){
+    g_return_if_fail(srv);
+    g_return_if_fail(!str_is_empty(nick));
+
+    if (find_nick(srv->monitor_list, nick)){
+        return;
+    }
+    srv->monitor_list = g_list_append(srv->monitor_list, g_strdup(nick));
+
+    if (!srv->monitoring || srv->monitor < 0){
+        // It is sent by srn_server_start_monitor() or polled by next ISON
+        return;
+    }
+    if (srv->monitor > 0
+            && (int)g_list_length(srv->monitor_list) > srv->monitor){
+        WARN_FR("Monitor list of %s is full, %s is not monitored",
+                srv->name, nick);
+        return;
+    }
+    sirc_cmd_monitor(srv->irc, '+', nick);
+}
+
+/**
+ * @brief ``srn_server_unmonitor_user`` stops monitoring a nick, nicks in
+ * watch list of server config are always monitored.
+ *
+ * @param srv
+ * @param nick
+ */
+void srn_server_unmonitor_user(SrnServer *srv, const char *nick){
+    GList *lst;
+
+    g_return_if_fail(srv);
+    g_return_if_fail(!str_is_empty(nick));
+
+    if (find_nick(srv->cfg->watch_list, nick)){
+        return;
+    }
+    lst = find_nick(srv->monitor_list, nick);
+    if (!lst){
+        return;
+    }
+
+    if (srv->monitoring && srv->monitor >= 0){
+        sirc_cmd_monitor(srv->irc, '-', lst->data);
+    }
+    g_free(lst->data);
+    srv->monitor_list = g_list_delete_link(srv->monitor_list, lst);
+}
+
+/**
+ * @brief ``srn_server_is_monitored`` checks whether a nick is in monitor
+ * list, all dialog peers are monitored.
+ *
+ * @param srv
+ * @param nick
+ *
+ * @return TRUE if monitored.
+ */
+bool srn_server_is_monitored(SrnServer *srv, const char *nick){
+    g_return_val_if_fail(srv, FALSE);
+
+    return find_nick(srv->monitor_list, nick) != NULL;
+}
+
+/**
+ * @brief ``srn_server_set_presence`` applies a RPL_MONONLINE,
+ * RPL_MONOFFLINE or RPL_ISON to user. A message is shown when the state of
+ * watched nick changes.
+ *
+ * @param srv
+ * @param nick
+ * @param online
+ * @param context
+ */
+void srn_server_set_presence(SrnServer *srv, const char *nick, bool online,
+        const SircMessageContext *context){
+    bool changed;
+    SrnServerUser *srv_user;
+
+    g_return_if_fail(srn_server_is_valid(srv));
+
+    srv_user = srn_server_add_and_get_user(srv, nick);
+    g_return_if_fail(srv_user);
+
+    changed = srv_user->is_online != online;
+    srn_server_user_set_is_online(srv_user, online);
+
+    if (changed && find_nick(srv->cfg->watch_list, nick)){
+        if (online){
+            srn_chat_add_misc_message_fmt(srv->chat, context,
+                    _("%1$s is online"), nick);
+        } else {
+            srn_chat_add_misc_message_fmt(srv->chat, context,
+                    _("%1$s is offline"), nick);
+        }
+    }
+}
+
+/**
+ * @brief ``srn_server_finish_ison`` applies RPL_ISON to nicks of the last
+ * ISON, nicks absent in reply are offline.
+ *
+ * @param srv
+ * @param nicks Space separated nicks of RPL_ISON
+ * @param context
+ */
+void srn_server_finish_ison(SrnServer *srv, const char *nicks,
+        const SircMessageContext *context){
+    char **query;
+    char **online;
+
+    g_return_if_fail(srn_server_is_valid(srv));
+
+    query = srv->ison_query;
+    if (!query){
+        // Not requested by poll_ison()
+        return;
+    }
+    srv->ison_query = NULL;
+
+    online = g_strsplit(nicks, " ", 0);
+    for (int i = 0; query[i]; i++){
+        bool found;
+
+        found = FALSE;
+        for (int j = 0; online[j]; j++){
+            if (sirc_target_equal(query[i], online[j])){
+                found = TRUE;
+                break;
+            }
+        }
+        srn_server_set_presence(srv, query[i], found, context);
+    }
+    g_strfreev(online);
+    g_strfreev(query);
+}
+
+static GList* find_nick(GList *list, const char *nick){
+    for (GList *lst = list; lst; lst = g_list_next(lst)){
+        if (sirc_target_equal(lst->data, nick)){
+            return lst;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Send the whole monitor list, as many nicks as possible are packed
+ * into a MONITOR command, limited by the length of IRC line. Nicks beyond
+ * the MONITOR limit of RPL_ISUPPORT are not added.
+ */
+static void send_monitor(SrnServer *srv){
+    int limit;
+    GString *targets;
+
+    limit = srv->monitor > 0 ? srv->monitor : G_MAXINT;
+    targets = g_string_new(NULL);
+    for (GList *lst = srv->monitor_list; lst; lst = g_list_next(lst)){
+        const char *nick = lst->data;
+
+        if (limit-- <= 0){
+            WARN_FR("Monitor list of %s is full, %s is not monitored",
+                    srv->name, nick);
+            break;
+        }
+
+        // Length of "MONITOR + <targets>" after adding this nick
+        if (targets->len > 0 && strlen("MONITOR + ") + targets->len + 1
+                + strlen(nick) > SRN_SERVER_MAX_LINE_LEN){
+            sirc_cmd_monitor(srv->irc, '+', targets->str);
+            g_string_truncate(targets, 0);
+        }
+        if (targets->len > 0){
+            g_string_append_c(targets, ',');
+        }
+        g_string_append(targets, nick);
+    }
+    if (targets->len > 0){
+        sirc_cmd_monitor(srv->irc, '+', targets->str);
+    }
+
+    g_string_free(targets, TRUE);
+}
+
+/**
+ * @brief Send one ISON of as many nicks as possible, nicks do not fit the
+ * IRC line are polled in the next interval.
+ */
+static gboolean poll_ison(gpointer user_data){
+    int len;
+    int count;
+    GList *start;
+    GPtrArray *query;
+    GString *nicks;
+    SrnServer *srv;
+
+    srv = user_data;
+
+    if (srv->ison_query){
+        // Last ISON is not replied yet
+        return G_SOURCE_CONTINUE;
+    }
+    count = g_list_length(srv->monitor_list);
+    if (count == 0){
+        return G_SOURCE_CONTINUE;
+    }
+    if (srv->ison_offset >= count){
+        srv->ison_offset = 0;
+    }
+
+    query = g_ptr_array_new();
+    nicks = g_string_new(NULL);
+    len = strlen("ISON :");
+    start = g_list_nth(srv->monitor_list, srv->ison_offset);
+    for (GList *lst = start; lst; lst = g_list_next(lst)){
+        const char *nick = lst->data;
+
+        if (nicks->len > 0 && len + nicks->len + 1 + strlen(nick)
+                > SRN_SERVER_MAX_LINE_LEN){
+            break;
+        }
+        if (nicks->len > 0){
+            g_string_append_c(nicks, ' ');
+        }
+        g_string_append(nicks, nick);
+        g_ptr_array_add(query, g_strdup(nick));
+        srv->ison_offset++;
+    }
+    g_ptr_array_add(query, NULL);
+    srv->ison_query = (char **)g_ptr_array_free(query, FALSE);
+
+    sirc_cmd_ison(srv->irc, nicks->str);
+    g_string_free(nicks, TRUE);
+
+    return G_SOURCE_CONTINUE;
+}
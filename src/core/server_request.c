@@ -0,0 +1,212 @@
+/* Copyright (C) 2016-2017 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file server_request.c
+ * @brief Track labeled commands until server replies them
+ *
+ * ref:
+ *  - https://ircv3.net/specs/extensions/labeled-response
+ *
+ * Commands sent between ``srn_server_begin_request`` and
+ * ``srn_server_end_request`` are labeled, the label is used to find the
+ * chat where the commands are sent from when their replies arrive.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "core/core.h"
+#include "srain.h"
+#include "log.h"
+
+static void complete_request(SrnServer *srv, SrnServerRequest *req);
+static void request_free(SrnServerRequest *req);
+
+void srn_server_init_requests(SrnServer *srv){
+    srv->requests = g_hash_table_new_full(g_str_hash, g_str_equal,
+            NULL, (GDestroyNotify)request_free);
+}
+
+void srn_server_finalize_requests(SrnServer *srv){
+    g_hash_table_destroy(srv->requests);
+    srv->requests = NULL;
+}
+
+/**
+ * @brief ``srn_server_begin_request`` starts labeling commands sent from
+ * given chat.
+ *
+ * @param srv
+ * @param chat
+ *
+ * @return NULL if server does not support labeled-response, otherwise
+ *      the request is owned by server.
+ */
+SrnServerRequest* srn_server_begin_request(SrnServer *srv, SrnChat *chat){
+    SrnServerRequest *req;
+
+    g_return_val_if_fail(srn_server_is_valid(srv), NULL);
+    g_return_val_if_fail(chat, NULL);
+
+    if (!srv->cap->client_enabled.labeled_response){
+        return NULL;
+    }
+
+    req = g_malloc0(sizeof(SrnServerRequest));
+    req->label = g_strdup_printf("srn%lu", ++srv->last_label);
+    req->chat = chat;
+    // Key is owned by request
+    g_hash_table_insert(srv->requests, req->label, req);
+    srv->cur_request = req;
+    sirc_begin_label(srv->irc, req->label);
+
+    return req;
+}
+
+/**
+ * @brief ``srn_server_end_request`` stops labeling commands. It is safe to
+ * call it even if ``srn_server_begin_request`` returned NULL or the request
+ * has been cancelled.
+ *
+ * @param srv
+ */
+void srn_server_end_request(SrnServer *srv){
+    SrnServerRequest *req;
+
+    g_return_if_fail(srn_server_is_valid(srv));
+
+    req = srv->cur_request;
+    if (!req){
+        return;
+    }
+
+    srv->cur_request = NULL;
+    req->pending += sirc_end_label(srv->irc);
+    if (req->pending == 0){
+        // Nothing is sent
+        req->rejected = TRUE;
+        complete_request(srv, req);
+    }
+}
+
+/**
+ * @brief ``srn_server_get_request`` finds the request by label of its
+ * commands.
+ *
+ * @param srv
+ * @param label Label of any command of request
+ *
+ * @return NULL if not found
+ */
+SrnServerRequest* srn_server_get_request(SrnServer *srv, const char *label){
+    size_t len;
+    char *key;
+    SrnServerRequest *req;
+
+    g_return_val_if_fail(srn_server_is_valid(srv), NULL);
+
+    if (!label){
+        return NULL;
+    }
+
+    // Strip the ".<n>" suffix, see sirc_begin_label()
+    len = strcspn(label, ".");
+    if (label[len] == '\0'){
+        return g_hash_table_lookup(srv->requests, label);
+    }
+
+    key = g_strndup(label, len);
+    req = g_hash_table_lookup(srv->requests, key);
+    g_free(key);
+
+    return req;
+}
+
+void srn_server_reject_request(SrnServer *srv, const char *label){
+    SrnServerRequest *req;
+
+    req = srn_server_get_request(srv, label);
+    if (req){
+        req->rejected = TRUE;
+    }
+}
+
+/**
+ * @brief ``srn_server_finish_request`` is called when the response of a
+ * labeled command ends, the request is completed after all of its commands
+ * are replied.
+ *
+ * @param srv
+ * @param label
+ */
+void srn_server_finish_request(SrnServer *srv, const char *label){
+    SrnServerRequest *req;
+
+    req = srn_server_get_request(srv, label);
+    if (!req){
+        return;
+    }
+
+    req->pending--;
+    if (req->pending <= 0){
+        complete_request(srv, req);
+    }
+}
+
+/**
+ * @brief ``srn_server_cancel_requests`` drops requests sent from given chat
+ * without waiting for the replies.
+ *
+ * @param srv
+ * @param chat Chat to be removed, or NULL for all chats when disconnected.
+ *      Provisional messages are rejected in the latter case.
+ */
+void srn_server_cancel_requests(SrnServer *srv, SrnChat *chat){
+    GHashTableIter iter;
+    SrnServerRequest *req;
+
+    g_return_if_fail(srv);
+
+    g_hash_table_iter_init(&iter, srv->requests);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&req)){
+        if (chat && req->chat != chat){
+            continue;
+        }
+        if (!chat && req->msg){
+            srn_chat_confirm_message(req->chat, req->msg, FALSE);
+        }
+        if (req == srv->cur_request){
+            srv->cur_request = NULL;
+            sirc_end_label(srv->irc);
+        }
+        g_hash_table_iter_remove(&iter);
+    }
+}
+
+static void complete_request(SrnServer *srv, SrnServerRequest *req){
+    if (req->msg){
+        srn_chat_confirm_message(req->chat, req->msg, !req->rejected);
+    }
+    g_hash_table_remove(srv->requests, req->label);
+}
+
+static void request_free(SrnServerRequest *req){
+    g_free(req->label);
+    g_free(req);
+}
@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
 
 #include "core/core.h"
 
@@ -23,6 +24,7 @@
 #include "utils.h"
 
 static void srn_server_user_update_chat_user(SrnServerUser *self);
+static void srn_server_user_update_prefix_len(SrnServerUser *self);
 
 SrnServerUser *srn_server_user_new(SrnServer *srv, const char *nick){
     SrnServerUser *self;
@@ -45,6 +47,7 @@ void srn_server_user_free(SrnServerUser *self){
     str_assign(&self->username, NULL);
     str_assign(&self->hostname, NULL);
     str_assign(&self->realname, NULL);
+    str_assign(&self->loginname, NULL);
     srn_extra_data_free(self->extra_data);
     g_free(self);
 }
@@ -82,33 +85,60 @@ SrnRet srn_server_user_detach_chat_user(SrnServerUser *self, SrnChatUser *chat_u
 void srn_server_user_set_nick(SrnServerUser *self, const char *nick){
     str_assign(&self->nick, nick);
     srn_server_user_update_chat_user(self);
+    srn_server_user_update_prefix_len(self);
 }
 
 void srn_server_user_set_username(SrnServerUser *self, const char *username){
     str_assign(&self->username, username);
     srn_server_user_update_chat_user(self);
+    srn_server_user_update_prefix_len(self);
 }
 
 void srn_server_user_set_hostname(SrnServerUser *self, const char *hostname){
     str_assign(&self->hostname, hostname);
     srn_server_user_update_chat_user(self);
+    srn_server_user_update_prefix_len(self);
 }
 
 void srn_server_user_set_realname(SrnServerUser *self, const char *realname){
     str_assign(&self->realname, realname);
 }
 
+/**
+ * @brief ``srn_server_user_set_loginname`` sets the account name of user.
+ *
+ * @param self
+ * @param loginname NULL if user is not logged in
+ */
+void srn_server_user_set_loginname(SrnServerUser *self, const char *loginname){
+    str_assign(&self->loginname, loginname);
+}
+
 void srn_server_user_set_is_me(SrnServerUser *self, bool me){
     if (self->is_me == me){
         return;
     }
     self->is_me = me;
     srn_server_user_update_chat_user(self);
+    srn_server_user_update_prefix_len(self);
 }
 
 void srn_server_user_set_is_online(SrnServerUser *self, bool online){
+    if (self->is_online == online){
+        return;
+    }
     self->is_online = online;
 
+    // Show online state of dialog peer
+    if (srn_server_is_monitored(self->srv, self->nick)){
+        SrnChat *chat;
+
+        chat = srn_server_get_chat(self->srv, self->nick);
+        if (chat && chat->type == SRN_CHAT_TYPE_DIALOG){
+            sui_set_online(chat->ui, online);
+        }
+    }
+
     if (!self->is_online){
         GList *lst;
 
@@ -123,6 +153,14 @@ void srn_server_user_set_is_online(SrnServerUser *self, bool online){
     }
 }
 
+void srn_server_user_set_is_away(SrnServerUser *self, bool away){
+    if (self->is_away == away){
+        return;
+    }
+    self->is_away = away;
+    srn_server_user_update_chat_user(self);
+}
+
 void srn_server_user_set_is_ignored(SrnServerUser *self, bool is_ignored){
     if (self->is_ignored == is_ignored) {
         return;
@@ -142,3 +180,23 @@ static void srn_server_user_update_chat_user(SrnServerUser *self){
         lst = g_list_next(lst);
     }
 }
+
+/**
+ * @brief Tell IRC session the length of our "nick!user@host", which is
+ * prepended to our messages when server relays them, so that long messages
+ * are split exactly at the line limit.
+ */
+static void srn_server_user_update_prefix_len(SrnServerUser *self){
+    int len;
+
+    if (!self->is_me || !self->srv || !self->srv->irc){
+        return;
+    }
+
+    len = 0;
+    if (self->nick && self->username && self->hostname){
+        len = strlen(self->nick) + strlen("!") + strlen(self->username)
+            + strlen("@") + strlen(self->hostname);
+    }
+    sirc_set_prefix_len(self->srv->irc, len);
+}
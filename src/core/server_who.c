@@ -0,0 +1,314 @@
+/* Copyright (C) 2016-2017 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file server_who.c
+ * @brief Fetch metadata of channel members by WHO in background
+ *
+ * ref:
+ *  - https://ircv3.net/specs/extensions/whox
+ *
+ * Channels are queued and only one WHO is sent at a time, so a lot of
+ * joined channels do not flood the server. Replies are staged and applied
+ * to users at RPL_ENDOFWHO.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "core/core.h"
+#include "sirc/sirc.h"
+#include "srain.h"
+#include "log.h"
+#include "utils.h"
+
+/* Token, channel, user, host, nick, flags, account and realname, the order
+ * of fields in RPL_WHOSPCRPL is fixed */
+#define WHOX_FIELDS     "tcuhnfar"
+
+typedef struct _WhoReply {
+    char *nick;
+    char *username;
+    char *hostname;
+    char *realname;
+    char *loginname;
+    bool has_loginname; // Plain WHO does not tell account
+    bool is_away;
+} WhoReply;
+
+static void send_next_who(SrnServer *srv);
+static void finish_who(SrnServer *srv);
+static gboolean who_timeout_cb(gpointer user_data);
+static void who_reply_free(WhoReply *reply);
+
+void srn_server_init_who(SrnServer *srv){
+    srv->who_queue = g_queue_new();
+}
+
+void srn_server_finalize_who(SrnServer *srv){
+    srn_server_cancel_who(srv);
+    g_queue_free(srv->who_queue);
+    srv->who_queue = NULL;
+}
+
+/**
+ * @brief ``srn_server_sync_who`` queues a WHO of given channel, the WHO is
+ * sent when no other WHO is waiting for reply.
+ *
+ * @param srv
+ * @param chat
+ */
+void srn_server_sync_who(SrnServer *srv, SrnChat *chat){
+    g_return_if_fail(srn_server_is_valid(srv));
+    g_return_if_fail(chat && chat->type == SRN_CHAT_TYPE_CHANNEL);
+
+    if (srv->who_chan && sirc_target_equal(srv->who_chan, chat->name)){
+        return;
+    }
+    for (GList *lst = srv->who_queue->head; lst; lst = g_list_next(lst)){
+        if (sirc_target_equal(lst->data, chat->name)){
+            return;
+        }
+    }
+    g_queue_push_tail(srv->who_queue, g_strdup(chat->name));
+
+    send_next_who(srv);
+}
+
+/**
+ * @brief ``srn_server_stage_who`` stages a RPL_WHOREPLY or RPL_WHOSPCRPL
+ * of the channel being synchronized.
+ *
+ * @param srv
+ * @param chan
+ * @param nick
+ * @param username
+ * @param hostname
+ * @param realname
+ * @param loginname "0" if user is not logged in, NULL if unknown
+ * @param flags Such as "H@", "G" means user is away
+ *
+ * @return FALSE if the reply is not requested by us
+ */
+bool srn_server_stage_who(SrnServer *srv, const char *chan, const char *nick,
+        const char *username, const char *hostname, const char *realname,
+        const char *loginname, const char *flags){
+    WhoReply *reply;
+
+    g_return_val_if_fail(srn_server_is_valid(srv), FALSE);
+
+    if (!srv->who_chan || !sirc_target_equal(srv->who_chan, chan)){
+        return FALSE;
+    }
+
+    reply = g_malloc0(sizeof(WhoReply));
+    reply->nick = g_strdup(nick);
+    reply->username = g_strdup(username);
+    reply->hostname = g_strdup(hostname);
+    reply->realname = g_strdup(realname);
+    if (loginname){
+        reply->has_loginname = TRUE;
+        if (strcmp(loginname, "0") != 0){
+            reply->loginname = g_strdup(loginname);
+        }
+    }
+    reply->is_away = flags && flags[0] == 'G';
+    srv->who_staging = g_list_prepend(srv->who_staging, reply);
+
+    return TRUE;
+}
+
+/**
+ * @brief ``srn_server_commit_who`` applies the staged replies to users in
+ * one batch when RPL_ENDOFWHO of the channel being synchronized arrives,
+ * then sends the next WHO.
+ *
+ * @param srv
+ * @param chan
+ *
+ * @return FALSE if the reply is not requested by us
+ */
+bool srn_server_commit_who(SrnServer *srv, const char *chan){
+    SrnChat *chat;
+
+    g_return_val_if_fail(srn_server_is_valid(srv), FALSE);
+
+    if (!srv->who_chan || !sirc_target_equal(srv->who_chan, chan)){
+        return FALSE;
+    }
+
+    // The channel may have been left before WHO is replied
+    chat = srn_server_get_chat(srv, srv->who_chan);
+    if (chat){
+        sui_freeze_user_list(chat->ui);
+    }
+    for (GList *lst = srv->who_staging; lst; lst = g_list_next(lst)){
+        WhoReply *reply;
+        SrnServerUser *srv_user;
+
+        reply = lst->data;
+        srv_user = srn_server_get_user(srv, reply->nick);
+        if (!srv_user){
+            continue;
+        }
+        // Setters update the user in all of its channels, skip unchanged
+        // fields like srn_chat_commit_names() does
+        if (g_strcmp0(srv_user->username, reply->username) != 0){
+            srn_server_user_set_username(srv_user, reply->username);
+        }
+        if (g_strcmp0(srv_user->hostname, reply->hostname) != 0){
+            srn_server_user_set_hostname(srv_user, reply->hostname);
+        }
+        if (g_strcmp0(srv_user->realname, reply->realname) != 0){
+            srn_server_user_set_realname(srv_user, reply->realname);
+        }
+        if (reply->has_loginname
+                && g_strcmp0(srv_user->loginname, reply->loginname) != 0){
+            srn_server_user_set_loginname(srv_user, reply->loginname);
+        }
+        srn_server_user_set_is_away(srv_user, reply->is_away);
+    }
+    if (chat){
+        sui_thaw_user_list(chat->ui);
+    }
+
+    finish_who(srv);
+    send_next_who(srv);
+
+    return TRUE;
+}
+
+/**
+ * @brief ``srn_server_abort_who`` gives up the WHO waiting for reply and
+ * sends the next one, it is called when RPL_ENDOFWHO will never arrive,
+ * such as the WHO is rejected by an error numeric or RPL_TRYAGAIN.
+ *
+ * @param srv
+ * @param target Target of the error numeric, NULL matches any WHO
+ *
+ * @return FALSE if no WHO of the target is waiting for reply
+ */
+bool srn_server_abort_who(SrnServer *srv, const char *target){
+    g_return_val_if_fail(srn_server_is_valid(srv), FALSE);
+
+    if (!srv->who_chan){
+        return FALSE;
+    }
+    if (target && !sirc_target_equal(srv->who_chan, target)){
+        return FALSE;
+    }
+
+    WARN_FR("WHO of %s is not replied, give up", srv->who_chan);
+    finish_who(srv);
+    send_next_who(srv);
+
+    return TRUE;
+}
+
+/**
+ * @brief ``srn_server_cancel_who`` drops all queued WHOs, it is called when
+ * server is disconnected.
+ *
+ * @param srv
+ */
+void srn_server_cancel_who(SrnServer *srv){
+    g_return_if_fail(srv);
+
+    g_queue_foreach(srv->who_queue, (GFunc)g_free, NULL);
+    g_queue_clear(srv->who_queue);
+    finish_who(srv);
+}
+
+static void send_next_who(SrnServer *srv){
+    GList *next;
+    SrnRet ret;
+
+    if (srv->who_chan){
+        // Wait for RPL_ENDOFWHO
+        return;
+    }
+
+    // The visible channel goes first
+    for (next = srv->who_queue->head; next; next = g_list_next(next)){
+        if (srv->cur_chat && sirc_target_equal(next->data, srv->cur_chat->name)){
+            break;
+        }
+    }
+    if (!next){
+        next = srv->who_queue->head;
+    }
+    if (!next){
+        return;
+    }
+    srv->who_chan = next->data;
+    g_queue_delete_link(srv->who_queue, next);
+
+    if (!srn_server_get_chat(srv, srv->who_chan)){
+        // Channel has been left
+        str_assign(&srv->who_chan, NULL);
+        send_next_who(srv);
+        return;
+    }
+
+    if (srv->whox){
+        ret = sirc_cmd_who(srv->irc, srv->who_chan,
+                "%" WHOX_FIELDS "," SRN_SERVER_WHOX_TOKEN);
+    } else {
+        ret = sirc_cmd_who(srv->irc, srv->who_chan, NULL);
+    }
+    if (!RET_IS_OK(ret)){
+        WARN_FR("Failed to send WHO of %s: %s", srv->who_chan, RET_MSG(ret));
+        str_assign(&srv->who_chan, NULL);
+        return;
+    }
+
+    srv->who_timer = g_timeout_add(SRN_SERVER_WHO_TIMEOUT, who_timeout_cb, srv);
+}
+
+/**
+ * @brief Drop the staged replies and forget the WHO waiting for reply.
+ */
+static void finish_who(SrnServer *srv){
+    if (srv->who_timer){
+        g_source_remove(srv->who_timer);
+        srv->who_timer = 0;
+    }
+    g_list_free_full(srv->who_staging, (GDestroyNotify)who_reply_free);
+    srv->who_staging = NULL;
+    str_assign(&srv->who_chan, NULL);
+}
+
+static gboolean who_timeout_cb(gpointer user_data){
+    SrnServer *srv;
+
+    srv = user_data;
+    // Source is removed by returning G_SOURCE_REMOVE
+    srv->who_timer = 0;
+    srn_server_abort_who(srv, NULL);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void who_reply_free(WhoReply *reply){
+    g_free(reply->nick);
+    g_free(reply->username);
+    g_free(reply->hostname);
+    g_free(reply->realname);
+    g_free(reply->loginname);
+    g_free(reply);
+}
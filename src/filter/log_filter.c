@@ -32,56 +32,73 @@
 #include "srain.h"
 #include "log.h"
 #include "i18n.h"
-#include "path.h"
+#include "chat_log.h"
 
 #include "./filter2.h"
 
+static void init(void);
 static bool filter(const SrnMessage *msg);
+static void finalize(void);
 
 /**
  * @brief log_filter is a filter module for recording chat log.
  */
 SrnMessageFilter log_filter = {
     .name = "log",
+    .init = init,
     .filter = filter,
+    .finalize = finalize,
 };
 
-bool filter(const SrnMessage *msg) {
-    char *date_str;
-    char *msg_str;
-    FILE *fp;
-    char *file;
-    GString *basename;
-
-    date_str = g_date_time_format(msg->time, "%F");
-    g_return_val_if_fail(date_str, TRUE);
-
-    basename = g_string_new("");
-    g_string_append_printf(basename, "%s.%s.log", date_str, msg->chat->name);
-    file = srn_create_log_file(msg->chat->srv->name, basename->str);
+static void init(void){
+    srn_chat_log_init();
+    srn_chat_log_index_init();
+    srn_chat_log_compress_init();
+}
 
-    if (!file){
-        ERR_FR("Failed to create log file");
-        goto cleanup1;
-    }
+bool filter(const SrnMessage *msg) {
+    const char *sender;
+    SrnChatLogMessageType type;
 
-    fp = fopen(file, "a+");
-    if (!fp){
-        ERR_FR("Failed to open file '%s'", file);
-        goto cleanup2;
+    if (msg->history){
+        // Old messages are already logged or out of order
+        return TRUE;
     }
 
-    msg_str = srn_message_to_string(msg);
-    if (msg_str){
-        fprintf(fp, "%s\n", msg_str);
-        g_free(msg_str);
+    sender = NULL;
+    switch (msg->type){
+        case SRN_MESSAGE_TYPE_SENT:
+            type = SRN_CHAT_LOG_MESSAGE_TYPE_SENT;
+            sender = msg->sender->srv_user->nick;
+            break;
+        case SRN_MESSAGE_TYPE_RECV:
+        case SRN_MESSAGE_TYPE_NOTICE:
+            type = SRN_CHAT_LOG_MESSAGE_TYPE_RECV;
+            sender = msg->sender->srv_user->nick;
+            break;
+        case SRN_MESSAGE_TYPE_ACTION:
+            type = SRN_CHAT_LOG_MESSAGE_TYPE_ACTION;
+            sender = msg->sender->srv_user->nick;
+            break;
+        case SRN_MESSAGE_TYPE_MISC:
+            type = SRN_CHAT_LOG_MESSAGE_TYPE_MISC;
+            break;
+        case SRN_MESSAGE_TYPE_ERROR:
+            type = SRN_CHAT_LOG_MESSAGE_TYPE_ERROR;
+            break;
+        default:
+            return TRUE;
     }
 
-    fclose(fp);
-cleanup2:
-    g_free(file);
-cleanup1:
-    g_string_free(basename, TRUE);
+    // Formatting and writing happen in writer thread
+    srn_chat_log_log(msg->chat->srv->name, msg->chat->name, type, msg->time,
+            sender, msg->content);
 
     return TRUE; // Always TRUE
 }
+
+static void finalize(void){
+    srn_chat_log_compress_finalize();
+    srn_chat_log_index_finalize();
+    srn_chat_log_finalize();
+}
@@ -19,7 +19,94 @@
 #ifndef __CHAT_LOG_H
 #define __CHAT_LOG_H
 
-void srn_chat_log_log(const char *srv_name, const char *chan_name, const char *msg);
-void srn_chat_log_fmt(const char *srv_name, const char *chan_name, const char *fmt, ...);
+#include <glib.h>
+
+#include "srain.h"
+#include "ret.h"
+
+typedef enum _SrnChatLogMessageType SrnChatLogMessageType;
+typedef enum _SrnChatLogOverflowPolicy SrnChatLogOverflowPolicy;
+typedef enum _SrnChatLogFormat SrnChatLogFormat;
+typedef struct _SrnChatLogConfig SrnChatLogConfig;
+typedef struct _SrnChatLogEntry SrnChatLogEntry;
+typedef struct _SrnChatLogReader SrnChatLogReader;
+typedef struct _SrnChatLogSearchResult SrnChatLogSearchResult;
+typedef struct _SrnChatLogDiskUsage SrnChatLogDiskUsage;
+
+enum _SrnChatLogMessageType {
+    SRN_CHAT_LOG_MESSAGE_TYPE_RECV,
+    SRN_CHAT_LOG_MESSAGE_TYPE_SENT,
+    SRN_CHAT_LOG_MESSAGE_TYPE_ACTION,
+    SRN_CHAT_LOG_MESSAGE_TYPE_MISC,
+    SRN_CHAT_LOG_MESSAGE_TYPE_ERROR,
+};
+
+enum _SrnChatLogOverflowPolicy {
+    SRN_CHAT_LOG_OVERFLOW_POLICY_BLOCK, // Wait until queue has free space
+    SRN_CHAT_LOG_OVERFLOW_POLICY_DROP,  // Drop the message and count it
+};
+
+enum _SrnChatLogFormat {
+    SRN_CHAT_LOG_FORMAT_TEXT,   // Human readable plain text
+    SRN_CHAT_LOG_FORMAT_BINARY, // Indexed binary records, see chat_log_binary.h
+};
+
+struct _SrnChatLogConfig {
+    int queue_size;
+    SrnChatLogOverflowPolicy overflow_policy;
+    SrnChatLogFormat format;
+    int compress_after; // In days, 0 means never
+};
+
+struct _SrnChatLogEntry {
+    SrnChatLogMessageType type;
+    gint64 time; // Unix time
+    gint32 utc_offset; // In seconds
+    char *sender; // NULL if the message has no sender
+    char *content;
+};
+
+struct _SrnChatLogSearchResult {
+    char *chat_name;
+    SrnChatLogEntry entry;
+};
+
+struct _SrnChatLogDiskUsage {
+    char *srv_name;
+    guint64 size; // Bytes used on disk
+    guint64 original_size; // Bytes before compression
+    int file_count;
+    int compressed_file_count;
+};
+
+void srn_chat_log_init(void);
+void srn_chat_log_finalize(void);
+void srn_chat_log_set_config(SrnChatLogConfig *cfg);
+
+void srn_chat_log_log(const char *srv_name, const char *chat_name, SrnChatLogMessageType type, gint64 time, const char *sender, const char *content);
+void srn_chat_log_flush(void);
+void srn_chat_log_close(const char *srv_name, const char *chat_name);
+
+SrnRet srn_chat_log_overflow_policy_from_string(const char *str, SrnChatLogOverflowPolicy *policy);
+SrnRet srn_chat_log_format_from_string(const char *str, SrnChatLogFormat *format);
+
+SrnChatLogReader* srn_chat_log_reader_new(const char *path, GError **error);
+void srn_chat_log_reader_free(SrnChatLogReader *reader);
+GList* srn_chat_log_reader_get_last(SrnChatLogReader *reader, gint64 before, int count);
+GList* srn_chat_log_get_history(const char *srv_name, const char *chat_name, gint64 before, int count);
+void srn_chat_log_entry_free(SrnChatLogEntry *entry);
+
+void srn_chat_log_index_init(void);
+void srn_chat_log_index_finalize(void);
+void srn_chat_log_index_update(void);
+bool srn_chat_log_index_sync(gint64 timeout);
+GList* srn_chat_log_search(const char *srv_name, const char *chat_name, const char *query, int limit, GError **error);
+void srn_chat_log_search_result_free(SrnChatLogSearchResult *result);
+
+void srn_chat_log_compress_init(void);
+void srn_chat_log_compress_finalize(void);
+void srn_chat_log_compress_set_config(SrnChatLogConfig *cfg);
+GList* srn_chat_log_get_disk_usage(void);
+void srn_chat_log_disk_usage_free(SrnChatLogDiskUsage *usage);
 
 #endif /* __CHAT_LOG_H */
@@ -28,6 +28,7 @@
 #include "log.h"
 #include "pattern_set.h"
 #include "command.h"
+#include "chat_log.h"
 
 #ifndef __IN_CORE_H
 	#error This file should not be included directly, include just core.h
@@ -65,6 +66,7 @@ struct _SrnApplicationConfig {
     bool prompt_on_quit; // TODO
     char *id;
     GList *auto_connect_srv_list;
+    SrnChatLogConfig chat_log;
 
     SuiApplicationConfig *ui;
 };
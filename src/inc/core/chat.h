@@ -50,13 +50,35 @@ struct _SrnChat {
     char *name;
     SrnChatType type;
     bool is_joined;
+    bool is_stale; // Unjoined by disconnection, user list is kept
 
     SrnChatUser *user;  // Yourself
     SrnChatUser *_user; // Hold all messages that do not belong other any user
     GList *user_list;  // List of SrnChatUser
+    GHashTable *names_staging; // Staging set of NAMES reply,
+                               // nick → SrnChatUserType
 
     GList *msg_list;
     SrnMessage *last_msg;
+    GList *batch_msg_list; // SuiMessages of playback batch, in reversed order,
+                           // added to UI when batch ends
+    char *batch_ref; // Reference of the playback batch which messages in
+                     // batch_msg_list belong to
+
+    /* Messages restored from chat log and server (IRCv3 chathistory) */
+    GCancellable *history_cancel;
+    GList *history; // List of SrnChatLogEntry, rendered when chat is shown
+    GList *history_msg_list; // SrnMessages received from server in reversed
+                             // order, rendered when chat is shown
+    char *history_page_msgid; // Msgid of the oldest one of history_msg_list
+    gint64 history_before; // Unix time of the oldest shown message
+    char *history_msgid; // Msgid of the oldest shown message, possibly NULL
+    bool history_fetched; // The latest messages have been requested
+    bool history_pending; // A CHATHISTORY request is in flight
+    char *history_label; // Label of the request in flight, NULL if
+                         // labeled-response is not supported
+    char *history_batch; // Reference of the batch replying the request
+    bool history_complete; // No more messages on server
 
     /* Used by Filters & Decorators */
     GList *ignore_regex_list;
@@ -72,6 +94,7 @@ struct _SrnChat {
 struct _SrnChatConfig {
     bool log; // TODO
     bool render_mirc_color;
+    int history_size; // Number of messages restored from chat log
     char *password;
     GList *auto_run_cmd_list;
 
@@ -108,6 +131,13 @@ SrnChat* srn_chat_new(SrnServer *srv, const char *name, SrnChatType type, SrnCha
 void srn_chat_free(SrnChat *chat);
 void srn_chat_set_config(SrnChat *chat, SrnChatConfig *cfg);
 void srn_chat_set_is_joined(SrnChat *chat, bool joined);
+void srn_chat_mark_stale(SrnChat *chat);
+void srn_chat_stage_names_user(SrnChat *chat, const char *nick, SrnChatUserType type);
+void srn_chat_commit_names(SrnChat *chat);
+void srn_chat_show_history(SrnChat *chat);
+void srn_chat_fetch_history(SrnChat *chat);
+void srn_chat_end_history(SrnChat *chat);
+bool srn_chat_is_history_batch(SrnChat *chat, const SircBatch *batch);
 SrnRet srn_chat_run_command(SrnChat *chat, const char *cmd);
 GList* srn_chat_complete_command(SrnChat *chat, const char *cmd);
 SrnRet srn_chat_add_user(SrnChat *chat, SrnServerUser *srv_user);
@@ -115,6 +145,8 @@ SrnRet srn_chat_rm_user(SrnChat *chat, SrnChatUser *user);
 SrnChatUser* srn_chat_get_user(SrnChat *chat, const char *nick);
 SrnChatUser* srn_chat_add_and_get_user(SrnChat *chat, SrnServerUser *srv_user);
 void srn_chat_add_sent_message(SrnChat *chat, const char *content, const SircMessageContext *context);
+SrnMessage* srn_chat_add_provisional_message(SrnChat *chat, SrnMessageType type, const char *content, const SircMessageContext *context);
+void srn_chat_confirm_message(SrnChat *chat, SrnMessage *msg, bool accepted);
 void srn_chat_add_recv_message(SrnChat *chat, SrnChatUser *user, const char *content, const SircMessageContext *context);
 void srn_chat_add_action_message(SrnChat *chat, SrnChatUser *user, const char *content, const SircMessageContext *context);
 void srn_chat_add_notice_message(SrnChat *chat, SrnChatUser *user, const char *content, const SircMessageContext *context);
@@ -126,6 +158,7 @@ void srn_chat_add_error_message(SrnChat *self, const char *content, const SircMe
 void srn_chat_add_error_message_fmt(SrnChat *self, const SircMessageContext *context, const char *fmt, ...);
 void srn_chat_add_error_message_with_user(SrnChat *chat, SrnChatUser *user, const char *content, const SircMessageContext *context);
 void srn_chat_add_error_message_with_user_fmt(SrnChat *chat, SrnChatUser *user, const SircMessageContext *context, const char *fmt, ...);
+void srn_chat_end_batch(SrnChat *self);
 void srn_chat_set_topic(SrnChat *chat, SrnChatUser *user, const char *topic, const SircMessageContext *context);
 void srn_chat_set_topic_setter(SrnChat *chat, const char *setter);
 
@@ -40,24 +40,32 @@ enum _SrnMessageType {
     SRN_MESSAGE_TYPE_ERROR,
 };
 
+/* Lots of messages are kept in memory, keep it small */
 struct _SrnMessage {
     SrnChat *chat;
     SrnChatUser *sender; // Sender of this message
-    SrnMessageType type;
 
     /* Raw message */
     char *content;  // Raw message content
-    GDateTime *time; // Local time when creating message
+    gint64 time; // Unix time when creating message
 
-    /* NOTE: All rendered_xxx fields MUST be valid XML and never be NULL */
-    char *rendered_sender; // Sender name
-    char *rendered_remark; // Message remark
-    char *rendered_content; // Rendered message content in
-    char *rendered_short_time; // Short format message time
-    char *rendered_full_time;  // Full format messsage time
-    GList *urls; // URLs in message, like "http://xxx", "irc://xxx"
+    /* NOTE: All rendered_xxx fields MUST be valid XML.
+     * Sender, remark and time are shared among messages and freed with the
+     * last message using them, use srn_message_set_rendered_xxx() to set. */
+    const char *rendered_sender; // Sender name, never be NULL
+    const char *rendered_remark; // Message remark, can be NULL
+    const char *rendered_time; // Overrides the short format time, can be NULL
+    char *rendered_content; // Rendered message content, never be NULL
+    char **urls; // NULL terminated URLs in message, like "http://xxx",
+                 // "irc://xxx", NULL if there is no URL
 
-    bool mentioned; // Whether this message should be mentioned
+    SrnMessageType type;
+    bool mentioned: 1; // Whether this message should be mentioned
+    bool history: 1; // Whether this message is restored from chat log or
+                     // received from server history
+    bool pending: 1; // Whether this message is sent but not yet accepted
+                     // by server
+    bool rejected: 1; // Whether this message is rejected by server
 
     SuiMessage *ui;
 };
@@ -66,5 +74,11 @@ SrnMessage* srn_message_new(SrnChat *chat, SrnChatUser *user, const char *conten
         SrnMessageType type, const SircMessageContext *context);
 void srn_message_free(SrnMessage *msg);
 char* srn_message_to_string(const SrnMessage *self);
+const char* srn_message_get_short_time(const SrnMessage *self);
+char* srn_message_get_full_time(const SrnMessage *self);
+void srn_message_add_url(SrnMessage *self, char *url);
+void srn_message_set_rendered_sender(SrnMessage *self, const char *markup);
+void srn_message_set_rendered_remark(SrnMessage *self, const char *markup);
+void srn_message_set_rendered_time(SrnMessage *self, const char *markup);
 
 #endif /* __MESSAGE_H */
@@ -35,6 +35,13 @@
 #define SRN_SERVER_PING_TIMEOUT     (SRN_SERVER_PING_INTERVAL * 2)
 #define SRN_SERVER_RECONN_INTERVAL  (5 * 1000)
 #define SRN_SERVER_RECONN_STEP      SRN_SERVER_RECONN_INTERVAL
+#define SRN_SERVER_ISON_INTERVAL    (60 * 1000)
+#define SRN_SERVER_STALE_TIMEOUT    (60 * 1000) // Max time to wait for rejoining
+#define SRN_SERVER_WHO_TIMEOUT      (30 * 1000) // Max time to wait for RPL_ENDOFWHO
+#define SRN_SERVER_MAX_LINE_LEN     510 // Max length of IRC line without CRLF
+#define SRN_SERVER_PREFIX_MODES     "qaohv" // Default PREFIX of RPL_ISUPPORT
+#define SRN_SERVER_PREFIX_SYMBOLS   "~&@%+"
+#define SRN_SERVER_WHOX_TOKEN       "616" // Query type of our WHOX
 
 typedef struct _SrnServerUser SrnServerUser;
 typedef struct _SrnServerAddr SrnServerAddr;
@@ -47,6 +54,7 @@ typedef struct _SrnUserConfig SrnUserConfig;
 typedef struct _SrnServerConfig SrnServerConfig;
 typedef struct _EnabledCap EnabledCap;
 typedef struct _SrnServerCap SrnServerCap;
+typedef struct _SrnServerRequest SrnServerRequest;
 
 #include "chat.h"
 
@@ -113,6 +121,44 @@ struct _SrnServer {
     unsigned long reconn_interval;  // Interval of next reconnect, in ms
     int ping_timer;
     int reconn_timer;
+    int rejoin_timer;               // Rejoin channels when login is timeout
+    int stale_timer;                // Drop users of stale channels when
+                                    // rejoining is timeout
+
+    /* Server features, see RPL_ISUPPORT */
+    GHashTable *targmax;    // Upper case command → max number of targets,
+                            // 0 means no limit
+    int chanlimit;          // Max number of joined channels, 0 means unknown
+    int chathistory;        // Max number of messages per CHATHISTORY request,
+                            // 0 means no limit
+    char *prefix_modes;     // Channel modes which have a nick prefix, from
+                            // the highest to lowest, such as "qaohv"
+    char *prefix_symbols;   // Prefixes of above modes, such as "~&@%+"
+    bool whox;              // Server supports WHOX
+    int monitor;            // Max number of MONITOR targets, 0 means no
+                            // limit, -1 if MONITOR is not supported
+
+    GHashTable *netsplits;  // Reference of netsplit/netjoin batch →
+                            // (chat name → number of affected users)
+
+    /* Labeled commands, see srn_server_begin_request() */
+    GHashTable *requests;   // Label → SrnServerRequest, not yet replied
+    SrnServerRequest *cur_request; // Request whose commands are being sent
+    unsigned long last_label;
+
+    /* Background WHO of channel members, see srn_server_sync_who() */
+    GQueue *who_queue;      // Names of channels waiting for WHO
+    char *who_chan;         // Channel whose WHO is waiting for reply
+    int who_timer;          // Give up who_chan if it is not replied in time
+    GList *who_staging;     // Staged replies of who_chan
+
+    /* Online state of dialog peers and watched nicks, see
+     * srn_server_monitor_user() */
+    GList *monitor_list;    // Nicks being monitored
+    bool monitoring;        // Monitor list has been sent or being polled
+    int ison_timer;         // Poll by ISON if MONITOR is not supported
+    int ison_offset;        // Index of nick to be polled in next ISON
+    char **ison_query;      // Nicks of the ISON waiting for reply
 
     SrnServerCap *cap;      // Server capabilities
 
@@ -141,6 +187,7 @@ struct _SrnLoginConfig {
 
     char *password;
     char *cert_file;
+    int timeout; // Seconds to wait for NickServ login before rejoining
     // ...
 };
 
@@ -168,6 +215,7 @@ struct _SrnServerConfig {
     char *password;
     GList *auto_join_chat_list;
     GList *auto_run_cmd_list; // List of autorun commands
+    GList *watch_list; // List of nicks whose presence are notified
 
     /* SrnServerUser */
     SrnUserConfig *user;
@@ -188,6 +236,10 @@ struct _EnabledCap {
     bool cap_notify;
     bool chghost;
     bool invite_notify;
+    bool batch;
+    bool chathistory;
+    bool echo_message;
+    bool labeled_response;
 
     // Vendor-Specific
     bool znc_server_time_iso;
@@ -202,6 +254,14 @@ struct _SrnServerCap {
     SrnServer *srv;
 };
 
+struct _SrnServerRequest {
+    char *label;
+    SrnChat *chat;      // Chat where the command is sent from
+    SrnMessage *msg;    // Provisional message waiting for echo, possibly NULL
+    int pending;        // Number of commands not yet replied
+    bool rejected;      // Any of commands is rejected by server
+};
+
 SrnServer* srn_server_new(const char *name, SrnServerConfig *cfg);
 void srn_server_free(SrnServer *srv);
 SrnRet srn_server_quit(SrnServer *srv, const char *reason);
@@ -225,6 +285,10 @@ SrnRet srn_server_rm_user(SrnServer *srv, SrnServerUser *user);
 SrnServerUser* srn_server_get_user(SrnServer *srv, const char *nick);
 SrnServerUser* srn_server_add_and_get_user(SrnServer *srv, const char *nick);
 SrnRet srn_server_rename_user(SrnServer *srv, SrnServerUser *user, const char *nick);
+void srn_server_set_isupport(SrnServer *srv, const char *key, const char *value);
+void srn_server_reset_isupport(SrnServer *srv);
+int srn_server_get_targmax(SrnServer *srv, const char *cmd);
+int srn_server_parse_prefix(SrnServer *srv, const char *name, SrnChatUserType *type);
 
 SrnServerUser *srn_server_user_new(SrnServer *srv, const char *nick);
 SrnServerUser *srn_server_user_ref(SrnServerUser *user);
@@ -233,8 +297,10 @@ void srn_server_user_set_nick(SrnServerUser *user, const char *nick);
 void srn_server_user_set_username(SrnServerUser *user, const char *username);
 void srn_server_user_set_hostname(SrnServerUser *user, const char *hostname);
 void srn_server_user_set_realname(SrnServerUser *user, const char *realname);
+void srn_server_user_set_loginname(SrnServerUser *user, const char *loginname);
 void srn_server_user_set_is_me(SrnServerUser *user, bool me);
 void srn_server_user_set_is_online(SrnServerUser *user, bool online);
+void srn_server_user_set_is_away(SrnServerUser *user, bool away);
 void srn_server_user_set_is_ignored(SrnServerUser *user, bool ignored);
 SrnRet srn_server_user_attach_chat_user(SrnServerUser *user, SrnChatUser *chat_user);
 SrnRet srn_server_user_detach_chat_user(SrnServerUser *user, SrnChatUser *chat_user);
@@ -271,4 +337,35 @@ bool srn_server_cap_all_enabled(SrnServerCap *scap);
 bool srn_server_cap_is_support(SrnServerCap *scap, const char *name, const char *value);
 char* srn_server_cap_dump(SrnServerCap *scap);
 
+void srn_server_init_requests(SrnServer *srv);
+void srn_server_finalize_requests(SrnServer *srv);
+SrnServerRequest* srn_server_begin_request(SrnServer *srv, SrnChat *chat);
+void srn_server_end_request(SrnServer *srv);
+SrnServerRequest* srn_server_get_request(SrnServer *srv, const char *label);
+void srn_server_reject_request(SrnServer *srv, const char *label);
+void srn_server_finish_request(SrnServer *srv, const char *label);
+void srn_server_cancel_requests(SrnServer *srv, SrnChat *chat);
+
+void srn_server_init_who(SrnServer *srv);
+void srn_server_finalize_who(SrnServer *srv);
+void srn_server_sync_who(SrnServer *srv, SrnChat *chat);
+bool srn_server_stage_who(SrnServer *srv, const char *chan, const char *nick,
+        const char *username, const char *hostname, const char *realname,
+        const char *loginname, const char *flags);
+bool srn_server_commit_who(SrnServer *srv, const char *chan);
+bool srn_server_abort_who(SrnServer *srv, const char *target);
+void srn_server_cancel_who(SrnServer *srv);
+
+void srn_server_init_monitor(SrnServer *srv);
+void srn_server_finalize_monitor(SrnServer *srv);
+void srn_server_start_monitor(SrnServer *srv);
+void srn_server_stop_monitor(SrnServer *srv);
+void srn_server_monitor_user(SrnServer *srv, const char *nick);
+void srn_server_unmonitor_user(SrnServer *srv, const char *nick);
+bool srn_server_is_monitored(SrnServer *srv, const char *nick);
+void srn_server_set_presence(SrnServer *srv, const char *nick, bool online,
+        const SircMessageContext *context);
+void srn_server_finish_ison(SrnServer *srv, const char *nicks,
+        const SircMessageContext *context);
+
 #endif /* __SERVER_H */
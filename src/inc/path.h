@@ -26,6 +26,8 @@ char *srn_get_theme_file(const char *fname);
 char *srn_get_user_config_file();
 char *srn_get_system_config_file();
 char *srn_create_log_file(const char *srv_name, const char *fname);
+char *srn_get_log_dir();
+char *srn_create_cache_dir(const char *name);
 SrnRet srn_create_user_file();
 char *srn_get_executable_path();
 char *srn_get_executable_dir();
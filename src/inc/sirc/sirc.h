@@ -53,5 +53,13 @@ GIOStream* sirc_get_stream(SircSession *sirc);
 SircEvents* sirc_get_events(SircSession *sirc);
 void* sirc_get_ctx(SircSession *sirc);
 void sirc_set_ctx(SircSession *sirc, void *ctx);
+void sirc_set_prefix_len(SircSession *sirc, int prefix_len);
+int sirc_get_prefix_len(SircSession *sirc);
+void sirc_add_batch(SircSession *sirc, SircBatch *batch);
+SircBatch* sirc_get_batch(SircSession *sirc, const char *ref);
+void sirc_remove_batch(SircSession *sirc, const char *ref);
+void sirc_begin_label(SircSession *sirc, const char *label);
+int sirc_end_label(SircSession *sirc);
+char* sirc_new_label(SircSession *sirc);
 
 #endif /* __IRC_H */
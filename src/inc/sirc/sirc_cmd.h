@@ -34,7 +34,11 @@ int sirc_cmd_quit(SircSession *sirc, const char *reason);
 int sirc_cmd_topic(SircSession *sirc, const char *chan, const char *topic);
 int sirc_cmd_action(SircSession *sirc, const char *target, const char *msg);
 int sirc_cmd_msg(SircSession *sirc, const char *target, const char *msg);
+int sirc_cmd_msg_multi(SircSession *sirc, const char *cmd, const char **targets, int max_targets, const char *msg);
 int sirc_cmd_whois(SircSession *sirc, const char *nick);
+int sirc_cmd_who(SircSession *sirc, const char *mask, const char *options);
+int sirc_cmd_ison(SircSession *sirc, const char *nicks);
+int sirc_cmd_monitor(SircSession *sirc, char op, const char *targets);
 int sirc_cmd_names(SircSession *sirc, const char *chan);
 int sirc_cmd_invite(SircSession *sirc, const char *nick, const char *chan);
 int sirc_cmd_kick(SircSession *sirc, const char *nick, const char *chan, const char *reason);
@@ -49,6 +53,7 @@ int sirc_cmd_cap_req(SircSession *sirc, const char *caps);
 int sirc_cmd_cap_end(SircSession *sirc);
 int sirc_cmd_authenticate(SircSession *sirc, const char *msg);
 int sirc_cmd_away(SircSession *sirc, const char *msg);
+int sirc_cmd_chathistory(SircSession *sirc, const char *subcmd, const char *target, const char *ref, int limit);
 int sirc_cmd_raw(SircSession *sirc, const char *fmt, ...);
 
 #endif /* __IRC_CMD_H */
@@ -24,16 +24,50 @@
 #include <glib.h>
 
 typedef struct _SircMessageContext SircMessageContext;
+typedef struct _SircBatch SircBatch;
+
+/* IRCv3 batch, see https://ircv3.net/specs/extensions/batch */
+struct _SircBatch {
+    char *ref;          // Reference tag, without the leading "+" or "-"
+    char *type;
+    char **params;      // NULL-terminated additional parameters
+    SircBatch *parent;  // Outer batch, possibly NULL
+    char *label;        // Label of the command replied by the batch,
+                        // possibly NULL
+};
+
+/* Context is small enough to be allocated on stack, initialize it by
+ * sirc_message_context_init() */
+struct _SircMessageContext {
+    gint64 time; // Unix time in microseconds
+    const SircBatch *batch; // Batch the message belongs to, possibly NULL
+    const char *msgid; // Value of "msgid" tag, possibly NULL, only valid
+                       // during the event callback
+    const char *label; // Label of the command which the message replies to,
+                       // possibly NULL, only valid during the event callback
+    const char *user; // User and host of message origin, possibly NULL,
+    const char *host; // only valid during the event callback
+};
 
 /*
- * @param time The original timestamp of the message. Defaults to now if NULL.
+ * @param time The original timestamp of the message in microseconds since
+ *      Unix epoch. Defaults to now if 0.
  */
-SircMessageContext* sirc_message_context_new(GDateTime* time);
+SircMessageContext* sirc_message_context_new(gint64 time);
+void sirc_message_context_init(SircMessageContext *context, gint64 time);
 void sirc_message_context_free(SircMessageContext *context);
 
-/* Server-provided "time" tag if any, or the time the message was received/sent.
- * Never returns NULL. */
-GDateTime* sirc_message_context_get_time(const SircMessageContext *context);
+/* Server-provided "time" tag if any, or the time the message was received/sent,
+ * in microseconds since Unix epoch. */
+gint64 sirc_message_context_get_time(const SircMessageContext *context);
+
+/* Innermost batch of given type the message belongs to, or NULL. */
+const SircBatch* sirc_message_context_get_batch(const SircMessageContext *context,
+        const char *type);
+
+SircBatch* sirc_batch_new(const char *ref, const char *type,
+        const char **params, int count);
+void sirc_batch_free(SircBatch *batch);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(SircMessageContext, sirc_message_context_free)
 
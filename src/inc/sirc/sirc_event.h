@@ -53,6 +53,9 @@ typedef struct {
     SircEventCallback           tagmsg;
     SircEventCallback           channel_notice;
     SircEventCallback           invite;
+    SircEventCallback           away;
+    SircEventCallback           account;
+    SircEventCallback           chghost;
     SircEventCallback           ctcp_req;
     SircEventCallback           ctcp_rsp;
     SircEventCallback           cap;
@@ -63,6 +66,8 @@ typedef struct {
     SircEventCallback           fail;
     SircEventCallback           warn;
     SircEventCallback           note;
+    SircEventCallback           batch;
+    SircSimpleEventCallback     reply; // Response of a labeled command ends
     SircEventCallback           unknown;
 
     SircNumericEventCallback    numeric;
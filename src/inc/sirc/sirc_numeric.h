@@ -1257,6 +1257,16 @@
 #define SIRC_RFC_RPL_WHOISHOST 378
 #define SIRC_RFC_RPL_WHOISSECURE 671
 #define SIRC_RFC_RPL_TOPICWHOTIME 333
+#define SIRC_RFC_RPL_WHOSPCRPL 354
+#define SIRC_RFC_RPL_VISIBLEHOST 396
+#define SIRC_RFC_ERR_TOOMANYMATCHES 416
+
+/* MONITOR related */
+#define SIRC_RFC_RPL_MONONLINE 730
+#define SIRC_RFC_RPL_MONOFFLINE 731
+#define SIRC_RFC_RPL_MONLIST 732
+#define SIRC_RFC_RPL_ENDOFMONLIST 733
+#define SIRC_RFC_ERR_MONLISTFULL 734
 
 /* SASL related */
 #define SIRC_RFC_RPL_LOGGEDIN 900
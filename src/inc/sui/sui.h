@@ -68,6 +68,8 @@ void sui_activate_buffer(SuiBuffer *buf);
 void* sui_buffer_get_ctx(SuiBuffer *buf);
 void sui_buffer_set_config(SuiBuffer *buf, SuiBufferConfig *cfg);
 void sui_buffer_add_message(SuiBuffer *buf, SuiMessage *msg);
+void sui_buffer_add_messages(SuiBuffer *buf, GList *msgs);
+void sui_buffer_prepend_message(SuiBuffer *buf, SuiMessage *msg);
 void sui_buffer_clear_message(SuiBuffer *buf);
 
 /* SuiMessage */
@@ -84,10 +86,14 @@ void sui_free_user(SuiUser *user);
 void sui_add_user(SuiBuffer *buf, SuiUser *user);
 void sui_rm_user(SuiBuffer *buf, SuiUser *user);
 void sui_update_user(SuiBuffer *buf, SuiUser *user);
+void sui_touch_user(SuiBuffer *buf, SuiUser *user);
+void sui_freeze_user_list(SuiBuffer *buf);
+void sui_thaw_user_list(SuiBuffer *buf);
 
 /* Misc */
 void sui_set_topic(SuiBuffer *sui, const char *topic);
 void sui_set_topic_setter(SuiBuffer *sui, const char *setter);
+void sui_set_online(SuiBuffer *sui, bool online);
 void sui_message_box(const char *title, const char *msg);
 
 void sui_chan_list_start(SuiBuffer *sui);
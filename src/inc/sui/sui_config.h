@@ -30,6 +30,7 @@ typedef struct _SuiApplicationConfig SuiApplicationConfig;
 typedef struct _SuiApplicationOptions SuiApplicationOptions;
 typedef struct _SuiWindowConfig SuiWindowConfig;
 typedef struct _SuiBufferConfig SuiBufferConfig;
+typedef struct _SuiUrlPreviewCacheConfig SuiUrlPreviewCacheConfig;
 
 struct _SuiWindowConfig {
     bool csd;
@@ -38,10 +39,16 @@ struct _SuiWindowConfig {
     bool server_visibility;
 };
 
+struct _SuiUrlPreviewCacheConfig {
+    int memory_size; // In MiB
+    int disk_size; // In MiB, 0 means disk cache is disabled
+};
+
 struct _SuiApplicationConfig {
     char *theme;
 
     SuiWindowConfig window;
+    SuiUrlPreviewCacheConfig preview_cache;
 };
 
 // NOTE: SuiApplicationOptions is different from SuiApplicationConfig,
@@ -52,6 +52,7 @@ typedef enum {
     SUI_EVENT_SERVER_LIST,
     SUI_EVENT_CHAN_LIST,
     SUI_EVENT_RECONNECT,
+    SUI_EVENT_HISTORY,
     SUI_EVENT_UNKNOWN,
 } SuiEvent;
 
@@ -87,6 +88,7 @@ typedef struct {
     SuiEventCallback ignore;
     SuiEventCallback cutover;
     SuiEventCallback chan_list;
+    SuiEventCallback history;
 } SuiBufferEvents;
 
 #endif /* __SUI_EVENT_H */
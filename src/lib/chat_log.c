@@ -0,0 +1,782 @@
+/* Copyright (C) 2016-2017 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file chat_log.c
+ * @brief Chat log writer
+ *
+ * Chat logs are stored in "<logs>/<server>/<YYYY-MM-DD>.<chat>.log", or in
+ * the indexed binary format described in chat_log_binary.h.
+ *
+ * Messages are copied to immutable records and sent to a dedicated writer
+ * thread through a bounded queue, all formatting and disk I/O happen in the
+ * writer thread. When the queue is full, producer either waits or drops the
+ * message, according to the overflow policy.
+ *
+ * Log file of a chat is kept open until the day changes, the chat is parted
+ * or the number of open files exceeds MAX_OPEN_FILES, in which case the
+ * least recently used one is closed. Writes are buffered and flushed when
+ * the buffer is full or every FLUSH_INTERVAL, even under steady traffic.
+ *
+ * Paths of opened log files are shared with the compressor, which never
+ * compresses a file being written, see chat_log_file_lock(). A compressed
+ * log is decompressed back before appending to it.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "srain.h"
+#include "log.h"
+#include "i18n.h"
+#include "path.h"
+#include "chat_log.h"
+
+#include "chat_log_binary.h"
+#include "chat_log_file.h"
+#include "chat_log_text.h"
+
+#define MAX_OPEN_FILES      32
+#define BUFFER_SIZE         8192
+#define FLUSH_INTERVAL      2 // In seconds
+#define IDLE_INTERVAL       60 // In seconds
+#define DEFAULT_QUEUE_SIZE  4096
+
+typedef enum _SrnChatLogRecordType SrnChatLogRecordType;
+typedef struct _SrnChatLogRecord SrnChatLogRecord;
+typedef struct _SrnChatLogFile SrnChatLogFile;
+
+enum _SrnChatLogRecordType {
+    RECORD_TYPE_MESSAGE,
+    RECORD_TYPE_CLOSE,
+    RECORD_TYPE_FLUSH,
+    RECORD_TYPE_STOP,
+};
+
+/* Record is allocated in one block and never modified after queued */
+struct _SrnChatLogRecord {
+    SrnChatLogRecordType type;
+    SrnChatLogMessageType msg_type;
+    gint64 time; // Unix time, converted to local time by writer thread
+    guint64 serial; // For RECORD_TYPE_FLUSH
+
+    const char *srv_name;
+    const char *chat_name;
+    const char *sender;
+    const char *content;
+    char data[];
+};
+
+struct _SrnChatLogFile {
+    char *key;
+    char *path; // Path of log, the index is not included
+    char *date; // YYYY-MM-DD
+    SrnChatLogFormat format;
+    FILE *fp;
+    FILE *index_fp; // Only for binary format
+    int unindexed_count; // Records written since last index entry
+    bool dirty; // Whether it has unflushed data
+    GList *link; // Link in lru_queue
+};
+
+/* Shared between producers and writer thread, protected by queue_mutex */
+static GMutex queue_mutex;
+static GCond queue_cond; // Signaled when queue becomes non-empty
+static GCond space_cond; // Signaled when queue has free space
+static GCond flush_cond; // Signaled when a flush record is processed
+static GQueue record_queue = G_QUEUE_INIT;
+static int queue_size = DEFAULT_QUEUE_SIZE;
+static SrnChatLogOverflowPolicy overflow_policy = SRN_CHAT_LOG_OVERFLOW_POLICY_BLOCK;
+static guint64 dropped_count = 0;
+static guint64 flush_serial = 0;
+static guint64 flushed_serial = 0;
+static volatile gint log_format = SRN_CHAT_LOG_FORMAT_TEXT;
+
+static GThread *writer = NULL;
+
+/* Shared between writer thread and compressor, protected by file_mutex */
+static GMutex file_mutex;
+static GHashTable *open_paths = NULL; // Paths of opened log files
+
+/* Only accessed by writer thread */
+static GHashTable *file_table = NULL; // Key → SrnChatLogFile
+static GQueue lru_queue = G_QUEUE_INIT; // Most recently used file first
+
+static SrnChatLogRecord* record_new(SrnChatLogRecordType type,
+        const char *srv_name, const char *chat_name, const char *sender,
+        const char *content);
+static void push_record(SrnChatLogRecord *rec);
+static gpointer writer_thread(gpointer user_data);
+static void write_message(SrnChatLogRecord *rec);
+static void write_text_message(SrnChatLogFile *file, SrnChatLogRecord *rec,
+        const char *clock);
+static void write_binary_message(SrnChatLogFile *file, SrnChatLogRecord *rec,
+        gint32 utc_offset);
+static gint32 format_time(gint64 time, char *date, gsize date_len,
+        char *clock, gsize clock_len);
+
+static char* get_key(const char *srv_name, const char *chat_name);
+static SrnChatLogFile* open_file(const char *srv_name, const char *chat_name,
+        const char *date);
+static FILE* open_log(const char *srv_name, const char *basename,
+        const char *magic, char **path);
+static void restore_log(const char *srv_name, const char *basename);
+static void close_file(SrnChatLogFile *file);
+static void remove_file(SrnChatLogFile *file);
+static bool flush_files(void);
+static void rotate_files(void);
+
+void srn_chat_log_init(void){
+    file_table = g_hash_table_new(g_str_hash, g_str_equal);
+    g_mutex_lock(&file_mutex);
+    open_paths = g_hash_table_new(g_str_hash, g_str_equal);
+    g_mutex_unlock(&file_mutex);
+    writer = g_thread_new("chat-log", writer_thread, NULL);
+}
+
+/**
+ * @brief ``srn_chat_log_finalize`` waits for all queued messages to be
+ * written, then stops the writer thread.
+ */
+void srn_chat_log_finalize(void){
+    g_return_if_fail(writer);
+
+    push_record(record_new(RECORD_TYPE_STOP, NULL, NULL, NULL, NULL));
+    g_thread_join(writer);
+    writer = NULL;
+
+    g_hash_table_destroy(file_table);
+    file_table = NULL;
+    g_mutex_lock(&file_mutex);
+    g_hash_table_destroy(open_paths);
+    open_paths = NULL;
+    g_mutex_unlock(&file_mutex);
+}
+
+/**
+ * @brief ``chat_log_file_lock`` prevents writer thread from opening or
+ * closing log files. Compressor holds it when it replaces a log file.
+ */
+void chat_log_file_lock(void){
+    g_mutex_lock(&file_mutex);
+}
+
+void chat_log_file_unlock(void){
+    g_mutex_unlock(&file_mutex);
+}
+
+/**
+ * @brief ``chat_log_file_is_open`` returns whether the log file is opened
+ * by writer thread, ``chat_log_file_lock`` must be held.
+ */
+bool chat_log_file_is_open(const char *path){
+    return open_paths && g_hash_table_contains(open_paths, path);
+}
+
+void srn_chat_log_set_config(SrnChatLogConfig *cfg){
+    g_return_if_fail(cfg);
+
+    g_mutex_lock(&queue_mutex);
+    queue_size = cfg->queue_size > 0 ? cfg->queue_size : DEFAULT_QUEUE_SIZE;
+    overflow_policy = cfg->overflow_policy;
+    // Opened files keep their format until closed
+    g_atomic_int_set(&log_format, cfg->format);
+    // Queue may become larger
+    g_cond_broadcast(&space_cond);
+    g_mutex_unlock(&queue_mutex);
+}
+
+/**
+ * @brief ``srn_chat_log_log`` appends a message to chat log.
+ *
+ * @param srv_name
+ * @param chat_name
+ * @param type
+ * @param time Unix time of message, which determines the log file
+ * @param sender Nickname of sender, can be NULL for misc and error message
+ * @param content
+ */
+void srn_chat_log_log(const char *srv_name, const char *chat_name,
+        SrnChatLogMessageType type, gint64 time, const char *sender,
+        const char *content){
+    SrnChatLogRecord *rec;
+
+    g_return_if_fail(writer);
+    g_return_if_fail(srv_name);
+    g_return_if_fail(chat_name);
+    g_return_if_fail(content);
+
+    rec = record_new(RECORD_TYPE_MESSAGE, srv_name, chat_name, sender, content);
+    rec->msg_type = type;
+    rec->time = time;
+
+    push_record(rec);
+}
+
+/**
+ * @brief ``srn_chat_log_flush`` is a barrier which returns after all
+ * previously queued messages are written to disk.
+ */
+void srn_chat_log_flush(void){
+    guint64 serial;
+    SrnChatLogRecord *rec;
+
+    g_return_if_fail(writer);
+
+    rec = record_new(RECORD_TYPE_FLUSH, NULL, NULL, NULL, NULL);
+    g_mutex_lock(&queue_mutex);
+    serial = rec->serial = ++flush_serial;
+    g_mutex_unlock(&queue_mutex);
+
+    push_record(rec);
+
+    g_mutex_lock(&queue_mutex);
+    while (flushed_serial < serial){
+        g_cond_wait(&flush_cond, &queue_mutex);
+    }
+    g_mutex_unlock(&queue_mutex);
+}
+
+/**
+ * @brief ``srn_chat_log_close`` closes log file of given chat if it is
+ * opened, it will be reopened when next message comes.
+ *
+ * @param srv_name
+ * @param chat_name
+ */
+void srn_chat_log_close(const char *srv_name, const char *chat_name){
+    if (!writer){
+        return;
+    }
+
+    push_record(record_new(RECORD_TYPE_CLOSE, srv_name, chat_name, NULL, NULL));
+}
+
+SrnRet srn_chat_log_overflow_policy_from_string(const char *str,
+        SrnChatLogOverflowPolicy *policy){
+    if (g_ascii_strcasecmp(str, "block") == 0){
+        *policy = SRN_CHAT_LOG_OVERFLOW_POLICY_BLOCK;
+    } else if (g_ascii_strcasecmp(str, "drop") == 0){
+        *policy = SRN_CHAT_LOG_OVERFLOW_POLICY_DROP;
+    } else {
+        return RET_ERR(_("Unknown overflow policy: %1$s"), str);
+    }
+
+    return SRN_OK;
+}
+
+SrnRet srn_chat_log_format_from_string(const char *str,
+        SrnChatLogFormat *format){
+    if (g_ascii_strcasecmp(str, "text") == 0){
+        *format = SRN_CHAT_LOG_FORMAT_TEXT;
+    } else if (g_ascii_strcasecmp(str, "binary") == 0){
+        *format = SRN_CHAT_LOG_FORMAT_BINARY;
+    } else {
+        return RET_ERR(_("Unknown chat log format: %1$s"), str);
+    }
+
+    return SRN_OK;
+}
+
+static SrnChatLogRecord* record_new(SrnChatLogRecordType type,
+        const char *srv_name, const char *chat_name, const char *sender,
+        const char *content){
+    gsize srv_len;
+    gsize chat_len;
+    gsize sender_len;
+    gsize content_len;
+    char *ptr;
+    SrnChatLogRecord *rec;
+
+    srv_len = srv_name ? strlen(srv_name) + 1 : 0;
+    chat_len = chat_name ? strlen(chat_name) + 1 : 0;
+    sender_len = sender ? strlen(sender) + 1 : 0;
+    content_len = content ? strlen(content) + 1 : 0;
+
+    rec = g_malloc0(sizeof(SrnChatLogRecord)
+            + srv_len + chat_len + sender_len + content_len);
+    rec->type = type;
+
+    ptr = rec->data;
+    if (srv_name){
+        rec->srv_name = memcpy(ptr, srv_name, srv_len);
+        ptr += srv_len;
+    }
+    if (chat_name){
+        rec->chat_name = memcpy(ptr, chat_name, chat_len);
+        ptr += chat_len;
+    }
+    if (sender){
+        rec->sender = memcpy(ptr, sender, sender_len);
+        ptr += sender_len;
+    }
+    if (content){
+        rec->content = memcpy(ptr, content, content_len);
+        ptr += content_len;
+    }
+
+    return rec;
+}
+
+static void push_record(SrnChatLogRecord *rec){
+    g_mutex_lock(&queue_mutex);
+
+    while (g_queue_get_length(&record_queue) >= queue_size){
+        // Only messages can be dropped
+        if (rec->type == RECORD_TYPE_MESSAGE
+                && overflow_policy == SRN_CHAT_LOG_OVERFLOW_POLICY_DROP){
+            dropped_count++;
+            g_mutex_unlock(&queue_mutex);
+            g_free(rec);
+            return;
+        }
+        g_cond_wait(&space_cond, &queue_mutex);
+    }
+
+    g_queue_push_tail(&record_queue, rec);
+    g_cond_signal(&queue_cond);
+
+    g_mutex_unlock(&queue_mutex);
+}
+
+static gpointer writer_thread(gpointer user_data){
+    bool dirty;
+    bool stopped;
+    gint64 last_flush;
+
+    dirty = FALSE;
+    stopped = FALSE;
+    last_flush = g_get_monotonic_time();
+    while (!stopped){
+        gint64 now;
+        gint64 deadline;
+        guint64 dropped;
+        GQueue records = G_QUEUE_INIT;
+
+        // Not postponed by incoming records
+        deadline = last_flush
+            + (dirty ? FLUSH_INTERVAL : IDLE_INTERVAL) * G_TIME_SPAN_SECOND;
+
+        g_mutex_lock(&queue_mutex);
+        while (g_queue_is_empty(&record_queue)){
+            if (!g_cond_wait_until(&queue_cond, &queue_mutex, deadline)){
+                break;
+            }
+        }
+        // Take all queued records at once
+        records = record_queue;
+        g_queue_init(&record_queue);
+        dropped = dropped_count;
+        dropped_count = 0;
+        g_cond_broadcast(&space_cond);
+        g_mutex_unlock(&queue_mutex);
+
+        if (dropped){
+            WARN_FR("%" G_GUINT64_FORMAT " chat log messages are dropped "
+                    "because of queue overflow", dropped);
+        }
+
+        while (!g_queue_is_empty(&records)){
+            SrnChatLogRecord *rec;
+
+            rec = g_queue_pop_head(&records);
+            switch (rec->type){
+                case RECORD_TYPE_MESSAGE:
+                    write_message(rec);
+                    dirty = TRUE;
+                    break;
+                case RECORD_TYPE_CLOSE:
+                    {
+                        char *key;
+                        SrnChatLogFile *file;
+
+                        key = get_key(rec->srv_name, rec->chat_name);
+                        file = g_hash_table_lookup(file_table, key);
+                        g_free(key);
+                        if (file){
+                            remove_file(file);
+                        }
+                        break;
+                    }
+                case RECORD_TYPE_FLUSH:
+                    dirty = flush_files();
+                    g_mutex_lock(&queue_mutex);
+                    flushed_serial = MAX(flushed_serial, rec->serial);
+                    g_cond_broadcast(&flush_cond);
+                    g_mutex_unlock(&queue_mutex);
+                    break;
+                case RECORD_TYPE_STOP:
+                    stopped = TRUE;
+                    break;
+                default:
+                    g_warn_if_reached();
+            }
+            g_free(rec);
+        }
+
+        now = g_get_monotonic_time();
+        if (now >= last_flush + FLUSH_INTERVAL * G_TIME_SPAN_SECOND){
+            dirty = flush_files();
+            rotate_files();
+            last_flush = now;
+        }
+    }
+
+    while (!g_queue_is_empty(&lru_queue)){
+        remove_file(g_queue_peek_head(&lru_queue));
+    }
+
+    return NULL;
+}
+
+static void write_message(SrnChatLogRecord *rec){
+    char date[sizeof("YYYY-MM-DD")];
+    char clock[sizeof("HH:MM:SS")];
+    char *key;
+    gint32 utc_offset;
+    SrnChatLogFile *file;
+
+    utc_offset = format_time(rec->time, date, sizeof(date),
+            clock, sizeof(clock));
+
+    key = get_key(rec->srv_name, rec->chat_name);
+    file = g_hash_table_lookup(file_table, key);
+    g_free(key);
+
+    if (file && g_strcmp0(file->date, date) != 0){
+        // Day changed
+        remove_file(file);
+        file = NULL;
+    }
+    if (!file){
+        file = open_file(rec->srv_name, rec->chat_name, date);
+        if (!file){
+            return;
+        }
+    } else {
+        g_queue_unlink(&lru_queue, file->link);
+        g_queue_push_head_link(&lru_queue, file->link);
+    }
+
+    switch (file->format){
+        case SRN_CHAT_LOG_FORMAT_TEXT:
+            write_text_message(file, rec, clock);
+            break;
+        case SRN_CHAT_LOG_FORMAT_BINARY:
+            write_binary_message(file, rec, utc_offset);
+            break;
+        default:
+            g_warn_if_reached();
+    }
+    file->dirty = TRUE;
+}
+
+static void write_text_message(SrnChatLogFile *file, SrnChatLogRecord *rec,
+        const char *clock){
+    switch (rec->msg_type){
+        case SRN_CHAT_LOG_MESSAGE_TYPE_SENT:
+            fprintf(file->fp, "[%s] <%s*> %s\n", clock, rec->sender, rec->content);
+            break;
+        case SRN_CHAT_LOG_MESSAGE_TYPE_RECV:
+            fprintf(file->fp, "[%s] <%s> %s\n", clock, rec->sender, rec->content);
+            break;
+        case SRN_CHAT_LOG_MESSAGE_TYPE_ACTION:
+            fprintf(file->fp, "[%s] * %s %s\n", clock, rec->sender, rec->content);
+            break;
+        case SRN_CHAT_LOG_MESSAGE_TYPE_MISC:
+            fprintf(file->fp, "[%s] = %s\n", clock, rec->content);
+            break;
+        case SRN_CHAT_LOG_MESSAGE_TYPE_ERROR:
+            fprintf(file->fp, "[%s] ! %s\n", clock, rec->content);
+            break;
+        default:
+            g_warn_if_reached();
+    }
+}
+
+/**
+ * @brief Append a record to binary log, an index entry is written before
+ * every CHAT_LOG_INDEX_INTERVAL records.
+ */
+static void write_binary_message(SrnChatLogFile *file, SrnChatLogRecord *rec,
+        gint32 utc_offset){
+    gsize sender_len;
+    gsize content_len;
+    SrnChatLogBinaryHeader hdr = { 0 };
+
+    if (file->unindexed_count == 0){
+        SrnChatLogIndexEntry entry;
+
+        entry.time = rec->time;
+        entry.offset = ftell(file->fp);
+        fwrite(&entry, sizeof(entry), 1, file->index_fp);
+    }
+    file->unindexed_count = (file->unindexed_count + 1) % CHAT_LOG_INDEX_INTERVAL;
+
+    sender_len = rec->sender ? MIN(strlen(rec->sender), G_MAXUINT16) : 0;
+    content_len = MIN(strlen(rec->content), G_MAXUINT32);
+
+    hdr.time = rec->time;
+    hdr.utc_offset = utc_offset;
+    hdr.content_len = content_len;
+    hdr.sender_len = sender_len;
+    hdr.type = rec->msg_type;
+
+    fwrite(&hdr, sizeof(hdr), 1, file->fp);
+    fwrite(rec->sender, 1, sender_len, file->fp);
+    fwrite(rec->content, 1, content_len, file->fp);
+}
+
+/**
+ * @brief Format unix time as local date and clock.
+ *
+ * @return Local UTC offset at the time in seconds.
+ */
+static gint32 format_time(gint64 time, char *date, gsize date_len,
+        char *clock, gsize clock_len){
+    gint32 utc_offset;
+    GDateTime *dt;
+
+    dt = g_date_time_new_from_unix_local(time);
+    utc_offset = g_date_time_get_utc_offset(dt) / G_TIME_SPAN_SECOND;
+    snprintf(date, date_len, "%04d-%02d-%02d",
+            g_date_time_get_year(dt),
+            g_date_time_get_month(dt),
+            g_date_time_get_day_of_month(dt));
+    snprintf(clock, clock_len, "%02d:%02d:%02d",
+            g_date_time_get_hour(dt),
+            g_date_time_get_minute(dt),
+            g_date_time_get_second(dt));
+    g_date_time_unref(dt);
+
+    return utc_offset;
+}
+
+static char* get_key(const char *srv_name, const char *chat_name){
+    // Space is not allowed in both server name and chat name
+    return g_strdup_printf("%s %s", srv_name, chat_name);
+}
+
+static SrnChatLogFile* open_file(const char *srv_name, const char *chat_name,
+        const char *date){
+    char *basename;
+    char *path;
+    FILE *fp;
+    FILE *index_fp;
+    SrnChatLogFile *file;
+    SrnChatLogFormat format;
+
+    format = g_atomic_int_get(&log_format);
+    path = NULL;
+    index_fp = NULL;
+
+    // Compressor must not replace the file before it is registered
+    chat_log_file_lock();
+    switch (format){
+        case SRN_CHAT_LOG_FORMAT_TEXT:
+            basename = g_strdup_printf("%s.%s" CHAT_LOG_TEXT_SUFFIX,
+                    date, chat_name);
+            fp = open_log(srv_name, basename, NULL, &path);
+            g_free(basename);
+            break;
+        case SRN_CHAT_LOG_FORMAT_BINARY:
+            basename = g_strdup_printf("%s.%s" CHAT_LOG_BINARY_SUFFIX,
+                    date, chat_name);
+            fp = open_log(srv_name, basename, CHAT_LOG_BINARY_MAGIC, &path);
+            g_free(basename);
+            if (!fp){
+                break;
+            }
+
+            basename = g_strdup_printf("%s.%s" CHAT_LOG_INDEX_SUFFIX,
+                    date, chat_name);
+            index_fp = open_log(srv_name, basename, CHAT_LOG_INDEX_MAGIC, NULL);
+            g_free(basename);
+            if (!index_fp){
+                fclose(fp);
+                fp = NULL;
+            }
+            break;
+        default:
+            g_warn_if_reached();
+            fp = NULL;
+    }
+    if (fp){
+        g_hash_table_add(open_paths, path);
+    }
+    chat_log_file_unlock();
+
+    if (!fp){
+        g_free(path);
+        return NULL;
+    }
+
+    while (g_queue_get_length(&lru_queue) >= MAX_OPEN_FILES){
+        remove_file(g_queue_peek_tail(&lru_queue));
+    }
+
+    file = g_malloc0(sizeof(SrnChatLogFile));
+    file->key = get_key(srv_name, chat_name);
+    file->path = path;
+    file->date = g_strdup(date);
+    file->format = format;
+    file->fp = fp;
+    file->index_fp = index_fp;
+    g_queue_push_head(&lru_queue, file);
+    file->link = lru_queue.head;
+    g_hash_table_insert(file_table, file->key, file);
+
+    return file;
+}
+
+/**
+ * @brief Open a log file for appending, the magic is written if the file is
+ * empty.
+ *
+ * @param path_out Returns path of the opened file, can be NULL
+ */
+static FILE* open_log(const char *srv_name, const char *basename,
+        const char *magic, char **path_out){
+    char *path;
+    FILE *fp;
+
+    restore_log(srv_name, basename);
+    path = srn_create_log_file(srv_name, basename);
+    if (!path){
+        ERR_FR("Failed to create log file");
+        return NULL;
+    }
+
+    fp = fopen(path, "a");
+    if (!fp){
+        ERR_FR("Failed to open file '%s'", path);
+        g_free(path);
+        return NULL;
+    }
+    if (path_out){
+        *path_out = path;
+    } else {
+        g_free(path);
+    }
+    setvbuf(fp, NULL, _IOFBF, BUFFER_SIZE);
+
+    fseek(fp, 0, SEEK_END);
+    if (magic && ftell(fp) == 0){
+        fwrite(magic, 1, CHAT_LOG_MAGIC_LEN, fp);
+    }
+
+    return fp;
+}
+
+/**
+ * @brief Decompress a compressed log back before appending to it, messages
+ * of an old day may come again, for example, replayed by bouncer.
+ */
+static void restore_log(const char *srv_name, const char *basename){
+    char *log_dir;
+    char *path;
+    char *gz_path;
+
+    log_dir = srn_get_log_dir();
+    path = g_build_filename(log_dir, srv_name, basename, NULL);
+    gz_path = g_strconcat(path, CHAT_LOG_COMPRESSED_SUFFIX, NULL);
+
+    if (!g_file_test(path, G_FILE_TEST_EXISTS)
+            && g_file_test(gz_path, G_FILE_TEST_EXISTS)){
+        if (!chat_log_file_decompress(path)){
+            // Compressor merges them later
+            WARN_FR("Failed to decompress chat log: %s", gz_path);
+        }
+    }
+
+    g_free(gz_path);
+    g_free(path);
+    g_free(log_dir);
+}
+
+static void close_file(SrnChatLogFile *file){
+    fclose(file->fp);
+    if (file->index_fp){
+        fclose(file->index_fp);
+    }
+    chat_log_file_lock();
+    g_hash_table_remove(open_paths, file->path);
+    chat_log_file_unlock();
+    g_free(file->path);
+    g_free(file->date);
+    g_free(file->key);
+    g_free(file);
+}
+
+static void remove_file(SrnChatLogFile *file){
+    g_hash_table_remove(file_table, file->key);
+    g_queue_delete_link(&lru_queue, file->link);
+    close_file(file);
+}
+
+/**
+ * @brief Flush all dirty files.
+ *
+ * @return FALSE, which means no file is dirty now.
+ */
+static bool flush_files(void){
+    for (GList *lst = lru_queue.head; lst; lst = g_list_next(lst)){
+        SrnChatLogFile *file;
+
+        file = lst->data;
+        if (file->dirty){
+            fflush(file->fp);
+            if (file->index_fp){
+                fflush(file->index_fp);
+            }
+            file->dirty = FALSE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief Close log files of previous days, new files are opened when
+ * messages of new day come.
+ */
+static void rotate_files(void){
+    char *date;
+    GList *lst;
+    GDateTime *now;
+
+    now = g_date_time_new_now_local();
+    date = g_date_time_format(now, "%F");
+
+    lst = lru_queue.head;
+    while (lst){
+        GList *next;
+        SrnChatLogFile *file;
+
+        next = g_list_next(lst);
+        file = lst->data;
+        if (g_strcmp0(file->date, date) != 0){
+            remove_file(file);
+        }
+        lst = next;
+    }
+
+    g_free(date);
+    g_date_time_unref(now);
+}
@@ -0,0 +1,72 @@
+/* Copyright (C) 2016-2017 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This is a private header file and should not be exported. */
+
+#ifndef __CHAT_LOG_BINARY_H
+#define __CHAT_LOG_BINARY_H
+
+/*
+ * Layout of binary chat log, all integers are in host byte order.
+ *
+ * "<YYYY-MM-DD>.<chat>.srnlog":
+ *   magic: CHAT_LOG_BINARY_MAGIC
+ *   records: { SrnChatLogBinaryHeader, sender, content }...
+ *     sender and content are UTF-8 strings without trailing NUL
+ *
+ * "<YYYY-MM-DD>.<chat>.srnidx", sparse time index of log:
+ *   magic: CHAT_LOG_INDEX_MAGIC
+ *   entries: SrnChatLogIndexEntry...
+ *     an entry is appended for every CHAT_LOG_INDEX_INTERVAL records, and
+ *     for the first record written after log is opened.
+ *
+ * Records are appended in time order, the index is only a hint, reader
+ * must validate the offsets.
+ */
+
+#include <glib.h>
+
+#define CHAT_LOG_BINARY_SUFFIX      ".srnlog"
+#define CHAT_LOG_INDEX_SUFFIX       ".srnidx"
+#define CHAT_LOG_BINARY_MAGIC       "SRNLOG\0\1"
+#define CHAT_LOG_INDEX_MAGIC        "SRNIDX\0\1"
+#define CHAT_LOG_MAGIC_LEN          8
+#define CHAT_LOG_INDEX_INTERVAL     64
+
+typedef struct _SrnChatLogBinaryHeader SrnChatLogBinaryHeader;
+typedef struct _SrnChatLogIndexEntry SrnChatLogIndexEntry;
+
+struct _SrnChatLogBinaryHeader {
+    gint64 time; // Unix time
+    gint32 utc_offset; // In seconds
+    guint32 content_len;
+    guint16 sender_len;
+    guint8 type; // SrnChatLogMessageType
+    guint8 flags; // Reserved
+    guint32 reserved;
+};
+
+struct _SrnChatLogIndexEntry {
+    gint64 time;
+    guint64 offset;
+};
+
+G_STATIC_ASSERT(sizeof(SrnChatLogBinaryHeader) == 24);
+G_STATIC_ASSERT(sizeof(SrnChatLogIndexEntry) == 16);
+
+#endif /* __CHAT_LOG_BINARY_H */
@@ -0,0 +1,571 @@
+/* Copyright (C) 2016-2017 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file chat_log_compress.c
+ * @brief Background compression of old chat logs
+ *
+ * A low priority thread compresses log files which are not modified for
+ * "chat-log.compress-after" days to "<basename>.gz". The compressed file is
+ * written to a temporary file first, then renamed, and the uncompressed one
+ * is removed at last, so there is always a complete copy of log on disk.
+ *
+ * Files opened by writer thread are skipped. A compressed log is
+ * decompressed back by writer before appending to it, so if both of them
+ * exist, the uncompressed one normally contains the compressed one and
+ * replaces it; otherwise they are merged.
+ *
+ * Binary logs are compressed too, but their time index is left untouched
+ * because it is small and refers to uncompressed offsets.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+#include "srain.h"
+#include "log.h"
+#include "path.h"
+#include "chat_log.h"
+
+#include "chat_log_binary.h"
+#include "chat_log_file.h"
+
+#define TMP_SUFFIX              ".tmp"
+#define CHUNK_SIZE              (64 * 1024) // Bytes compressed before yielding CPU
+#define YIELD_INTERVAL          10 // In milliseconds
+#define STARTUP_DELAY           60 // In seconds
+#define UPDATE_INTERVAL         3600 // In seconds
+#define DEFAULT_COMPRESS_AFTER  7 // In days
+
+static GMutex compress_mutex;
+static GCond compressor_cond;
+static volatile gint compress_after = DEFAULT_COMPRESS_AFTER;
+static volatile gint stopping = FALSE;
+static GThread *compressor = NULL;
+
+static gpointer compressor_thread(gpointer user_data);
+static void compress_all(void);
+static void compress_server(const char *dir, time_t before);
+static bool compress_file(const char *dir, const char *name);
+static bool is_older_than(const char *dir, const char *name, time_t before);
+static bool is_prefix_of(const char *gz_path, const char *path);
+static GInputStream* open_compressed(const char *gz_path);
+static bool copy_stream(GInputStream *in, GOutputStream *out, bool throttle);
+static bool yield(void);
+
+void srn_chat_log_compress_init(void){
+    g_atomic_int_set(&stopping, FALSE);
+    compressor = g_thread_new("chat-log-compress", compressor_thread, NULL);
+}
+
+void srn_chat_log_compress_finalize(void){
+    g_return_if_fail(compressor);
+
+    g_mutex_lock(&compress_mutex);
+    g_atomic_int_set(&stopping, TRUE);
+    g_cond_signal(&compressor_cond);
+    g_mutex_unlock(&compress_mutex);
+
+    g_thread_join(compressor);
+    compressor = NULL;
+}
+
+void srn_chat_log_compress_set_config(SrnChatLogConfig *cfg){
+    g_return_if_fail(cfg);
+
+    // Takes effect at the next round
+    g_atomic_int_set(&compress_after, cfg->compress_after);
+}
+
+/**
+ * @brief ``srn_chat_log_get_disk_usage`` reports disk usage of chat logs of
+ * every server. Every log file is stated, so it should not be called in
+ * main thread.
+ *
+ * @return A list of SrnChatLogDiskUsage, should be freed by
+ *      ``srn_chat_log_disk_usage_free``.
+ */
+GList* srn_chat_log_get_disk_usage(void){
+    char *log_dir;
+    const char *srv_name;
+    GDir *dir;
+    GList *lst;
+
+    log_dir = srn_get_log_dir();
+    dir = g_dir_open(log_dir, 0, NULL);
+    if (!dir){
+        g_free(log_dir);
+        return NULL;
+    }
+
+    lst = NULL;
+    while ((srv_name = g_dir_read_name(dir))){
+        char *srv_dir;
+        const char *name;
+        GDir *subdir;
+        SrnChatLogDiskUsage *usage;
+
+        srv_dir = g_build_filename(log_dir, srv_name, NULL);
+        subdir = g_dir_open(srv_dir, 0, NULL);
+        if (!subdir){
+            g_free(srv_dir);
+            continue;
+        }
+
+        usage = g_malloc0(sizeof(SrnChatLogDiskUsage));
+        usage->srv_name = g_strdup(srv_name);
+        while ((name = g_dir_read_name(subdir))){
+            char *path;
+            char *basename;
+            guint64 size;
+            GStatBuf st;
+
+            basename = chat_log_get_basename(name);
+            if (!basename){
+                continue;
+            }
+            path = g_build_filename(srv_dir, name, NULL);
+            if (g_stat(path, &st) == 0){
+                usage->size += st.st_size;
+                usage->file_count++;
+                if (g_strcmp0(basename, name) != 0){
+                    usage->compressed_file_count++;
+                    if (chat_log_file_get_size(srv_dir, basename, &size)){
+                        usage->original_size += size;
+                    }
+                } else {
+                    usage->original_size += st.st_size;
+                }
+            }
+            g_free(path);
+            g_free(basename);
+        }
+        g_dir_close(subdir);
+        g_free(srv_dir);
+
+        lst = g_list_prepend(lst, usage);
+    }
+    g_dir_close(dir);
+    g_free(log_dir);
+
+    return g_list_reverse(lst);
+}
+
+void srn_chat_log_disk_usage_free(SrnChatLogDiskUsage *usage){
+    g_return_if_fail(usage);
+
+    g_free(usage->srv_name);
+    g_free(usage);
+}
+
+static gpointer compressor_thread(gpointer user_data){
+    gint64 deadline;
+
+#ifdef __linux__
+    // On Linux it only changes the nice value of current thread
+    setpriority(PRIO_PROCESS, 0, 19);
+#endif
+
+    deadline = g_get_monotonic_time() + STARTUP_DELAY * G_TIME_SPAN_SECOND;
+    g_mutex_lock(&compress_mutex);
+    while (!g_atomic_int_get(&stopping)){
+        if (g_cond_wait_until(&compressor_cond, &compress_mutex, deadline)){
+            // Woken up, check the conditions again
+            continue;
+        }
+        g_mutex_unlock(&compress_mutex);
+
+        compress_all();
+
+        g_mutex_lock(&compress_mutex);
+        deadline = g_get_monotonic_time() + UPDATE_INTERVAL * G_TIME_SPAN_SECOND;
+    }
+    g_mutex_unlock(&compress_mutex);
+
+    return NULL;
+}
+
+/**
+ * @brief ``chat_log_file_decompress`` decompresses "<path>.gz" to path and
+ * removes the compressed one, ``chat_log_file_lock`` must be held.
+ *
+ * @return FALSE if failed, the compressed one is untouched.
+ */
+bool chat_log_file_decompress(const char *path){
+    bool ok;
+    char *gz_path;
+    char *tmp_path;
+    GFile *file;
+    GInputStream *in;
+    GFileOutputStream *out;
+
+    gz_path = g_strconcat(path, CHAT_LOG_COMPRESSED_SUFFIX, NULL);
+    tmp_path = g_strconcat(path, TMP_SUFFIX, NULL);
+    out = NULL;
+    ok = FALSE;
+
+    in = open_compressed(gz_path);
+    if (!in){
+        goto FIN;
+    }
+    file = g_file_new_for_path(tmp_path);
+    out = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL);
+    g_object_unref(file);
+    if (!out){
+        goto FIN;
+    }
+    if (!copy_stream(in, G_OUTPUT_STREAM(out), FALSE)
+            || !g_output_stream_close(G_OUTPUT_STREAM(out), NULL, NULL)){
+        goto FIN;
+    }
+    // The uncompressed one contains the compressed one once renamed
+    if (g_rename(tmp_path, path) != 0){
+        goto FIN;
+    }
+    g_unlink(gz_path);
+    ok = TRUE;
+
+FIN:
+    if (out){
+        g_object_unref(out);
+    }
+    if (in){
+        g_object_unref(in);
+    }
+    if (!ok){
+        g_unlink(tmp_path);
+    }
+    g_free(tmp_path);
+    g_free(gz_path);
+
+    return ok;
+}
+
+static void compress_all(void){
+    int days;
+    char *log_dir;
+    const char *name;
+    GDir *dir;
+    time_t before;
+
+    days = g_atomic_int_get(&compress_after);
+    if (days <= 0){
+        return;
+    }
+
+    log_dir = srn_get_log_dir();
+    dir = g_dir_open(log_dir, 0, NULL);
+    if (!dir){
+        g_free(log_dir);
+        return;
+    }
+
+    before = time(NULL) - (time_t)days * 24 * 3600;
+    while ((name = g_dir_read_name(dir)) && !g_atomic_int_get(&stopping)){
+        char *path;
+
+        path = g_build_filename(log_dir, name, NULL);
+        if (g_file_test(path, G_FILE_TEST_IS_DIR)){
+            compress_server(path, before);
+        }
+        g_free(path);
+    }
+
+    g_dir_close(dir);
+    g_free(log_dir);
+}
+
+static void compress_server(const char *dir, time_t before){
+    const char *name;
+    GDir *gdir;
+    GPtrArray *names;
+
+    gdir = g_dir_open(dir, 0, NULL);
+    if (!gdir){
+        return;
+    }
+    // Directory should not be changed during iteration
+    names = g_ptr_array_new_with_free_func(g_free);
+    while ((name = g_dir_read_name(gdir))){
+        char *chat_name;
+
+        chat_name = chat_log_get_chat_name(name, NULL);
+        if (chat_name && is_older_than(dir, name, before)){
+            g_ptr_array_add(names, g_strdup(name));
+        }
+        g_free(chat_name);
+    }
+    g_dir_close(gdir);
+
+    for (guint i = 0; i < names->len; i++){
+        if (!compress_file(dir, names->pdata[i])){
+            if (g_atomic_int_get(&stopping)){
+                break;
+            }
+            WARN_FR("Failed to compress chat log: %s/%s",
+                    dir, (char *)names->pdata[i]);
+        }
+    }
+    g_ptr_array_free(names, TRUE);
+}
+
+/**
+ * @brief Compress a log file to "<name>.gz" and remove it. The file is
+ * skipped if it is opened or modified by writer thread meanwhile.
+ *
+ * @return FALSE if failed or compressor is stopping.
+ */
+static bool compress_file(const char *dir, const char *name){
+    bool ok;
+    bool opened;
+    bool merged;
+    char *path;
+    char *gz_path;
+    char *tmp_path;
+    GFile *file;
+    GInputStream *in;
+    GFileOutputStream *tmp_out;
+    GOutputStream *out;
+    GConverter *conv;
+    GStatBuf st;
+    GStatBuf new_st;
+
+    path = g_build_filename(dir, name, NULL);
+    gz_path = g_strconcat(path, CHAT_LOG_COMPRESSED_SUFFIX, NULL);
+    tmp_path = g_strconcat(gz_path, TMP_SUFFIX, NULL);
+    in = NULL;
+    out = NULL;
+    ok = FALSE;
+
+    chat_log_file_lock();
+    opened = chat_log_file_is_open(path);
+    chat_log_file_unlock();
+    if (opened){
+        // Compressed at next round
+        ok = TRUE;
+        goto FIN;
+    }
+    if (g_stat(path, &st) != 0){
+        goto FIN;
+    }
+
+    file = g_file_new_for_path(tmp_path);
+    tmp_out = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL);
+    g_object_unref(file);
+    if (!tmp_out){
+        goto FIN;
+    }
+    conv = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+    out = g_converter_output_stream_new(G_OUTPUT_STREAM(tmp_out), conv);
+    g_object_unref(conv);
+    g_object_unref(tmp_out);
+
+    merged = g_file_test(gz_path, G_FILE_TEST_EXISTS)
+        && !is_prefix_of(gz_path, path);
+    if (merged){
+        // Should not happen, merge them rather than lose any of them
+        WARN_FR("Chat log %s does not contain %s, merge them", path, gz_path);
+        in = open_compressed(gz_path);
+        if (!in || !copy_stream(in, out, TRUE)){
+            goto FIN;
+        }
+        g_clear_object(&in);
+    }
+
+    file = g_file_new_for_path(path);
+    in = G_INPUT_STREAM(g_file_read(file, NULL, NULL));
+    g_object_unref(file);
+    if (!in){
+        goto FIN;
+    }
+    if (merged && g_str_has_suffix(name, CHAT_LOG_BINARY_SUFFIX)){
+        // Magic has been copied from the compressed one
+        g_input_stream_skip(in, CHAT_LOG_MAGIC_LEN, NULL, NULL);
+    }
+    if (!copy_stream(in, out, TRUE)){
+        goto FIN;
+    }
+    // Gzip trailer is written on closing
+    if (!g_output_stream_close(out, NULL, NULL)){
+        goto FIN;
+    }
+
+    chat_log_file_lock();
+    if (chat_log_file_is_open(path)
+            || g_stat(path, &new_st) != 0
+            || new_st.st_size != st.st_size
+            || new_st.st_mtime != st.st_mtime){
+        // Written meanwhile, compressed at next round
+        ok = TRUE;
+    } else if (g_rename(tmp_path, gz_path) == 0){
+        ok = g_unlink(path) == 0;
+    }
+    chat_log_file_unlock();
+
+FIN:
+    if (out){
+        g_object_unref(out);
+    }
+    if (in){
+        g_object_unref(in);
+    }
+    // The temporary file is renamed if succeeded
+    g_unlink(tmp_path);
+    g_free(tmp_path);
+    g_free(gz_path);
+    g_free(path);
+
+    return ok;
+}
+
+/**
+ * @brief Whether the log file is not modified since given time.
+ */
+static bool is_older_than(const char *dir, const char *name, time_t before){
+    char *path;
+    bool older;
+    GStatBuf st;
+
+    path = g_build_filename(dir, name, NULL);
+    older = g_stat(path, &st) == 0 && st.st_mtime < before;
+    g_free(path);
+
+    return older;
+}
+
+/**
+ * @brief Whether the uncompressed content of gz_path is a prefix of the
+ * content of path.
+ */
+static bool is_prefix_of(const char *gz_path, const char *path){
+    bool prefix;
+    char *buf1;
+    char *buf2;
+    GFile *file;
+    GInputStream *in1;
+    GInputStream *in2;
+
+    in1 = open_compressed(gz_path);
+    file = g_file_new_for_path(path);
+    in2 = G_INPUT_STREAM(g_file_read(file, NULL, NULL));
+    g_object_unref(file);
+    buf1 = g_malloc(CHUNK_SIZE);
+    buf2 = g_malloc(CHUNK_SIZE);
+
+    prefix = FALSE;
+    while (in1 && in2){
+        gsize len1;
+        gsize len2;
+
+        if (!g_input_stream_read_all(in1, buf1, CHUNK_SIZE, &len1, NULL, NULL)
+                || !g_input_stream_read_all(in2, buf2, len1, &len2, NULL, NULL)
+                || len1 != len2 || memcmp(buf1, buf2, len1) != 0){
+            break;
+        }
+        if (len1 < CHUNK_SIZE){
+            // End of compressed content
+            prefix = TRUE;
+            break;
+        }
+    }
+
+    g_free(buf2);
+    g_free(buf1);
+    if (in2){
+        g_object_unref(in2);
+    }
+    if (in1){
+        g_object_unref(in1);
+    }
+
+    return prefix;
+}
+
+static GInputStream* open_compressed(const char *gz_path){
+    GFile *file;
+    GConverter *conv;
+    GInputStream *base;
+    GInputStream *in;
+
+    file = g_file_new_for_path(gz_path);
+    base = G_INPUT_STREAM(g_file_read(file, NULL, NULL));
+    g_object_unref(file);
+    if (!base){
+        return NULL;
+    }
+
+    conv = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+    in = g_converter_input_stream_new(base, conv);
+    g_object_unref(conv);
+    g_object_unref(base);
+
+    return in;
+}
+
+/**
+ * @brief Copy the whole input stream to output stream.
+ *
+ * @param throttle Whether to yield CPU after every chunk
+ *
+ * @return FALSE if failed or compressor is stopping.
+ */
+static bool copy_stream(GInputStream *in, GOutputStream *out, bool throttle){
+    bool ok;
+    char *buf;
+
+    buf = g_malloc(CHUNK_SIZE);
+    for (;;){
+        gssize len;
+
+        len = g_input_stream_read(in, buf, CHUNK_SIZE, NULL, NULL);
+        ok = len >= 0;
+        if (len <= 0){
+            break;
+        }
+        ok = g_output_stream_write_all(out, buf, len, NULL, NULL, NULL);
+        if (!ok){
+            break;
+        }
+        if (throttle && !yield()){
+            ok = FALSE;
+            break;
+        }
+    }
+    g_free(buf);
+
+    return ok;
+}
+
+/**
+ * @brief Give CPU to other threads.
+ *
+ * @return FALSE if compressor is stopping.
+ */
+static bool yield(void){
+    g_usleep(YIELD_INTERVAL * 1000);
+
+    return !g_atomic_int_get(&stopping);
+}
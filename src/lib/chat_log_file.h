@@ -0,0 +1,57 @@
+/* Copyright (C) 2016-2017 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This is a private header file and should not be exported. */
+
+#ifndef __CHAT_LOG_FILE_H
+#define __CHAT_LOG_FILE_H
+
+/*
+ * Log files are stored in "<logs>/<server>/", they are named
+ * "<YYYY-MM-DD>.<chat>.log" or "<YYYY-MM-DD>.<chat>.srnlog".
+ *
+ * Old log files are compressed to "<basename>.gz" in background, so a log
+ * file should always be accessed by its uncompressed basename via functions
+ * below, which fall back to the compressed one transparently. Offsets in log
+ * file are always offsets in the uncompressed content.
+ *
+ * If both of them exist, the uncompressed one is preferred: a compressed log
+ * is decompressed back before appending, so the uncompressed one always
+ * contains the compressed one.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "srain.h"
+#include "chat_log.h"
+
+#define CHAT_LOG_COMPRESSED_SUFFIX  ".gz"
+
+char* chat_log_get_chat_name(const char *basename, SrnChatLogFormat *format);
+char* chat_log_get_basename(const char *name);
+GInputStream* chat_log_file_open(const char *dir, const char *basename, GError **error);
+GBytes* chat_log_file_load(const char *dir, const char *basename, GError **error);
+bool chat_log_file_get_size(const char *dir, const char *basename, guint64 *size);
+
+void chat_log_file_lock(void);
+void chat_log_file_unlock(void);
+bool chat_log_file_is_open(const char *path);
+bool chat_log_file_decompress(const char *path);
+
+#endif /* __CHAT_LOG_FILE_H */
@@ -0,0 +1,1771 @@
+/* Copyright (C) 2016-2017 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file chat_log_index.c
+ * @brief Full-text search index of chat logs
+ *
+ * A low priority indexer thread reads chat logs incrementally and builds an
+ * inverted index for every server in "$XDG_CACHE_HOME/srain/log-index/<server>".
+ *
+ * The index consists of immutable segments, every segment maps terms to
+ * posting lists of (file, offset, time), which are sorted by file and offset,
+ * and delta encoded as varints. Newly indexed messages are written to a new
+ * segment, small segments are merged into larger ones when there are too
+ * many of them. The read offset of every log file is saved in "state.ini"
+ * after the segment is written, so indexing is resumed after restart.
+ *
+ * Searching maps the segments into memory and intersects the posting lists
+ * of all terms, only the matched messages are read from log files.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+#include "srain.h"
+#include "log.h"
+#include "i18n.h"
+#include "path.h"
+#include "chat_log.h"
+
+#include "chat_log_binary.h"
+#include "chat_log_text.h"
+#include "chat_log_file.h"
+
+#define INDEX_DIR               "log-index"
+#define STATE_FILE              "state.ini"
+#define STATE_VERSION           1
+#define SEGMENT_SUFFIX          ".srnseg"
+#define SEGMENT_MAGIC           "SRNSEG\0\1"
+#define SEGMENT_MAGIC_LEN       8
+
+#define MAX_SEGMENT_COUNT       8
+#define MAX_BATCH_POSTINGS      (256 * 1024) // Postings buffered in memory
+#define YIELD_SIZE              (64 * 1024) // Bytes read before yielding CPU
+#define YIELD_INTERVAL          10 // In milliseconds
+#define STARTUP_DELAY           10 // In seconds
+#define UPDATE_INTERVAL         300 // In seconds
+#define MAX_TERM_LEN            64
+#define SENDER_TERM_PREFIX      "from:"
+
+typedef struct _Posting Posting;
+typedef struct _SegmentHeader SegmentHeader;
+typedef struct _SegmentTerm SegmentTerm;
+typedef struct _Segment Segment;
+typedef struct _SegmentWriter SegmentWriter;
+typedef struct _ChatLogIndex ChatLogIndex;
+typedef struct _IndexBatch IndexBatch;
+typedef struct _SearchHit SearchHit;
+
+struct _Posting {
+    gint64 time;
+    guint64 offset;
+    guint32 file_id;
+};
+
+/* Posting must be the first member, so that posting comparators apply */
+struct _SearchHit {
+    Posting posting;
+    SrnChatLogSearchResult *result; // NULL if failed to read
+};
+
+/* On-disk layout of segment:
+ *   SegmentHeader, { term, postings }..., SegmentTerm...
+ * Terms in table are sorted in byte order. */
+struct _SegmentHeader {
+    char magic[SEGMENT_MAGIC_LEN];
+    guint64 table_offset;
+    guint32 term_count;
+    guint32 reserved;
+};
+
+struct _SegmentTerm {
+    guint64 term_offset;
+    guint64 postings_offset;
+    guint32 term_len;
+    guint32 postings_len;
+};
+
+G_STATIC_ASSERT(sizeof(SegmentHeader) == 24);
+G_STATIC_ASSERT(sizeof(SegmentTerm) == 24);
+
+struct _Segment {
+    volatile gint ref;
+    int id;
+    char *path;
+    GMappedFile *file;
+    guint32 term_count;
+    guint64 table_offset;
+};
+
+struct _SegmentWriter {
+    FILE *fp;
+    char *path;
+    char *tmp_path;
+    guint64 pos;
+    GArray *terms; // SegmentTerm
+};
+
+struct _ChatLogIndex {
+    char *srv_name;
+    char *dir;
+    char *log_dir;
+    int next_segment_id;
+    GPtrArray *segments; // Segment, oldest first
+    GPtrArray *files; // File ID → basename of log file
+    GHashTable *file_ids; // Basename → file ID + 1
+    GArray *offsets; // File ID → indexed offset, only accessed by indexer
+};
+
+struct _IndexBatch {
+    GHashTable *postings; // Term → GArray of Posting
+    gsize count;
+    GArray *offsets; // Offsets after the batch is committed
+};
+
+/* Protects index_table and fields of ChatLogIndex except offsets */
+static GMutex index_mutex;
+static GCond indexer_cond;
+static GCond updated_cond; // Signaled when a requested update is finished
+static GHashTable *index_table = NULL; // Server name → ChatLogIndex
+static bool update_requested = FALSE;
+static guint64 update_serial = 0; // Serial of the last requested update
+static guint64 updated_serial = 0; // Serial of the last finished update
+static volatile gint stopping = FALSE;
+static GThread *indexer = NULL;
+
+static gpointer indexer_thread(gpointer user_data);
+static void update_all(void);
+static void update_server(const char *srv_name);
+static bool index_file(ChatLogIndex *index, IndexBatch *batch, guint32 id);
+static bool commit_batch(ChatLogIndex *index, IndexBatch *batch);
+static void merge_segments(ChatLogIndex *index);
+static bool yield(void);
+
+static ChatLogIndex* get_index(const char *srv_name);
+static ChatLogIndex* chat_log_index_new(const char *srv_name);
+static void chat_log_index_free(ChatLogIndex *index);
+static void chat_log_index_reset(ChatLogIndex *index);
+static bool chat_log_index_save(ChatLogIndex *index);
+static guint32 chat_log_index_get_file_id(ChatLogIndex *index, const char *name);
+
+static IndexBatch* index_batch_new(ChatLogIndex *index);
+static void index_batch_free(IndexBatch *batch);
+static void index_batch_add(IndexBatch *batch, guint32 id, guint64 offset,
+        SrnChatLogEntry *entry);
+
+static Segment* segment_open(const char *dir, int id);
+static Segment* segment_ref(Segment *seg);
+static void segment_unref(Segment *seg);
+static gsize segment_get_size(Segment *seg);
+static bool segment_get_term(Segment *seg, guint32 i, SegmentTerm *term);
+static bool segment_find(Segment *seg, const char *term, SegmentTerm *found);
+static bool segment_decode(Segment *seg, const SegmentTerm *term, GArray *postings);
+static bool get_varint(const guint8 **p, const guint8 *end, guint64 *val);
+static void put_varint(GByteArray *buf, guint64 val);
+
+static SegmentWriter* segment_writer_new(const char *path);
+static bool segment_writer_add(SegmentWriter *writer, const char *term,
+        gsize term_len, GArray *postings);
+static bool segment_writer_finish(SegmentWriter *writer);
+static void segment_writer_free(SegmentWriter *writer);
+
+static void tokenize(const char *text, GHashTable *terms);
+static char* get_sender_term(const char *sender);
+static bool read_line(GDataInputStream *in, GString *line, gsize *len);
+static bool read_all(GInputStream *in, void *buf, gsize size);
+static bool skip_all(GInputStream *in, guint64 size);
+static void read_hits(const char *log_dir, const char *basename,
+        SearchHit *hits, guint count);
+static bool read_entry(GDataInputStream *in, const char *basename,
+        SrnChatLogFormat format, guint64 avail, SrnChatLogEntry *entry,
+        guint64 *len);
+static int term_cmp(const char *a, gsize a_len, const char *b, gsize b_len);
+static int posting_cmp(gconstpointer a, gconstpointer b);
+static int posting_time_cmp(gconstpointer a, gconstpointer b);
+
+void srn_chat_log_index_init(void){
+    index_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+            NULL, (GDestroyNotify)chat_log_index_free);
+    g_atomic_int_set(&stopping, FALSE);
+    indexer = g_thread_new("chat-log-index", indexer_thread, NULL);
+}
+
+void srn_chat_log_index_finalize(void){
+    g_return_if_fail(indexer);
+
+    g_mutex_lock(&index_mutex);
+    g_atomic_int_set(&stopping, TRUE);
+    g_cond_signal(&indexer_cond);
+    g_cond_broadcast(&updated_cond);
+    g_mutex_unlock(&index_mutex);
+
+    g_thread_join(indexer);
+    indexer = NULL;
+
+    g_hash_table_destroy(index_table);
+    index_table = NULL;
+}
+
+/**
+ * @brief ``srn_chat_log_index_update`` asks indexer to index new messages
+ * as soon as possible, rather than at the next UPDATE_INTERVAL.
+ */
+void srn_chat_log_index_update(void){
+    g_return_if_fail(indexer);
+
+    g_mutex_lock(&index_mutex);
+    update_requested = TRUE;
+    update_serial++;
+    g_cond_signal(&indexer_cond);
+    g_mutex_unlock(&index_mutex);
+}
+
+/**
+ * @brief ``srn_chat_log_index_sync`` asks indexer to index new messages and
+ * waits until it is done, it should not be called in main thread.
+ *
+ * @param timeout Max time to wait in microseconds
+ *
+ * @return FALSE if timed out.
+ */
+bool srn_chat_log_index_sync(gint64 timeout){
+    bool done;
+    guint64 serial;
+    gint64 deadline;
+
+    g_return_val_if_fail(indexer, FALSE);
+
+    deadline = g_get_monotonic_time() + timeout;
+    g_mutex_lock(&index_mutex);
+    update_requested = TRUE;
+    serial = ++update_serial;
+    g_cond_signal(&indexer_cond);
+    while (updated_serial < serial && !g_atomic_int_get(&stopping)){
+        if (!g_cond_wait_until(&updated_cond, &index_mutex, deadline)){
+            break;
+        }
+    }
+    done = updated_serial >= serial;
+    g_mutex_unlock(&index_mutex);
+
+    return done;
+}
+
+/**
+ * @brief ``srn_chat_log_search`` searches indexed chat logs of a server.
+ * All words of query must appear in a message, a word like "from:<nick>"
+ * matches the sender of message.
+ *
+ * This function may block for a short while, it is thread safe.
+ *
+ * @param srv_name
+ * @param chat_name Only search logs of the chat, can be NULL
+ * @param query
+ * @param limit Maximum number of results
+ * @param error
+ *
+ * @return A list of SrnChatLogSearchResult, newest first
+ */
+GList* srn_chat_log_search(const char *srv_name, const char *chat_name,
+        const char *query, int limit, GError **error){
+    char **words;
+    GHashTable *term_set;
+    GPtrArray *terms;
+    GPtrArray *segments;
+    GPtrArray *files;
+    GArray *matches;
+    char *log_dir;
+    GList *results;
+    GArray *hits;
+    ChatLogIndex *index;
+
+    g_return_val_if_fail(srv_name, NULL);
+    g_return_val_if_fail(query, NULL);
+    g_return_val_if_fail(limit > 0, NULL);
+    g_return_val_if_fail(index_table, NULL);
+
+    term_set = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    words = g_strsplit_set(query, " \t", -1);
+    for (int i = 0; words[i]; i++){
+        if (g_str_has_prefix(words[i], SENDER_TERM_PREFIX)
+                && strlen(words[i]) > strlen(SENDER_TERM_PREFIX)){
+            g_hash_table_add(term_set, get_sender_term(
+                        words[i] + strlen(SENDER_TERM_PREFIX)));
+        } else {
+            tokenize(words[i], term_set);
+        }
+    }
+    g_strfreev(words);
+
+    if (g_hash_table_size(term_set) == 0){
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                _("Nothing to search"));
+        g_hash_table_destroy(term_set);
+        return NULL;
+    }
+
+    // Take a snapshot of index
+    segments = g_ptr_array_new_with_free_func((GDestroyNotify)segment_unref);
+    files = g_ptr_array_new_with_free_func(g_free);
+    g_mutex_lock(&index_mutex);
+    index = get_index(srv_name);
+    for (guint i = 0; i < index->segments->len; i++){
+        g_ptr_array_add(segments, segment_ref(index->segments->pdata[i]));
+    }
+    for (guint i = 0; i < index->files->len; i++){
+        g_ptr_array_add(files, g_strdup(index->files->pdata[i]));
+    }
+    log_dir = g_strdup(index->log_dir);
+    g_mutex_unlock(&index_mutex);
+
+    terms = g_ptr_array_new();
+    {
+        GHashTableIter iter;
+        gpointer term;
+
+        g_hash_table_iter_init(&iter, term_set);
+        while (g_hash_table_iter_next(&iter, &term, NULL)){
+            g_ptr_array_add(terms, term);
+        }
+    }
+
+    matches = g_array_new(FALSE, FALSE, sizeof(Posting));
+    for (guint i = 0; i < segments->len; i++){
+        Segment *seg;
+        SegmentTerm *found;
+        GArray *result;
+        GArray *postings;
+
+        seg = segments->pdata[i];
+        found = g_new(SegmentTerm, terms->len);
+        for (guint j = 0; j < terms->len; j++){
+            if (!segment_find(seg, terms->pdata[j], &found[j])){
+                goto NEXT;
+            }
+        }
+
+        // Start from the shortest posting list
+        for (guint j = 1; j < terms->len; j++){
+            if (found[j].postings_len < found[0].postings_len){
+                SegmentTerm tmp = found[0];
+                found[0] = found[j];
+                found[j] = tmp;
+            }
+        }
+
+        result = g_array_new(FALSE, FALSE, sizeof(Posting));
+        postings = g_array_new(FALSE, FALSE, sizeof(Posting));
+        segment_decode(seg, &found[0], result);
+        for (guint j = 1; j < terms->len && result->len; j++){
+            guint k;
+            guint m;
+            guint n;
+
+            g_array_set_size(postings, 0);
+            segment_decode(seg, &found[j], postings);
+
+            // Intersect sorted posting lists in place
+            k = m = n = 0;
+            while (k < result->len && m < postings->len){
+                int cmp;
+
+                cmp = posting_cmp(&g_array_index(result, Posting, k),
+                        &g_array_index(postings, Posting, m));
+                if (cmp < 0){
+                    k++;
+                } else if (cmp > 0){
+                    m++;
+                } else {
+                    g_array_index(result, Posting, n++) =
+                        g_array_index(result, Posting, k);
+                    k++;
+                    m++;
+                }
+            }
+            g_array_set_size(result, n);
+        }
+
+        for (guint j = 0; j < result->len; j++){
+            Posting *p;
+            char *name;
+
+            p = &g_array_index(result, Posting, j);
+            if (p->file_id >= files->len || !files->pdata[p->file_id]){
+                continue;
+            }
+            if (chat_name){
+                name = chat_log_get_chat_name(files->pdata[p->file_id], NULL);
+                if (!name || g_ascii_strcasecmp(name, chat_name) != 0){
+                    g_free(name);
+                    continue;
+                }
+                g_free(name);
+            }
+            g_array_append_val(matches, *p);
+        }
+
+        g_array_free(postings, TRUE);
+        g_array_free(result, TRUE);
+NEXT:
+        g_free(found);
+    }
+
+    // Pick the newest matches
+    g_array_sort(matches, posting_time_cmp);
+    hits = g_array_new(FALSE, TRUE, sizeof(SearchHit));
+    for (guint i = 0; i < matches->len && hits->len < (guint)limit; i++){
+        SearchHit hit = { 0 };
+
+        hit.posting = g_array_index(matches, Posting, i);
+        if (i > 0 && posting_cmp(&hit.posting,
+                    &g_array_index(matches, Posting, i - 1)) == 0){
+            continue;
+        }
+        g_array_append_val(hits, hit);
+    }
+
+    // Read them in file order, so that every file is streamed only once
+    g_array_sort(hits, posting_cmp);
+    for (guint i = 0, j; i < hits->len; i = j){
+        guint32 file_id;
+
+        file_id = g_array_index(hits, SearchHit, i).posting.file_id;
+        for (j = i; j < hits->len
+                && g_array_index(hits, SearchHit, j).posting.file_id == file_id;
+                j++);
+        read_hits(log_dir, files->pdata[file_id],
+                &g_array_index(hits, SearchHit, i), j - i);
+    }
+
+    g_array_sort(hits, posting_time_cmp);
+    results = NULL;
+    for (guint i = 0; i < hits->len; i++){
+        SearchHit *hit;
+
+        hit = &g_array_index(hits, SearchHit, i);
+        // Log file may be removed
+        if (hit->result){
+            results = g_list_prepend(results, hit->result);
+        }
+    }
+    results = g_list_reverse(results);
+
+    g_array_free(hits, TRUE);
+    g_array_free(matches, TRUE);
+    g_ptr_array_free(terms, TRUE);
+    g_hash_table_destroy(term_set);
+    g_ptr_array_free(segments, TRUE);
+    g_ptr_array_free(files, TRUE);
+    g_free(log_dir);
+
+    return results;
+}
+
+void srn_chat_log_search_result_free(SrnChatLogSearchResult *result){
+    g_return_if_fail(result);
+
+    g_free(result->chat_name);
+    g_free(result->entry.sender);
+    g_free(result->entry.content);
+    g_free(result);
+}
+
+/*****************************************************************************
+ * Indexer
+ *****************************************************************************/
+
+static gpointer indexer_thread(gpointer user_data){
+    guint64 serial;
+    gint64 deadline;
+
+#ifdef __linux__
+    // On Linux it only changes the nice value of current thread
+    setpriority(PRIO_PROCESS, 0, 19);
+#endif
+
+    deadline = g_get_monotonic_time() + STARTUP_DELAY * G_TIME_SPAN_SECOND;
+    g_mutex_lock(&index_mutex);
+    while (!g_atomic_int_get(&stopping)){
+        if (!update_requested
+                && g_cond_wait_until(&indexer_cond, &index_mutex, deadline)){
+            // Woken up, check the conditions again
+            continue;
+        }
+        update_requested = FALSE;
+        serial = update_serial;
+        g_mutex_unlock(&index_mutex);
+
+        update_all();
+
+        g_mutex_lock(&index_mutex);
+        updated_serial = serial;
+        g_cond_broadcast(&updated_cond);
+        deadline = g_get_monotonic_time() + UPDATE_INTERVAL * G_TIME_SPAN_SECOND;
+    }
+    g_mutex_unlock(&index_mutex);
+
+    return NULL;
+}
+
+static void update_all(void){
+    char *log_dir;
+    const char *name;
+    GDir *dir;
+
+    log_dir = srn_get_log_dir();
+    dir = g_dir_open(log_dir, 0, NULL);
+    if (!dir){
+        g_free(log_dir);
+        return;
+    }
+
+    while ((name = g_dir_read_name(dir)) && !g_atomic_int_get(&stopping)){
+        char *path;
+
+        path = g_build_filename(log_dir, name, NULL);
+        if (g_file_test(path, G_FILE_TEST_IS_DIR)){
+            update_server(name);
+        }
+        g_free(path);
+    }
+
+    g_dir_close(dir);
+    g_free(log_dir);
+}
+
+static void update_server(const char *srv_name){
+    const char *name;
+    GDir *dir;
+    GPtrArray *names;
+    GHashTable *seen;
+    ChatLogIndex *index;
+    IndexBatch *batch;
+
+    g_mutex_lock(&index_mutex);
+    index = get_index(srv_name);
+    g_mutex_unlock(&index_mutex);
+
+    dir = g_dir_open(index->log_dir, 0, NULL);
+    if (!dir){
+        return;
+    }
+    names = g_ptr_array_new_with_free_func(g_free);
+    seen = g_hash_table_new(g_str_hash, g_str_equal);
+    while ((name = g_dir_read_name(dir))){
+        char *basename;
+
+        // Compressed log is indexed by its uncompressed name
+        basename = chat_log_get_basename(name);
+        if (basename && !g_hash_table_contains(seen, basename)){
+            g_hash_table_add(seen, basename);
+            g_ptr_array_add(names, basename);
+        } else {
+            g_free(basename);
+        }
+    }
+    g_dir_close(dir);
+    g_hash_table_destroy(seen);
+
+    batch = index_batch_new(index);
+    for (guint i = 0; i < names->len; i++){
+        guint32 id;
+
+        id = chat_log_index_get_file_id(index, names->pdata[i]);
+        if (batch->offsets->len <= id){
+            g_array_set_size(batch->offsets, id + 1);
+        }
+        while (!index_file(index, batch, id)){
+            if (g_atomic_int_get(&stopping)){
+                goto FIN;
+            }
+            // Batch is full
+            if (!commit_batch(index, batch)){
+                goto FIN;
+            }
+            index_batch_free(batch);
+            batch = index_batch_new(index);
+        }
+    }
+    if (batch->count){
+        commit_batch(index, batch);
+    }
+    merge_segments(index);
+
+FIN:
+    index_batch_free(batch);
+    g_ptr_array_free(names, TRUE);
+}
+
+/**
+ * @brief Index new messages of a log file.
+ *
+ * @return FALSE if indexing is interrupted because the batch is full or
+ *      indexer is stopping.
+ */
+static bool index_file(ChatLogIndex *index, IndexBatch *batch, guint32 id){
+    bool finished;
+    const char *name;
+    guint64 offset;
+    guint64 size;
+    gsize read_size;
+    GInputStream *in;
+    SrnChatLogFormat format;
+    SrnChatLogEntry entry;
+
+    name = index->files->pdata[id]; // Never changes
+    g_free(chat_log_get_chat_name(name, &format));
+    offset = g_array_index(batch->offsets, guint64, id);
+
+    // Offsets always refer to the uncompressed content
+    if (!chat_log_file_get_size(index->log_dir, name, &size) || size <= offset){
+        return TRUE;
+    }
+    in = chat_log_file_open(index->log_dir, name, NULL);
+    if (!in){
+        return TRUE;
+    }
+
+    finished = TRUE;
+    read_size = 0;
+    if (format == SRN_CHAT_LOG_FORMAT_BINARY && offset == 0){
+        char magic[CHAT_LOG_MAGIC_LEN];
+
+        if (!read_all(in, magic, sizeof(magic))
+                || memcmp(magic, CHAT_LOG_BINARY_MAGIC, sizeof(magic)) != 0){
+            goto FIN;
+        }
+        offset = sizeof(magic);
+    } else if (!skip_all(in, offset)){
+        goto FIN;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    if (format == SRN_CHAT_LOG_FORMAT_TEXT){
+        gsize len;
+        GString *line;
+        GDataInputStream *data_in;
+
+        line = g_string_new(NULL);
+        data_in = g_data_input_stream_new(in);
+        while (read_line(data_in, line, &len)){
+            if (chat_log_text_parse_line(name, line->str, &entry)){
+                index_batch_add(batch, id, offset, &entry);
+            }
+            g_free(entry.sender);
+            g_free(entry.content);
+            memset(&entry, 0, sizeof(entry));
+
+            offset += len;
+            read_size += len;
+            if (read_size >= YIELD_SIZE){
+                read_size = 0;
+                if (!yield() || batch->count >= MAX_BATCH_POSTINGS){
+                    finished = FALSE;
+                    break;
+                }
+            }
+        }
+        g_object_unref(data_in);
+        g_string_free(line, TRUE);
+    } else {
+        SrnChatLogBinaryHeader hdr;
+
+        while (read_all(in, &hdr, sizeof(hdr))){
+            char *sender;
+            char *content;
+
+            if ((guint64)sizeof(hdr) + hdr.sender_len + hdr.content_len
+                    > size - offset){
+                break; // Truncated or corrupted record
+            }
+
+            sender = g_malloc(hdr.sender_len + 1);
+            content = g_malloc(hdr.content_len + 1);
+            if (!read_all(in, sender, hdr.sender_len)
+                    || !read_all(in, content, hdr.content_len)){
+                // Truncated record
+                g_free(sender);
+                g_free(content);
+                break;
+            }
+            sender[hdr.sender_len] = '\0';
+            content[hdr.content_len] = '\0';
+
+            entry.type = hdr.type;
+            entry.time = hdr.time;
+            entry.sender = hdr.sender_len ? sender : NULL;
+            entry.content = content;
+            index_batch_add(batch, id, offset, &entry);
+            g_free(sender);
+            g_free(content);
+
+            offset += sizeof(hdr) + hdr.sender_len + hdr.content_len;
+            read_size += sizeof(hdr) + hdr.sender_len + hdr.content_len;
+            if (read_size >= YIELD_SIZE){
+                read_size = 0;
+                if (!yield() || batch->count >= MAX_BATCH_POSTINGS){
+                    finished = FALSE;
+                    break;
+                }
+            }
+        }
+    }
+
+    g_array_index(batch->offsets, guint64, id) = offset;
+
+FIN:
+    g_object_unref(in);
+
+    return finished;
+}
+
+/**
+ * @brief Write postings of batch to a new segment, then save the offsets.
+ */
+static bool commit_batch(ChatLogIndex *index, IndexBatch *batch){
+    int id;
+    char *path;
+    GList *terms;
+    Segment *seg;
+    SegmentWriter *writer;
+
+    id = index->next_segment_id;
+    path = g_strdup_printf("%s%s%d%s", index->dir, G_DIR_SEPARATOR_S,
+            id, SEGMENT_SUFFIX);
+    writer = segment_writer_new(path);
+    g_free(path);
+    if (!writer){
+        return FALSE;
+    }
+
+    terms = g_hash_table_get_keys(batch->postings);
+    terms = g_list_sort(terms, (GCompareFunc)strcmp);
+    for (GList *lst = terms; lst; lst = g_list_next(lst)){
+        GArray *postings;
+
+        postings = g_hash_table_lookup(batch->postings, lst->data);
+        g_array_sort(postings, posting_cmp);
+        if (!segment_writer_add(writer, lst->data, strlen(lst->data), postings)){
+            break;
+        }
+    }
+    g_list_free(terms);
+
+    if (!segment_writer_finish(writer)){
+        segment_writer_free(writer);
+        return FALSE;
+    }
+    segment_writer_free(writer);
+
+    seg = segment_open(index->dir, id);
+    if (!seg){
+        return FALSE;
+    }
+
+    g_mutex_lock(&index_mutex);
+    index->next_segment_id++;
+    g_ptr_array_add(index->segments, seg);
+    g_array_set_size(index->offsets, 0);
+    g_array_append_vals(index->offsets,
+            batch->offsets->data, batch->offsets->len);
+    g_mutex_unlock(&index_mutex);
+
+    DBG_FR("Segment %d of %s is written, %" G_GSIZE_FORMAT " postings",
+            id, index->srv_name, batch->count);
+
+    return chat_log_index_save(index);
+}
+
+/**
+ * @brief Merge the newest segments whose total size is comparable to the
+ * older one, so that large segments are rarely rewritten.
+ */
+static void merge_segments(ChatLogIndex *index){
+    while (index->segments->len > MAX_SEGMENT_COUNT){
+        int id;
+        guint start;
+        guint end;
+        gsize total;
+        char *path;
+        guint32 *cursors;
+        bool ok;
+        Segment *seg;
+        SegmentWriter *writer;
+        GArray *postings;
+        GPtrArray *olds;
+
+        end = index->segments->len;
+        start = end - 2;
+        total = segment_get_size(index->segments->pdata[start])
+            + segment_get_size(index->segments->pdata[start + 1]);
+        while (start > 0
+                && segment_get_size(index->segments->pdata[start - 1]) <= total * 2){
+            start--;
+            total += segment_get_size(index->segments->pdata[start]);
+        }
+
+        id = index->next_segment_id;
+        path = g_strdup_printf("%s%s%d%s", index->dir, G_DIR_SEPARATOR_S,
+                id, SEGMENT_SUFFIX);
+        writer = segment_writer_new(path);
+        g_free(path);
+        if (!writer){
+            return;
+        }
+
+        // K-way merge of sorted term tables
+        ok = TRUE;
+        cursors = g_new0(guint32, end - start);
+        postings = g_array_new(FALSE, FALSE, sizeof(Posting));
+        while (ok && !g_atomic_int_get(&stopping)){
+            const char *min_term;
+            guint32 min_len;
+
+            min_term = NULL;
+            min_len = 0;
+            for (guint i = start; i < end; i++){
+                const char *term;
+                Segment *s;
+                SegmentTerm st;
+
+                s = index->segments->pdata[i];
+                if (!segment_get_term(s, cursors[i - start], &st)){
+                    continue;
+                }
+                term = g_mapped_file_get_contents(s->file) + st.term_offset;
+                if (!min_term
+                        || term_cmp(term, st.term_len, min_term, min_len) < 0){
+                    min_term = term;
+                    min_len = st.term_len;
+                }
+            }
+            if (!min_term){
+                break; // All merged
+            }
+
+            g_array_set_size(postings, 0);
+            for (guint i = start; i < end; i++){
+                const char *term;
+                Segment *s;
+                SegmentTerm st;
+
+                s = index->segments->pdata[i];
+                if (!segment_get_term(s, cursors[i - start], &st)){
+                    continue;
+                }
+                term = g_mapped_file_get_contents(s->file) + st.term_offset;
+                if (term_cmp(term, st.term_len, min_term, min_len) == 0){
+                    segment_decode(s, &st, postings);
+                    cursors[i - start]++;
+                }
+            }
+            g_array_sort(postings, posting_cmp);
+            ok = segment_writer_add(writer, min_term, min_len, postings);
+        }
+        g_array_free(postings, TRUE);
+        g_free(cursors);
+
+        if (!ok || g_atomic_int_get(&stopping) || !segment_writer_finish(writer)){
+            segment_writer_free(writer);
+            return;
+        }
+        segment_writer_free(writer);
+
+        seg = segment_open(index->dir, id);
+        if (!seg){
+            return;
+        }
+
+        olds = g_ptr_array_new_with_free_func((GDestroyNotify)segment_unref);
+        g_mutex_lock(&index_mutex);
+        index->next_segment_id++;
+        for (guint i = start; i < end; i++){
+            g_ptr_array_add(olds, segment_ref(index->segments->pdata[i]));
+        }
+        g_ptr_array_remove_range(index->segments, start, end - start);
+        g_ptr_array_add(index->segments, seg);
+        g_mutex_unlock(&index_mutex);
+
+        // Old segments are removed after they are no longer referenced by
+        // state file, they are still readable by searchers while mapped
+        ok = chat_log_index_save(index);
+        for (guint i = 0; ok && i < olds->len; i++){
+            g_unlink(((Segment *)olds->pdata[i])->path);
+        }
+        g_ptr_array_free(olds, TRUE);
+        if (!ok){
+            return;
+        }
+
+        DBG_FR("Segments %u-%u of %s are merged to %d",
+                start, end - 1, index->srv_name, id);
+    }
+}
+
+/**
+ * @brief Give CPU to other threads.
+ *
+ * @return FALSE if indexer is stopping.
+ */
+static bool yield(void){
+    g_usleep(YIELD_INTERVAL * 1000);
+
+    return !g_atomic_int_get(&stopping);
+}
+
+/*****************************************************************************
+ * ChatLogIndex
+ *****************************************************************************/
+
+/**
+ * @brief Get index of a server, load it if needed. index_mutex must be held.
+ */
+static ChatLogIndex* get_index(const char *srv_name){
+    ChatLogIndex *index;
+
+    index = g_hash_table_lookup(index_table, srv_name);
+    if (!index){
+        index = chat_log_index_new(srv_name);
+        g_hash_table_insert(index_table, index->srv_name, index);
+    }
+
+    return index;
+}
+
+static ChatLogIndex* chat_log_index_new(const char *srv_name){
+    char *log_dir;
+    char *cache_dir;
+    char *path;
+    char **keys;
+    char **segments;
+    GKeyFile *state;
+    ChatLogIndex *index;
+
+    index = g_malloc0(sizeof(ChatLogIndex));
+    index->srv_name = g_strdup(srv_name);
+    index->segments = g_ptr_array_new_with_free_func(
+            (GDestroyNotify)segment_unref);
+    index->files = g_ptr_array_new_with_free_func(g_free);
+    index->file_ids = g_hash_table_new(g_str_hash, g_str_equal);
+    index->offsets = g_array_new(FALSE, TRUE, sizeof(guint64));
+
+    log_dir = srn_get_log_dir();
+    index->log_dir = g_build_filename(log_dir, srv_name, NULL);
+    g_free(log_dir);
+
+    cache_dir = srn_create_cache_dir(INDEX_DIR);
+    index->dir = g_build_filename(cache_dir ? cache_dir : "", srv_name, NULL);
+    g_free(cache_dir);
+    if (g_mkdir_with_parents(index->dir, 0700) != 0){
+        WARN_FR("Failed to create index directory '%s'", index->dir);
+    }
+
+    state = g_key_file_new();
+    path = g_build_filename(index->dir, STATE_FILE, NULL);
+    if (!g_key_file_load_from_file(state, path, G_KEY_FILE_NONE, NULL)
+            || g_key_file_get_integer(state, "index", "version", NULL)
+                != STATE_VERSION){
+        goto FIN;
+    }
+
+    index->next_segment_id = g_key_file_get_integer(state,
+            "index", "next-segment", NULL);
+    segments = g_key_file_get_string_list(state,
+            "index", "segments", NULL, NULL);
+    for (int i = 0; segments && segments[i]; i++){
+        Segment *seg;
+
+        seg = segment_open(index->dir, atoi(segments[i]));
+        if (!seg){
+            WARN_FR("Index of %s is broken, rebuilding", srv_name);
+            g_strfreev(segments);
+            chat_log_index_reset(index);
+            goto FIN;
+        }
+        g_ptr_array_add(index->segments, seg);
+    }
+    g_strfreev(segments);
+
+    keys = g_key_file_get_keys(state, "files", NULL, NULL);
+    for (int i = 0; keys && keys[i]; i++){
+        int id;
+        char *name;
+        guint64 offset;
+
+        id = atoi(keys[i]);
+        name = g_key_file_get_string(state, "files", keys[i], NULL);
+        offset = g_key_file_get_uint64(state, "offsets", keys[i], NULL);
+        if (!name || id < 0){
+            g_free(name);
+            continue;
+        }
+        if (index->files->len <= (guint)id){
+            g_ptr_array_set_size(index->files, id + 1);
+            g_array_set_size(index->offsets, id + 1);
+        }
+        g_free(index->files->pdata[id]);
+        index->files->pdata[id] = name;
+        g_array_index(index->offsets, guint64, id) = offset;
+        g_hash_table_insert(index->file_ids, name, GUINT_TO_POINTER(id + 1));
+    }
+    g_strfreev(keys);
+
+FIN:
+    // Remove segments which are not referenced by state
+    {
+        const char *name;
+        GDir *dir;
+
+        dir = g_dir_open(index->dir, 0, NULL);
+        while (dir && (name = g_dir_read_name(dir))){
+            bool used;
+
+            if (g_strcmp0(name, STATE_FILE) == 0){
+                continue;
+            }
+            used = FALSE;
+            for (guint i = 0; i < index->segments->len; i++){
+                Segment *seg;
+                char *basename;
+
+                seg = index->segments->pdata[i];
+                basename = g_path_get_basename(seg->path);
+                used = g_strcmp0(basename, name) == 0;
+                g_free(basename);
+                if (used){
+                    break;
+                }
+            }
+            if (!used){
+                char *file;
+
+                file = g_build_filename(index->dir, name, NULL);
+                g_unlink(file);
+                g_free(file);
+            }
+        }
+        if (dir){
+            g_dir_close(dir);
+        }
+    }
+
+    g_free(path);
+    g_key_file_free(state);
+
+    return index;
+}
+
+static void chat_log_index_free(ChatLogIndex *index){
+    g_ptr_array_free(index->segments, TRUE);
+    g_hash_table_destroy(index->file_ids);
+    g_ptr_array_free(index->files, TRUE);
+    g_array_free(index->offsets, TRUE);
+    g_free(index->log_dir);
+    g_free(index->dir);
+    g_free(index->srv_name);
+    g_free(index);
+}
+
+static void chat_log_index_reset(ChatLogIndex *index){
+    g_ptr_array_set_size(index->segments, 0);
+    g_hash_table_remove_all(index->file_ids);
+    g_ptr_array_set_size(index->files, 0);
+    g_array_set_size(index->offsets, 0);
+}
+
+static bool chat_log_index_save(ChatLogIndex *index){
+    bool ok;
+    char *path;
+    char **segments;
+    GKeyFile *state;
+    GError *err;
+
+    state = g_key_file_new();
+    g_key_file_set_integer(state, "index", "version", STATE_VERSION);
+
+    g_mutex_lock(&index_mutex);
+    g_key_file_set_integer(state, "index", "next-segment",
+            index->next_segment_id);
+    segments = g_new0(char *, index->segments->len + 1);
+    for (guint i = 0; i < index->segments->len; i++){
+        Segment *seg;
+
+        seg = index->segments->pdata[i];
+        segments[i] = g_strdup_printf("%d", seg->id);
+    }
+    g_key_file_set_string_list(state, "index", "segments",
+            (const char * const *)segments, index->segments->len);
+    g_strfreev(segments);
+
+    for (guint i = 0; i < index->files->len; i++){
+        char key[16];
+
+        if (!index->files->pdata[i]){
+            continue;
+        }
+        g_snprintf(key, sizeof(key), "%u", i);
+        g_key_file_set_string(state, "files", key, index->files->pdata[i]);
+        g_key_file_set_uint64(state, "offsets", key, i < index->offsets->len
+                ? g_array_index(index->offsets, guint64, i) : 0);
+    }
+    g_mutex_unlock(&index_mutex);
+
+    // Saved atomically
+    err = NULL;
+    path = g_build_filename(index->dir, STATE_FILE, NULL);
+    ok = g_key_file_save_to_file(state, path, &err);
+    if (!ok){
+        ERR_FR("Failed to save index state: %s", err->message);
+        g_error_free(err);
+    }
+    g_free(path);
+    g_key_file_free(state);
+
+    return ok;
+}
+
+static guint32 chat_log_index_get_file_id(ChatLogIndex *index, const char *name){
+    guint32 id;
+
+    g_mutex_lock(&index_mutex);
+    id = GPOINTER_TO_UINT(g_hash_table_lookup(index->file_ids, name));
+    if (id){
+        id--;
+    } else {
+        char *dup;
+
+        dup = g_strdup(name);
+        id = index->files->len;
+        g_ptr_array_add(index->files, dup);
+        g_hash_table_insert(index->file_ids, dup, GUINT_TO_POINTER(id + 1));
+    }
+    if (index->offsets->len <= id){
+        g_array_set_size(index->offsets, id + 1);
+    }
+    g_mutex_unlock(&index_mutex);
+
+    return id;
+}
+
+/*****************************************************************************
+ * IndexBatch
+ *****************************************************************************/
+
+static IndexBatch* index_batch_new(ChatLogIndex *index){
+    IndexBatch *batch;
+
+    batch = g_malloc0(sizeof(IndexBatch));
+    batch->postings = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify)g_array_unref);
+    batch->offsets = g_array_new(FALSE, TRUE, sizeof(guint64));
+    g_array_append_vals(batch->offsets,
+            index->offsets->data, index->offsets->len);
+
+    return batch;
+}
+
+static void index_batch_free(IndexBatch *batch){
+    g_hash_table_destroy(batch->postings);
+    g_array_free(batch->offsets, TRUE);
+    g_free(batch);
+}
+
+static void index_batch_add(IndexBatch *batch, guint32 id, guint64 offset,
+        SrnChatLogEntry *entry){
+    GHashTable *terms;
+    GHashTableIter iter;
+    gpointer term;
+    Posting posting;
+
+    switch (entry->type){
+        case SRN_CHAT_LOG_MESSAGE_TYPE_RECV:
+        case SRN_CHAT_LOG_MESSAGE_TYPE_SENT:
+        case SRN_CHAT_LOG_MESSAGE_TYPE_ACTION:
+            break;
+        default:
+            return; // Only messages from users are indexed
+    }
+
+    terms = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    tokenize(entry->content, terms);
+    if (entry->sender){
+        g_hash_table_add(terms, get_sender_term(entry->sender));
+    }
+
+    posting.time = entry->time;
+    posting.offset = offset;
+    posting.file_id = id;
+
+    g_hash_table_iter_init(&iter, terms);
+    while (g_hash_table_iter_next(&iter, &term, NULL)){
+        GArray *postings;
+
+        postings = g_hash_table_lookup(batch->postings, term);
+        if (!postings){
+            postings = g_array_new(FALSE, FALSE, sizeof(Posting));
+            g_hash_table_insert(batch->postings, g_strdup(term), postings);
+        }
+        g_array_append_val(postings, posting);
+        batch->count++;
+    }
+
+    g_hash_table_destroy(terms);
+}
+
+/*****************************************************************************
+ * Segment
+ *****************************************************************************/
+
+static Segment* segment_open(const char *dir, int id){
+    char *basename;
+    GMappedFile *file;
+    SegmentHeader hdr;
+    Segment *seg;
+
+    seg = g_malloc0(sizeof(Segment));
+    seg->ref = 1;
+    seg->id = id;
+    basename = g_strdup_printf("%d%s", id, SEGMENT_SUFFIX);
+    seg->path = g_build_filename(dir, basename, NULL);
+    g_free(basename);
+
+    file = g_mapped_file_new(seg->path, FALSE, NULL);
+    if (!file){
+        goto ERR;
+    }
+    seg->file = file;
+
+    if (g_mapped_file_get_length(file) < sizeof(hdr)){
+        goto ERR;
+    }
+    memcpy(&hdr, g_mapped_file_get_contents(file), sizeof(hdr));
+    if (memcmp(hdr.magic, SEGMENT_MAGIC, SEGMENT_MAGIC_LEN) != 0
+            || hdr.table_offset > g_mapped_file_get_length(file)
+            || (g_mapped_file_get_length(file) - hdr.table_offset)
+                / sizeof(SegmentTerm) < hdr.term_count){
+        goto ERR;
+    }
+    seg->term_count = hdr.term_count;
+    seg->table_offset = hdr.table_offset;
+
+    return seg;
+
+ERR:
+    WARN_FR("Failed to open index segment '%s'", seg->path);
+    segment_unref(seg);
+    return NULL;
+}
+
+static Segment* segment_ref(Segment *seg){
+    g_atomic_int_inc(&seg->ref);
+
+    return seg;
+}
+
+static void segment_unref(Segment *seg){
+    if (!g_atomic_int_dec_and_test(&seg->ref)){
+        return;
+    }
+
+    if (seg->file){
+        g_mapped_file_unref(seg->file);
+    }
+    g_free(seg->path);
+    g_free(seg);
+}
+
+static gsize segment_get_size(Segment *seg){
+    return g_mapped_file_get_length(seg->file);
+}
+
+static bool segment_get_term(Segment *seg, guint32 i, SegmentTerm *term){
+    gsize len;
+
+    if (i >= seg->term_count){
+        return FALSE;
+    }
+
+    len = g_mapped_file_get_length(seg->file);
+    memcpy(term, g_mapped_file_get_contents(seg->file)
+            + seg->table_offset + (gsize)i * sizeof(SegmentTerm),
+            sizeof(SegmentTerm));
+
+    return term->term_offset <= len && term->term_len <= len - term->term_offset
+        && term->postings_offset <= len
+        && term->postings_len <= len - term->postings_offset;
+}
+
+static bool segment_find(Segment *seg, const char *term, SegmentTerm *found){
+    gsize len;
+    guint32 lo;
+    guint32 hi;
+    const char *data;
+
+    len = strlen(term);
+    data = g_mapped_file_get_contents(seg->file);
+    lo = 0;
+    hi = seg->term_count;
+    while (lo < hi){
+        int cmp;
+        guint32 mid;
+        SegmentTerm st;
+
+        mid = lo + (hi - lo) / 2;
+        if (!segment_get_term(seg, mid, &st)){
+            return FALSE;
+        }
+
+        cmp = term_cmp(data + st.term_offset, st.term_len, term, len);
+        if (cmp < 0){
+            lo = mid + 1;
+        } else if (cmp > 0){
+            hi = mid;
+        } else {
+            *found = st;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static bool get_varint(const guint8 **p, const guint8 *end, guint64 *val){
+    int shift;
+
+    *val = 0;
+    for (shift = 0; *p < end && shift < 64; shift += 7){
+        guint8 b;
+
+        b = *(*p)++;
+        *val |= (guint64)(b & 0x7f) << shift;
+        if (!(b & 0x80)){
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void put_varint(GByteArray *buf, guint64 val){
+    guint8 b;
+
+    while (val >= 0x80){
+        b = (val & 0x7f) | 0x80;
+        g_byte_array_append(buf, &b, 1);
+        val >>= 7;
+    }
+    b = val;
+    g_byte_array_append(buf, &b, 1);
+}
+
+/**
+ * @brief Decode posting list of a term and append them to ``postings``.
+ * Every posting is encoded as three varints: delta of file ID, offset (delta
+ * if file ID is unchanged) and zigzag encoded delta of time.
+ */
+static bool segment_decode(Segment *seg, const SegmentTerm *term, GArray *postings){
+    const guint8 *p;
+    const guint8 *end;
+    Posting posting = { 0 };
+
+    p = (const guint8 *)g_mapped_file_get_contents(seg->file)
+        + term->postings_offset;
+    end = p + term->postings_len;
+    while (p < end){
+        guint64 file_delta;
+        guint64 offset;
+        guint64 time_delta;
+
+        if (!get_varint(&p, end, &file_delta)
+                || !get_varint(&p, end, &offset)
+                || !get_varint(&p, end, &time_delta)){
+            WARN_FR("Index segment '%s' is corrupted", seg->path);
+            return FALSE;
+        }
+
+        posting.offset = file_delta ? offset : posting.offset + offset;
+        posting.file_id += file_delta;
+        posting.time += (gint64)(time_delta >> 1) ^ -(gint64)(time_delta & 1);
+        g_array_append_val(postings, posting);
+    }
+
+    return TRUE;
+}
+
+static SegmentWriter* segment_writer_new(const char *path){
+    SegmentHeader hdr = { 0 };
+    SegmentWriter *writer;
+
+    writer = g_malloc0(sizeof(SegmentWriter));
+    writer->path = g_strdup(path);
+    writer->tmp_path = g_strdup_printf("%s.tmp", path);
+    writer->terms = g_array_new(FALSE, FALSE, sizeof(SegmentTerm));
+
+    writer->fp = g_fopen(writer->tmp_path, "wb");
+    if (!writer->fp){
+        ERR_FR("Failed to create index segment '%s'", writer->tmp_path);
+        segment_writer_free(writer);
+        return NULL;
+    }
+
+    // Placeholder, it is rewritten when finished
+    fwrite(&hdr, sizeof(hdr), 1, writer->fp);
+    writer->pos = sizeof(hdr);
+
+    return writer;
+}
+
+static bool segment_writer_add(SegmentWriter *writer, const char *term,
+        gsize term_len, GArray *postings){
+    GByteArray *buf;
+    Posting prev = { 0 };
+    SegmentTerm st;
+
+    buf = g_byte_array_new();
+    for (guint i = 0; i < postings->len; i++){
+        gint64 time_delta;
+        Posting *p;
+
+        p = &g_array_index(postings, Posting, i);
+        if (i > 0 && posting_cmp(p, &prev) == 0){
+            continue; // Duplicated
+        }
+        time_delta = p->time - prev.time;
+        put_varint(buf, p->file_id - prev.file_id);
+        put_varint(buf, p->file_id == prev.file_id
+                ? p->offset - prev.offset : p->offset);
+        put_varint(buf, ((guint64)time_delta << 1) ^ (guint64)(time_delta >> 63));
+        prev = *p;
+    }
+
+    st.term_offset = writer->pos;
+    st.term_len = term_len;
+    st.postings_offset = writer->pos + term_len;
+    st.postings_len = buf->len;
+    g_array_append_val(writer->terms, st);
+
+    fwrite(term, 1, term_len, writer->fp);
+    fwrite(buf->data, 1, buf->len, writer->fp);
+    writer->pos += term_len + buf->len;
+    g_byte_array_free(buf, TRUE);
+
+    return !ferror(writer->fp);
+}
+
+static bool segment_writer_finish(SegmentWriter *writer){
+    int ret;
+    SegmentHeader hdr = { 0 };
+
+    memcpy(hdr.magic, SEGMENT_MAGIC, SEGMENT_MAGIC_LEN);
+    hdr.table_offset = writer->pos;
+    hdr.term_count = writer->terms->len;
+
+    fwrite(writer->terms->data, sizeof(SegmentTerm), writer->terms->len,
+            writer->fp);
+    fseek(writer->fp, 0, SEEK_SET);
+    fwrite(&hdr, sizeof(hdr), 1, writer->fp);
+
+    ret = ferror(writer->fp);
+    ret |= fclose(writer->fp);
+    writer->fp = NULL;
+    if (ret != 0 || g_rename(writer->tmp_path, writer->path) != 0){
+        ERR_FR("Failed to write index segment '%s'", writer->path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void segment_writer_free(SegmentWriter *writer){
+    if (writer->fp){
+        fclose(writer->fp);
+    }
+    g_unlink(writer->tmp_path); // Removed if not renamed
+    g_array_free(writer->terms, TRUE);
+    g_free(writer->tmp_path);
+    g_free(writer->path);
+    g_free(writer);
+}
+
+/*****************************************************************************
+ * Misc
+ *****************************************************************************/
+
+/**
+ * @brief Split text into normalized terms. A term is a sequence of
+ * alphanumeric characters, every wide character (such as CJK ideograph) is
+ * treated as a term.
+ */
+static void tokenize(const char *text, GHashTable *terms){
+    char *norm;
+    char *fold;
+    GString *term;
+
+    norm = g_utf8_normalize(text, -1, G_NORMALIZE_ALL);
+    if (!norm){
+        return; // Invalid UTF-8
+    }
+    fold = g_utf8_casefold(norm, -1);
+    g_free(norm);
+
+    term = g_string_new(NULL);
+    for (const char *p = fold; ; p = g_utf8_next_char(p)){
+        gunichar c;
+
+        c = g_utf8_get_char(p);
+        if (c && g_unichar_isalnum(c) && !g_unichar_iswide(c)){
+            g_string_append_unichar(term, c);
+            continue;
+        }
+
+        if (term->len > 0 && term->len <= MAX_TERM_LEN){
+            g_hash_table_add(terms, g_strndup(term->str, term->len));
+        }
+        g_string_truncate(term, 0);
+
+        if (!c){
+            break;
+        }
+        if (g_unichar_isalnum(c)){
+            g_string_append_unichar(term, c);
+            g_hash_table_add(terms, g_strndup(term->str, term->len));
+            g_string_truncate(term, 0);
+        }
+    }
+
+    g_string_free(term, TRUE);
+    g_free(fold);
+}
+
+static char* get_sender_term(const char *sender){
+    char *fold;
+    char *term;
+
+    fold = g_utf8_casefold(sender, -1);
+    term = g_strconcat(SENDER_TERM_PREFIX, fold, NULL);
+    g_free(fold);
+
+    return term;
+}
+
+/**
+ * @brief Read a complete line without trailing newline.
+ *
+ * @param len Number of bytes consumed, including the newline
+ *
+ * @return FALSE if there is no more complete line.
+ */
+static bool read_line(GDataInputStream *in, GString *line, gsize *len){
+    char *buf;
+    gsize buf_len;
+    GError *err;
+
+    err = NULL;
+    buf = g_data_input_stream_read_upto(in, "\n", 1, &buf_len, NULL, &err);
+    if (!buf){
+        g_clear_error(&err);
+        return FALSE;
+    }
+    // The last line is incomplete if no newline follows
+    if (g_data_input_stream_read_byte(in, NULL, &err) != '\n'){
+        g_clear_error(&err);
+        g_free(buf);
+        return FALSE;
+    }
+
+    g_string_assign(line, buf);
+    g_free(buf);
+    *len = buf_len + 1;
+    if (line->len > 0 && line->str[line->len - 1] == '\r'){
+        g_string_truncate(line, line->len - 1);
+    }
+
+    return TRUE;
+}
+
+static bool read_all(GInputStream *in, void *buf, gsize size){
+    gsize read;
+
+    return g_input_stream_read_all(in, buf, size, &read, NULL, NULL)
+        && read == size;
+}
+
+/**
+ * @brief Skip given bytes, compressed stream is not seekable so it is read
+ * through.
+ */
+static bool skip_all(GInputStream *in, guint64 size){
+    while (size > 0){
+        gssize skipped;
+
+        skipped = g_input_stream_skip(in, MIN(size, G_MAXSSIZE), NULL, NULL);
+        if (skipped <= 0){
+            return FALSE;
+        }
+        size -= skipped;
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Read messages of hits in a log file, hits are sorted by offset.
+ * Compressed log is not seekable, so the file is streamed once for all hits.
+ */
+static void read_hits(const char *log_dir, const char *basename,
+        SearchHit *hits, guint count){
+    guint64 pos;
+    guint64 size;
+    GInputStream *in;
+    GDataInputStream *data_in;
+    SrnChatLogFormat format;
+
+    g_free(chat_log_get_chat_name(basename, &format));
+
+    if (!chat_log_file_get_size(log_dir, basename, &size)){
+        return;
+    }
+    in = chat_log_file_open(log_dir, basename, NULL);
+    if (!in){
+        return;
+    }
+    data_in = g_data_input_stream_new(in);
+    g_object_unref(in);
+
+    pos = 0;
+    for (guint i = 0; i < count; i++){
+        guint64 len;
+        guint64 offset;
+        SrnChatLogEntry entry = { 0 };
+
+        offset = hits[i].posting.offset;
+        if (offset < pos || offset >= size){
+            continue;
+        }
+        if (!skip_all(G_INPUT_STREAM(data_in), offset - pos)){
+            break;
+        }
+        pos = offset;
+
+        len = 0;
+        if (read_entry(data_in, basename, format, size - pos, &entry, &len)){
+            hits[i].result = g_malloc0(sizeof(SrnChatLogSearchResult));
+            hits[i].result->chat_name = chat_log_get_chat_name(basename, NULL);
+            hits[i].result->entry = entry;
+        }
+        if (len == 0){
+            // Position is lost
+            break;
+        }
+        pos += len;
+    }
+
+    g_object_unref(data_in);
+}
+
+/**
+ * @brief Read a message at current position of stream.
+ *
+ * @param avail Number of bytes remaining in log file
+ * @param len Returns number of bytes consumed, 0 if it is unknown
+ */
+static bool read_entry(GDataInputStream *in, const char *basename,
+        SrnChatLogFormat format, guint64 avail, SrnChatLogEntry *entry,
+        guint64 *len){
+    if (format == SRN_CHAT_LOG_FORMAT_TEXT){
+        bool ok;
+        gsize line_len;
+        GString *line;
+
+        line = g_string_new(NULL);
+        ok = read_line(in, line, &line_len);
+        if (ok){
+            *len = line_len;
+            ok = chat_log_text_parse_line(basename, line->str, entry);
+        }
+        g_string_free(line, TRUE);
+
+        return ok;
+    } else {
+        SrnChatLogBinaryHeader hdr;
+
+        if (!read_all(G_INPUT_STREAM(in), &hdr, sizeof(hdr))
+                || (guint64)sizeof(hdr) + hdr.sender_len + hdr.content_len
+                    > avail){
+            return FALSE;
+        }
+        entry->type = hdr.type;
+        entry->time = hdr.time;
+        entry->utc_offset = hdr.utc_offset;
+        entry->sender = hdr.sender_len ? g_malloc0(hdr.sender_len + 1) : NULL;
+        entry->content = g_malloc0(hdr.content_len + 1);
+        if (!read_all(G_INPUT_STREAM(in), entry->sender, hdr.sender_len)
+                || !read_all(G_INPUT_STREAM(in), entry->content, hdr.content_len)){
+            g_free(entry->sender);
+            g_free(entry->content);
+            return FALSE;
+        }
+        *len = sizeof(hdr) + hdr.sender_len + hdr.content_len;
+
+        return TRUE;
+    }
+}
+
+/* Terms are compared in byte order */
+static int term_cmp(const char *a, gsize a_len, const char *b, gsize b_len){
+    int cmp;
+
+    cmp = memcmp(a, b, MIN(a_len, b_len));
+    if (cmp != 0){
+        return cmp;
+    }
+    return a_len < b_len ? -1 : a_len > b_len ? 1 : 0;
+}
+
+static int posting_cmp(gconstpointer a, gconstpointer b){
+    const Posting *pa = a;
+    const Posting *pb = b;
+
+    if (pa->file_id != pb->file_id){
+        return pa->file_id < pb->file_id ? -1 : 1;
+    }
+    if (pa->offset != pb->offset){
+        return pa->offset < pb->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Newest first */
+static int posting_time_cmp(gconstpointer a, gconstpointer b){
+    const Posting *pa = a;
+    const Posting *pb = b;
+
+    if (pa->time != pb->time){
+        return pa->time > pb->time ? -1 : 1;
+    }
+    return -posting_cmp(a, b);
+}
@@ -0,0 +1,740 @@
+/* Copyright (C) 2016-2017 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file chat_log_reader.c
+ * @brief Reader of chat logs
+ *
+ * Log file is mapped into memory, or decompressed into memory if it has been
+ * compressed. For binary log, the sparse time index is
+ * used to locate the records before a given time, so only a few index
+ * intervals are scanned no matter how large the log is. Text log is scanned
+ * backward from its end line by line.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "srain.h"
+#include "log.h"
+#include "i18n.h"
+#include "path.h"
+#include "chat_log.h"
+
+#include "chat_log_binary.h"
+#include "chat_log_text.h"
+#include "chat_log_file.h"
+
+struct _SrnChatLogReader {
+    char *basename;
+    SrnChatLogFormat format;
+    GBytes *log; // Uncompressed content of log
+    GArray *index; // SrnChatLogIndexEntry, validated, ordered by offset,
+                   // NULL for text log
+};
+
+static GArray* load_index(const char *path, gsize log_len);
+static gsize find_index(SrnChatLogReader *reader, gint64 before);
+static void scan_records(SrnChatLogReader *reader, gsize offset, gsize end,
+        gint64 before, GArray *offsets);
+static SrnChatLogEntry* read_entry(SrnChatLogReader *reader, gsize offset);
+static GList* get_last_text(SrnChatLogReader *reader, gint64 before, int count);
+static int basename_cmp(gconstpointer a, gconstpointer b);
+
+/**
+ * @brief ``srn_chat_log_reader_new`` opens a chat log for reading, the log is
+ * decompressed into memory if it has been compressed. Messages appended after
+ * the reader is created are not visible to it.
+ *
+ * @param path Path of the ".log" or ".srnlog" file, the index of binary log
+ *      is looked up next to it
+ * @param error
+ *
+ * @return A new SrnChatLogReader, or NULL on error
+ */
+SrnChatLogReader* srn_chat_log_reader_new(const char *path, GError **error){
+    char *dir;
+    char *basename;
+    char *index_path;
+    gsize len;
+    const char *data;
+    GBytes *log;
+    SrnChatLogFormat format;
+    SrnChatLogReader *reader;
+
+    g_return_val_if_fail(path, NULL);
+
+    if (g_str_has_suffix(path, CHAT_LOG_TEXT_SUFFIX)){
+        format = SRN_CHAT_LOG_FORMAT_TEXT;
+    } else if (g_str_has_suffix(path, CHAT_LOG_BINARY_SUFFIX)){
+        format = SRN_CHAT_LOG_FORMAT_BINARY;
+    } else {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                _("Invalid chat log file: %1$s"), path);
+        return NULL;
+    }
+
+    dir = g_path_get_dirname(path);
+    basename = g_path_get_basename(path);
+    log = chat_log_file_load(dir, basename, error);
+    g_free(dir);
+    if (!log){
+        g_free(basename);
+        return NULL;
+    }
+
+    data = g_bytes_get_data(log, &len);
+    if (format == SRN_CHAT_LOG_FORMAT_BINARY
+            && (len < CHAT_LOG_MAGIC_LEN
+                || memcmp(data, CHAT_LOG_BINARY_MAGIC, CHAT_LOG_MAGIC_LEN) != 0)){
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                _("Invalid chat log file: %1$s"), path);
+        g_bytes_unref(log);
+        g_free(basename);
+        return NULL;
+    }
+
+    reader = g_malloc0(sizeof(SrnChatLogReader));
+    reader->basename = basename;
+    reader->format = format;
+    reader->log = log;
+    if (format == SRN_CHAT_LOG_FORMAT_BINARY){
+        index_path = g_strdup_printf("%.*s" CHAT_LOG_INDEX_SUFFIX,
+                (int)(strlen(path) - strlen(CHAT_LOG_BINARY_SUFFIX)), path);
+        reader->index = load_index(index_path, len);
+        g_free(index_path);
+    }
+
+    return reader;
+}
+
+void srn_chat_log_reader_free(SrnChatLogReader *reader){
+    g_return_if_fail(reader);
+
+    g_free(reader->basename);
+    g_bytes_unref(reader->log);
+    if (reader->index){
+        g_array_free(reader->index, TRUE);
+    }
+    g_free(reader);
+}
+
+/**
+ * @brief ``srn_chat_log_reader_get_last`` gets the last messages before
+ * given time.
+ *
+ * @param reader
+ * @param before Unix time, use G_MAXINT64 to get the latest messages
+ * @param count Maximum number of messages
+ *
+ * @return A list of SrnChatLogEntry in chronological order, free it with
+ *      ``g_list_free_full(lst, (GDestroyNotify)srn_chat_log_entry_free)``
+ */
+GList* srn_chat_log_reader_get_last(SrnChatLogReader *reader, gint64 before,
+        int count){
+    gsize pos;
+    gsize step;
+    gsize end;
+    gsize first;
+    GArray *offsets;
+    GList *lst;
+
+    g_return_val_if_fail(reader, NULL);
+    g_return_val_if_fail(count > 0, NULL);
+
+    if (reader->format == SRN_CHAT_LOG_FORMAT_TEXT){
+        return get_last_text(reader, before, count);
+    }
+
+    // Records before the found index entry are earlier than the given time
+    pos = find_index(reader, before);
+    if (pos == 0){
+        return NULL;
+    }
+    end = pos < reader->index->len
+        ? g_array_index(reader->index, SrnChatLogIndexEntry, pos).offset
+        : g_bytes_get_size(reader->log);
+
+    // Scan backward interval by interval, intervals may contain fewer
+    // records than CHAT_LOG_INDEX_INTERVAL when log was reopened, so the step
+    // is doubled every time
+    offsets = g_array_new(FALSE, FALSE, sizeof(gsize));
+    step = count / CHAT_LOG_INDEX_INTERVAL + 1;
+    while (pos > 0 && offsets->len < (guint)count){
+        gsize start;
+        GArray *tmp;
+
+        pos = pos > step ? pos - step : 0;
+        start = g_array_index(reader->index, SrnChatLogIndexEntry, pos).offset;
+
+        tmp = g_array_new(FALSE, FALSE, sizeof(gsize));
+        scan_records(reader, start, end, before, tmp);
+        g_array_prepend_vals(offsets, tmp->data, tmp->len);
+        g_array_free(tmp, TRUE);
+
+        end = start;
+        step *= 2;
+    }
+
+    lst = NULL;
+    first = offsets->len > (guint)count ? offsets->len - count : 0;
+    for (gsize i = offsets->len; i > first; i--){
+        lst = g_list_prepend(lst,
+                read_entry(reader, g_array_index(offsets, gsize, i - 1)));
+    }
+    g_array_free(offsets, TRUE);
+
+    return lst;
+}
+
+/**
+ * @brief ``srn_chat_log_get_history`` gets the last messages of a chat from
+ * its log files. Log files are read from the newest one until enough
+ * messages are found, so the time cost does not grow with the size of logs.
+ *
+ * @param srv_name
+ * @param chat_name
+ * @param before Unix time, messages at or after this time are ignored
+ * @param count Maximum number of messages
+ *
+ * @return A list of SrnChatLogEntry in chronological order, free it with
+ *      ``g_list_free_full(lst, (GDestroyNotify)srn_chat_log_entry_free)``
+ */
+GList* srn_chat_log_get_history(const char *srv_name, const char *chat_name,
+        gint64 before, int count){
+    char *log_dir;
+    char *srv_dir;
+    const char *name;
+    GDir *dir;
+    GPtrArray *names;
+    GHashTable *seen;
+    GList *lst;
+
+    g_return_val_if_fail(srv_name, NULL);
+    g_return_val_if_fail(chat_name, NULL);
+    g_return_val_if_fail(count > 0, NULL);
+
+    log_dir = srn_get_log_dir();
+    srv_dir = g_build_filename(log_dir, srv_name, NULL);
+    g_free(log_dir);
+
+    dir = g_dir_open(srv_dir, 0, NULL);
+    if (!dir){
+        // Nothing is logged yet
+        g_free(srv_dir);
+        return NULL;
+    }
+    names = g_ptr_array_new_with_free_func(g_free);
+    seen = g_hash_table_new(g_str_hash, g_str_equal);
+    while ((name = g_dir_read_name(dir))){
+        char *basename;
+        char *tmp;
+
+        // Log may be compressed
+        basename = chat_log_get_basename(name);
+        if (!basename){
+            continue;
+        }
+        tmp = chat_log_get_chat_name(basename, NULL);
+        if (g_ascii_strcasecmp(tmp, chat_name) == 0
+                && !g_hash_table_contains(seen, basename)){
+            g_hash_table_add(seen, basename);
+            g_ptr_array_add(names, basename);
+        } else {
+            g_free(basename);
+        }
+        g_free(tmp);
+    }
+    g_dir_close(dir);
+    g_hash_table_destroy(seen);
+
+    // Basenames start with date, the newest log is the last one
+    g_ptr_array_sort(names, basename_cmp);
+
+    lst = NULL;
+    for (guint i = names->len; i > 0 && count > 0; i--){
+        char *path;
+        GList *entries;
+        GError *err;
+        SrnChatLogReader *reader;
+
+        err = NULL;
+        path = g_build_filename(srv_dir, names->pdata[i - 1], NULL);
+        reader = srn_chat_log_reader_new(path, &err);
+        g_free(path);
+        if (!reader){
+            WARN_FR("Failed to open chat log: %s", err->message);
+            g_error_free(err);
+            continue;
+        }
+
+        entries = srn_chat_log_reader_get_last(reader, before, count);
+        srn_chat_log_reader_free(reader);
+
+        count -= g_list_length(entries);
+        lst = g_list_concat(entries, lst);
+    }
+
+    g_ptr_array_free(names, TRUE);
+    g_free(srv_dir);
+
+    return lst;
+}
+
+void srn_chat_log_entry_free(SrnChatLogEntry *entry){
+    g_return_if_fail(entry);
+
+    g_free(entry->sender);
+    g_free(entry->content);
+    g_free(entry);
+}
+
+/**
+ * @brief Get chat name from basename of log file
+ * "<YYYY-MM-DD>.<chat>.log" or "<YYYY-MM-DD>.<chat>.srnlog".
+ *
+ * @return NULL if it is not a log file.
+ */
+char* chat_log_get_chat_name(const char *basename, SrnChatLogFormat *format){
+    int y;
+    int m;
+    int d;
+    gsize len;
+    gsize suffix_len;
+    SrnChatLogFormat fmt;
+
+    if (sscanf(basename, "%4d-%2d-%2d.", &y, &m, &d) != 3
+            || strlen(basename) < 11 || basename[10] != '.'){
+        return NULL;
+    }
+
+    if (g_str_has_suffix(basename, CHAT_LOG_TEXT_SUFFIX)){
+        fmt = SRN_CHAT_LOG_FORMAT_TEXT;
+        suffix_len = strlen(CHAT_LOG_TEXT_SUFFIX);
+    } else if (g_str_has_suffix(basename, CHAT_LOG_BINARY_SUFFIX)){
+        fmt = SRN_CHAT_LOG_FORMAT_BINARY;
+        suffix_len = strlen(CHAT_LOG_BINARY_SUFFIX);
+    } else {
+        return NULL;
+    }
+
+    len = strlen(basename);
+    if (len <= 11 + suffix_len){
+        return NULL;
+    }
+    if (format){
+        *format = fmt;
+    }
+
+    return g_strndup(basename + 11, len - 11 - suffix_len);
+}
+
+/**
+ * @brief Get the uncompressed basename from a file name in log directory.
+ *
+ * @return NULL if it is not a log file.
+ */
+char* chat_log_get_basename(const char *name){
+    char *basename;
+    char *chat_name;
+
+    if (g_str_has_suffix(name, CHAT_LOG_COMPRESSED_SUFFIX)){
+        basename = g_strndup(name,
+                strlen(name) - strlen(CHAT_LOG_COMPRESSED_SUFFIX));
+    } else {
+        basename = g_strdup(name);
+    }
+
+    chat_name = chat_log_get_chat_name(basename, NULL);
+    if (!chat_name){
+        g_free(basename);
+        return NULL;
+    }
+    g_free(chat_name);
+
+    return basename;
+}
+
+/**
+ * @brief Open a log file for reading, the compressed one is decompressed on
+ * the fly if the uncompressed one does not exist.
+ */
+GInputStream* chat_log_file_open(const char *dir, const char *basename,
+        GError **error){
+    char *path;
+    GError *err;
+    GFile *file;
+    GInputStream *stream;
+
+    err = NULL;
+    path = g_build_filename(dir, basename, NULL);
+    file = g_file_new_for_path(path);
+    stream = G_INPUT_STREAM(g_file_read(file, NULL, &err));
+    g_object_unref(file);
+
+    if (!stream && g_error_matches(err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)){
+        char *gz_path;
+        GInputStream *base;
+
+        g_clear_error(&err);
+        gz_path = g_strconcat(path, CHAT_LOG_COMPRESSED_SUFFIX, NULL);
+        file = g_file_new_for_path(gz_path);
+        base = G_INPUT_STREAM(g_file_read(file, NULL, &err));
+        g_object_unref(file);
+        g_free(gz_path);
+
+        if (base){
+            GConverter *conv;
+
+            conv = G_CONVERTER(g_zlib_decompressor_new(
+                        G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+            stream = g_converter_input_stream_new(base, conv);
+            g_object_unref(conv);
+            g_object_unref(base);
+        }
+    }
+    g_free(path);
+
+    if (err){
+        g_propagate_error(error, err);
+    }
+
+    return stream;
+}
+
+/**
+ * @brief Load the whole content of log file, the uncompressed one is mapped
+ * into memory, the compressed one is decompressed into memory.
+ */
+GBytes* chat_log_file_load(const char *dir, const char *basename,
+        GError **error){
+    char *path;
+    GBytes *bytes;
+    GMappedFile *file;
+    GInputStream *in;
+    GOutputStream *out;
+
+    path = g_build_filename(dir, basename, NULL);
+    file = g_mapped_file_new(path, FALSE, NULL);
+    g_free(path);
+    if (file){
+        bytes = g_mapped_file_get_bytes(file);
+        g_mapped_file_unref(file);
+        return bytes;
+    }
+
+    in = chat_log_file_open(dir, basename, error);
+    if (!in){
+        return NULL;
+    }
+    out = g_memory_output_stream_new_resizable();
+    bytes = NULL;
+    if (g_output_stream_splice(out, in,
+                G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE
+                | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                NULL, error) >= 0){
+        bytes = g_memory_output_stream_steal_as_bytes(
+                G_MEMORY_OUTPUT_STREAM(out));
+    }
+    g_object_unref(out);
+    g_object_unref(in);
+
+    return bytes;
+}
+
+/**
+ * @brief Get the uncompressed size of log file. For compressed log, the size
+ * is read from the gzip trailer, which is correct for files smaller than
+ * 4 GiB.
+ */
+bool chat_log_file_get_size(const char *dir, const char *basename,
+        guint64 *size){
+    bool ok;
+    char *path;
+    char *gz_path;
+    guint8 isize[4];
+    FILE *fp;
+    GStatBuf st;
+
+    path = g_build_filename(dir, basename, NULL);
+    if (g_stat(path, &st) == 0){
+        *size = st.st_size;
+        g_free(path);
+        return TRUE;
+    }
+
+    gz_path = g_strconcat(path, CHAT_LOG_COMPRESSED_SUFFIX, NULL);
+    fp = g_fopen(gz_path, "rb");
+    g_free(gz_path);
+    g_free(path);
+    if (!fp){
+        return FALSE;
+    }
+
+    ok = fseek(fp, -4, SEEK_END) == 0 && fread(isize, 1, 4, fp) == 4;
+    if (ok){
+        // ISIZE is little endian
+        *size = (guint64)isize[0] | (guint64)isize[1] << 8
+            | (guint64)isize[2] << 16 | (guint64)isize[3] << 24;
+    }
+    fclose(fp);
+
+    return ok;
+}
+
+/**
+ * @brief Parse a line of text log, which is written by ``write_text_message``
+ * in chat_log.c, the line should not contain trailing newline.
+ */
+bool chat_log_text_parse_line(const char *basename, const char *line,
+        SrnChatLogEntry *entry){
+    int year;
+    int month;
+    int day;
+    int hour;
+    int min;
+    int sec;
+    const char *p;
+    const char *end;
+    GDateTime *time;
+
+    if (sscanf(basename, "%4d-%2d-%2d", &year, &month, &day) != 3
+            || sscanf(line, "[%2d:%2d:%2d] ", &hour, &min, &sec) != 3
+            || strlen(line) < 11 || line[9] != ']' || line[10] != ' '){
+        return FALSE;
+    }
+
+    p = line + 11;
+    if (p[0] == '<' && (end = strstr(p, "> "))){
+        if (end > p + 1 && end[-1] == '*'){
+            entry->type = SRN_CHAT_LOG_MESSAGE_TYPE_SENT;
+            entry->sender = g_strndup(p + 1, end - p - 2);
+        } else {
+            entry->type = SRN_CHAT_LOG_MESSAGE_TYPE_RECV;
+            entry->sender = g_strndup(p + 1, end - p - 1);
+        }
+        entry->content = g_strdup(end + 2);
+    } else if (g_str_has_prefix(p, "* ") && (end = strchr(p + 2, ' '))){
+        entry->type = SRN_CHAT_LOG_MESSAGE_TYPE_ACTION;
+        entry->sender = g_strndup(p + 2, end - p - 2);
+        entry->content = g_strdup(end + 1);
+    } else if (g_str_has_prefix(p, "= ")){
+        entry->type = SRN_CHAT_LOG_MESSAGE_TYPE_MISC;
+        entry->content = g_strdup(p + 2);
+    } else if (g_str_has_prefix(p, "! ")){
+        entry->type = SRN_CHAT_LOG_MESSAGE_TYPE_ERROR;
+        entry->content = g_strdup(p + 2);
+    } else {
+        return FALSE;
+    }
+
+    time = g_date_time_new_local(year, month, day, hour, min, sec);
+    if (time){
+        entry->time = g_date_time_to_unix(time);
+        entry->utc_offset = g_date_time_get_utc_offset(time) / G_TIME_SPAN_SECOND;
+        g_date_time_unref(time);
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Load index entries which point into the log, the index is only a
+ * hint so that the entries after the first invalid one are ignored.
+ * The first record is always indexed.
+ */
+static GArray* load_index(const char *path, gsize log_len){
+    gsize len;
+    const char *data;
+    GMappedFile *file;
+    GArray *index;
+    SrnChatLogIndexEntry entry;
+
+    index = g_array_new(FALSE, FALSE, sizeof(SrnChatLogIndexEntry));
+    entry.time = G_MININT64;
+    entry.offset = CHAT_LOG_MAGIC_LEN;
+    g_array_append_val(index, entry);
+
+    file = g_mapped_file_new(path, FALSE, NULL);
+    if (!file){
+        WARN_FR("Index of chat log '%s' not found", path);
+        return index;
+    }
+
+    len = g_mapped_file_get_length(file);
+    data = g_mapped_file_get_contents(file);
+    if (len < CHAT_LOG_MAGIC_LEN
+            || memcmp(data, CHAT_LOG_INDEX_MAGIC, CHAT_LOG_MAGIC_LEN) != 0){
+        WARN_FR("Invalid index of chat log '%s'", path);
+        g_mapped_file_unref(file);
+        return index;
+    }
+
+    for (gsize i = CHAT_LOG_MAGIC_LEN; i + sizeof(entry) <= len; i += sizeof(entry)){
+        SrnChatLogIndexEntry *last;
+
+        memcpy(&entry, data + i, sizeof(entry));
+        last = &g_array_index(index, SrnChatLogIndexEntry, index->len - 1);
+        if (entry.offset < last->offset || entry.offset >= log_len
+                || entry.time < last->time){
+            break;
+        }
+        if (entry.offset == last->offset){
+            last->time = entry.time;
+            continue;
+        }
+        g_array_append_val(index, entry);
+    }
+
+    g_mapped_file_unref(file);
+
+    return index;
+}
+
+/**
+ * @brief Find the first index entry whose time is not earlier than given
+ * time.
+ */
+static gsize find_index(SrnChatLogReader *reader, gint64 before){
+    gsize lo;
+    gsize hi;
+
+    lo = 0;
+    hi = reader->index->len;
+    while (lo < hi){
+        gsize mid;
+
+        mid = lo + (hi - lo) / 2;
+        if (g_array_index(reader->index, SrnChatLogIndexEntry, mid).time < before){
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * @brief Collect offsets of records in [offset, end) which are earlier than
+ * given time. Scanning stops at the first record which is not earlier than
+ * given time, or a truncated record.
+ */
+static void scan_records(SrnChatLogReader *reader, gsize offset, gsize end,
+        gint64 before, GArray *offsets){
+    const char *data;
+
+    data = g_bytes_get_data(reader->log, NULL);
+    end = MIN(end, g_bytes_get_size(reader->log));
+
+    while (offset + sizeof(SrnChatLogBinaryHeader) <= end){
+        guint64 len;
+        SrnChatLogBinaryHeader hdr;
+
+        // Records are not aligned
+        memcpy(&hdr, data + offset, sizeof(hdr));
+        len = (guint64)sizeof(hdr) + hdr.sender_len + hdr.content_len;
+        if (len > end - offset){
+            break;
+        }
+        if (hdr.time >= before){
+            break;
+        }
+
+        g_array_append_val(offsets, offset);
+        offset += len;
+    }
+}
+
+static SrnChatLogEntry* read_entry(SrnChatLogReader *reader, gsize offset){
+    const char *data;
+    SrnChatLogEntry *entry;
+    SrnChatLogBinaryHeader hdr;
+
+    data = (const char *)g_bytes_get_data(reader->log, NULL) + offset;
+    memcpy(&hdr, data, sizeof(hdr));
+    data += sizeof(hdr);
+
+    entry = g_malloc0(sizeof(SrnChatLogEntry));
+    entry->type = hdr.type;
+    entry->time = hdr.time;
+    entry->utc_offset = hdr.utc_offset;
+    if (hdr.sender_len){
+        entry->sender = g_strndup(data, hdr.sender_len);
+    }
+    entry->content = g_strndup(data + hdr.sender_len, hdr.content_len);
+
+    return entry;
+}
+
+/**
+ * @brief Scan text log backward line by line, lines at or after the given
+ * time are skipped.
+ */
+static GList* get_last_text(SrnChatLogReader *reader, gint64 before,
+        int count){
+    gsize end;
+    const char *data;
+    GList *lst;
+
+    data = g_bytes_get_data(reader->log, &end);
+
+    // Ignore incomplete line which is being written
+    while (end > 0 && data[end - 1] != '\n'){
+        end--;
+    }
+
+    lst = NULL;
+    while (end > 0 && count > 0){
+        gsize start;
+        gsize len;
+        char *line;
+        SrnChatLogEntry *entry;
+
+        start = end - 1;
+        while (start > 0 && data[start - 1] != '\n'){
+            start--;
+        }
+        len = end - 1 - start;
+        if (len > 0 && data[start + len - 1] == '\r'){
+            len--;
+        }
+        line = g_strndup(data + start, len);
+
+        entry = g_malloc0(sizeof(SrnChatLogEntry));
+        if (chat_log_text_parse_line(reader->basename, line, entry)
+                && entry->time < before){
+            lst = g_list_prepend(lst, entry);
+            count--;
+        } else {
+            srn_chat_log_entry_free(entry);
+        }
+        g_free(line);
+
+        end = start;
+    }
+
+    return lst;
+}
+
+static int basename_cmp(gconstpointer a, gconstpointer b){
+    return strcmp(*(const char **)a, *(const char **)b);
+}
@@ -0,0 +1,44 @@
+/* Copyright (C) 2016-2017 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This is a private header file and should not be exported. */
+
+#ifndef __CHAT_LOG_TEXT_H
+#define __CHAT_LOG_TEXT_H
+
+/*
+ * Layout of text chat log "<YYYY-MM-DD>.<chat>.log", one message per line:
+ *   "[HH:MM:SS] <nick> content"   received message or notice
+ *   "[HH:MM:SS] <nick*> content"  sent message
+ *   "[HH:MM:SS] * nick content"   action
+ *   "[HH:MM:SS] = content"        misc message
+ *   "[HH:MM:SS] ! content"        error message
+ *
+ * The time is local time, and the date is taken from file name.
+ */
+
+#include <glib.h>
+
+#include "srain.h"
+#include "chat_log.h"
+
+#define CHAT_LOG_TEXT_SUFFIX        ".log"
+
+bool chat_log_text_parse_line(const char *basename, const char *line, SrnChatLogEntry *entry);
+
+#endif /* __CHAT_LOG_TEXT_H */
@@ -239,6 +239,53 @@ char *srn_create_log_file(const char *srv_name, const char *fname){
     return path;
 }
 
+/**
+ * @brief srn_get_log_dir returns the path of directory where chat logs are
+ *  stored, the directory may not exist.
+ *
+ * @return Path to chat logs directory, must be freed by g_free.
+ */
+char *srn_get_log_dir(){
+    char *path;
+
+    path = srn_try_to_find_user_file("logs");
+    if (!path){
+        // $XDG_DATA_HOME/srain/logs
+        path = g_build_filename(g_get_user_data_dir(), PACKAGE, "logs", NULL);
+    }
+
+    return path;
+}
+
+/**
+ * @brief srn_create_cache_dir returns the path of a sub-directory of user
+ *  cache directory, the directory is created if not exist.
+ *
+ * @param name Name of the sub-directory
+ *
+ * @return NULL or path to $XDG_CACHE_HOME/srain/<name>, must be freed by
+ *  g_free.
+ */
+char *srn_create_cache_dir(const char *name){
+    char *path;
+    SrnRet ret;
+
+    path = g_build_filename(g_get_user_cache_dir(), PACKAGE, name, NULL);
+    if (!path){
+        return NULL;
+    }
+
+    ret = create_dir_if_not_exist(path);
+    if (!RET_IS_OK(ret)){
+        WARN_FR("Failed to create cache directory: %1$s", RET_MSG(ret));
+
+        g_free(path);
+        return NULL;
+    }
+
+    return path;
+}
+
 /**
  * @brief srn_create_user_files creates users files which required for
  *  running of Srain
@@ -103,17 +103,23 @@ static SrnRet render(SrnMessage *msg) {
                 time = g_match_info_fetch_named(match_info, "time");
 
                 if (sender) {
-                    g_free(msg->rendered_remark);
-                    msg->rendered_remark = msg->rendered_sender;
-                    msg->rendered_sender = g_markup_escape_text(sender, -1);
+                    char *markup;
+
+                    markup = g_markup_escape_text(sender, -1);
+                    srn_message_set_rendered_remark(msg, msg->rendered_sender);
+                    srn_message_set_rendered_sender(msg, markup);
+                    g_free(markup);
                 }
                 if (content) {
                     g_free(msg->rendered_content);
                     msg->rendered_content = g_markup_escape_text(content, -1);
                 }
                 if (time) {
-                    g_free(msg->rendered_short_time);
-                    msg->rendered_short_time = g_markup_escape_text(time, -1);
+                    char *markup;
+
+                    markup = g_markup_escape_text(time, -1);
+                    srn_message_set_rendered_time(msg, markup);
+                    g_free(markup);
                 }
 
                 g_free(sender);
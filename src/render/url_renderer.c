@@ -208,7 +208,7 @@ void text(GMarkupParseContext *context, const gchar *text, gsize text_len,
                     break;
             }
 
-            msg->urls = g_list_append(msg->urls, url);
+            srn_message_add_url(msg, url);
             g_string_append(rcontent, markuped_url);
 
             DBG_FR("Appended url: %s", url);
@@ -52,6 +52,18 @@ struct _SircSession {
     SircConfig *cfg;
     void *ctx;
 
+    /* Transcoding, reopened when the encoding of config is changed */
+    char *codeset;      // Codeset which conv converts from
+    GIConv conv;        // (GIConv)-1 if codeset is UTF-8 or invalid
+
+    GHashTable *batches; // Reference → SircBatch, batches not yet ended
+
+    /* Labeled response, see sirc_begin_label() */
+    char *label;        // Label of commands being sent, possibly NULL
+    int label_count;    // Number of commands labeled with it
+
+    int prefix_len;     // Length of our "nick!user@host", 0 if unknown
+
     // ONLY FOR DEBUG
     int msgid;          // Message ID
 };
@@ -67,6 +79,10 @@ static void on_disconnect_ready(GObject *obj, GAsyncResult *result, gpointer use
 static void on_recv_ready(GObject *obj, GAsyncResult *res, gpointer user_data);
 static void on_disconnect(SircSession *sirc, const char *reason);
 
+static char* transcode_line(SircSession *sirc, const char *line, gsize len);
+static char* transcode_text(SircSession *sirc, const char *line, gsize len);
+static bool is_plain_ascii(const char *str, gsize len);
+
 SircSession* sirc_new_session(SircEvents *events, SircConfig *cfg){
     SircSession *sirc;
 
@@ -83,6 +99,9 @@ SircSession* sirc_new_session(SircEvents *events, SircConfig *cfg){
     sirc->client = g_socket_client_new();
     // g_socket_client_set_timeout(sirc->client, SERVER_PING_INTERVAL);
     sirc->cancel = g_cancellable_new();
+    sirc->conv = (GIConv)-1;
+    sirc->batches = g_hash_table_new_full(g_str_hash, g_str_equal,
+            NULL, (GDestroyNotify)sirc_batch_free);
 
     return sirc;
 }
@@ -101,6 +120,12 @@ void sirc_free_session(SircSession *sirc){
     g_object_unref(sirc->client);
     g_object_unref(sirc->cancel);
     str_assign(&sirc->host, NULL);
+    str_assign(&sirc->codeset, NULL);
+    if (sirc->conv != (GIConv)-1){
+        g_iconv_close(sirc->conv);
+    }
+    g_hash_table_destroy(sirc->batches);
+    str_assign(&sirc->label, NULL);
 
     g_free(sirc);
 }
@@ -145,6 +170,132 @@ void* sirc_get_ctx(SircSession *sirc){
     return sirc->ctx;
 }
 
+/**
+ * @brief ``sirc_set_prefix_len`` tells session the length of
+ * "nick!user@host" which server prepends to messages sent by us, so that
+ * long messages are split exactly at the IRC line limit.
+ *
+ * @param sirc
+ * @param prefix_len 0 if unknown
+ */
+void sirc_set_prefix_len(SircSession *sirc, int prefix_len){
+    g_return_if_fail(sirc);
+    g_return_if_fail(prefix_len >= 0);
+
+    sirc->prefix_len = prefix_len;
+}
+
+int sirc_get_prefix_len(SircSession *sirc){
+    g_return_val_if_fail(sirc, 0);
+
+    return sirc->prefix_len;
+}
+
+/**
+ * @brief ``sirc_add_batch`` adds a started batch to session, the batch is
+ * owned by session until it is removed.
+ */
+void sirc_add_batch(SircSession *sirc, SircBatch *batch){
+    g_return_if_fail(sirc);
+    g_return_if_fail(batch);
+
+    // Reference is reused before the batch ends, do not trust the server
+    sirc_remove_batch(sirc, batch->ref);
+    // Key is owned by batch
+    g_hash_table_insert(sirc->batches, batch->ref, batch);
+}
+
+SircBatch* sirc_get_batch(SircSession *sirc, const char *ref){
+    g_return_val_if_fail(sirc, NULL);
+    g_return_val_if_fail(ref, NULL);
+
+    return g_hash_table_lookup(sirc->batches, ref);
+}
+
+void sirc_remove_batch(SircSession *sirc, const char *ref){
+    GHashTableIter iter;
+    SircBatch *batch;
+    SircBatch *child;
+
+    g_return_if_fail(sirc);
+    g_return_if_fail(ref);
+
+    batch = g_hash_table_lookup(sirc->batches, ref);
+    if (!batch){
+        return;
+    }
+    // Nested batches should be ended before their parent, but do not trust
+    // the server
+    g_hash_table_iter_init(&iter, sirc->batches);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&child)){
+        if (child->parent == batch){
+            child->parent = NULL;
+        }
+    }
+    g_hash_table_remove(sirc->batches, ref);
+}
+
+/**
+ * @brief ``sirc_begin_label`` attaches label to every command sent until
+ * ``sirc_end_label`` is called, see
+ * https://ircv3.net/specs/extensions/labeled-response.
+ *
+ * A message may be split into several commands, the first one is labeled
+ * with ``label`` and the following ones are labeled with "<label>.<n>",
+ * so that labels of pending commands are unique.
+ *
+ * @param sirc
+ * @param label Must not contain '.'
+ */
+void sirc_begin_label(SircSession *sirc, const char *label){
+    g_return_if_fail(sirc);
+    g_return_if_fail(label && !strchr(label, '.'));
+
+    str_assign(&sirc->label, label);
+    sirc->label_count = 0;
+}
+
+/**
+ * @brief ``sirc_end_label`` stops labeling commands.
+ *
+ * @return Number of labeled commands since ``sirc_begin_label``
+ */
+int sirc_end_label(SircSession *sirc){
+    int count;
+
+    g_return_val_if_fail(sirc, 0);
+
+    count = sirc->label_count;
+    str_assign(&sirc->label, NULL);
+    sirc->label_count = 0;
+
+    return count;
+}
+
+/**
+ * @brief ``sirc_new_label`` returns label of the next command to be sent.
+ *
+ * @return NULL if commands are not being labeled, otherwise the returned
+ *      value should be freed by ``g_free``.
+ */
+char* sirc_new_label(SircSession *sirc){
+    char *label;
+
+    g_return_val_if_fail(sirc, NULL);
+
+    if (!sirc->label){
+        return NULL;
+    }
+    if (sirc->label_count == 0){
+        label = g_strdup(sirc->label);
+    } else {
+        label = g_strdup_printf("%s.%d", sirc->label, sirc->label_count);
+    }
+    sirc->label_count++;
+
+    return label;
+}
+
 void sirc_connect(SircSession *sirc, const char *host, int port){
     char *escaped_host;
 
@@ -156,6 +307,7 @@ void sirc_connect(SircSession *sirc, const char *host, int port){
     g_cancellable_reset(sirc->cancel);
     str_assign(&sirc->host, escaped_host);
     sirc->port = port;
+    sirc->prefix_len = 0;
     g_socket_client_connect_to_host_async (sirc->client, escaped_host,
             port, sirc->cancel, on_connect_ready, sirc);
     g_free(escaped_host);
@@ -185,6 +337,7 @@ static void sirc_recv(SircSession *sirc){
 
 static void on_recv_ready(GObject *obj, GAsyncResult *res, gpointer user_data){
     int size;
+    char *line;
     GInputStream *in;
     GError *err;
     SircSession *sirc;
@@ -228,20 +381,23 @@ static void on_recv_ready(GObject *obj, GAsyncResult *res, gpointer user_data){
     sirc->bufptr -= 2;
     sirc->buf[sirc->bufptr] = '\0';
 
-    DBG_FR("Line: %s", sirc->buf);
+    /* Transcode the whole line before parsing */
+    line = transcode_line(sirc, sirc->buf, sirc->bufptr);
+
+    DBG_FR("Line: %s", line ? line : sirc->buf);
 
-    imsg = sirc_parse(sirc->buf);
+    imsg = sirc_parse(line ? line : sirc->buf);
     if (!imsg){
-        ERR_FR("Failed to parse line: %s", sirc->buf);
+        ERR_FR("Failed to parse line: %s", line ? line : sirc->buf);
+        g_free(line);
         goto FIN;
     }
 
-    /* Transcoding */
-    sirc_message_transcoding(imsg, sirc->cfg->encoding);
     /* Handle event */
     sirc_event_hdr(sirc, imsg);
 
     sirc_message_free(imsg);
+    g_free(line);
 
 FIN:
     /* Clear buffer */
@@ -372,7 +528,7 @@ static void on_disconnect_ready(GObject *obj, GAsyncResult *result, gpointer use
 
 static void on_connect_finish(SircSession *sirc, GIOStream *stream){
     LOG_FR("Connected");
-    g_autoptr(SircMessageContext) context = sirc_message_context_new(NULL);
+    g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
 
     sirc->stream = stream;
     sirc_recv(sirc);
@@ -385,7 +541,7 @@ static void on_connect_finish(SircSession *sirc, GIOStream *stream){
 
 static void on_connect_fail(SircSession *sirc, const char *reason){
     const char *params[] = { reason };
-    g_autoptr(SircMessageContext) context = sirc_message_context_new(NULL);
+    g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
 
     ERR_FR("Connect failed: %s", reason);
 
@@ -397,15 +553,160 @@ static void on_connect_fail(SircSession *sirc, const char *reason){
 
 static void on_disconnect(SircSession *sirc, const char *reason){
     const char *params[] = { reason };
-    g_autoptr(SircMessageContext) context = sirc_message_context_new(NULL);
+    g_autoptr(SircMessageContext) context = sirc_message_context_new(0);
 
     LOG_FR("Disconnected: %s", reason);
 
     g_object_unref(sirc->stream);
     sirc->stream = NULL;
+    // Unfinished batches never end
+    g_hash_table_remove_all(sirc->batches);
 
     if (!sirc->events->disconnect) {
         g_return_if_fail(0);
     }
     sirc->events->disconnect(sirc, "DISCONNECT", "", params, 1, context);
 }
+
+/**
+ * @brief Transcode a received line to SRN_CODESET, make it valid if it is
+ * not.
+ *
+ * Tags are guaranteed to be UTF-8 by
+ * https://ircv3.net/specs/extensions/message-tags, so only the part after
+ * them is transcoded.
+ *
+ * @return NULL if the line can be used as is, otherwise a newly allocated
+ *      string.
+ */
+static char* transcode_line(SircSession *sirc, const char *line, gsize len){
+    char *tags;
+    char *text;
+    char *res;
+    const char *body;
+    gsize body_len;
+
+    if (is_plain_ascii(line, len)){
+        return NULL;
+    }
+
+    // Message tags are always in UTF-8, only the rest of line is in the
+    // encoding of server
+    body = NULL;
+    if (len > 0 && line[0] == '@'){
+        body = memchr(line, ' ', len);
+    }
+    if (!body){
+        return transcode_text(sirc, line, len);
+    }
+    while (body < line + len && *body == ' '){
+        body++;
+    }
+    body_len = line + len - body;
+
+    text = transcode_text(sirc, body, body_len);
+    if (!text && g_utf8_validate(line, body - line, NULL)){
+        return NULL;
+    }
+
+    tags = g_utf8_make_valid(line, body - line);
+    if (!text){
+        text = g_strndup(body, body_len);
+    }
+    res = g_strconcat(tags, text, NULL);
+    g_free(tags);
+    g_free(text);
+
+    return res;
+}
+
+/**
+ * @brief Convert text from the encoding of server to UTF-8.
+ *
+ * @return NULL if the text is already valid UTF-8, else a newly allocated
+ * string.
+ */
+static char* transcode_text(SircSession *sirc, const char *line, gsize len){
+    char *res;
+    const char *encoding;
+    GError *err;
+
+    if (is_plain_ascii(line, len)){
+        return NULL;
+    }
+
+    encoding = sirc->cfg->encoding;
+    if (g_strcmp0(sirc->codeset, encoding) != 0){
+        if (sirc->conv != (GIConv)-1){
+            g_iconv_close(sirc->conv);
+            sirc->conv = (GIConv)-1;
+        }
+        if (g_ascii_strcasecmp(encoding, SRN_CODESET) != 0){
+            sirc->conv = g_iconv_open(SRN_CODESET, encoding);
+            if (sirc->conv == (GIConv)-1){
+                WARN_FR("Failed to open converter from %s to %s",
+                        encoding, SRN_CODESET);
+            }
+        }
+        str_assign(&sirc->codeset, encoding);
+    }
+
+    if (sirc->conv == (GIConv)-1){
+        // UTF-8 to UTF-8, just make sure it is valid
+        if (g_utf8_validate(line, len, NULL)){
+            return NULL;
+        }
+        return g_utf8_make_valid(line, len);
+    }
+
+    // Reset the shift state left by previous line
+    g_iconv(sirc->conv, NULL, NULL, NULL, NULL);
+    err = NULL;
+    res = g_convert_with_iconv(line, len, sirc->conv, NULL, NULL, &err);
+    if (!res){
+        // Rare, the fallback opens a converter of its own
+        g_clear_error(&err);
+        res = g_convert_with_fallback(line, len, SRN_CODESET, encoding,
+                "\xef\xbf\xbd", NULL, NULL, &err); // U+FFFD
+    }
+    if (!res){
+        WARN_FR("Failed to convert line from %s to %s: %s",
+                encoding, SRN_CODESET, err->message);
+        g_error_free(err);
+        res = g_utf8_make_valid(line, len);
+    }
+
+    return res;
+}
+
+/**
+ * @brief Whether a string only consists of ASCII characters except ESC,
+ * such string needs no transcoding. ESC is excluded because it switches
+ * character set in ISO-2022 encodings.
+ *
+ * Eight bytes are checked at once.
+ */
+static bool is_plain_ascii(const char *str, gsize len){
+    const guint64 ones = G_GUINT64_CONSTANT(0x0101010101010101);
+    const guint64 highs = G_GUINT64_CONSTANT(0x8080808080808080);
+    const guint64 escs = ones * 0x1b;
+    gsize i;
+
+    for (i = 0; i + sizeof(guint64) <= len; i += sizeof(guint64)){
+        guint64 word;
+        guint64 esc;
+
+        memcpy(&word, str + i, sizeof(word));
+        esc = word ^ escs; // Byte is zero if it is ESC
+        if ((word & highs) || ((esc - ones) & ~esc & highs)){
+            return FALSE;
+        }
+    }
+    for (; i < len; i++){
+        if ((guchar)str[i] >= 0x80 || str[i] == '\x1b'){
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
@@ -40,6 +40,11 @@
 #include "log.h"
 #include "utils.h"
 
+static int send_msg(SircSession *sirc, const char *cmd, const char *target,
+        const char *msg);
+static bool fits_in_one_line(SircSession *sirc, const char *cmd,
+        const char *targets, const char *msg);
+
 int sirc_cmd_ping(SircSession *sirc, const char *data){
     g_return_val_if_fail(!str_is_empty(data), SRN_ERR);
 
@@ -126,34 +131,64 @@ int sirc_cmd_msg(SircSession *sirc, const char *chan, const char *msg){
     g_return_val_if_fail(!str_is_empty(chan), SRN_ERR);
     g_return_val_if_fail(!str_is_empty(msg), SRN_ERR);
 
-    const char *origin_msg = msg;
-    while (msg) {
-        SircCommandBuilder *builder = sirc_command_builder_new("PRIVMSG");
-        if (!sirc_command_builder_add_middle(builder, chan)) {
-            sirc_command_builder_free(builder);
-            g_warn_if_reached();
-            return SRN_ERR;
+    return send_msg(sirc, "PRIVMSG", chan, msg);
+}
+
+// sirc_cmd_msg_multi: For sending the same PRIVMSG or NOTICE to many targets.
+// Targets are packed into comma separated lists of at most max_targets
+// targets (0 means no limit) as long as the message still fits in one line,
+// so a message which has to be split is sent to every target respectively.
+int sirc_cmd_msg_multi(SircSession *sirc, const char *cmd,
+        const char **targets, int max_targets, const char *msg){
+    int ngroup;
+    SrnRet ret;
+    GString *group;
+
+    g_return_val_if_fail(g_strcmp0(cmd, "PRIVMSG") == 0
+            || g_strcmp0(cmd, "NOTICE") == 0, SRN_ERR);
+    g_return_val_if_fail(targets, SRN_ERR);
+    g_return_val_if_fail(!str_is_empty(msg), SRN_ERR);
+
+    if (max_targets <= 0){
+        max_targets = G_MAXINT;
+    }
+
+    ret = SRN_OK;
+    ngroup = 0;
+    group = g_string_new(NULL);
+    for (int i = 0; targets[i]; i++){
+        if (str_is_empty(targets[i])){
+            continue;
         }
-        msg = sirc_command_builder_set_trailing(builder, msg);
-        // Prevent endless loop
-        if (msg == origin_msg) {
-            sirc_command_builder_free(builder);
-            g_warn_if_reached();
-            return SRN_ERR;
+        if (ngroup > 0){
+            bool fit;
+            char *packed;
+
+            packed = g_strdup_printf("%s,%s", group->str, targets[i]);
+            fit = ngroup < max_targets && fits_in_one_line(sirc, cmd, packed, msg);
+            g_free(packed);
+            if (!fit){
+                ret = send_msg(sirc, cmd, group->str, msg);
+                if (!RET_IS_OK(ret)){
+                    break;
+                }
+                g_string_truncate(group, 0);
+                ngroup = 0;
+            }
         }
 
-        char *cmd = sirc_command_builder_build(builder);
-        SrnRet ret = sirc_cmd_raw(sirc, "%s", cmd);
-        g_free(cmd);
-        sirc_command_builder_free(builder);
-
-        if (!RET_IS_OK(ret)) {
-            return ret;
+        if (ngroup > 0){
+            g_string_append_c(group, ',');
         }
+        g_string_append(group, targets[i]);
+        ngroup++;
+    }
+    if (RET_IS_OK(ret) && ngroup > 0){
+        ret = send_msg(sirc, cmd, group->str, msg);
     }
+    g_string_free(group, TRUE);
 
-    // Entire message has been sent
-    return SRN_OK;
+    return ret;
 }
 
 int sirc_cmd_names(SircSession *sirc, const char *chan){
@@ -168,6 +203,30 @@ int sirc_cmd_whois(SircSession *sirc, const char *who){
     return sirc_cmd_raw(sirc, "WHOIS %s\r\n", who);
 }
 
+int sirc_cmd_who(SircSession *sirc, const char *mask, const char *options){
+    g_return_val_if_fail(!str_is_empty(mask), SRN_ERR);
+
+    if (options){
+        return sirc_cmd_raw(sirc, "WHO %s %s\r\n", mask, options);
+    } else {
+        return sirc_cmd_raw(sirc, "WHO %s\r\n", mask);
+    }
+}
+
+int sirc_cmd_ison(SircSession *sirc, const char *nicks){
+    g_return_val_if_fail(!str_is_empty(nicks), SRN_ERR);
+
+    return sirc_cmd_raw(sirc, "ISON :%s\r\n", nicks);
+}
+
+// sirc_cmd_monitor: op is '+' or '-', targets are separated by comma
+int sirc_cmd_monitor(SircSession *sirc, char op, const char *targets){
+    g_return_val_if_fail(op == '+' || op == '-', SRN_ERR);
+    g_return_val_if_fail(!str_is_empty(targets), SRN_ERR);
+
+    return sirc_cmd_raw(sirc, "MONITOR %c %s\r\n", op, targets);
+}
+
 int sirc_cmd_invite(SircSession *sirc, const char *nick, const char *chan){
     g_return_val_if_fail(!str_is_empty(nick), SRN_ERR);
     g_return_val_if_fail(!str_is_empty(chan), SRN_ERR);
@@ -278,12 +337,33 @@ int sirc_cmd_away(SircSession *sirc, const char *msg){
     }
 }
 
+/**
+ * @brief ``sirc_cmd_chathistory`` requests history messages of target, see
+ * https://ircv3.net/specs/extensions/chathistory
+ *
+ * @param subcmd Such as "LATEST", "BEFORE"
+ * @param ref "*", "msgid=<msgid>" or "timestamp=<time>"
+ * @param limit Max number of messages
+ */
+int sirc_cmd_chathistory(SircSession *sirc, const char *subcmd,
+        const char *target, const char *ref, int limit){
+    g_return_val_if_fail(!str_is_empty(subcmd), SRN_ERR);
+    g_return_val_if_fail(!str_is_empty(target), SRN_ERR);
+    g_return_val_if_fail(!str_is_empty(ref), SRN_ERR);
+    g_return_val_if_fail(limit > 0, SRN_ERR);
+
+    return sirc_cmd_raw(sirc, "CHATHISTORY %s %s %s %d\r\n",
+            subcmd, target, ref, limit);
+}
+
 int sirc_get_msgid(SircSession *sirc);
 void sirc_set_msgid(SircSession *sirc, int msgid);
 
 int sirc_cmd_raw(SircSession *sirc, const char *fmt, ...){
     char buf[SIRC_BUF_LEN];
+    char *label;
     int len = 0;
+    int tag_len = 0;
     int msgid = sirc_get_msgid(sirc);
     va_list args;
     GIOStream *stream;
@@ -293,17 +373,24 @@ int sirc_cmd_raw(SircSession *sirc, const char *fmt, ...){
     stream = sirc_get_stream(sirc);
     g_return_val_if_fail(G_IS_IO_STREAM(stream), SRN_ERR);
 
+    label = sirc_new_label(sirc);
+    if (label){
+        tag_len = snprintf(buf, sizeof(buf), "@label=%s ", label);
+        g_free(label);
+    }
     if (strlen(fmt) != 0){
         va_start(args, fmt);
-        len = vsnprintf(buf, sizeof(buf), fmt, args);
+        len = vsnprintf(buf + tag_len, sizeof(buf) - tag_len, fmt, args);
         va_end(args);
     }
     DBG_FR("[#%d] Send raw: %s", msgid, buf);
 
+    // Tags are not counted in the 512 bytes limit
     if (len > 512){
         WARN_FR("Raw command too long");
         len = 512;
     }
+    len += tag_len;
 
     // TODO send it totally
     msgid++;
@@ -311,3 +398,48 @@ int sirc_cmd_raw(SircSession *sirc, const char *fmt, ...){
     return (io_stream_write(stream, buf, len) < 0) ?
         SRN_ERR : SRN_OK;
 }
+
+/**
+ * @brief Send a PRIVMSG or NOTICE, long message is split into lines.
+ */
+static int send_msg(SircSession *sirc, const char *cmd, const char *target,
+        const char *msg){
+    while (msg) {
+        const char *rest;
+        SircCommandBuilder builder;
+
+        sirc_command_builder_init(&builder, cmd, sirc_get_prefix_len(sirc));
+        if (!sirc_command_builder_add_middle(&builder, target)) {
+            g_warn_if_reached();
+            return SRN_ERR;
+        }
+        rest = sirc_command_builder_set_trailing(&builder, msg);
+        // Prevent endless loop
+        if (rest == msg) {
+            g_warn_if_reached();
+            return SRN_ERR;
+        }
+        msg = rest;
+
+        SrnRet ret = sirc_cmd_raw(sirc, "%s",
+                sirc_command_builder_build(&builder));
+        if (!RET_IS_OK(ret)) {
+            return ret;
+        }
+    }
+
+    // Entire message has been sent
+    return SRN_OK;
+}
+
+/**
+ * @brief Whether the whole message can be sent to targets in one line.
+ */
+static bool fits_in_one_line(SircSession *sirc, const char *cmd,
+        const char *targets, const char *msg){
+    SircCommandBuilder builder;
+
+    sirc_command_builder_init(&builder, cmd, sirc_get_prefix_len(sirc));
+    return sirc_command_builder_add_middle(&builder, targets)
+        && sirc_command_builder_set_trailing(&builder, msg) == NULL;
+}
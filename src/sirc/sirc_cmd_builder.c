@@ -24,6 +24,7 @@
 #define SIRC_RFC_CRLF "\r\n"
 #define SIRC_RFC_PARAM_DELIM " "
 #define SIRC_RFC_TRAILING_PREFIX ":"
+#define SIRC_MIRC_COLOR '\x03'
 
 // The "prefix" means a servername or a nick!user@host in IRC message
 //
@@ -37,45 +38,38 @@
 // ":nick!~user@hostname PRIVMSG #archlinux-cn :BlahBlah..." whose length MUST
 // exceeds 512 bytes.
 //
-// It is hard to known length of user's prefix(a.k.a "nick!~user@hostname"),
-// so we have to use such an magic number:
+// So the length of our prefix is reserved, it is learned from the messages
+// sent by ourselves (see sirc_set_prefix_len()). Before that we have to use
+// such an magic number:
 #define MAGIC_PREFIX_LEN 50
-#define SIRC_RFC_MESSAGE_SZIE (512 - MAGIC_PREFIX_LEN)
+// Prefix is learned from server data, a bogus long prefix must not leave
+// no room for the command
+#define MAX_PREFIX_LEN (SIRC_RFC_MESSAGE_SIZE / 2)
 
-struct _SircCommandBuilder {
-    char *cmd;
-    GList *middles; // List of middle param
-    char *trailing; // Trailing param
-    int expected_len; // Expected command length
-};
+static const char* find_split(const char *param, size_t max_len,
+        const char **rest);
+static const char* skip_color_code(const char *param, const char *end);
 
 /**
- * @brief Create a SircCommandBuilder instance.
- *
- * @param cmd
- *
- * @return
- */
-SircCommandBuilder* sirc_command_builder_new(const char *cmd) {
-    SircCommandBuilder *self;
-
-    self = g_malloc0(sizeof(SircCommandBuilder));
-    self->cmd = g_strdup(cmd);
-    self->expected_len = strlen(cmd) + strlen(SIRC_RFC_CRLF);
-
-    return self;
-}
-
-/**
- * @brief Free a SircCommandBuilder instance.
+ * @brief Initialize a SircCommandBuilder.
  *
  * @param self
+ * @param cmd
+ * @param prefix_len Length of "nick!user@host" of ourselves, 0 if unknown
  */
-void sirc_command_builder_free(SircCommandBuilder *self) {
-    g_free(self->cmd);
-    g_list_free_full(self->middles, g_free);
-    g_free(self->trailing);
-    g_free(self);
+void sirc_command_builder_init(SircCommandBuilder *self, const char *cmd,
+        int prefix_len) {
+    if (prefix_len <= 0) {
+        prefix_len = MAGIC_PREFIX_LEN;
+    }
+    prefix_len = MIN(prefix_len, MAX_PREFIX_LEN);
+    // Server forwards ":<prefix> <cmd>...\r\n"
+    self->max_len = SIRC_RFC_MESSAGE_SIZE - strlen(SIRC_RFC_CRLF)
+        - (strlen(SIRC_RFC_TRAILING_PREFIX) + prefix_len + strlen(SIRC_RFC_PARAM_DELIM));
+    self->len = g_strlcpy(self->buf, cmd, self->max_len + 1);
+    g_warn_if_fail(self->len <= self->max_len);
+    self->len = MIN(self->len, self->max_len);
+    self->has_trailing = FALSE;
 }
 
 /**
@@ -85,20 +79,26 @@ void sirc_command_builder_free(SircCommandBuilder *self) {
  * @param param
  *
  * @return TRUE if the param is successfully added;
- * FALSE if length of command exceeds SIRC_RFC_MESSAGE_SZIE after param added,
- * nothing added.
+ * FALSE if length of command exceeds limit after param added, nothing added.
  */
 bool sirc_command_builder_add_middle(SircCommandBuilder *self, const char *param) {
-    int added_len;
+    size_t param_len;
+    size_t added_len;
+
+    // Middle param can not follow trailing param
+    g_return_val_if_fail(!self->has_trailing, FALSE);
 
-    added_len = strlen(SIRC_RFC_PARAM_DELIM) + strlen(param);
-    if (self->expected_len + added_len > SIRC_RFC_MESSAGE_SZIE) {
+    param_len = strlen(param);
+    added_len = strlen(SIRC_RFC_PARAM_DELIM) + param_len;
+    if (self->len + added_len > self->max_len) {
         // Message length exceeds max message size, don't accpet param
         return FALSE;
     }
 
-    self->middles = g_list_append(self->middles, g_strdup(param));
-    self->expected_len += added_len;
+    strcpy(self->buf + self->len, SIRC_RFC_PARAM_DELIM);
+    memcpy(self->buf + self->len + strlen(SIRC_RFC_PARAM_DELIM), param, param_len);
+    self->len += added_len;
+    self->buf[self->len] = '\0';
     return TRUE;
 }
 
@@ -109,67 +109,124 @@ bool sirc_command_builder_add_middle(SircCommandBuilder *self, const char *param
  * @param param
  *
  * @return remaining param that failed to add to builder due to length
- * limitation(SIRC_RFC_MESSAGE_SZIE). If whole param added, NULL is returned.
+ * limitation. If whole param added, NULL is returned.
  *
- * UTF-8 param can be handled correctly.
+ * Long param is split on UTF-8 character boundary, preferably on whitespace,
+ * and never in the middle of a mIRC color code.
  */
 const char* sirc_command_builder_set_trailing(SircCommandBuilder *self, const char *param) {
+    size_t avail_len;
+    size_t delim_len;
+    const char *end;
+    const char *rest;
+
     // Repeat set is not allwoed
-    g_warn_if_fail(!self->trailing);
-
-    int added_len = strlen(SIRC_RFC_PARAM_DELIM) + strlen(SIRC_RFC_TRAILING_PREFIX) + strlen(param);
-    if (self->expected_len + added_len > SIRC_RFC_MESSAGE_SZIE) {
-        // Message length exceeds max message size, try truncate param
-        // NOTE: Please correctly handle UTF-8 chars
-        int exceeded_len = self->expected_len + added_len - SIRC_RFC_MESSAGE_SZIE;
-        const char *end = param + strlen(param);
-        const char *prev = param+ strlen(param);
-        for (;;) {
-            prev = g_utf8_find_prev_char(param, prev);
-            if (!prev) {
-                // Can not truncate
-                return param;
-            }
-            if (end - prev > exceeded_len) {
-                // Found that [param, prev) can just add to the command without
-                // exceeding the limit
-                break;
-            }
-        }
-        self->trailing = g_strndup(param, prev - param);
-        self->expected_len += strlen(SIRC_RFC_PARAM_DELIM) + strlen(SIRC_RFC_TRAILING_PREFIX) + (prev - param);
-        return prev;
+    g_return_val_if_fail(!self->has_trailing, param);
+
+    delim_len = strlen(SIRC_RFC_PARAM_DELIM) + strlen(SIRC_RFC_TRAILING_PREFIX);
+    if (self->len + delim_len >= self->max_len) {
+        // No room for any character
+        return param;
     }
+    avail_len = self->max_len - self->len - delim_len;
 
-    self->trailing = g_strdup(param);
-    self->expected_len += added_len;
-    return NULL;
-}
+    end = find_split(param, avail_len, &rest);
+    if (end == param && rest) {
+        // Can not truncate
+        return param;
+    }
+
+    strcpy(self->buf + self->len, SIRC_RFC_PARAM_DELIM SIRC_RFC_TRAILING_PREFIX);
+    memcpy(self->buf + self->len + delim_len, param, end - param);
+    self->len += delim_len + (end - param);
+    self->buf[self->len] = '\0';
+    self->has_trailing = TRUE;
 
+    return rest;
+}
 
 /**
  * @brief Build a legal length IRC message from builder.
  *
  * @param self
  *
- * @return a newly-allocated string, must be freed by g_free().
+ * @return Command with CRLF, owned by builder.
  */
-char* sirc_command_builder_build(SircCommandBuilder *self) {
-    GString *buf = g_string_new(self->cmd);
-    for (GList *elem = self->middles; elem != NULL; elem = g_list_next(elem)) {
-        const char *middle = elem->data;
-        g_string_append(buf, SIRC_RFC_PARAM_DELIM);
-        g_string_append(buf, middle);
+const char* sirc_command_builder_build(SircCommandBuilder *self) {
+    strcpy(self->buf + self->len, SIRC_RFC_CRLF);
+    return self->buf;
+}
+
+/**
+ * @brief Find where to split a param which has at most ``max_len`` bytes
+ * in the first part.
+ *
+ * @param param
+ * @param max_len
+ * @param rest Returns the remaining part, NULL if whole param is taken
+ *
+ * @return End of the first part
+ */
+static const char* find_split(const char *param, size_t max_len,
+        const char **rest) {
+    const char *end;
+
+    if (strlen(param) <= max_len) {
+        *rest = NULL;
+        return param + strlen(param);
+    }
+
+    // Step back to the start of UTF-8 character
+    end = param + max_len;
+    while (end > param && ((unsigned char)*end & 0xC0) == 0x80) {
+        end--;
+    }
+    end = skip_color_code(param, end);
+    *rest = end;
+
+    // Prefer the last whitespace in the latter half
+    for (const char *ptr = end; ptr > param + (end - param) / 2; ptr--) {
+        if (*ptr == ' ') {
+            end = ptr;
+            *rest = ptr + 1;
+            break;
+        }
+    }
+    if (**rest == '\0') {
+        *rest = NULL;
     }
-    if (self->trailing) {
-        g_string_append(buf, SIRC_RFC_PARAM_DELIM);
-        g_string_append(buf, SIRC_RFC_TRAILING_PREFIX);
-        g_string_append(buf, self->trailing);
+
+    return end;
+}
+
+/**
+ * @brief If ``end`` is in the middle of a mIRC color code ("^C<fg>[,<bg>]"),
+ * move it back to the start of code.
+ */
+static const char* skip_color_code(const char *param, const char *end) {
+    // The longest color code is "^CNN,NN"
+    for (const char *ptr = end - 1; ptr >= param && end - ptr < 6; ptr--) {
+        const char *code_end;
+
+        if (*ptr != SIRC_MIRC_COLOR) {
+            continue;
+        }
+        code_end = ptr + 1;
+        for (int i = 0; i < 2 && g_ascii_isdigit(*code_end); i++) {
+            code_end++;
+        }
+        if (code_end > ptr + 1 && *code_end == ','
+                && g_ascii_isdigit(code_end[1])) {
+            code_end++;
+            for (int i = 0; i < 2 && g_ascii_isdigit(*code_end); i++) {
+                code_end++;
+            }
+        }
+        if (code_end > end) {
+            return ptr;
+        }
+        break;
     }
-    g_string_append(buf, SIRC_RFC_CRLF);
 
-    g_warn_if_fail(buf->len == self->expected_len);
-    char *cmd = buf->str;
-    g_string_free(buf, FALSE);
-    return cmd;
+    return end;
 }
@@ -19,17 +19,31 @@
 #ifndef __SIRC_COMMAND_BUILDER_H
 #define __SIRC_COMMAND_BUILDER_H
 
+#include <stddef.h>
+
 #include "srain.h"
 
+#define SIRC_RFC_MESSAGE_SIZE   512 // Max length of IRC message with CRLF
+
 /**
  * @brief A helper for building legal length IRC command.
+ *
+ * It is small enough to be allocated on stack, initialize it by
+ * ``sirc_command_builder_init()``, no need to free.
  */
 typedef struct _SircCommandBuilder SircCommandBuilder;
 
-SircCommandBuilder* sirc_command_builder_new(const char *cmd);
-void sirc_command_builder_free(SircCommandBuilder *self);
+struct _SircCommandBuilder {
+    char buf[SIRC_RFC_MESSAGE_SIZE + 1]; // "<cmd> <middles> :<trailing>\r\n"
+    size_t len;     // Length of command without CRLF
+    size_t max_len; // Max length of command without CRLF
+    bool has_trailing;
+};
+
+void sirc_command_builder_init(SircCommandBuilder *self, const char *cmd,
+        int prefix_len);
 bool sirc_command_builder_add_middle(SircCommandBuilder *self, const char *param);
 const char* sirc_command_builder_set_trailing(SircCommandBuilder *self, const char *param);
-char* sirc_command_builder_build(SircCommandBuilder *self);
+const char* sirc_command_builder_build(SircCommandBuilder *self);
 
 #endif /* __SIRC_COMMAND_BUILDER_H */
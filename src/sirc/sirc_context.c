@@ -19,30 +19,80 @@
 
 #include "sirc/sirc.h"
 
-struct _SircMessageContext {
-    GDateTime *time; 
-};
-
-SircMessageContext* sirc_message_context_new(GDateTime* time) {
+SircMessageContext* sirc_message_context_new(gint64 time) {
     SircMessageContext *context;
 
+    context = g_malloc0(sizeof(SircMessageContext));
+    sirc_message_context_init(context, time);
+
+    return context;
+}
+
+void sirc_message_context_init(SircMessageContext *context, gint64 time) {
+    g_return_if_fail(context);
+
     if (!time) {
-        time = g_date_time_new_now_local();
+        /* Unlike g_date_time_new_now_local(), no timezone lookup here */
+        time = g_get_real_time();
     }
-
-    context = g_malloc0(sizeof(SircMessageContext));
     context->time = time;
+    context->batch = NULL;
+    context->msgid = NULL;
+    context->label = NULL;
+    context->user = NULL;
+    context->host = NULL;
+}
 
-    return context;
+gint64 sirc_message_context_get_time(const SircMessageContext *context) {
+    g_return_val_if_fail(context, 0);
+    return context->time;
 }
 
-GDateTime* sirc_message_context_get_time(const SircMessageContext *context) {
+const SircBatch* sirc_message_context_get_batch(const SircMessageContext *context,
+        const char *type) {
+    const SircBatch *batch;
+
     g_return_val_if_fail(context, NULL);
-    return context->time;
+    g_return_val_if_fail(type, NULL);
+
+    for (batch = context->batch; batch; batch = batch->parent) {
+        if (g_strcmp0(batch->type, type) == 0) {
+            return batch;
+        }
+    }
+    return NULL;
+}
+
+SircBatch* sirc_batch_new(const char *ref, const char *type,
+        const char **params, int count) {
+    SircBatch *batch;
+
+    g_return_val_if_fail(ref, NULL);
+    g_return_val_if_fail(type, NULL);
+    g_return_val_if_fail(count >= 0, NULL);
+
+    batch = g_malloc0(sizeof(SircBatch));
+    batch->ref = g_strdup(ref);
+    batch->type = g_strdup(type);
+    batch->params = g_malloc0_n(count + 1, sizeof(char *));
+    for (int i = 0; i < count; i++) {
+        batch->params[i] = g_strdup(params[i]);
+    }
+
+    return batch;
+}
+
+void sirc_batch_free(SircBatch *batch) {
+    g_return_if_fail(batch);
+
+    g_free(batch->ref);
+    g_free(batch->type);
+    g_strfreev(batch->params);
+    g_free(batch->label);
+    g_free(batch);
 }
 
 void sirc_message_context_free(SircMessageContext *context) {
     g_return_if_fail(context);
-    g_date_time_unref(context->time);
     g_free(context);
 }
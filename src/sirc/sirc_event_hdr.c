@@ -35,30 +35,73 @@
 #include "log.h"
 
 static void sirc_ctcp_event_hdr(SircSession *sirc, SircMessage *imsg, const SircMessageContext *context);
+static void sirc_batch_event_hdr(SircSession *sirc, SircMessage *imsg, SircMessageContext *context);
+static bool parse_server_time(const char *str, gint64 *time);
+static bool parse_digits(const char **str, int n, int *val);
+static gint64 days_from_civil(int year, int month, int day);
 
 void _sirc_event_hdr(SircSession *sirc, SircMessage *imsg, const SircMessageContext *context);
 
 void sirc_event_hdr(SircSession *sirc, SircMessage *imsg){
-    GDateTime *time = NULL;
+    gint64 time = 0;
+    const char *batch = NULL;
+    const char *msgid = NULL;
+    const char *label = NULL;
+    SircEvents *events;
+    SircMessageContext context;
 
     for (size_t i=0; i<imsg->ntags; i++) {
-        if (!g_strcmp0(imsg->tags[i].key, "time") && imsg->tags[i].value) {
-            /* https://ircv3.net/specs/extensions/server-time requires the
-             * timezone to be explicitly UTC in the timestamp, so we don't
-             * need to provide default_tz */
-            time = g_date_time_new_from_iso8601(imsg->tags[i].value, NULL);
-            break;
+        if (!imsg->tags[i].value) {
+            continue;
+        }
+        if (!time && strcmp(imsg->tags[i].key, "time") == 0) {
+            if (!parse_server_time(imsg->tags[i].value, &time)) {
+                WARN_FR("Invalid server time: %s", imsg->tags[i].value);
+            }
+        } else if (!batch && strcmp(imsg->tags[i].key, "batch") == 0) {
+            batch = imsg->tags[i].value;
+        } else if (!msgid && strcmp(imsg->tags[i].key, "msgid") == 0) {
+            msgid = imsg->tags[i].value;
+        } else if (!label && strcmp(imsg->tags[i].key, "label") == 0) {
+            label = imsg->tags[i].value;
+        }
+    }
+
+    /* Defaults to now if not provided by the server or could not be parsed */
+    sirc_message_context_init(&context, time);
+    context.msgid = msgid;
+    context.label = label;
+    context.user = imsg->user;
+    context.host = imsg->host;
+    if (batch) {
+        context.batch = sirc_get_batch(sirc, batch);
+        if (!context.batch) {
+            WARN_FR("Unknown batch: %s", batch);
         }
     }
+    if (!context.label) {
+        const SircBatch *labeled;
 
-    if (!time) {
-        /* Either not provided by the server, or could not be parsed */
-        time = g_date_time_new_now_local();
+        // Messages in a labeled-response batch reply to the same command
+        labeled = sirc_message_context_get_batch(&context, "labeled-response");
+        if (labeled) {
+            context.label = labeled->label;
+        }
     }
 
-    g_autoptr(SircMessageContext) context = sirc_message_context_new(time);
+    if (strcasecmp(imsg->cmd, "BATCH") == 0) {
+        sirc_batch_event_hdr(sirc, imsg, &context);
+        return;
+    }
 
-    _sirc_event_hdr(sirc, imsg, context);
+    _sirc_event_hdr(sirc, imsg, &context);
+
+    if (label) {
+        // A single labeled message is the whole response
+        events = sirc_get_events(sirc);
+        g_return_if_fail(events->reply);
+        events->reply(sirc, imsg->cmd, &context);
+    }
 }
 
 void _sirc_event_hdr(SircSession *sirc, SircMessage *imsg, const SircMessageContext *context){
@@ -197,6 +240,21 @@ void _sirc_event_hdr(SircSession *sirc, SircMessage *imsg, const SircMessageCont
              g_return_if_fail(events->invite);
              events->invite(sirc, event, origin, params, imsg->nparam, context);
          }
+         /* https://ircv3.net/specs/extensions/away-notify */
+         else if (strcasecmp(event, "AWAY") == 0){
+             g_return_if_fail(events->away);
+             events->away(sirc, event, origin, params, imsg->nparam, context);
+         }
+         /* https://ircv3.net/specs/extensions/account-notify */
+         else if (strcasecmp(event, "ACCOUNT") == 0){
+             g_return_if_fail(events->account);
+             events->account(sirc, event, origin, params, imsg->nparam, context);
+         }
+         /* https://ircv3.net/specs/extensions/chghost */
+         else if (strcasecmp(event, "CHGHOST") == 0){
+             g_return_if_fail(events->chghost);
+             events->chghost(sirc, event, origin, params, imsg->nparam, context);
+         }
          else if (strcasecmp(event, "CAP") == 0){
              g_return_if_fail(events->cap);
              events->cap(sirc, event, origin, params, imsg->nparam, context);
@@ -236,6 +294,11 @@ void _sirc_event_hdr(SircSession *sirc, SircMessage *imsg, const SircMessageCont
          else if (strcasecmp(event, "NOTE") == 0){
              g_return_if_fail(events->error);
              events->note(sirc, event, origin, params, imsg->nparam, context);
+        }
+         /* ACK is an empty response of labeled command, see
+          * https://ircv3.net/specs/extensions/labeled-response */
+         else if (strcasecmp(event, "ACK") == 0){
+             // Nothing to do, it is handled by the reply event
         }
          else {
              g_return_if_fail(events->unknown);
@@ -298,3 +361,177 @@ static void sirc_ctcp_event_hdr(SircSession *sirc, SircMessage *imsg, const Sirc
 
     g_free(ctcp_msg);
 }
+
+/**
+ * @brief Handle "BATCH +ref type [params...]" and "BATCH -ref". The batch
+ * callback is called with the started or ended batch in ``context->batch``,
+ * an ended batch is freed after the callback returns.
+ *
+ * The end of a labeled-response batch is the end of response of a labeled
+ * command, the reply callback is called as well.
+ */
+static void sirc_batch_event_hdr(SircSession *sirc, SircMessage *imsg,
+        SircMessageContext *context){
+    const char *ref;
+    const char *origin;
+    const char **params;
+    SircBatch *batch;
+    SircEvents *events;
+
+    g_return_if_fail(imsg->nick || imsg->prefix);
+    g_return_if_fail(imsg->nparam >= 1);
+
+    events = sirc_get_events(sirc);
+    origin = imsg->nick ? imsg->nick : imsg->prefix;
+    params = (const char **)imsg->params;
+    ref = params[0] + 1;
+
+    switch (params[0][0]) {
+        case '+':
+            g_return_if_fail(imsg->nparam >= 2);
+            batch = sirc_batch_new(ref, params[1], params + 2, imsg->nparam - 2);
+            // The BATCH message itself may belong to an outer batch
+            batch->parent = (SircBatch *)context->batch;
+            batch->label = g_strdup(context->label);
+            sirc_add_batch(sirc, batch);
+            break;
+        case '-':
+            batch = sirc_get_batch(sirc, ref);
+            if (!batch) {
+                WARN_FR("Unknown batch: %s", ref);
+                return;
+            }
+            break;
+        default:
+            g_return_if_reached();
+    }
+
+    context->batch = batch;
+    if (!context->label) {
+        context->label = batch->label;
+    }
+    g_return_if_fail(events->batch);
+    events->batch(sirc, imsg->cmd, origin, params, imsg->nparam, context);
+
+    if (params[0][0] == '-') {
+        if (batch->label && g_strcmp0(batch->type, "labeled-response") == 0) {
+            g_return_if_fail(events->reply);
+            events->reply(sirc, imsg->cmd, context);
+        }
+        sirc_remove_batch(sirc, ref);
+    }
+}
+
+/**
+ * @brief Parse the value of "time" tag.
+ *
+ * https://ircv3.net/specs/extensions/server-time requires the timestamp to
+ * be "YYYY-MM-DDThh:mm:ss.sssZ", which is parsed without any timezone
+ * lookup. Other ISO 8601 timestamps fall back to GDateTime.
+ *
+ * @param str
+ * @param time Returns microseconds since Unix epoch
+ *
+ * @return FALSE if failed to parse
+ */
+static bool parse_server_time(const char *str, gint64 *time){
+    int year, month, day, hour, minute, second;
+    int usec;
+    int offset;
+    const char *ptr;
+    GDateTime *dt;
+
+    ptr = str;
+    if (!parse_digits(&ptr, 4, &year) || *ptr++ != '-'
+            || !parse_digits(&ptr, 2, &month) || *ptr++ != '-'
+            || !parse_digits(&ptr, 2, &day) || (*ptr != 'T' && *ptr != 't')
+            || (ptr++, !parse_digits(&ptr, 2, &hour)) || *ptr++ != ':'
+            || !parse_digits(&ptr, 2, &minute) || *ptr++ != ':'
+            || !parse_digits(&ptr, 2, &second)){
+        goto FALLBACK;
+    }
+
+    usec = 0;
+    if (*ptr == '.'){
+        int scale;
+
+        ptr++;
+        if (!g_ascii_isdigit(*ptr)){
+            goto FALLBACK;
+        }
+        /* Digits beyond microsecond are ignored */
+        for (scale = 100000; g_ascii_isdigit(*ptr); ptr++, scale /= 10){
+            usec += (*ptr - '0') * scale;
+        }
+    }
+
+    offset = 0;
+    if (*ptr == 'Z' || *ptr == 'z'){
+        ptr++;
+    } else if (*ptr == '+' || *ptr == '-'){
+        int sign, offset_hour, offset_minute;
+
+        sign = *ptr++ == '-' ? -1 : 1;
+        if (!parse_digits(&ptr, 2, &offset_hour) || *ptr++ != ':'
+                || !parse_digits(&ptr, 2, &offset_minute)){
+            goto FALLBACK;
+        }
+        offset = sign * (offset_hour * 3600 + offset_minute * 60);
+    } else {
+        goto FALLBACK;
+    }
+
+    if (*ptr != '\0'
+            || month < 1 || month > 12
+            || day < 1 || day > g_date_get_days_in_month(month, year)
+            || hour > 23 || minute > 59 || second > 60){
+        goto FALLBACK;
+    }
+    second = MIN(second, 59); // Leap second
+
+    *time = ((days_from_civil(year, month, day) * 24 + hour) * 60 + minute)
+        * 60 + second - offset;
+    *time = *time * G_USEC_PER_SEC + usec;
+
+    return TRUE;
+
+FALLBACK:
+    dt = g_date_time_new_from_iso8601(str, NULL);
+    if (!dt){
+        return FALSE;
+    }
+    *time = g_date_time_to_unix(dt) * G_USEC_PER_SEC
+        + g_date_time_get_microsecond(dt);
+    g_date_time_unref(dt);
+
+    return TRUE;
+}
+
+static bool parse_digits(const char **str, int n, int *val){
+    *val = 0;
+    for (int i = 0; i < n; i++){
+        if (!g_ascii_isdigit((*str)[i])){
+            return FALSE;
+        }
+        *val = *val * 10 + (*str)[i] - '0';
+    }
+    *str += n;
+
+    return TRUE;
+}
+
+/**
+ * @brief Days since Unix epoch of a date in proleptic Gregorian calendar.
+ */
+static gint64 days_from_civil(int year, int month, int day){
+    gint64 era;
+    int yoe, doy, doe;
+
+    year -= month <= 2;
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = year - era * 400;
+    doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
@@ -65,21 +65,6 @@ void sirc_message_free(SircMessage *imsg){
     g_free(imsg);
 }
 
-void sirc_message_transcoding(SircMessage *imsg, const char *from_codeset) {
-    str_transcoding(&imsg->prefix, from_codeset);
-    str_transcoding(&imsg->nick, from_codeset);
-    str_transcoding(&imsg->user, from_codeset);
-    str_transcoding(&imsg->host, from_codeset);
-    str_transcoding(&imsg->cmd, from_codeset);
-
-    for (int i = 0; i < imsg->nparam; i++){
-        str_transcoding(&imsg->params[i], from_codeset);
-    }
-
-    /* No need to transcode tags, they are guaranteed to be UTF-8
-     * by https://ircv3.net/specs/extensions/message-tags */
-}
-
 /**
  * @brief Parsing IRC raw data
  *
@@ -40,7 +40,6 @@ typedef struct {
 
 SircMessage *sirc_message_new();
 void sirc_message_free(SircMessage *imsg);
-void sirc_message_transcoding(SircMessage *imsg, const char *from_codeset);
 SircMessage *sirc_parse(char *line);
 
 #endif /* __SIRC_PARSE_H */
@@ -122,28 +122,47 @@ void sui_activate_buffer(SuiBuffer *buf){
 }
 
 void sui_buffer_add_message(SuiBuffer *buf, SuiMessage *msg){
-    GType type;
+    GList lst = { .data = msg };
+
+    sui_buffer_add_messages(buf, &lst);
+}
+
+/**
+ * @brief ``sui_buffer_add_messages`` adds a list of messages after all
+ * messages of buffer, side bar is updated after all messages are added.
+ *
+ * @param buf
+ * @param msgs List of SuiMessage, in chronological order
+ */
+void sui_buffer_add_messages(SuiBuffer *buf, GList *msgs){
     SuiWindow *win;
     SuiSideBar *sidebar;
     SuiSideBarItem *item;
     SuiMessageList *list;
 
     g_return_if_fail(SUI_IS_BUFFER(buf));
-    g_return_if_fail(SUI_IS_MESSAGE(msg));
 
-    /* Add message */
-    sui_message_set_buffer(msg, buf);
-    sui_message_update(msg);
+    /* Add messages */
     list = sui_buffer_get_message_list(buf);
-    type = G_OBJECT_TYPE(msg);
-    if (type == SUI_TYPE_MISC_MESSAGE){
-        sui_message_list_add_message(list, msg, GTK_ALIGN_CENTER);
-    } else if (type == SUI_TYPE_SEND_MESSAGE){
-        sui_message_list_add_message(list, msg, GTK_ALIGN_END);
-    } else if (type == SUI_TYPE_RECV_MESSAGE){
-        sui_message_list_add_message(list, msg, GTK_ALIGN_START);
-    } else {
-        g_warn_if_reached();
+    for (GList *lst = msgs; lst; lst = g_list_next(lst)){
+        GType type;
+        SuiMessage *msg;
+
+        msg = lst->data;
+        g_return_if_fail(SUI_IS_MESSAGE(msg));
+
+        sui_message_set_buffer(msg, buf);
+        sui_message_update(msg);
+        type = G_OBJECT_TYPE(msg);
+        if (type == SUI_TYPE_MISC_MESSAGE){
+            sui_message_list_add_message(list, msg, GTK_ALIGN_CENTER);
+        } else if (type == SUI_TYPE_SEND_MESSAGE){
+            sui_message_list_add_message(list, msg, GTK_ALIGN_END);
+        } else if (type == SUI_TYPE_RECV_MESSAGE){
+            sui_message_list_add_message(list, msg, GTK_ALIGN_START);
+        } else {
+            g_warn_if_reached();
+        }
     }
 
     /* Update side bar */
@@ -152,7 +171,9 @@ void sui_buffer_add_message(SuiBuffer *buf, SuiMessage *msg){
 
     sidebar = sui_window_get_side_bar(win);
     item = sui_side_bar_get_item(sidebar, buf);
-    sui_message_update_side_bar_item(msg, item);
+    for (GList *lst = msgs; lst; lst = g_list_next(lst)){
+        sui_message_update_side_bar_item(lst->data, item);
+    }
 
     if (buf == sui_common_get_cur_buffer()){
         // Don't show counter while buffer is active
@@ -160,6 +181,36 @@ void sui_buffer_add_message(SuiBuffer *buf, SuiMessage *msg){
     }
 }
 
+/**
+ * @brief ``sui_buffer_prepend_message`` adds a message before all messages
+ * of buffer. Unlike ``sui_buffer_add_message``, the side bar is not updated
+ * because the message is not a new one.
+ *
+ * @param buf
+ * @param msg
+ */
+void sui_buffer_prepend_message(SuiBuffer *buf, SuiMessage *msg){
+    GType type;
+    SuiMessageList *list;
+
+    g_return_if_fail(SUI_IS_BUFFER(buf));
+    g_return_if_fail(SUI_IS_MESSAGE(msg));
+
+    sui_message_set_buffer(msg, buf);
+    sui_message_update(msg);
+    list = sui_buffer_get_message_list(buf);
+    type = G_OBJECT_TYPE(msg);
+    if (type == SUI_TYPE_MISC_MESSAGE){
+        sui_message_list_prepend_message(list, msg, GTK_ALIGN_CENTER);
+    } else if (type == SUI_TYPE_SEND_MESSAGE){
+        sui_message_list_prepend_message(list, msg, GTK_ALIGN_END);
+    } else if (type == SUI_TYPE_RECV_MESSAGE){
+        sui_message_list_prepend_message(list, msg, GTK_ALIGN_START);
+    } else {
+        g_warn_if_reached();
+    }
+}
+
 void sui_buffer_clear_message(SuiBuffer *buf){
     SuiWindow *win;
     SuiSideBar *sidebar;
@@ -186,6 +237,22 @@ void sui_free_message(SuiMessage *msg){
     // TODO
 }
 
+/**
+ * @brief ``sui_update_message`` refreshes the ``msg`` after its context is
+ * changed.
+ *
+ * @param msg
+ */
+void sui_update_message(SuiMessage *msg){
+    g_return_if_fail(SUI_IS_MESSAGE(msg));
+
+    if (!sui_message_get_buffer(msg)){
+        // Not yet added to buffer, it will be updated when adding
+        return;
+    }
+    sui_message_update(msg);
+}
+
 /**
  * @brief ``sui_notify_message`` sends a notification about the ``msg`` as
  * appropriate.
@@ -262,6 +329,14 @@ void sui_update_user(SuiBuffer *buf, SuiUser *user){
             sui_chat_buffer_get_user_list(SUI_CHAT_BUFFER(buf)), user);
 }
 
+void sui_touch_user(SuiBuffer *buf, SuiUser *user){
+    g_return_if_fail(SUI_IS_CHAT_BUFFER(buf));
+    g_return_if_fail(user);
+
+    sui_user_list_touch_user(
+            sui_chat_buffer_get_user_list(SUI_CHAT_BUFFER(buf)), user);
+}
+
 void sui_add_user(SuiBuffer *buf, SuiUser *user){
     SuiChatBuffer *chat_buf;
     SuiUserList *list;
@@ -288,6 +363,27 @@ void sui_rm_user(SuiBuffer *buf, SuiUser *user){
     sui_user_list_rm_user(list, user);
 }
 
+/**
+ * @brief ``sui_freeze_user_list`` detaches the user list of buffer from its
+ * view and suspends sorting, until ``sui_thaw_user_list`` is called.
+ * Use it when adding, removing or updating lots of users.
+ *
+ * @param buf
+ */
+void sui_freeze_user_list(SuiBuffer *buf){
+    g_return_if_fail(SUI_IS_CHAT_BUFFER(buf));
+
+    sui_user_list_begin_bulk(
+            sui_chat_buffer_get_user_list(SUI_CHAT_BUFFER(buf)));
+}
+
+void sui_thaw_user_list(SuiBuffer *buf){
+    g_return_if_fail(SUI_IS_CHAT_BUFFER(buf));
+
+    sui_user_list_end_bulk(
+            sui_chat_buffer_get_user_list(SUI_CHAT_BUFFER(buf)));
+}
+
 void sui_set_topic(SuiBuffer *buf, const char *topic){
     SuiBuffer *buffer;
 
@@ -312,6 +408,35 @@ void sui_set_topic_setter(SuiBuffer *buf, const char *setter){
     sui_buffer_set_topic_setter(buffer, setter);
 }
 
+/**
+ * @brief ``sui_set_online`` shows online state of peer of a dialog buffer
+ * on side bar and header.
+ *
+ * @param buf
+ * @param online
+ */
+void sui_set_online(SuiBuffer *buf, bool online){
+    SuiWindow *win;
+    SuiSideBar *sidebar;
+    SuiSideBarItem *item;
+
+    g_return_if_fail(SUI_IS_DIALOG_BUFFER(buf));
+
+    sui_dialog_buffer_set_online(SUI_DIALOG_BUFFER(buf), online);
+
+    win = SUI_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(buf)));
+    g_return_if_fail(SUI_IS_WINDOW(win));
+
+    sidebar = sui_window_get_side_bar(win);
+    item = sui_side_bar_get_item(sidebar, buf);
+    sui_side_bar_item_set_icon(item,
+            online ? "user-available-symbolic" : "user-offline-symbolic");
+
+    if (buf == sui_window_get_cur_buffer(win)){
+        sui_window_update_subtitle(win);
+    }
+}
+
 void sui_message_box(const char *title, const char *msg){
     GtkMessageDialog *dia;
     char *markuped_msg;
@@ -37,6 +37,7 @@
 #include "sui_app.h"
 #include "sui_window.h"
 #include "sui_prefs_dialog.h"
+#include "sui_url_preview_cache.h"
 
 struct _SuiApplication {
     GtkApplication parent;
@@ -379,6 +380,8 @@ void sui_application_set_config(SuiApplication *self, SuiApplicationConfig *cfg)
 
     self->cfg = cfg;
 
+    sui_url_preview_cache_set_config(&cfg->preview_cache);
+
     /* Update config of all SuiWindow */
     wins = gtk_application_get_windows(GTK_APPLICATION(self));
     for (GList *lst = wins; lst; lst = g_list_next(lst)){
@@ -187,7 +187,7 @@ static GtkListStore* sui_chat_buffer_completion_func(SuiBuffer *_self,
         g_free(nick_with_suffix);
         g_free(corrected_prefix);
     }
-    g_list_free_full(users, (GDestroyNotify)sui_user_free);
+    g_list_free(users);
 
     return store;
 }
@@ -34,6 +34,14 @@ SrnRet sui_application_config_check(SuiApplicationConfig *cfg){
     if (str_is_empty(cfg->theme)){
         return RET_ERR(fmt, "theme");
     }
+    if (cfg->preview_cache.memory_size < 0){
+        return RET_ERR(_("Invalid value of preview-cache.memory-size: %1$d"),
+                cfg->preview_cache.memory_size);
+    }
+    if (cfg->preview_cache.disk_size < 0){
+        return RET_ERR(_("Invalid value of preview-cache.disk-size: %1$d"),
+                cfg->preview_cache.disk_size);
+    }
 
     return SRN_OK;
 }
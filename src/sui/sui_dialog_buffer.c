@@ -32,11 +32,14 @@
 #include "sui_dialog_buffer.h"
 
 #include "log.h"
+#include "i18n.h"
 
 struct _SuiDialogBuffer {
     SuiChatBuffer parent;
 
     GtkMenuItem *close_menu_item;
+
+    const char *status; // Online state of peer, NULL if unknown
 };
 
 struct _SuiDialogBufferClass {
@@ -107,6 +110,17 @@ SuiDialogBuffer* sui_dialog_buffer_new(void *ctx, SuiBufferEvents *events,
     return self;
 }
 
+void sui_dialog_buffer_set_online(SuiDialogBuffer *self, bool online){
+    g_return_if_fail(SUI_IS_DIALOG_BUFFER(self));
+
+    self->status = online ? _("Online") : _("Offline");
+}
+
+const char* sui_dialog_buffer_get_status(SuiDialogBuffer *self){
+    g_return_val_if_fail(SUI_IS_DIALOG_BUFFER(self), NULL);
+
+    return self->status;
+}
 
 /*****************************************************************************
  * Static functions
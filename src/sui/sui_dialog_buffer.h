@@ -33,5 +33,7 @@ typedef struct _SuiDialogBufferClass SuiDialogBufferClass;
 
 GType sui_dialog_buffer_get_type(void);
 SuiDialogBuffer* sui_dialog_buffer_new(void *ctx, SuiBufferEvents *events, SuiBufferConfig *cfg);
+void sui_dialog_buffer_set_online(SuiDialogBuffer *self, bool online);
+const char* sui_dialog_buffer_get_status(SuiDialogBuffer *self);
 
 #endif /* __SUI_PRIVATE_BUFFER_H */
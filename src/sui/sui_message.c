@@ -36,6 +36,7 @@
 #include "sui_chat_buffer.h"
 #include "sui_message.h"
 #include "sui_url_previewer.h"
+#include "sui_url_preview_scheduler.h"
 
 #include "log.h"
 #include "i18n.h"
@@ -296,20 +297,39 @@ void sui_message_label_on_popup(GtkLabel *label, GtkMenu *menu, gpointer user_da
     }
 }
 
+/**
+ * @brief ``sui_message_time_on_query_tooltip`` shows the full time of message
+ * as tooltip, the time is only formatted when the tooltip is about to show.
+ */
+gboolean sui_message_time_on_query_tooltip(GtkWidget *widget, int x, int y,
+        gboolean keyboard_mode, GtkTooltip *tooltip, gpointer user_data){
+    char *full_time;
+    SuiMessage *self;
+
+    self = SUI_MESSAGE(user_data);
+    full_time = sui_message_get_full_time(self);
+    g_return_val_if_fail(full_time, FALSE);
+
+    gtk_tooltip_set_text(tooltip, full_time);
+    g_free(full_time);
+
+    return TRUE;
+}
+
 const char* sui_message_get_time(SuiMessage *self){
     SrnMessage *ctx;
 
     ctx = sui_message_get_ctx(self);
 
-    return ctx->rendered_short_time;
+    return srn_message_get_short_time(ctx);
 }
 
-const char* sui_message_get_full_time(SuiMessage *self){
+char* sui_message_get_full_time(SuiMessage *self){
     SrnMessage *ctx;
 
     ctx = sui_message_get_ctx(self);
 
-    return ctx->rendered_full_time;
+    return srn_message_get_full_time(ctx);
 }
 
 bool sui_message_is_mentioned(SuiMessage *self){
@@ -330,14 +350,27 @@ static void sui_message_real_update(SuiMessage *self){
     // Update message content
     gtk_label_set_markup(self->message_label, self->ctx->rendered_content);
 
+    style_context = gtk_widget_get_style_context(GTK_WIDGET(self));
+    if (self->ctx->history){
+        gtk_style_context_add_class(style_context, "sui-message-history");
+    }
+    if (self->ctx->pending){
+        gtk_style_context_add_class(style_context, "sui-message-pending");
+    } else {
+        gtk_style_context_remove_class(style_context, "sui-message-pending");
+    }
+    if (self->ctx->rejected){
+        gtk_style_context_add_class(style_context, "sui-message-rejected");
+    }
+
     // Show url previewer if needed
     if (self->buf->cfg->preview_url) {
         GList *children;
-        GList *urls;
+        char **urls;
         children = gtk_container_get_children(GTK_CONTAINER(self->content_box));
         urls = self->ctx->urls;
 
-        for (GList *url = urls; url; url = g_list_next(url)) {
+        for (char **url = urls; url && *url; url++) {
             bool found;
 
             found = FALSE;
@@ -346,7 +379,7 @@ static void sui_message_real_update(SuiMessage *self){
                     SuiUrlPreviewer *pvr;
 
                     pvr = SUI_URL_PREVIEWER(child->data);
-                    if (g_strcmp0(url->data, sui_url_previewer_get_url(pvr)) == 0){
+                    if (g_strcmp0(*url, sui_url_previewer_get_url(pvr)) == 0){
                         found = TRUE;
                     }
                 }
@@ -354,7 +387,7 @@ static void sui_message_real_update(SuiMessage *self){
             if (!found) { // Create one if not found
                 SuiUrlPreviewer *pvr;
 
-                pvr = sui_url_previewer_new(url->data);
+                pvr = sui_url_previewer_new(*url);
                 if (sui_url_previewer_get_content_type(pvr) ==
                         SUI_URL_CONTENT_TYPE_UNSUPPORTED) {
                     g_object_ref_sink(pvr);
@@ -375,7 +408,7 @@ static void sui_message_real_update(SuiMessage *self){
                                 G_CALLBACK(url_previewer_on_notify_content_type),
                                 self->content_box);
 
-                        sui_url_previewer_preview(pvr);
+                        sui_url_preview_scheduler_queue(pvr, self->buf);
                     }
 
                 }
@@ -94,9 +94,11 @@ SuiBuffer* sui_message_get_buffer(SuiMessage *self);
 SuiMessage* sui_message_get_prev(SuiMessage *self);
 SuiMessage* sui_message_get_next(SuiMessage *self);
 const char* sui_message_get_time(SuiMessage *self);
-const char* sui_message_get_full_time(SuiMessage *self);
+char* sui_message_get_full_time(SuiMessage *self);
 bool sui_message_is_mentioned(SuiMessage *self);
 
 void sui_message_label_on_popup(GtkLabel *label, GtkMenu *menu, gpointer user_data);
+gboolean sui_message_time_on_query_tooltip(GtkWidget *widget, int x, int y,
+        gboolean keyboard_mode, GtkTooltip *tooltip, gpointer user_data);
 
 #endif /* __SUI_MESSAGE_H */
@@ -28,6 +28,7 @@
 #include <string.h>
 
 #include "sui_common.h"
+#include "sui_event_hdr.h"
 #include "sui_window.h"
 #include "sui_message_list.h"
 
@@ -186,7 +187,6 @@ void sui_message_list_append_message(SuiMessageList *self, SuiMessage *msg,
 
 void sui_message_list_prepend_message(SuiMessageList *self, SuiMessage *msg,
         GtkAlign halign){
-    GtkBox *box;
     GtkListBoxRow *row;
 
     if (self->first_msg
@@ -199,10 +199,9 @@ void sui_message_list_prepend_message(SuiMessageList *self, SuiMessage *msg,
         self->last_msg = msg;
     }
 
-    box = GTK_BOX(gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0));
-    gtk_box_pack_start(box, GTK_WIDGET(msg), TRUE, TRUE, 0);
-    gtk_widget_set_halign(GTK_WIDGET(msg), halign);
-    row = sui_common_unfocusable_list_box_row_new(GTK_WIDGET(box));
+    // Same as sui_message_list_append_message(), row's child must be the
+    // message itself
+    row = sui_common_unfocusable_list_box_row_new(GTK_WIDGET(msg));
     gtk_list_box_prepend(self->list_box, GTK_WIDGET(row));
     self->first_row = row;
     if (!self->last_row) {
@@ -333,9 +332,17 @@ static void smart_scroll(SuiMessageList *self){
 
 static void scrolled_window_on_edge_overshot(GtkScrolledWindow *swin,
         GtkPositionType pos, gpointer user_data){
+    SuiBuffer *buf;
+    SuiMessageList *self;
+
+    self = SUI_MESSAGE_LIST(user_data);
     switch (pos) {
         case GTK_POS_TOP:
-            // TODO: Dynamic load
+            // Load older messages
+            buf = sui_common_get_cur_buffer();
+            if (SUI_IS_BUFFER(buf) && sui_buffer_get_message_list(buf) == self){
+                sui_buffer_event_hdr(buf, SUI_EVENT_HISTORY, NULL);
+            }
             break;
         case GTK_POS_BOTTOM:
             break;
@@ -97,6 +97,9 @@ static void sui_misc_message_init(SuiMiscMessage *self){
             G_CALLBACK(sui_common_activate_gtk_label_link), self);
     g_signal_connect(SUI_MESSAGE(self)->message_label, "populate-popup",
             G_CALLBACK(sui_message_label_on_popup), self);
+    gtk_widget_set_has_tooltip(GTK_WIDGET(SUI_MESSAGE(self)->message_label), TRUE);
+    g_signal_connect(SUI_MESSAGE(self)->message_label, "query-tooltip",
+            G_CALLBACK(sui_message_time_on_query_tooltip), self);
 }
 
 static void sui_misc_message_class_init(SuiMiscMessageClass *class){
@@ -137,7 +140,6 @@ static void sui_misc_message_class_init(SuiMiscMessageClass *class){
 }
 
 static void sui_misc_message_update(SuiMessage *_self){
-    const char *full_time;
     SrnMessage *ctx;
     SuiMiscMessage *self;
 
@@ -145,10 +147,6 @@ static void sui_misc_message_update(SuiMessage *_self){
     g_return_if_fail(ctx);
     self = SUI_MISC_MESSAGE(_self);
 
-    full_time = sui_message_get_full_time(_self);
-    g_return_if_fail(full_time);
-    gtk_widget_set_tooltip_text(GTK_WIDGET(_self->message_label), full_time);
-
     SUI_MESSAGE_CLASS(sui_misc_message_parent_class)->update(_self);
 
     /* Override the content of message_label */
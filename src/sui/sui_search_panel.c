@@ -0,0 +1,411 @@
+/* Copyright (C) 2016-2018 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file sui_search_panel.c
+ * @brief Panel widget for searching chat logs
+ */
+
+#include <gtk/gtk.h>
+
+#include "sui/sui.h"
+#include "srain.h"
+#include "i18n.h"
+#include "log.h"
+#include "utils.h"
+#include "chat_log.h"
+
+#include "sui_search_panel.h"
+
+#define MAX_RESULT_COUNT                200
+
+#define RESULT_LIST_STORE_COL_TIME      0
+#define RESULT_LIST_STORE_COL_CHAT      1
+#define RESULT_LIST_STORE_COL_NICK      2
+#define RESULT_LIST_STORE_COL_MESSAGE   3
+
+struct _SuiSearchPanel {
+    GtkBox parent;
+
+    char *srv_name;
+    char *chat_name; // NULL if panel is opened in server buffer
+    GCancellable *cancel; // Cancellable of current search
+
+    GtkSearchEntry *search_entry;
+    GtkCheckButton *all_chats_check_button;
+    GtkTreeView *result_tree_view;
+    GtkTreeViewColumn *chat_tree_view_column;
+    GtkLabel *status_label;
+    GtkSpinner *status_spinner;
+
+    GtkListStore *result_list_store;
+};
+
+struct _SuiSearchPanelClass {
+    GtkBoxClass parent_class;
+};
+
+typedef struct _SearchTaskData {
+    char *srv_name;
+    char *chat_name;
+    char *query;
+} SearchTaskData;
+
+static void search(SuiSearchPanel *self);
+static void search_task(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable);
+static void search_ready(GObject *source_object, GAsyncResult *res,
+        gpointer user_data);
+static void search_task_data_free(SearchTaskData *data);
+static void free_results(GList *results);
+
+static void on_map(GtkWidget *widget, gpointer user_data);
+static void search_entry_on_search_changed(GtkSearchEntry *entry,
+        gpointer user_data);
+static void all_chats_check_button_on_toggled(GtkToggleButton *button,
+        gpointer user_data);
+
+/*****************************************************************************
+ * GObject functions
+ *****************************************************************************/
+
+enum
+{
+    // 0 for PROP_NOME
+    PROP_SERVER_NAME = 1,
+    PROP_CHAT_NAME,
+    N_PROPERTIES
+};
+
+static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
+
+G_DEFINE_TYPE(SuiSearchPanel, sui_search_panel, GTK_TYPE_BOX);
+
+static void sui_search_panel_set_property(GObject *object, guint property_id,
+        const GValue *value, GParamSpec *pspec){
+    SuiSearchPanel *self;
+
+    self = SUI_SEARCH_PANEL(object);
+
+    switch (property_id){
+        case PROP_SERVER_NAME:
+            str_assign(&self->srv_name, g_value_get_string(value));
+            break;
+        case PROP_CHAT_NAME:
+            str_assign(&self->chat_name, g_value_get_string(value));
+            break;
+        default:
+            /* We don't have any other property... */
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void sui_search_panel_get_property(GObject *object, guint property_id,
+        GValue *value, GParamSpec *pspec){
+    SuiSearchPanel *self;
+
+    self = SUI_SEARCH_PANEL(object);
+
+    switch (property_id){
+        case PROP_SERVER_NAME:
+            g_value_set_string(value, self->srv_name);
+            break;
+        case PROP_CHAT_NAME:
+            g_value_set_string(value, self->chat_name);
+            break;
+        default:
+            /* We don't have any other property... */
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void sui_search_panel_init(SuiSearchPanel *self){
+    gtk_widget_init_template(GTK_WIDGET(self));
+
+    /* 4 columns: time, chat, nick, message */
+    self->result_list_store = gtk_list_store_new(4,
+            G_TYPE_STRING,
+            G_TYPE_STRING,
+            G_TYPE_STRING,
+            G_TYPE_STRING);
+    gtk_tree_view_set_model(self->result_tree_view,
+            GTK_TREE_MODEL(self->result_list_store));
+
+    g_signal_connect(self, "map",
+            G_CALLBACK(on_map), NULL);
+    g_signal_connect(self->search_entry, "search-changed",
+            G_CALLBACK(search_entry_on_search_changed), self);
+    g_signal_connect(self->all_chats_check_button, "toggled",
+            G_CALLBACK(all_chats_check_button_on_toggled), self);
+}
+
+static void sui_search_panel_constructed(GObject *object){
+    SuiSearchPanel *self;
+
+    G_OBJECT_CLASS(sui_search_panel_parent_class)->constructed(object);
+
+    self = SUI_SEARCH_PANEL(object);
+    if (!self->chat_name){
+        // Opened in server buffer, always search all chats
+        gtk_toggle_button_set_active(
+                GTK_TOGGLE_BUTTON(self->all_chats_check_button), TRUE);
+        gtk_widget_set_sensitive(
+                GTK_WIDGET(self->all_chats_check_button), FALSE);
+    }
+    gtk_tree_view_column_set_visible(self->chat_tree_view_column,
+            !self->chat_name);
+}
+
+static void sui_search_panel_dispose(GObject *object){
+    SuiSearchPanel *self;
+
+    self = SUI_SEARCH_PANEL(object);
+    if (self->cancel){
+        g_cancellable_cancel(self->cancel);
+        g_clear_object(&self->cancel);
+    }
+    g_clear_object(&self->result_list_store);
+
+    G_OBJECT_CLASS(sui_search_panel_parent_class)->dispose(object);
+}
+
+static void sui_search_panel_finalize(GObject *object){
+    SuiSearchPanel *self;
+
+    self = SUI_SEARCH_PANEL(object);
+    str_assign(&self->srv_name, NULL);
+    str_assign(&self->chat_name, NULL);
+
+    G_OBJECT_CLASS(sui_search_panel_parent_class)->finalize(object);
+}
+
+static void sui_search_panel_class_init(SuiSearchPanelClass *class){
+    GObjectClass *object_class;
+    GtkWidgetClass *widget_class;
+
+    object_class = G_OBJECT_CLASS(class);
+    object_class->set_property = sui_search_panel_set_property;
+    object_class->get_property = sui_search_panel_get_property;
+    object_class->constructed = sui_search_panel_constructed;
+    object_class->dispose = sui_search_panel_dispose;
+    object_class->finalize = sui_search_panel_finalize;
+
+    /* Install properties */
+    obj_properties[PROP_SERVER_NAME] =
+        g_param_spec_string("server-name",
+                "Server Name",
+                "Name of server whose chat logs are searched.",
+                NULL, // Default value
+                G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    obj_properties[PROP_CHAT_NAME] =
+        g_param_spec_string("chat-name",
+                "Chat Name",
+                "Name of chat whose chat logs are searched by default.",
+                NULL, // Default value
+                G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    g_object_class_install_properties(object_class, N_PROPERTIES,
+            obj_properties);
+
+    widget_class = GTK_WIDGET_CLASS(class);
+    gtk_widget_class_set_template_from_resource(widget_class,
+            "/im/srain/Srain/search_panel.glade");
+
+    gtk_widget_class_bind_template_child(widget_class, SuiSearchPanel, search_entry);
+    gtk_widget_class_bind_template_child(widget_class, SuiSearchPanel, all_chats_check_button);
+    gtk_widget_class_bind_template_child(widget_class, SuiSearchPanel, result_tree_view);
+    gtk_widget_class_bind_template_child(widget_class, SuiSearchPanel, chat_tree_view_column);
+    gtk_widget_class_bind_template_child(widget_class, SuiSearchPanel, status_label);
+    gtk_widget_class_bind_template_child(widget_class, SuiSearchPanel, status_spinner);
+}
+
+/*****************************************************************************
+ * Exported functions
+ *****************************************************************************/
+
+/**
+ * @brief ``sui_search_panel_new`` creates a panel for searching chat logs.
+ *
+ * @param srv_name
+ * @param chat_name Chat to be searched by default, NULL for all chats of
+ *      server
+ *
+ * @return A new SuiSearchPanel
+ */
+SuiSearchPanel* sui_search_panel_new(const char *srv_name,
+        const char *chat_name){
+    return g_object_new(SUI_TYPE_SEARCH_PANEL,
+            "server-name", srv_name,
+            "chat-name", chat_name,
+            NULL);
+}
+
+/*****************************************************************************
+ * Static functions
+ *****************************************************************************/
+
+static void search(SuiSearchPanel *self){
+    const char *query;
+    GTask *task;
+    SearchTaskData *data;
+
+    // Result of previous search is no longer needed
+    if (self->cancel){
+        g_cancellable_cancel(self->cancel);
+        g_object_unref(self->cancel);
+        self->cancel = NULL;
+    }
+
+    query = gtk_entry_get_text(GTK_ENTRY(self->search_entry));
+    if (str_is_empty(query)){
+        gtk_list_store_clear(self->result_list_store);
+        gtk_label_set_text(self->status_label, "");
+        gtk_spinner_stop(self->status_spinner);
+        return;
+    }
+
+    data = g_malloc0(sizeof(SearchTaskData));
+    data->srv_name = g_strdup(self->srv_name);
+    if (!gtk_toggle_button_get_active(
+                GTK_TOGGLE_BUTTON(self->all_chats_check_button))){
+        data->chat_name = g_strdup(self->chat_name);
+    }
+    data->query = g_strdup(query);
+
+    self->cancel = g_cancellable_new();
+    task = g_task_new(self, self->cancel, search_ready, NULL);
+    g_task_set_task_data(task, data, (GDestroyNotify)search_task_data_free);
+    g_task_run_in_thread(task, search_task);
+    g_object_unref(task);
+
+    gtk_label_set_text(self->status_label, _("Searching..."));
+    gtk_spinner_start(self->status_spinner);
+}
+
+static void search_task(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable){
+    GList *results;
+    GError *err;
+    SearchTaskData *data;
+
+    data = task_data;
+    err = NULL;
+    results = srn_chat_log_search(data->srv_name, data->chat_name,
+            data->query, MAX_RESULT_COUNT, &err);
+    if (err){
+        g_task_return_error(task, err);
+        return;
+    }
+
+    // Result is freed by GTask if the search is cancelled
+    g_task_return_pointer(task, results, (GDestroyNotify)free_results);
+}
+
+static void search_ready(GObject *source_object, GAsyncResult *res,
+        gpointer user_data){
+    int count;
+    char *status;
+    GList *results;
+    GError *err;
+    SuiSearchPanel *self;
+
+    err = NULL;
+    results = g_task_propagate_pointer(G_TASK(res), &err);
+    if (g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)){
+        // Panel may be disposed
+        g_error_free(err);
+        return;
+    }
+
+    self = SUI_SEARCH_PANEL(source_object);
+    gtk_spinner_stop(self->status_spinner);
+    gtk_list_store_clear(self->result_list_store);
+    if (err){
+        gtk_label_set_text(self->status_label, err->message);
+        g_error_free(err);
+        return;
+    }
+
+    count = 0;
+    for (GList *lst = results; lst; lst = g_list_next(lst)){
+        char *time;
+        GDateTime *dt;
+        GtkTreeIter iter;
+        SrnChatLogSearchResult *result;
+
+        result = lst->data;
+        dt = g_date_time_new_from_unix_utc(result->entry.time
+                + result->entry.utc_offset);
+        time = g_date_time_format(dt, "%Y-%m-%d %H:%M");
+        g_date_time_unref(dt);
+
+        gtk_list_store_append(self->result_list_store, &iter);
+        gtk_list_store_set(self->result_list_store, &iter,
+                RESULT_LIST_STORE_COL_TIME, time,
+                RESULT_LIST_STORE_COL_CHAT, result->chat_name,
+                RESULT_LIST_STORE_COL_NICK, result->entry.sender,
+                RESULT_LIST_STORE_COL_MESSAGE, result->entry.content,
+                -1);
+        g_free(time);
+        count++;
+    }
+    free_results(results);
+
+    status = g_strdup_printf(_("%1$d message(s) found"), count);
+    gtk_label_set_text(self->status_label, status);
+    g_free(status);
+}
+
+static void search_task_data_free(SearchTaskData *data){
+    g_free(data->srv_name);
+    g_free(data->chat_name);
+    g_free(data->query);
+    g_free(data);
+}
+
+static void free_results(GList *results){
+    g_list_free_full(results, (GDestroyNotify)srn_chat_log_search_result_free);
+}
+
+static void on_map(GtkWidget *widget, gpointer user_data){
+    SuiSearchPanel *self;
+
+    self = SUI_SEARCH_PANEL(widget);
+    gtk_widget_grab_focus(GTK_WIDGET(self->search_entry));
+
+    // Messages logged recently may not be indexed yet
+    srn_chat_log_index_update();
+}
+
+static void search_entry_on_search_changed(GtkSearchEntry *entry,
+        gpointer user_data){
+    search(SUI_SEARCH_PANEL(user_data));
+}
+
+static void all_chats_check_button_on_toggled(GtkToggleButton *button,
+        gpointer user_data){
+    SuiSearchPanel *self;
+
+    self = SUI_SEARCH_PANEL(user_data);
+    gtk_tree_view_column_set_visible(self->chat_tree_view_column,
+            gtk_toggle_button_get_active(button));
+    search(self);
+}
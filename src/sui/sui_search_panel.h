@@ -0,0 +1,34 @@
+/* Copyright (C) 2016-2018 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SUI_SEARCH_PANEL_H
+#define __SUI_SEARCH_PANEL_H
+
+#include <gtk/gtk.h>
+
+#define SUI_TYPE_SEARCH_PANEL (sui_search_panel_get_type())
+#define SUI_SEARCH_PANEL(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), SUI_TYPE_SEARCH_PANEL, SuiSearchPanel))
+#define SUI_IS_SEARCH_PANEL(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj), SUI_TYPE_SEARCH_PANEL))
+
+typedef struct _SuiSearchPanel SuiSearchPanel;
+typedef struct _SuiSearchPanelClass SuiSearchPanelClass;
+
+GType sui_search_panel_get_type(void);
+SuiSearchPanel* sui_search_panel_new(const char *srv_name, const char *chat_name);
+
+#endif /* __SUI_SEARCH_PANEL_H */
@@ -46,6 +46,9 @@ static void sui_send_message_init(SuiSendMessage *self){
             G_CALLBACK(sui_common_activate_gtk_label_link), self);
     g_signal_connect(SUI_MESSAGE(self)->message_label, "populate-popup",
             G_CALLBACK(sui_message_label_on_popup), self);
+    gtk_widget_set_has_tooltip(GTK_WIDGET(self->time_label), TRUE);
+    g_signal_connect(self->time_label, "query-tooltip",
+            G_CALLBACK(sui_message_time_on_query_tooltip), self);
 }
 
 static void sui_send_message_class_init(SuiSendMessageClass *class){
@@ -77,7 +80,6 @@ SuiSendMessage* sui_send_message_new(void *ctx){
 
 static void sui_send_message_update(SuiMessage *_self){
     const char *time;
-    const char *full_time;
     SrnMessage *ctx;
     SuiSendMessage *self;
 
@@ -86,12 +88,9 @@ static void sui_send_message_update(SuiMessage *_self){
     self = SUI_SEND_MESSAGE(_self);
 
     time =  sui_message_get_time(_self);
-    full_time = sui_message_get_full_time(_self);
     g_return_if_fail(time);
-    g_return_if_fail(full_time);
 
     gtk_label_set_text(self->time_label, time);
-    gtk_widget_set_tooltip_text(GTK_WIDGET(self->time_label), full_time);
 
     SUI_MESSAGE_CLASS(sui_send_message_parent_class)->update(_self);
 }
@@ -123,6 +123,10 @@ void sui_side_bar_item_update(SuiSideBarItem *self,
     gtk_list_box_row_changed(GTK_LIST_BOX_ROW(row));
 }
 
+void sui_side_bar_item_set_icon(SuiSideBarItem *self, const char *icon){
+    gtk_image_set_from_icon_name(self->image, icon, GTK_ICON_SIZE_BUTTON);
+}
+
 void sui_side_bar_item_highlight(SuiSideBarItem *self){
     GtkStyleContext *style_context;
 
@@ -32,6 +32,7 @@ GType sui_side_bar_item_get_type(void);
 SuiSideBarItem *sui_side_bar_item_new(const char *name, const char *remark, const char *icon);
 
 void sui_side_bar_item_update(SuiSideBarItem *self, const char *nick, const char *msg);
+void sui_side_bar_item_set_icon(SuiSideBarItem *self, const char *icon);
 void sui_side_bar_item_highlight(SuiSideBarItem *self);
 void sui_side_bar_item_inc_count(SuiSideBarItem *self);
 void sui_side_bar_item_clear_count(SuiSideBarItem *self);
@@ -0,0 +1,635 @@
+/* Copyright (C) 2016-2018 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file sui_url_preview_cache.c
+ * @brief Two-level cache of URL previews
+ *
+ * The first level is an in-memory LRU of thumbnails and encoded images,
+ * keyed by normalized URL and limited by memory usage.
+ *
+ * The second level is an on-disk cache under $XDG_CACHE_HOME/srain/previews,
+ * every entry is a PNG thumbnail plus a key file which records the ETag and
+ * Last-Modified of response, so that the entry can be revalidated with a
+ * conditional request. All disk accesses happen in worker threads, writers
+ * are serialized and files are renamed into place once completely written.
+ */
+
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+#include <libsoup/soup.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sui_url_preview_cache.h"
+
+#include "log.h"
+#include "path.h"
+#include "utils.h"
+
+#define DISK_CACHE_DIR      "previews"
+#define META_GROUP          "preview"
+#define MIB                 (1024 * 1024)
+
+#define DEFAULT_MEMORY_SIZE (32 * MIB)
+#define DEFAULT_DISK_SIZE   (128 * MIB)
+
+typedef struct _Validators {
+    char *etag;
+    char *last_modified;
+} Validators;
+
+typedef struct _SaveTaskData {
+    char *key;
+    char *etag;
+    char *last_modified;
+    GdkPixbuf *thumbnail;
+    goffset disk_limit;
+} SaveTaskData;
+
+static GHashTable *mem_table = NULL;     // Key → GList link of mem_queue
+static GQueue mem_queue = G_QUEUE_INIT; // Most recently used entry first
+static gsize mem_usage = 0;
+static gsize mem_limit = DEFAULT_MEMORY_SIZE;
+static goffset disk_limit = DEFAULT_DISK_SIZE;
+static GMutex disk_mutex; // Serializes disk writing and eviction
+
+static void mem_shrink(gsize limit);
+static void entry_free(SuiUrlPreviewCacheEntry *entry);
+static char* disk_get_path(const char *key, const char *suffix);
+static void validators_free(Validators *validators);
+static void get_validators_thread(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable);
+static void load_thumbnail_thread(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable);
+static void save_task_data_free(SaveTaskData *data);
+static void save_thumbnail_thread(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable);
+static void disk_shrink(const char *dir, goffset limit);
+
+/*****************************************************************************
+ * Exported functions
+ *****************************************************************************/
+
+void sui_url_preview_cache_set_config(SuiUrlPreviewCacheConfig *cfg){
+    g_return_if_fail(cfg);
+
+    mem_limit = (gsize)cfg->memory_size * MIB;
+    disk_limit = (goffset)cfg->disk_size * MIB;
+    mem_shrink(mem_limit);
+}
+
+/**
+ * @brief ``sui_url_preview_cache_normalize_url`` normalizes URL to cache key,
+ * the scheme and host are case insensitive and fragment is never sent to
+ * server.
+ *
+ * @param url
+ *
+ * @return NULL if URL is invalid, otherwise the key must be freed by g_free.
+ */
+char* sui_url_preview_cache_normalize_url(const char *url){
+    char *key;
+    char *host;
+    SoupURI *uri;
+
+    uri = soup_uri_new(url);
+    if (!uri){
+        return NULL;
+    }
+    soup_uri_set_fragment(uri, NULL);
+    if (soup_uri_get_host(uri)){
+        host = g_ascii_strdown(soup_uri_get_host(uri), -1);
+        soup_uri_set_host(uri, host);
+        g_free(host);
+    }
+    key = soup_uri_to_string(uri, FALSE);
+    soup_uri_free(uri);
+
+    return key;
+}
+
+/**
+ * @brief ``sui_url_preview_cache_lookup`` looks up the in-memory cache, the
+ * entry becomes the most recently used one.
+ *
+ * @param key
+ *
+ * @return NULL if not found, the entry is owned by cache and is only
+ * valid until next insertion.
+ */
+const SuiUrlPreviewCacheEntry* sui_url_preview_cache_lookup(const char *key){
+    GList *link;
+
+    if (!mem_table || !key){
+        return NULL;
+    }
+
+    link = g_hash_table_lookup(mem_table, key);
+    if (!link){
+        return NULL;
+    }
+    g_queue_unlink(&mem_queue, link);
+    g_queue_push_head_link(&mem_queue, link);
+
+    return link->data;
+}
+
+/**
+ * @brief ``sui_url_preview_cache_insert`` adds a preview to in-memory cache,
+ * the least recently used entries are evicted if memory limit is exceeded.
+ *
+ * @param key
+ * @param content_type
+ * @param data Encoded image, can be NULL
+ * @param mime_type MIME type of encoded image, can be NULL
+ * @param thumbnail Scaled image, can be NULL
+ */
+void sui_url_preview_cache_insert(const char *key,
+        SuiUrlContentType content_type, GBytes *data, const char *mime_type,
+        GdkPixbuf *thumbnail){
+    GList *link;
+    SuiUrlPreviewCacheEntry *entry;
+
+    g_return_if_fail(key);
+
+    if (!mem_table){
+        mem_table = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+
+    link = g_hash_table_lookup(mem_table, key);
+    if (link){
+        entry = link->data;
+        g_queue_delete_link(&mem_queue, link);
+        g_hash_table_remove(mem_table, entry->key);
+        mem_usage -= entry->size;
+        entry_free(entry);
+    }
+
+    entry = g_malloc0(sizeof(SuiUrlPreviewCacheEntry));
+    entry->key = g_strdup(key);
+    entry->content_type = content_type;
+    entry->size = sizeof(SuiUrlPreviewCacheEntry) + strlen(key);
+    if (thumbnail){
+        entry->thumbnail = g_object_ref(thumbnail);
+        entry->size += gdk_pixbuf_get_byte_length(thumbnail);
+    }
+    // An image larger than a quarter of cache would flush everything,
+    // only keep its thumbnail
+    if (data && g_bytes_get_size(data) <= mem_limit / 4){
+        entry->data = g_bytes_ref(data);
+        entry->mime_type = g_strdup(mime_type);
+        entry->size += g_bytes_get_size(data);
+    }
+
+    if (entry->size > mem_limit){
+        entry_free(entry);
+        return;
+    }
+
+    mem_shrink(mem_limit - entry->size);
+    g_queue_push_head(&mem_queue, entry);
+    g_hash_table_insert(mem_table, entry->key, mem_queue.head);
+    mem_usage += entry->size;
+}
+
+/**
+ * @brief ``sui_url_preview_cache_get_validators_async`` asynchronously gets
+ * the HTTP validators of the thumbnail in disk cache.
+ *
+ * @param key
+ * @param cancel
+ * @param callback
+ * @param user_data
+ */
+void sui_url_preview_cache_get_validators_async(const char *key,
+        GCancellable *cancel, GAsyncReadyCallback callback, gpointer user_data){
+    GTask *task;
+
+    task = g_task_new(NULL, cancel, callback, user_data);
+    if (disk_limit <= 0 || !key){
+        g_task_return_pointer(task, NULL, NULL);
+        g_object_unref(task);
+        return;
+    }
+
+    g_task_set_task_data(task, g_strdup(key), g_free);
+    g_task_run_in_thread(task, get_validators_thread);
+    g_object_unref(task);
+}
+
+/**
+ * @brief ``sui_url_preview_cache_get_validators_finish`` finishes the
+ * operation started with ``sui_url_preview_cache_get_validators_async``.
+ *
+ * @param result
+ * @param etag Return location of ETag, may be set to NULL
+ * @param last_modified Return location of Last-Modified, may be set to NULL
+ *
+ * @return TRUE if the URL is found in disk cache.
+ */
+bool sui_url_preview_cache_get_validators_finish(GAsyncResult *result,
+        char **etag, char **last_modified){
+    Validators *validators;
+
+    *etag = NULL;
+    *last_modified = NULL;
+
+    validators = g_task_propagate_pointer(G_TASK(result), NULL);
+    if (!validators){
+        return FALSE;
+    }
+
+    *etag = validators->etag;
+    *last_modified = validators->last_modified;
+    g_free(validators);
+
+    return TRUE;
+}
+
+/**
+ * @brief ``sui_url_preview_cache_load_thumbnail_async`` asynchronously loads
+ * thumbnail from disk cache, it should be called after the entry is
+ * revalidated.
+ *
+ * @param key
+ * @param cancel
+ * @param callback
+ * @param user_data
+ */
+void sui_url_preview_cache_load_thumbnail_async(const char *key,
+        GCancellable *cancel, GAsyncReadyCallback callback, gpointer user_data){
+    GTask *task;
+
+    g_return_if_fail(key);
+
+    task = g_task_new(NULL, cancel, callback, user_data);
+    g_task_set_task_data(task, g_strdup(key), g_free);
+    g_task_run_in_thread(task, load_thumbnail_thread);
+    g_object_unref(task);
+}
+
+/**
+ * @brief ``sui_url_preview_cache_load_thumbnail_finish`` finishes the
+ * operation started with ``sui_url_preview_cache_load_thumbnail_async``.
+ *
+ * @param result
+ * @param error
+ *
+ * @return NULL if failed, otherwise a new reference of thumbnail.
+ */
+GdkPixbuf* sui_url_preview_cache_load_thumbnail_finish(GAsyncResult *result,
+        GError **error){
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+/**
+ * @brief ``sui_url_preview_cache_save_thumbnail`` asynchronously saves
+ * thumbnail and its HTTP validators to disk cache, least recently used
+ * thumbnails are evicted if disk limit is exceeded.
+ *
+ * A response without any validator can not be revalidated, so it is not
+ * saved.
+ *
+ * @param key
+ * @param thumbnail
+ * @param etag
+ * @param last_modified
+ */
+void sui_url_preview_cache_save_thumbnail(const char *key,
+        GdkPixbuf *thumbnail, const char *etag, const char *last_modified){
+    GTask *task;
+    SaveTaskData *data;
+
+    g_return_if_fail(key);
+    g_return_if_fail(GDK_IS_PIXBUF(thumbnail));
+
+    if (disk_limit <= 0 || (!etag && !last_modified)){
+        return;
+    }
+
+    data = g_malloc0(sizeof(SaveTaskData));
+    data->key = g_strdup(key);
+    data->etag = g_strdup(etag);
+    data->last_modified = g_strdup(last_modified);
+    data->thumbnail = g_object_ref(thumbnail);
+    data->disk_limit = disk_limit;
+
+    task = g_task_new(NULL, NULL, NULL, NULL);
+    g_task_set_task_data(task, data, (GDestroyNotify)save_task_data_free);
+    g_task_run_in_thread(task, save_thumbnail_thread);
+    g_object_unref(task);
+}
+
+/*****************************************************************************
+ * Static functions
+ *****************************************************************************/
+
+/**
+ * @brief Evict least recently used entries until memory usage is not greater
+ * than limit.
+ */
+static void mem_shrink(gsize limit){
+    while (mem_usage > limit && !g_queue_is_empty(&mem_queue)){
+        SuiUrlPreviewCacheEntry *entry;
+
+        entry = g_queue_pop_tail(&mem_queue);
+        g_hash_table_remove(mem_table, entry->key);
+        mem_usage -= entry->size;
+        entry_free(entry);
+    }
+}
+
+static void entry_free(SuiUrlPreviewCacheEntry *entry){
+    g_free(entry->key);
+    g_free(entry->mime_type);
+    if (entry->data){
+        g_bytes_unref(entry->data);
+    }
+    if (entry->thumbnail){
+        g_object_unref(entry->thumbnail);
+    }
+    g_free(entry);
+}
+
+static char* disk_get_path(const char *key, const char *suffix){
+    char *dir;
+    char *hash;
+    char *fname;
+    char *path;
+
+    dir = srn_create_cache_dir(DISK_CACHE_DIR);
+    if (!dir){
+        return NULL;
+    }
+
+    hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+    fname = g_strconcat(hash, suffix, NULL);
+    path = g_build_filename(dir, fname, NULL);
+
+    g_free(fname);
+    g_free(hash);
+    g_free(dir);
+
+    return path;
+}
+
+static void validators_free(Validators *validators){
+    g_free(validators->etag);
+    g_free(validators->last_modified);
+    g_free(validators);
+}
+
+static void get_validators_thread(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable){
+    bool found;
+    const char *key;
+    char *meta_path;
+    char *png_path;
+    GKeyFile *meta;
+    Validators *validators;
+
+    key = task_data;
+    validators = NULL;
+
+    meta_path = disk_get_path(key, ".ini");
+    png_path = disk_get_path(key, ".png");
+    if (!meta_path || !png_path){
+        goto FIN;
+    }
+
+    meta = g_key_file_new();
+    found = g_key_file_load_from_file(meta, meta_path, G_KEY_FILE_NONE, NULL)
+        && g_file_test(png_path, G_FILE_TEST_IS_REGULAR);
+    if (found){
+        char *url;
+
+        // Make sure it is not a hash collision
+        url = g_key_file_get_string(meta, META_GROUP, "url", NULL);
+        found = g_strcmp0(url, key) == 0;
+        g_free(url);
+    }
+    if (found){
+        validators = g_malloc0(sizeof(Validators));
+        validators->etag = g_key_file_get_string(meta, META_GROUP,
+                "etag", NULL);
+        validators->last_modified = g_key_file_get_string(meta, META_GROUP,
+                "last-modified", NULL);
+        if (!validators->etag && !validators->last_modified){
+            validators_free(validators);
+            validators = NULL;
+        }
+    }
+    g_key_file_free(meta);
+
+FIN:
+    g_free(meta_path);
+    g_free(png_path);
+
+    g_task_return_pointer(task, validators,
+            (GDestroyNotify)validators_free);
+}
+
+static void load_thumbnail_thread(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable){
+    char *path;
+    GError *err;
+    GdkPixbuf *thumbnail;
+
+    path = disk_get_path(task_data, ".png");
+    if (!path){
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                "Failed to get path of cached thumbnail");
+        return;
+    }
+
+    err = NULL;
+    thumbnail = gdk_pixbuf_new_from_file(path, &err);
+    if (err){
+        WARN_FR("Failed to load cached thumbnail %s: %s", path, err->message);
+        g_task_return_error(task, err);
+    } else {
+        // Modification time is used as access time for eviction
+        g_utime(path, NULL);
+        g_task_return_pointer(task, thumbnail, g_object_unref);
+    }
+    g_free(path);
+}
+
+static void save_task_data_free(SaveTaskData *data){
+    g_free(data->key);
+    g_free(data->etag);
+    g_free(data->last_modified);
+    if (data->thumbnail){
+        g_object_unref(data->thumbnail);
+    }
+    g_free(data);
+}
+
+static void save_thumbnail_thread(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable){
+    char *dir;
+    char *png_path;
+    char *tmp_path;
+    char *meta_path;
+    char *content;
+    GError *err;
+    GKeyFile *meta;
+    SaveTaskData *data;
+
+    data = task_data;
+
+    dir = srn_create_cache_dir(DISK_CACHE_DIR);
+    png_path = disk_get_path(data->key, ".png");
+    meta_path = disk_get_path(data->key, ".ini");
+    if (!dir || !png_path || !meta_path){
+        g_free(dir);
+        g_free(png_path);
+        g_free(meta_path);
+        return;
+    }
+    tmp_path = g_strconcat(png_path, ".tmp", NULL);
+
+    g_mutex_lock(&disk_mutex);
+
+    // Readers never see a partially written thumbnail
+    err = NULL;
+    if (!gdk_pixbuf_save(data->thumbnail, tmp_path, "png", &err, NULL)){
+        WARN_FR("Failed to save thumbnail %s: %s", tmp_path, err->message);
+        g_error_free(err);
+        g_unlink(tmp_path);
+        goto FIN;
+    }
+    if (g_rename(tmp_path, png_path) != 0){
+        WARN_FR("Failed to rename thumbnail %s: %s",
+                tmp_path, g_strerror(errno));
+        g_unlink(tmp_path);
+        goto FIN;
+    }
+
+    meta = g_key_file_new();
+    g_key_file_set_string(meta, META_GROUP, "url", data->key);
+    if (data->etag){
+        g_key_file_set_string(meta, META_GROUP, "etag", data->etag);
+    }
+    if (data->last_modified){
+        g_key_file_set_string(meta, META_GROUP, "last-modified",
+                data->last_modified);
+    }
+    content = g_key_file_to_data(meta, NULL, NULL);
+    if (!g_file_set_contents(meta_path, content, -1, &err)){
+        WARN_FR("Failed to save thumbnail meta %s: %s",
+                meta_path, err->message);
+        g_error_free(err);
+        g_unlink(png_path);
+    }
+    g_free(content);
+    g_key_file_free(meta);
+
+    disk_shrink(dir, data->disk_limit);
+
+FIN:
+    g_mutex_unlock(&disk_mutex);
+
+    g_free(dir);
+    g_free(png_path);
+    g_free(tmp_path);
+    g_free(meta_path);
+}
+
+typedef struct _DiskFile {
+    char *name;
+    goffset size;
+    gint64 mtime;
+} DiskFile;
+
+static int disk_file_cmp(gconstpointer a, gconstpointer b){
+    const DiskFile *file1 = a;
+    const DiskFile *file2 = b;
+
+    if (file1->mtime != file2->mtime){
+        return file1->mtime < file2->mtime ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Evict least recently used thumbnails until disk usage is not greater
+ * than limit, run in worker thread with ``disk_mutex`` held.
+ */
+static void disk_shrink(const char *dir, goffset limit){
+    goffset usage;
+    const char *name;
+    GArray *files;
+    GDir *gdir;
+
+    gdir = g_dir_open(dir, 0, NULL);
+    if (!gdir){
+        return;
+    }
+
+    usage = 0;
+    files = g_array_new(FALSE, FALSE, sizeof(DiskFile));
+    while ((name = g_dir_read_name(gdir))){
+        char *path;
+        GStatBuf buf;
+        DiskFile file;
+
+        if (!g_str_has_suffix(name, ".png")){
+            continue;
+        }
+        path = g_build_filename(dir, name, NULL);
+        if (g_stat(path, &buf) == 0){
+            file.name = g_strdup(name);
+            file.size = buf.st_size;
+            file.mtime = buf.st_mtime;
+            g_array_append_val(files, file);
+            usage += file.size;
+        }
+        g_free(path);
+    }
+    g_dir_close(gdir);
+
+    if (usage > limit){
+        g_array_sort(files, disk_file_cmp);
+        for (unsigned i = 0; i < files->len && usage > limit; i++){
+            char *path;
+            char *meta_name;
+            DiskFile *file;
+
+            file = &g_array_index(files, DiskFile, i);
+            path = g_build_filename(dir, file->name, NULL);
+            g_unlink(path);
+            g_free(path);
+
+            meta_name = g_strndup(file->name, strlen(file->name) - strlen(".png"));
+            path = g_strconcat(dir, G_DIR_SEPARATOR_S, meta_name, ".ini", NULL);
+            g_unlink(path);
+            g_free(path);
+            g_free(meta_name);
+
+            usage -= file->size;
+        }
+        DBG_FR("Disk cache shrunk to %" G_GINT64_FORMAT " bytes", (gint64)usage);
+    }
+
+    for (unsigned i = 0; i < files->len; i++){
+        g_free(g_array_index(files, DiskFile, i).name);
+    }
+    g_array_free(files, TRUE);
+}
@@ -0,0 +1,50 @@
+/* Copyright (C) 2016-2018 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SUI_URL_PREVIEW_CACHE_H
+#define __SUI_URL_PREVIEW_CACHE_H
+
+#include <gtk/gtk.h>
+
+#include "sui/sui.h"
+#include "sui_url_previewer.h"
+
+typedef struct _SuiUrlPreviewCacheEntry SuiUrlPreviewCacheEntry;
+
+struct _SuiUrlPreviewCacheEntry {
+    char *key; // Normalized URL
+    SuiUrlContentType content_type;
+    GBytes *data;           // Encoded image, may be NULL if it is too large
+    char *mime_type;        // MIME type of encoded image, may be NULL
+    GdkPixbuf *thumbnail;   // Scaled image, NULL if content is not an image
+    gsize size;             // Memory usage in bytes
+};
+
+void sui_url_preview_cache_set_config(SuiUrlPreviewCacheConfig *cfg);
+char* sui_url_preview_cache_normalize_url(const char *url);
+
+const SuiUrlPreviewCacheEntry* sui_url_preview_cache_lookup(const char *key);
+void sui_url_preview_cache_insert(const char *key, SuiUrlContentType content_type, GBytes *data, const char *mime_type, GdkPixbuf *thumbnail);
+
+void sui_url_preview_cache_get_validators_async(const char *key, GCancellable *cancel, GAsyncReadyCallback callback, gpointer user_data);
+bool sui_url_preview_cache_get_validators_finish(GAsyncResult *result, char **etag, char **last_modified);
+void sui_url_preview_cache_load_thumbnail_async(const char *key, GCancellable *cancel, GAsyncReadyCallback callback, gpointer user_data);
+GdkPixbuf* sui_url_preview_cache_load_thumbnail_finish(GAsyncResult *result, GError **error);
+void sui_url_preview_cache_save_thumbnail(const char *key, GdkPixbuf *thumbnail, const char *etag, const char *last_modified);
+
+#endif /* __SUI_URL_PREVIEW_CACHE_H */
@@ -0,0 +1,455 @@
+/* Copyright (C) 2016-2018 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file sui_url_preview_scheduler.c
+ * @brief Application-wide scheduler of automatic URL previews
+ *
+ * Queued previewers are only started when they are in the visible viewport
+ * of current buffer, and the number of running previews is limited both
+ * globally and per host. A running preview is cancelled and queued again
+ * once it is scrolled away or its buffer is hidden.
+ *
+ * Pending previewers are kept in a queue per buffer, queues of hidden
+ * buffers are parked and not walked until their buffers are shown again.
+ *
+ * Previewers are not referenced by scheduler, they are removed from
+ * scheduler when disposed.
+ */
+
+#include <gtk/gtk.h>
+#include <libsoup/soup.h>
+
+#include "sui/sui.h"
+#include "sui_buffer.h"
+#include "sui_url_preview_scheduler.h"
+
+#include "log.h"
+#include "utils.h"
+
+#define MAX_RUNNING_COUNT           6
+#define MAX_RUNNING_COUNT_PER_HOST  2
+
+#define ADJUSTMENT_HOOKED_KEY       "sui-url-preview-scheduler-hooked"
+
+typedef struct _BufferQueue BufferQueue;
+
+typedef struct _PreviewJob {
+    SuiUrlPreviewer *previewer;
+    GtkWidget *anchor; // Widget used to determine visibility of previewer
+    char *host;
+    BufferQueue *queue; // NULL if its buffer has been destroyed
+    GList *link; // Link in pending queue, NULL if the job is running
+} PreviewJob;
+
+struct _BufferQueue {
+    SuiBuffer *buf;
+    GQueue pending; // PreviewJobs in queued order
+    int running;    // Number of running jobs of buffer
+    gulong map_handler;
+    gulong unmap_handler;
+    gulong destroy_handler;
+};
+
+static GHashTable *job_table = NULL;   // SuiUrlPreviewer → PreviewJob
+static GHashTable *queue_table = NULL; // SuiBuffer → BufferQueue
+static GList *running_jobs = NULL;
+static int running_count = 0;
+static guint update_id = 0;
+
+static PreviewJob* preview_job_new(SuiUrlPreviewer *previewer,
+        BufferQueue *queue);
+static void preview_job_free(PreviewJob *job);
+static void remove_job(PreviewJob *job);
+static BufferQueue* buffer_queue_new(SuiBuffer *buf);
+static void buffer_queue_free(BufferQueue *queue);
+static void free_queue_if_idle(BufferQueue *queue);
+static int get_host_running_count(const char *host);
+static bool is_in_viewport(GtkWidget *widget);
+static void schedule_update(void);
+static gboolean update(gpointer user_data);
+
+static void buffer_on_map_changed(GtkWidget *widget, gpointer user_data);
+static void buffer_on_destroy(GtkWidget *widget, gpointer user_data);
+static void adjustment_on_changed(GtkAdjustment *adj, gpointer user_data);
+
+/*****************************************************************************
+ * Exported functions
+ *****************************************************************************/
+
+/**
+ * @brief ``sui_url_preview_scheduler_queue`` queues a previewer, it will be
+ * previewed when it becomes visible and there is a free slot.
+ *
+ * @param previewer
+ * @param buf Buffer which the previewer is shown in
+ */
+void sui_url_preview_scheduler_queue(SuiUrlPreviewer *previewer,
+        SuiBuffer *buf){
+    PreviewJob *job;
+    BufferQueue *queue;
+
+    g_return_if_fail(SUI_IS_URL_PREVIEWER(previewer));
+    g_return_if_fail(SUI_IS_BUFFER(buf));
+
+    if (!job_table){
+        job_table = g_hash_table_new(g_direct_hash, g_direct_equal);
+        queue_table = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                NULL, (GDestroyNotify)buffer_queue_free);
+    }
+    if (g_hash_table_contains(job_table, previewer)){
+        return;
+    }
+
+    queue = g_hash_table_lookup(queue_table, buf);
+    if (!queue){
+        queue = buffer_queue_new(buf);
+        g_hash_table_insert(queue_table, buf, queue);
+    }
+
+    job = preview_job_new(previewer, queue);
+    g_queue_push_tail(&queue->pending, job);
+    job->link = queue->pending.tail;
+    g_hash_table_insert(job_table, previewer, job);
+
+    schedule_update();
+}
+
+/**
+ * @brief ``sui_url_preview_scheduler_remove`` removes a previewer from
+ * scheduler, it should be called when previewer is disposed.
+ *
+ * @param previewer
+ */
+void sui_url_preview_scheduler_remove(SuiUrlPreviewer *previewer){
+    bool running;
+    PreviewJob *job;
+    BufferQueue *queue;
+
+    if (!job_table){
+        return;
+    }
+    job = g_hash_table_lookup(job_table, previewer);
+    if (!job){
+        return;
+    }
+
+    running = !job->link;
+    queue = job->queue;
+    remove_job(job);
+    free_queue_if_idle(queue);
+    if (running){
+        schedule_update();
+    }
+}
+
+/**
+ * @brief ``sui_url_preview_scheduler_finish`` tells scheduler that the
+ * request of previewer is finished, no matter it is succeeded or not.
+ *
+ * @param previewer
+ */
+void sui_url_preview_scheduler_finish(SuiUrlPreviewer *previewer){
+    PreviewJob *job;
+
+    if (!job_table){
+        return;
+    }
+    job = g_hash_table_lookup(job_table, previewer);
+    if (job && !job->link){
+        BufferQueue *queue;
+
+        queue = job->queue;
+        remove_job(job);
+        free_queue_if_idle(queue);
+    }
+
+    // A slot may be released by a cancelled request
+    if (g_hash_table_size(job_table) > 0){
+        schedule_update();
+    }
+}
+
+/*****************************************************************************
+ * Static functions
+ *****************************************************************************/
+
+static PreviewJob* preview_job_new(SuiUrlPreviewer *previewer,
+        BufferQueue *queue){
+    GtkWidget *anchor;
+    SoupURI *uri;
+    PreviewJob *job;
+
+    // Previewer may be hidden until its content type is known
+    anchor = GTK_WIDGET(previewer);
+    if (!gtk_widget_get_visible(anchor) && gtk_widget_get_parent(anchor)){
+        anchor = gtk_widget_get_parent(anchor);
+    }
+
+    job = g_malloc0(sizeof(PreviewJob));
+    job->previewer = previewer;
+    job->anchor = anchor;
+    job->queue = queue;
+
+    uri = soup_uri_new(sui_url_previewer_get_url(previewer));
+    if (uri){
+        if (soup_uri_get_host(uri)){
+            job->host = g_ascii_strdown(soup_uri_get_host(uri), -1);
+        }
+        soup_uri_free(uri);
+    }
+
+    return job;
+}
+
+static void preview_job_free(PreviewJob *job){
+    g_free(job->host);
+    g_free(job);
+}
+
+/**
+ * @brief Remove job from scheduler and free it, the queue of its buffer is
+ * kept even if it becomes empty, see ``free_queue_if_idle()``.
+ */
+static void remove_job(PreviewJob *job){
+    if (job->link){
+        g_queue_delete_link(&job->queue->pending, job->link);
+    } else {
+        running_jobs = g_list_remove(running_jobs, job);
+        running_count--;
+        if (job->queue){
+            job->queue->running--;
+        }
+    }
+    g_hash_table_remove(job_table, job->previewer);
+
+    preview_job_free(job);
+}
+
+static BufferQueue* buffer_queue_new(SuiBuffer *buf){
+    BufferQueue *queue;
+
+    queue = g_malloc0(sizeof(BufferQueue));
+    queue->buf = buf;
+    g_queue_init(&queue->pending);
+    // Pending jobs are resumed when buffer is shown, running jobs are
+    // cancelled when buffer is hidden
+    queue->map_handler = g_signal_connect(buf, "map",
+            G_CALLBACK(buffer_on_map_changed), NULL);
+    queue->unmap_handler = g_signal_connect(buf, "unmap",
+            G_CALLBACK(buffer_on_map_changed), NULL);
+    queue->destroy_handler = g_signal_connect(buf, "destroy",
+            G_CALLBACK(buffer_on_destroy), queue);
+
+    return queue;
+}
+
+static void buffer_queue_free(BufferQueue *queue){
+    g_signal_handler_disconnect(queue->buf, queue->map_handler);
+    g_signal_handler_disconnect(queue->buf, queue->unmap_handler);
+    g_signal_handler_disconnect(queue->buf, queue->destroy_handler);
+    g_free(queue);
+}
+
+static void free_queue_if_idle(BufferQueue *queue){
+    if (queue && g_queue_is_empty(&queue->pending) && queue->running == 0){
+        g_hash_table_remove(queue_table, queue->buf);
+    }
+}
+
+static int get_host_running_count(const char *host){
+    int count;
+
+    count = 0;
+    for (GList *lst = running_jobs; lst; lst = g_list_next(lst)){
+        PreviewJob *job;
+
+        job = lst->data;
+        if (g_strcmp0(job->host, host) == 0){
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief Whether the widget is in the visible area of its scrolled window.
+ * Widgets in hidden buffers are never mapped.
+ */
+static bool is_in_viewport(GtkWidget *widget){
+    int x;
+    int y;
+    GtkWidget *sw;
+    GtkAdjustment *adj;
+
+    if (!gtk_widget_get_mapped(widget)){
+        return FALSE;
+    }
+
+    sw = gtk_widget_get_ancestor(widget, GTK_TYPE_SCROLLED_WINDOW);
+    if (!sw){
+        return TRUE;
+    }
+
+    // Re-check viewport when scrolled
+    adj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(sw));
+    if (!g_object_get_data(G_OBJECT(adj), ADJUSTMENT_HOOKED_KEY)){
+        g_signal_connect(adj, "value-changed",
+                G_CALLBACK(adjustment_on_changed), NULL);
+        g_signal_connect(adj, "changed",
+                G_CALLBACK(adjustment_on_changed), NULL);
+        g_object_set_data(G_OBJECT(adj), ADJUSTMENT_HOOKED_KEY,
+                GINT_TO_POINTER(TRUE));
+    }
+
+    if (!gtk_widget_translate_coordinates(widget, sw, 0, 0, &x, &y)){
+        return FALSE;
+    }
+
+    return y + gtk_widget_get_allocated_height(widget) > 0
+        && y < gtk_widget_get_allocated_height(sw);
+}
+
+static void schedule_update(void){
+    if (update_id){
+        return;
+    }
+    // Run after layout so that allocations are up to date
+    update_id = g_idle_add(update, NULL);
+}
+
+static gboolean update(gpointer user_data){
+    GList *lst;
+    GHashTableIter iter;
+    BufferQueue *queue;
+
+    update_id = 0;
+
+    // Cancel running previews which are no longer visible, they are queued
+    // again in front of the pending ones of their buffers
+    lst = running_jobs;
+    while (lst){
+        GList *next;
+        PreviewJob *job;
+
+        next = g_list_next(lst);
+        job = lst->data;
+        if (job->queue && !is_in_viewport(job->anchor)){
+            DBG_FR("Preview of %s is cancelled",
+                    sui_url_previewer_get_url(job->previewer));
+            running_jobs = g_list_delete_link(running_jobs, lst);
+            running_count--;
+            job->queue->running--;
+            g_queue_push_head(&job->queue->pending, job);
+            job->link = job->queue->pending.head;
+            sui_url_previewer_cancel(job->previewer);
+        }
+        lst = next;
+    }
+
+    // Start visible pending previews, queues of hidden buffers are parked
+    g_hash_table_iter_init(&iter, queue_table);
+    while (running_count < MAX_RUNNING_COUNT
+            && g_hash_table_iter_next(&iter, NULL, (gpointer *)&queue)){
+        if (!gtk_widget_get_mapped(GTK_WIDGET(queue->buf))){
+            continue;
+        }
+
+        lst = queue->pending.head;
+        while (lst && running_count < MAX_RUNNING_COUNT){
+            GList *next;
+            PreviewJob *job;
+
+            next = g_list_next(lst);
+            job = lst->data;
+            if (!gtk_widget_is_ancestor(job->anchor, GTK_WIDGET(queue->buf))){
+                // Message has been removed from buffer
+                remove_job(job);
+                goto NEXT;
+            }
+            if (sui_url_previewer_is_loading(job->previewer)){
+                // Cancelled request is not finished yet
+                goto NEXT;
+            }
+            if (!is_in_viewport(job->anchor)){
+                goto NEXT;
+            }
+            if (get_host_running_count(job->host) >= MAX_RUNNING_COUNT_PER_HOST){
+                goto NEXT;
+            }
+
+            g_queue_delete_link(&queue->pending, lst);
+            job->link = NULL;
+            running_jobs = g_list_prepend(running_jobs, job);
+            running_count++;
+            queue->running++;
+            sui_url_previewer_preview(job->previewer);
+            if (!sui_url_previewer_is_loading(job->previewer)){
+                // Previewed from cache, or it has been previewed
+                remove_job(job);
+            }
+NEXT:
+            lst = next;
+        }
+    }
+
+    // Queues are not freed above, it would break the iteration
+    g_hash_table_iter_init(&iter, queue_table);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&queue)){
+        if (g_queue_is_empty(&queue->pending) && queue->running == 0){
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void buffer_on_map_changed(GtkWidget *widget, gpointer user_data){
+    schedule_update();
+}
+
+/**
+ * @brief Drop jobs of destroyed buffer, running previews are cancelled and
+ * removed from scheduler when they are finished.
+ */
+static void buffer_on_destroy(GtkWidget *widget, gpointer user_data){
+    PreviewJob *job;
+    BufferQueue *queue;
+
+    queue = user_data;
+    for (GList *lst = running_jobs; lst; lst = g_list_next(lst)){
+        job = lst->data;
+        if (job->queue == queue){
+            job->queue = NULL;
+            sui_url_previewer_cancel(job->previewer);
+        }
+    }
+    while ((job = g_queue_pop_head(&queue->pending))){
+        g_hash_table_remove(job_table, job->previewer);
+        preview_job_free(job);
+    }
+
+    g_hash_table_remove(queue_table, queue->buf);
+}
+
+static void adjustment_on_changed(GtkAdjustment *adj, gpointer user_data){
+    if (job_table && g_hash_table_size(job_table) > 0){
+        schedule_update();
+    }
+}
@@ -0,0 +1,29 @@
+/* Copyright (C) 2016-2018 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SUI_URL_PREVIEW_SCHEDULER_H
+#define __SUI_URL_PREVIEW_SCHEDULER_H
+
+#include "sui/sui.h"
+#include "sui_url_previewer.h"
+
+void sui_url_preview_scheduler_queue(SuiUrlPreviewer *previewer, SuiBuffer *buf);
+void sui_url_preview_scheduler_remove(SuiUrlPreviewer *previewer);
+void sui_url_preview_scheduler_finish(SuiUrlPreviewer *previewer);
+
+#endif /* __SUI_URL_PREVIEW_SCHEDULER_H */
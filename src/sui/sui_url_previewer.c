@@ -23,6 +23,10 @@
  * @author Shengyu Zhang <i@silverrainz.me>
  * @version 0.06.2
  * @date 2016-04-01
+ *
+ * Images are decoded and scaled in worker threads of GTask, the loader is
+ * asked to decode directly to the target size, so that the full-resolution
+ * image is only materialized when needed.
  */
 
 #include <gtk/gtk.h>
@@ -31,6 +35,8 @@
 
 #include "sui_common.h"
 #include "sui_url_previewer.h"
+#include "sui_url_preview_cache.h"
+#include "sui_url_preview_scheduler.h"
 
 #include "log.h"
 #include "utils.h"
@@ -43,12 +49,13 @@
 
 #define THUMBNAIL_SIZE      300
 #define MAX_CONTENT_LENGTH  10485760 // 10Mb
-#define MAX_INSTANCE_COUNT  20
+#define DECODE_CHUNK_SIZE   65536
 
 struct _SuiUrlPreviewer {
     GtkBox parent;
 
     char *url;
+    char *cache_key;
     char *mime_type;
     SuiUrlContentType content_type;
 
@@ -70,10 +77,18 @@ struct _SuiUrlPreviewer {
     GtkLabel *text_label;
     /* Page image */
     GtkEventBox *image_event_box;
-    GdkPixbuf *pixbuf;
+    GBytes *image_data; // Encoded image, NULL if only thumbnail is available
+    GdkPixbuf *thumbnail;
     GtkImage *image;
 };
 
+typedef struct _DecodeTaskData {
+    GBytes *data;
+    char *mime_type;
+    int max_width;
+    int max_height;
+} DecodeTaskData;
+
 struct _SuiUrlPreviewerClass {
     GtkBoxClass parent_class;
 };
@@ -92,17 +107,40 @@ static void sui_url_previewer_set_mime_type(SuiUrlPreviewer *self,
 static void cancel_preview(SuiUrlPreviewer *self);
 static void preview_error_text(SuiUrlPreviewer *self,
         const char *text);
-static void preview_image(SuiUrlPreviewer *self, GdkPixbuf *pixbuf);
+static void preview_image(SuiUrlPreviewer *self, GBytes *data,
+        GdkPixbuf *thumbnail);
+static void preview_cache_entry(SuiUrlPreviewer *self,
+        const SuiUrlPreviewCacheEntry *entry);
+static void send_request(SuiUrlPreviewer *self, bool conditional);
+static void finish_request(SuiUrlPreviewer *self);
+static void show_image_window(GdkPixbuf *pixbuf);
+static void get_image_window_size(int *width, int *height);
+
+static void decode_image_async(SuiUrlPreviewer *self, GBytes *data,
+        int max_width, int max_height, GAsyncReadyCallback callback);
+static GdkPixbuf* decode_image_finish(SuiUrlPreviewer *self,
+        GAsyncResult *result, GError **error);
+static void decode_image_thread(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable);
+static void decode_task_data_free(DecodeTaskData *data);
 
 static void on_notify_visible(GObject *object, GParamSpec *pspec, gpointer data);
 static void preview_button_on_clicked(GtkWidget *widget, gpointer user_data);
 static void cancel_button_on_clicked(GtkWidget *widget, gpointer user_data);
 static void image_event_box_on_button_release(GtkWidget *widget,
         GdkEventButton *event, gpointer user_data);
+static void validators_ready(GObject *object, GAsyncResult *result,
+        gpointer user_data);
 static void session_send_ready(GObject *object, GAsyncResult *result,
         gpointer user_data);
 static void buffered_stream_fill_ready(GObject *object, GAsyncResult *result,
         gpointer user_data);
+static void thumbnail_load_ready(GObject *object, GAsyncResult *result,
+        gpointer user_data);
+static void thumbnail_decode_ready(GObject *object, GAsyncResult *result,
+        gpointer user_data);
+static void image_decode_ready(GObject *object, GAsyncResult *result,
+        gpointer user_data);
 
 /*****************************************************************************
  * GObject functions
@@ -197,11 +235,24 @@ static void sui_url_previewer_constructed(GObject *object){
     gtk_widget_set_tooltip_text(GTK_WIDGET(self), self->url);
 }
 
+static void sui_url_previewer_dispose(GObject *object){
+    SuiUrlPreviewer *self;
+
+    self = SUI_URL_PREVIEWER(object);
+    sui_url_preview_scheduler_remove(self);
+    // Pending requests hold a reference of previewer, cancel them once the
+    // previewer is destroyed
+    g_cancellable_cancel(self->cancel);
+
+    G_OBJECT_CLASS(sui_url_previewer_parent_class)->dispose(object);
+}
+
 static void sui_url_previewer_finalize(GObject *object){
     SuiUrlPreviewer *self;
 
     self = SUI_URL_PREVIEWER(object);
     str_assign(&self->url, NULL);
+    str_assign(&self->cache_key, NULL);
     str_assign(&self->mime_type, NULL);
     if (self->uri) {
         soup_uri_free(self->uri);
@@ -211,8 +262,11 @@ static void sui_url_previewer_finalize(GObject *object){
     if (SOUP_IS_MESSAGE(self->msg)){
         g_object_unref(self->msg);
     }
-    if (GDK_IS_PIXBUF(self->pixbuf)){
-        g_object_unref(self->pixbuf);
+    if (self->image_data){
+        g_bytes_unref(self->image_data);
+    }
+    if (GDK_IS_PIXBUF(self->thumbnail)){
+        g_object_unref(self->thumbnail);
     }
 
     G_OBJECT_CLASS(sui_url_previewer_parent_class)->finalize(object);
@@ -226,6 +280,7 @@ static void sui_url_previewer_class_init(SuiUrlPreviewerClass *class){
     object_class->set_property = sui_url_previewer_set_property;
     object_class->get_property = sui_url_previewer_get_property;
     object_class->constructed = sui_url_previewer_constructed;
+    object_class->dispose = sui_url_previewer_dispose;
     object_class->finalize = sui_url_previewer_finalize;
 
     /* Install properties */
@@ -267,44 +322,6 @@ static void sui_url_previewer_class_init(SuiUrlPreviewerClass *class){
  * Exported functions
  *****************************************************************************/
 
-SuiUrlPreviewer* sui_url_previewer_new_from_cache(const char *url){
-    static GList *instance_list = NULL;
-    GList *lst;
-    SoupURI *uri;
-    SuiUrlPreviewer *instance;
-
-    while (g_list_length(instance_list) > MAX_INSTANCE_COUNT){
-        SuiUrlPreviewer *cur;
-
-        lst = g_list_last(instance_list);
-        cur = SUI_URL_PREVIEWER(lst->data);
-        g_object_unref(cur);
-        instance_list = g_list_delete_link(instance_list, lst);
-    }
-
-    instance = NULL;
-    uri = soup_uri_new(url);
-    lst = instance_list;
-    while (lst){
-        SuiUrlPreviewer *cur;
-
-        cur = SUI_URL_PREVIEWER(lst->data);
-        if (soup_uri_equal(cur->uri, uri)){
-            instance = cur;
-            break;
-        }
-        lst = g_list_next(lst);
-    }
-
-    if (!instance){
-        instance = sui_url_previewer_new(url);
-        instance_list = g_list_append(instance_list, g_object_ref(instance));
-    }
-
-    soup_uri_free(uri);
-    return instance;
-}
-
 SuiUrlPreviewer* sui_url_previewer_new(const char *url){
     return g_object_new(SUI_TYPE_URL_PREVIEWER,
             "url", url,
@@ -317,6 +334,8 @@ SuiUrlPreviewer* sui_url_previewer_new(const char *url){
  * @param self
  */
 void sui_url_previewer_preview(SuiUrlPreviewer *self){
+    const SuiUrlPreviewCacheEntry *entry;
+
     g_return_if_fail(!SOUP_IS_MESSAGE(self->msg));
 
     gtk_expander_set_expanded(self->expander, TRUE);
@@ -329,12 +348,39 @@ void sui_url_previewer_preview(SuiUrlPreviewer *self){
         return;
     }
 
+    entry = sui_url_preview_cache_lookup(self->cache_key);
+    if (entry){
+        preview_cache_entry(self, entry);
+        return;
+    }
+
     gtk_stack_set_visible_child_name(self->stack, STACK_PAGE_LOADING);
 
     g_cancellable_reset(self->cancel);
-    self->msg = soup_message_new_from_uri("GET", self->uri);
-    soup_session_send_async(self->session, self->msg, self->cancel,
-            session_send_ready, self);
+    g_object_ref(self); // Released by finish_request()
+    send_request(self, TRUE);
+}
+
+/**
+ * @brief ``sui_url_previewer_cancel`` cancels the preview in progress, the
+ * previewer goes back to the state before preview.
+ *
+ * @param self
+ */
+void sui_url_previewer_cancel(SuiUrlPreviewer *self){
+    cancel_preview(self);
+}
+
+/**
+ * @brief ``sui_url_previewer_is_loading`` returns whether the previewer has
+ * a request in progress, including a cancelled one which is not finished yet.
+ *
+ * @param self
+ *
+ * @return TRUE if loading.
+ */
+bool sui_url_previewer_is_loading(SuiUrlPreviewer *self){
+    return SOUP_IS_MESSAGE(self->msg);
 }
 
 const char* sui_url_previewer_get_url(SuiUrlPreviewer *self){
@@ -369,6 +415,7 @@ static void sui_url_previewer_set_url(SuiUrlPreviewer *self, const char *url){
         return;
     }
 
+    self->cache_key = sui_url_preview_cache_normalize_url(url);
     sui_url_previewer_set_content_type(self, SUI_URL_CONTENT_TYPE_UNKNOWN);
 }
 
@@ -407,22 +454,241 @@ static void preview_error_text(SuiUrlPreviewer *self,
     gtk_label_set_text(self->text_label, text);
 }
 
-static void preview_image(SuiUrlPreviewer *self, GdkPixbuf *pixbuf){
+static void preview_image(SuiUrlPreviewer *self, GBytes *data,
+        GdkPixbuf *thumbnail){
+    self->previewed = TRUE;
+    gtk_stack_set_visible_child_name(self->stack, STACK_PAGE_IMAGE);
+
+    if (self->image_data){
+        g_bytes_unref(self->image_data);
+    }
+    if (GDK_IS_PIXBUF(self->thumbnail)){
+        g_object_unref(self->thumbnail);
+    }
+    // Image data is not available if thumbnail comes from disk cache
+    self->image_data = data ? g_bytes_ref(data) : NULL;
+    self->thumbnail = g_object_ref(thumbnail);
+    gtk_image_set_from_pixbuf(self->image, thumbnail);
+}
+
+static void preview_cache_entry(SuiUrlPreviewer *self,
+        const SuiUrlPreviewCacheEntry *entry){
+    g_object_freeze_notify(G_OBJECT(self));
+
+    sui_url_previewer_set_content_type(self, entry->content_type);
+    switch (entry->content_type){
+        case SUI_URL_CONTENT_TYPE_IMAGE:
+            sui_url_previewer_set_mime_type(self, entry->mime_type);
+            preview_image(self, entry->data, entry->thumbnail);
+            break;
+        case SUI_URL_CONTENT_TYPE_UNSUPPORTED:
+            preview_error_text(self, _("Unsupported URL content type"));
+            break;
+        default:
+            g_warn_if_reached();
+    }
+
+    g_object_thaw_notify(G_OBJECT(self));
+}
+
+/**
+ * @brief Send GET request of URL, if ``conditional`` is TRUE and thumbnail
+ * is found in disk cache, the request is sent with validators of cache.
+ */
+static void send_request(SuiUrlPreviewer *self, bool conditional){
+    self->msg = soup_message_new_from_uri("GET", self->uri);
+    if (!conditional){
+        soup_session_send_async(self->session, self->msg, self->cancel,
+                session_send_ready, self);
+        return;
+    }
+
+    // Disk cache is looked up in worker thread, the request is sent later
+    sui_url_preview_cache_get_validators_async(self->cache_key, self->cancel,
+            validators_ready, self);
+}
+
+static void finish_request(SuiUrlPreviewer *self){
+    g_object_unref(self->msg);
+    self->msg = NULL;
+
+    sui_url_preview_scheduler_finish(self);
+    g_object_unref(self);
+}
+
+static void show_image_window(GdkPixbuf *pixbuf){
     int width;
     int height;
+    int max_width;
+    int max_height;
     GdkPixbuf *scaled_pixbuf;
+    GtkImage *image;
+    GtkWindow *iwin;
+    GtkBuilder *builder;
 
-    self->previewed = TRUE;
-    gtk_stack_set_visible_child_name(self->stack, STACK_PAGE_IMAGE);
+    builder = gtk_builder_new_from_resource("/im/srain/Srain/image_window.glade");
+    iwin = GTK_WINDOW(gtk_builder_get_object(builder, "image_window"));
+    image = GTK_IMAGE(gtk_builder_get_object(builder, "image"));
 
+    get_image_window_size(&max_width, &max_height);
+    width = gdk_pixbuf_get_width(pixbuf);
+    height = gdk_pixbuf_get_height(pixbuf);
     sui_common_scale_size(gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf),
-            THUMBNAIL_SIZE, THUMBNAIL_SIZE, &width, &height);
-    scaled_pixbuf = gdk_pixbuf_scale_simple(pixbuf, width, height,
-            GDK_INTERP_BILINEAR);
+            max_width, max_height, &width, &height);
+    if (width != gdk_pixbuf_get_width(pixbuf)
+            || height != gdk_pixbuf_get_height(pixbuf)){
+        scaled_pixbuf = gdk_pixbuf_scale_simple(pixbuf, width, height,
+                GDK_INTERP_BILINEAR);
+    } else {
+        scaled_pixbuf = g_object_ref(pixbuf);
+    }
+
+    gtk_image_set_from_pixbuf(image, scaled_pixbuf);
+
+    g_signal_connect_swapped(iwin, "button-release-event",
+            G_CALLBACK(gtk_widget_destroy), iwin);
+    g_signal_connect_swapped(image, "button-release-event",
+            G_CALLBACK(gtk_widget_destroy), iwin);
 
-    self->pixbuf = g_object_ref(pixbuf);
-    gtk_image_set_from_pixbuf(self->image, scaled_pixbuf);
     g_object_unref(scaled_pixbuf);
+    g_object_unref(builder);
+
+    gtk_window_present(iwin);
+}
+
+static void get_image_window_size(int *width, int *height){
+#if GTK_CHECK_VERSION(3, 22, 0)
+    GdkDisplay *display;
+    GdkMonitor *monitor;
+#else
+    GdkScreen *screen;
+    int monitor;
+#endif
+    GdkWindow *gdkwin;
+    GdkRectangle rect;
+
+#if GTK_CHECK_VERSION(3, 22, 0)
+    display = gdk_display_get_default();
+    gdkwin = gtk_widget_get_window(GTK_WIDGET(sui_common_get_cur_window()));
+    monitor = gdk_display_get_monitor_at_window(display, gdkwin);
+    gdk_monitor_get_geometry(monitor, &rect);
+#else
+    screen = gdk_screen_get_default();
+    gdkwin = gtk_widget_get_window(GTK_WIDGET(sui_common_get_cur_window()));
+    monitor = gdk_screen_get_monitor_at_window(screen, gdkwin);
+    gdk_screen_get_monitor_geometry(screen, monitor, &rect);
+#endif
+
+    /* If we should scale the image, do not fill full screen */
+    *width = rect.width - 20;
+    *height = rect.height - 20;
+}
+
+/**
+ * @brief Decode image data in a worker thread, the image is scaled down
+ * during decoding if it is larger than ``max_width`` x ``max_height``.
+ */
+static void decode_image_async(SuiUrlPreviewer *self, GBytes *data,
+        int max_width, int max_height, GAsyncReadyCallback callback){
+    GTask *task;
+    DecodeTaskData *task_data;
+
+    task_data = g_malloc0(sizeof(DecodeTaskData));
+    task_data->data = g_bytes_ref(data);
+    task_data->mime_type = g_strdup(self->mime_type);
+    task_data->max_width = max_width;
+    task_data->max_height = max_height;
+
+    task = g_task_new(self, self->cancel, callback, NULL);
+    g_task_set_task_data(task, task_data, (GDestroyNotify)decode_task_data_free);
+    g_task_run_in_thread(task, decode_image_thread);
+    g_object_unref(task);
+}
+
+static GdkPixbuf* decode_image_finish(SuiUrlPreviewer *self,
+        GAsyncResult *result, GError **error){
+    g_return_val_if_fail(g_task_is_valid(result, self), NULL);
+
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+static void loader_on_size_prepared(GdkPixbufLoader *loader,
+        int width, int height, gpointer user_data){
+    int dst_width;
+    int dst_height;
+    DecodeTaskData *data;
+
+    data = user_data;
+    dst_width = width;
+    dst_height = height;
+    sui_common_scale_size(width, height, data->max_width, data->max_height,
+            &dst_width, &dst_height);
+    if (dst_width != width || dst_height != height){
+        gdk_pixbuf_loader_set_size(loader, dst_width, dst_height);
+    }
+}
+
+static void decode_image_thread(GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable){
+    gsize len;
+    gsize offset;
+    const guchar *buf;
+    GError *err;
+    GdkPixbuf *pixbuf;
+    GdkPixbufLoader *loader;
+    DecodeTaskData *data;
+
+    data = task_data;
+    err = NULL;
+    loader = NULL;
+    if (data->mime_type) {
+        loader = gdk_pixbuf_loader_new_with_mime_type(data->mime_type, &err);
+        if (err) {
+            WARN_FR("Failed to create pixbuf loader: %s", err->message);
+            g_error_free(err);
+            err = NULL;
+        }
+    }
+    if (!loader){
+        loader = gdk_pixbuf_loader_new();
+    }
+    g_signal_connect(loader, "size-prepared",
+            G_CALLBACK(loader_on_size_prepared), data);
+
+    buf = g_bytes_get_data(data->data, &len);
+    for (offset = 0; offset < len; offset += DECODE_CHUNK_SIZE){
+        if (g_task_return_error_if_cancelled(task)){
+            gdk_pixbuf_loader_close(loader, NULL);
+            goto FIN;
+        }
+        if (!gdk_pixbuf_loader_write(loader, buf + offset,
+                    MIN(DECODE_CHUNK_SIZE, len - offset), &err)){
+            gdk_pixbuf_loader_close(loader, NULL);
+            g_task_return_error(task, err);
+            goto FIN;
+        }
+    }
+    if (!gdk_pixbuf_loader_close(loader, &err)){
+        g_task_return_error(task, err);
+        goto FIN;
+    }
+
+    pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+    if (!pixbuf){
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                _("Failed to decode image"));
+        goto FIN;
+    }
+    g_task_return_pointer(task, g_object_ref(pixbuf), g_object_unref);
+
+FIN:
+    g_object_unref(loader);
+}
+
+static void decode_task_data_free(DecodeTaskData *data){
+    g_bytes_unref(data->data);
+    g_free(data->mime_type);
+    g_free(data);
 }
 
 static void on_notify_visible(GObject *object, GParamSpec *pspec, gpointer data){
@@ -453,20 +719,6 @@ static void image_event_box_on_button_release(GtkWidget *widget,
         GdkEventButton *event, gpointer user_data){
     int width;
     int height;
-#if GTK_CHECK_VERSION(3, 22, 0)
-    GdkDisplay *display;
-    GdkMonitor *monitor;
-#else
-    GdkScreen *screen;
-    int monitor;
-#endif
-    GdkWindow *gdkwin;
-    GdkRectangle rect;
-    GdkPixbuf *pixbuf;
-    GdkPixbuf *scaled_pixbuf;
-    GtkImage *image;
-    GtkWindow *iwin;
-    GtkBuilder *builder;
     SuiUrlPreviewer *self;
 
     if (event->button != 1){ // Left mouse button
@@ -474,44 +726,41 @@ static void image_event_box_on_button_release(GtkWidget *widget,
     }
 
     self = SUI_URL_PREVIEWER(user_data);
-    builder = gtk_builder_new_from_resource("/im/srain/Srain/image_window.glade");
-    iwin = GTK_WINDOW(gtk_builder_get_object(builder, "image_window"));
-    image = GTK_IMAGE(gtk_builder_get_object(builder, "image"));
-
-#if GTK_CHECK_VERSION(3, 22, 0)
-    display = gdk_display_get_default();
-    gdkwin = gtk_widget_get_window(GTK_WIDGET(sui_common_get_cur_window()));
-    monitor = gdk_display_get_monitor_at_window(display, gdkwin);
-    gdk_monitor_get_geometry(monitor, &rect);
-#else
-    screen = gdk_screen_get_default();
-    gdkwin = gtk_widget_get_window(GTK_WIDGET(sui_common_get_cur_window()));
-    monitor = gdk_screen_get_monitor_at_window(screen, gdkwin);
-    gdk_screen_get_monitor_geometry(screen, monitor, &rect);
-#endif
-
-    /* If we should scale the image, do not fill full screen */
-    rect.height -= 20;
-    rect.width -= 20;
-    pixbuf = self->pixbuf;
-    width = gdk_pixbuf_get_width(pixbuf);
-    height = gdk_pixbuf_get_height(pixbuf);
-    sui_common_scale_size(gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf),
-            rect.width, rect.height, &width, &height);
-    scaled_pixbuf = gdk_pixbuf_scale_simple(pixbuf, width, height,
-            GDK_INTERP_BILINEAR);
+    if (!self->image_data){
+        show_image_window(self->thumbnail);
+        return;
+    }
 
-    gtk_image_set_from_pixbuf(image, scaled_pixbuf);
+    get_image_window_size(&width, &height);
+    decode_image_async(self, self->image_data, width, height,
+            image_decode_ready);
+}
 
-    g_signal_connect_swapped(iwin, "button-release-event",
-            G_CALLBACK(gtk_widget_destroy), iwin);
-    g_signal_connect_swapped(image, "button-release-event",
-            G_CALLBACK(gtk_widget_destroy), iwin);
+static void validators_ready(GObject *object, GAsyncResult *result,
+        gpointer user_data){
+    char *etag;
+    char *last_modified;
+    SoupMessageHeaders *headers;
+    SuiUrlPreviewer *self;
 
-    g_object_unref(scaled_pixbuf);
-    g_object_unref(builder);
+    self = SUI_URL_PREVIEWER(user_data);
+    headers = self->msg->request_headers;
+    if (sui_url_preview_cache_get_validators_finish(result,
+                &etag, &last_modified)){
+        if (etag){
+            soup_message_headers_append(headers, "If-None-Match", etag);
+        }
+        if (last_modified){
+            soup_message_headers_append(headers, "If-Modified-Since",
+                    last_modified);
+        }
+        g_free(etag);
+        g_free(last_modified);
+    }
 
-    gtk_window_present(iwin);
+    // A cancelled request is finished in session_send_ready()
+    soup_session_send_async(self->session, self->msg, self->cancel,
+            session_send_ready, self);
 }
 
 static void session_send_ready(GObject *object, GAsyncResult *result,
@@ -526,7 +775,10 @@ static void session_send_ready(GObject *object, GAsyncResult *result,
     SuiUrlPreviewer *self;
 
     session = SOUP_SESSION(object);
-    self = NULL;
+    self = SUI_URL_PREVIEWER(user_data);
+    // Freeze notify because PROP_CONTENT_TYPE may be modified here
+    g_object_freeze_notify(G_OBJECT(self));
+
     err = NULL;
     input_stream = soup_session_send_finish(session, result, &err);
     if (err) {
@@ -535,9 +787,14 @@ static void session_send_ready(GObject *object, GAsyncResult *result,
         goto ERR;
     }
 
-    self = SUI_URL_PREVIEWER(user_data);
-    // Freeze notify because PROP_CONTENT_TYPE may be modified here
-    g_object_freeze_notify(G_OBJECT(self));
+    if (self->msg->status_code == SOUP_STATUS_NOT_MODIFIED){
+        // self->msg is kept until thumbnail is loaded
+        g_object_unref(input_stream);
+        sui_url_preview_cache_load_thumbnail_async(self->cache_key,
+                self->cancel, thumbnail_load_ready, self);
+        g_object_thaw_notify(G_OBJECT(self));
+        return;
+    }
 
     headers = self->msg->response_headers;
     // TODO: chunked encoding support
@@ -566,6 +823,8 @@ static void session_send_ready(GObject *object, GAsyncResult *result,
             goto ERR;
         case SUI_URL_CONTENT_TYPE_UNSUPPORTED:
             preview_error_text(self, _("Unsupported URL content type"));
+            sui_url_preview_cache_insert(self->cache_key,
+                    SUI_URL_CONTENT_TYPE_UNSUPPORTED, NULL, NULL, NULL);
             goto ERR;
         default:
             buffered_stream = G_BUFFERED_INPUT_STREAM(
@@ -584,12 +843,8 @@ ERR:
         g_object_unref(input_stream);
     }
 
-    if (self) {
-        g_object_unref(self->msg);
-        self->msg = NULL;
-
-        g_object_thaw_notify(G_OBJECT(self));
-    }
+    g_object_thaw_notify(G_OBJECT(self));
+    finish_request(self);
 }
 
 static void buffered_stream_fill_ready(GObject *object, GAsyncResult *result,
@@ -601,7 +856,7 @@ static void buffered_stream_fill_ready(GObject *object, GAsyncResult *result,
     SuiUrlPreviewer *self;
 
     buffered_stream = G_BUFFERED_INPUT_STREAM(object);
-    self = NULL;
+    self = SUI_URL_PREVIEWER(user_data);
 
     err = NULL;
     g_buffered_input_stream_fill_finish(buffered_stream, result, &err);
@@ -610,7 +865,6 @@ static void buffered_stream_fill_ready(GObject *object, GAsyncResult *result,
         g_error_free(err);
         goto FIN;
     }
-    self = SUI_URL_PREVIEWER(user_data);
 
     {
         int avail;
@@ -630,42 +884,15 @@ static void buffered_stream_fill_ready(GObject *object, GAsyncResult *result,
     switch (sui_url_previewer_get_content_type(self)){
         case SUI_URL_CONTENT_TYPE_IMAGE:
             {
-                GdkPixbuf *pixbuf;
-                GdkPixbufLoader *loader;
-
-                if (self->mime_type) {
-                    GError *err;
-
-                    err = NULL;
-                    loader = gdk_pixbuf_loader_new_with_mime_type(self->mime_type, &err);
-                    if (err) {
-                        ERR_FR("Failed to create pixbuf loader: %s", err->message);
-                        g_error_free(err);
-                        // loader never be NULL even error occurred, so continue
-                    }
-                } else {
-                    loader = gdk_pixbuf_loader_new();
-                }
-
-                err = NULL;
-                gdk_pixbuf_loader_write(loader, buf, len, &err);
-                if (err) {
-                    WARN_FR("Failed to write to GdkPixbufLoader: %s", err->message);
-                    gdk_pixbuf_loader_close(loader, NULL);
-                    g_object_unref(loader);
-                    preview_error_text(self, err->message);
-                    g_error_free(err);
-                    goto FIN;
-                }
-                pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
-                if (pixbuf){
-                    preview_image(self, pixbuf);
-                } else {
-                    WARN_FR("Get a NULL pixbuf from pixbuf loader");
-                }
-                gdk_pixbuf_loader_close(loader, NULL);
-                g_object_unref(loader);
-                break;
+                GBytes *data;
+
+                // self->msg is kept until thumbnail is decoded
+                data = g_bytes_new(buf, len);
+                decode_image_async(self, data, THUMBNAIL_SIZE, THUMBNAIL_SIZE,
+                        thumbnail_decode_ready);
+                g_bytes_unref(data);
+                g_object_unref(buffered_stream);
+                return;
             }
         default:
             g_warn_if_reached();
@@ -673,8 +900,97 @@ static void buffered_stream_fill_ready(GObject *object, GAsyncResult *result,
 
 FIN:
     g_object_unref(buffered_stream);
-    if (self) {
-        g_object_unref(self->msg);
-        self->msg = NULL;
+    finish_request(self);
+}
+
+static void thumbnail_load_ready(GObject *object, GAsyncResult *result,
+        gpointer user_data){
+    GError *err;
+    GdkPixbuf *thumbnail;
+    SuiUrlPreviewer *self;
+
+    self = SUI_URL_PREVIEWER(user_data);
+    err = NULL;
+    thumbnail = sui_url_preview_cache_load_thumbnail_finish(result, &err);
+    if (err){
+        bool cancelled;
+
+        cancelled = g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+        g_error_free(err);
+        if (!cancelled){
+            // Cache is broken, request the full content
+            g_object_unref(self->msg);
+            send_request(self, FALSE);
+            return;
+        }
+        goto FIN;
     }
+
+    g_object_freeze_notify(G_OBJECT(self));
+    sui_url_previewer_set_content_type(self, SUI_URL_CONTENT_TYPE_IMAGE);
+    preview_image(self, NULL, thumbnail);
+    g_object_thaw_notify(G_OBJECT(self));
+
+    sui_url_preview_cache_insert(self->cache_key,
+            SUI_URL_CONTENT_TYPE_IMAGE, NULL, NULL, thumbnail);
+    g_object_unref(thumbnail);
+
+FIN:
+    finish_request(self);
+}
+
+static void thumbnail_decode_ready(GObject *object, GAsyncResult *result,
+        gpointer user_data){
+    GError *err;
+    GBytes *data;
+    GdkPixbuf *thumbnail;
+    SoupMessageHeaders *headers;
+    SuiUrlPreviewer *self;
+
+    self = SUI_URL_PREVIEWER(object);
+    err = NULL;
+    thumbnail = decode_image_finish(self, result, &err);
+    if (err){
+        WARN_FR("Failed to decode image: %s", err->message);
+        if (!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)){
+            preview_error_text(self, err->message);
+        }
+        g_error_free(err);
+        goto FIN;
+    }
+
+    data = ((DecodeTaskData *)g_task_get_task_data(G_TASK(result)))->data;
+    preview_image(self, data, thumbnail);
+
+    headers = self->msg->response_headers;
+    sui_url_preview_cache_insert(self->cache_key, SUI_URL_CONTENT_TYPE_IMAGE,
+            data, self->mime_type, thumbnail);
+    sui_url_preview_cache_save_thumbnail(self->cache_key, thumbnail,
+            soup_message_headers_get_one(headers, "ETag"),
+            soup_message_headers_get_one(headers, "Last-Modified"));
+    g_object_unref(thumbnail);
+
+FIN:
+    finish_request(self);
+}
+
+static void image_decode_ready(GObject *object, GAsyncResult *result,
+        gpointer user_data){
+    GError *err;
+    GdkPixbuf *pixbuf;
+    SuiUrlPreviewer *self;
+
+    self = SUI_URL_PREVIEWER(object);
+    err = NULL;
+    pixbuf = decode_image_finish(self, result, &err);
+    if (err){
+        WARN_FR("Failed to decode image: %s", err->message);
+        g_error_free(err);
+        // Fall back to thumbnail
+        show_image_window(self->thumbnail);
+        return;
+    }
+
+    show_image_window(pixbuf);
+    g_object_unref(pixbuf);
 }
@@ -38,9 +38,10 @@ enum _SuiUrlContentType {
 
 GType sui_url_previewer_get_type(void);
 SuiUrlPreviewer* sui_url_previewer_new(const char *url);
-SuiUrlPreviewer* sui_url_previewer_new_from_cache(const char *url);
 
 void sui_url_previewer_preview(SuiUrlPreviewer *self);
+void sui_url_previewer_cancel(SuiUrlPreviewer *self);
+bool sui_url_previewer_is_loading(SuiUrlPreviewer *self);
 
 const char* sui_url_previewer_get_url(SuiUrlPreviewer *self);
 SuiUrlContentType sui_url_previewer_get_content_type(SuiUrlPreviewer *self);
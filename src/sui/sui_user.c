@@ -24,6 +24,7 @@
  * @date 2018-06-03
  */
 
+#include <string.h>
 #include <gtk/gtk.h>
 
 #include "core/core.h"
@@ -34,6 +35,8 @@
 #define COL_ICON    1
 #define COL_USER    2
 #define COL_TYPE    3
+#define COL_SORT_KEY    4
+#define COL_ACTIVE  5
 
 /**
  * @brief SuiUser is a iterator of SuiUserList.
@@ -46,8 +49,12 @@ struct _SuiUser {
 
     GtkListStore *list;
     SuiUserStat *stat;
+
+    char *sort_key; // Rank byte + collation key of casefolded nickname,
+                    // only the SuiUser owned by SrnChatUser holds it
 };
 
+static void update_sort_key(SuiUser *self);
 static cairo_surface_t* new_user_icon_from_type(SrnChatUserType type,
         GtkStyleContext *style_context, GdkWindow *window);
 
@@ -80,6 +87,7 @@ SuiUser *sui_user_new_from_iter(GtkListStore *list, GtkTreeIter *iter){
 }
 
 void sui_user_free(SuiUser *self){
+    g_free(self->sort_key);
     g_free(self);
 }
 
@@ -95,6 +103,37 @@ int sui_user_compare(SuiUser *user1, SuiUser *user2){
             user2->ctx->srv_user->nick);
 }
 
+/**
+ * @brief ``sui_user_compare_iter`` compares two rows of a SuiUserList by
+ * their precomputed sort keys.
+ *
+ * It is used as the sort function of list store, so it must not allocate
+ * anything: the sort key column is a G_TYPE_POINTER which is not copied by
+ * ``gtk_tree_model_get()``.
+ *
+ * @param model
+ * @param iter1
+ * @param iter2
+ *
+ * @return
+ */
+int sui_user_compare_iter(GtkTreeModel *model,
+        GtkTreeIter *iter1, GtkTreeIter *iter2){
+    const char *key1;
+    const char *key2;
+
+    key1 = NULL;
+    key2 = NULL;
+    gtk_tree_model_get(model, iter1, COL_SORT_KEY, &key1, -1);
+    gtk_tree_model_get(model, iter2, COL_SORT_KEY, &key2, -1);
+
+    // Row which is just appended has no sort key yet
+    if (!key1 || !key2){
+        return (key1 != NULL) - (key2 != NULL);
+    }
+    return strcmp(key1, key2);
+}
+
 void sui_user_update(SuiUser *self, GtkStyleContext *style_context,
         GdkWindow *window){
     g_return_if_fail(self->list);
@@ -135,10 +174,13 @@ void sui_user_update(SuiUser *self, GtkStyleContext *style_context,
         }
     }
     self->type = self->ctx->type;
+    update_sort_key(self);
     gtk_list_store_set(self->list, (GtkTreeIter *)self,
             COL_NAME, self->ctx->srv_user->nick,
             COL_USER, self->ctx,
             COL_TYPE, self->ctx->type,
+            COL_SORT_KEY, ((SuiUser *)self->ctx->ui)->sort_key,
+            COL_ACTIVE, !self->ctx->srv_user->is_away,
             -1);
 
     // Update icon only when GdkWindow available
@@ -174,6 +216,37 @@ const char* sui_user_get_nickname(SuiUser *self){
  * Static functions
  *****************************************************************************/
 
+static void update_sort_key(SuiUser *self){
+    char *casefolded;
+    char *collate_key;
+    SuiUser *owner;
+
+    // Iterators created by sui_user_new_from_iter() are temporary copies,
+    // the sort key referenced by list store is always owned by ctx->ui
+    owner = self->ctx->ui;
+    g_return_if_fail(owner);
+
+    casefolded = g_utf8_casefold(self->ctx->srv_user->nick, -1);
+    collate_key = g_utf8_collate_key(casefolded, -1);
+
+    if (owner->sort_key
+            && owner->sort_key[0] == (char)('0' + self->ctx->type)
+            && g_strcmp0(owner->sort_key + 1, collate_key) == 0){
+        g_free(collate_key);
+        g_free(casefolded);
+        return;
+    }
+
+    /* The old key is still referenced by list store, but no comparison
+     * happens before caller sets the new one */
+    g_free(owner->sort_key);
+    owner->sort_key = g_strdup_printf("%c%s",
+            (char)('0' + self->ctx->type), collate_key);
+
+    g_free(collate_key);
+    g_free(casefolded);
+}
+
 static cairo_surface_t* new_user_icon_from_type(SrnChatUserType type,
         GtkStyleContext *style_context, GdkWindow *window){
     const char *color_str;
@@ -37,6 +37,7 @@ void sui_user_free(SuiUser *self);
 
 void sui_user_update(SuiUser *self, GtkStyleContext *style_context, GdkWindow *window);
 int sui_user_compare(SuiUser *user1, SuiUser *user2);
+int sui_user_compare_iter(GtkTreeModel *model, GtkTreeIter *iter1, GtkTreeIter *iter2);
 
 void sui_user_set_list(SuiUser *self, GtkListStore *list);
 void sui_user_set_stat(SuiUser *self, SuiUserStat *stat);
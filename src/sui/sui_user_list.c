@@ -29,6 +29,7 @@
 
 #include <gtk/gtk.h>
 #include <cairo-gobject.h>
+#include <string.h>
 
 #include "core/core.h"
 
@@ -38,6 +39,13 @@
 #include "log.h"
 #include "i18n.h"
 
+/* Entry of nickname index */
+typedef struct _NickIndexEntry {
+    char *key;          // Casefolded nickname
+    SrnChatUser *ctx;
+    gint64 last_active; // Monotonic time of last message, 0 if never spoke
+} NickIndexEntry;
+
 struct _SuiUserList {
     GtkBox parent;
 
@@ -48,10 +56,15 @@ struct _SuiUserList {
     GtkCellRendererPixbuf *user_icon_cell_renderer;
 
     /* Data model */
+    int bulk_depth;     // Sorting is suspended when greater than 0
     SuiUserStat user_stat;
     GtkListStore *user_list_store;
     GtkTreeModel *user_tree_model_filter;   // FilterTreeModel of user_list_store
                                             // TODO: user search
+
+    /* Nickname index for completion */
+    GPtrArray *nick_index;          // Array of NickIndexEntry, sorted by key
+    GHashTable *nick_index_table;   // SrnChatUser → NickIndexEntry
 };
 
 struct _SuiUserListClass {
@@ -69,6 +82,13 @@ static void user_list_store_on_row_changed(GtkTreeModel *tree_model,
         GtkTreePath *path, GtkTreeIter *iter, gpointer user_data);
 static void on_style_updated(SuiUserList *self, gpointer user_data);
 
+static unsigned int nick_index_lower_bound(SuiUserList *self, const char *key);
+static void nick_index_take(SuiUserList *self, NickIndexEntry *entry);
+static void nick_index_update(SuiUserList *self, SrnChatUser *ctx);
+static void nick_index_remove(SuiUserList *self, SrnChatUser *ctx);
+static void nick_index_entry_free(NickIndexEntry *entry);
+static int nick_index_entry_activity_cmp(gconstpointer a, gconstpointer b);
+
 /*****************************************************************************
  * GObject functions
  *****************************************************************************/
@@ -78,6 +98,11 @@ G_DEFINE_TYPE(SuiUserList, sui_user_list, GTK_TYPE_BOX);
 static void sui_user_list_init(SuiUserList *self){
     gtk_widget_init_template(GTK_WIDGET(self));
 
+    self->nick_index = g_ptr_array_new();
+    self->nick_index_table = g_hash_table_new_full(
+            g_direct_hash, g_direct_equal,
+            NULL, (GDestroyNotify)nick_index_entry_free);
+
     user_tree_view_set_model(self);
     stat_label_update_stat(self);
 
@@ -89,9 +114,23 @@ static void sui_user_list_init(SuiUserList *self){
             G_CALLBACK(on_style_updated), NULL);
 }
 
+static void sui_user_list_finalize(GObject *object){
+    SuiUserList *self;
+
+    self = SUI_USER_LIST(object);
+    g_ptr_array_free(self->nick_index, TRUE);
+    g_hash_table_destroy(self->nick_index_table);
+
+    G_OBJECT_CLASS(sui_user_list_parent_class)->finalize(object);
+}
+
 static void sui_user_list_class_init(SuiUserListClass *class){
+    GObjectClass *object_class;
     GtkWidgetClass *widget_class;
 
+    object_class = G_OBJECT_CLASS(class);
+    object_class->finalize = sui_user_list_finalize;
+
     widget_class = GTK_WIDGET_CLASS(class);
 
     gtk_widget_class_set_template_from_resource(widget_class,
@@ -127,6 +166,7 @@ void sui_user_list_rm_user(SuiUserList *self, SuiUser *user){
 
     self->user_stat.total--;
     sui_user_list_update_user(self, user);
+    nick_index_remove(self, chat_user);
     gtk_list_store_remove(self->user_list_store, (GtkTreeIter *)user);
     sui_user_set_list(user, NULL);
     sui_user_set_stat(user, NULL);
@@ -136,40 +176,115 @@ void sui_user_list_update_user(SuiUserList *self, SuiUser *user){
     sui_user_update(user,
             gtk_widget_get_style_context(GTK_WIDGET(self)),
             gtk_widget_get_window(GTK_WIDGET(self)));
+    nick_index_update(self, sui_user_get_ctx(user));
+}
+
+/**
+ * @brief ``sui_user_list_touch_user`` records that the user has just spoken,
+ * recent speakers are preferred when completing nicknames.
+ *
+ * @param self
+ * @param user
+ */
+void sui_user_list_touch_user(SuiUserList *self, SuiUser *user){
+    NickIndexEntry *entry;
+
+    entry = g_hash_table_lookup(self->nick_index_table, sui_user_get_ctx(user));
+    if (!entry){
+        return;
+    }
+    entry->last_active = g_get_monotonic_time();
+}
+
+/**
+ * @brief ``sui_user_list_begin_bulk`` detaches the list store from tree view
+ * and suspends sorting until the paired ``sui_user_list_end_bulk`` is called,
+ * so that adding or updating lots of users does not re-sort the list store
+ * and refresh the view on every row.
+ *
+ * Calls can be nested.
+ *
+ * @param self
+ */
+void sui_user_list_begin_bulk(SuiUserList *self){
+    if (self->bulk_depth++ > 0){
+        return;
+    }
+    gtk_tree_view_set_model(self->user_tree_view, NULL);
+    gtk_tree_sortable_set_sort_column_id(
+            GTK_TREE_SORTABLE(self->user_list_store),
+            GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID,
+            GTK_SORT_ASCENDING);
+}
+
+/**
+ * @brief ``sui_user_list_end_bulk`` resumes sorting of user list and attaches
+ * it to tree view again, the whole list is sorted only once here.
+ *
+ * @param self
+ */
+void sui_user_list_end_bulk(SuiUserList *self){
+    g_return_if_fail(self->bulk_depth > 0);
+
+    if (--self->bulk_depth > 0){
+        return;
+    }
+    gtk_tree_sortable_set_sort_column_id(
+            GTK_TREE_SORTABLE(self->user_list_store),
+            GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID,
+            GTK_SORT_ASCENDING);
+    gtk_tree_view_set_model(self->user_tree_view,
+            self->user_tree_model_filter);
+    stat_label_update_stat(self);
 }
 
 void sui_user_list_clear(SuiUserList *self){
+    g_ptr_array_set_size(self->nick_index, 0);
+    g_hash_table_remove_all(self->nick_index_table);
     gtk_list_store_clear(self->user_list_store);
     memset(&self->user_stat, 0, sizeof(self->user_stat));
 }
 
+/**
+ * @brief ``sui_user_list_get_users_by_prefix`` looks up users whose nickname
+ * starts with the given prefix (case insensitive) in the nickname index,
+ * recent speakers come first.
+ *
+ * @param self
+ * @param prefix
+ *
+ * @return A list of SuiUser, the list should be freed by ``g_list_free()``,
+ * but the users are owned by SuiUserList.
+ */
 GList* sui_user_list_get_users_by_prefix(SuiUserList *self, const char *prefix){
+    unsigned int i;
+    char *key;
     GList *users;
-    GtkTreeModel *model;
-    GtkTreeIter iter;
-    char *normalized_prefix;
+    GPtrArray *matches;
 
-    model = GTK_TREE_MODEL(self->user_list_store);
-    if (!gtk_tree_model_get_iter_first(model, &iter)){
-        return NULL;
+    key = g_utf8_casefold(prefix, -1);
+    matches = g_ptr_array_new();
+    for (i = nick_index_lower_bound(self, key); i < self->nick_index->len; i++){
+        NickIndexEntry *entry;
+
+        entry = g_ptr_array_index(self->nick_index, i);
+        if (!g_str_has_prefix(entry->key, key)){
+            break;
+        }
+        g_ptr_array_add(matches, entry);
     }
+    g_free(key);
 
-    normalized_prefix = g_utf8_strdown(prefix, -1);
+    g_ptr_array_sort(matches, nick_index_entry_activity_cmp);
 
     users = NULL;
-    do {
-        SuiUser *user;
-        char *normalized_nickname;
+    for (i = matches->len; i > 0; i--){
+        NickIndexEntry *entry;
 
-        user = sui_user_new_from_iter(GTK_LIST_STORE(model), &iter);
-        normalized_nickname = g_utf8_strdown(sui_user_get_nickname(user), -1);
-        if (g_str_has_prefix(normalized_nickname, normalized_prefix)){
-            users = g_list_append(users, user);
-        } else {
-            sui_user_free(user);
-        }
-        g_free(normalized_nickname);
-    } while (gtk_tree_model_iter_next(model, &iter));
+        entry = g_ptr_array_index(matches, i - 1);
+        users = g_list_prepend(users, entry->ctx->ui);
+    }
+    g_ptr_array_free(matches, TRUE);
 
     return users;
 }
@@ -183,14 +298,19 @@ static void user_tree_view_set_model(SuiUserList *self){
     GtkTreeModel *filter;
     GtkTreeView *view;
 
-    /* 4 columns: user, icon, model, type */
-    self->user_list_store = gtk_list_store_new(4,
+    /* 6 columns: user, icon, model, type, sort key, active */
+    self->user_list_store = gtk_list_store_new(6,
             G_TYPE_STRING,
             CAIRO_GOBJECT_TYPE_SURFACE,
             G_TYPE_POINTER,
-            G_TYPE_INT);
+            G_TYPE_INT,
+            G_TYPE_POINTER,
+            G_TYPE_BOOLEAN);
     gtk_tree_view_column_add_attribute(self->user_tree_view_column,
             GTK_CELL_RENDERER(self->user_name_cell_renderer), "text", 0);
+    // Away users are greyed out
+    gtk_tree_view_column_add_attribute(self->user_tree_view_column,
+            GTK_CELL_RENDERER(self->user_name_cell_renderer), "sensitive", 5);
     gtk_tree_view_column_add_attribute(self->user_tree_view_column,
             GTK_CELL_RENDERER(self->user_icon_cell_renderer), "surface", 1);
 
@@ -228,19 +348,7 @@ static void stat_label_update_stat(SuiUserList *self){
 
 static int user_list_store_sort_func(GtkTreeModel *model,
         GtkTreeIter *iter1, GtkTreeIter *iter2, gpointer user_data){
-    int ret;
-    SuiUser *user1;
-    SuiUser *user2;
-
-    user1 = sui_user_new_from_iter(GTK_LIST_STORE(model), iter1);
-    user2 = sui_user_new_from_iter(GTK_LIST_STORE(model), iter2);
-
-    ret = sui_user_compare(user1, user2);
-
-    sui_user_free(user1);
-    sui_user_free(user2);
-
-    return ret;
+    return sui_user_compare_iter(model, iter1, iter2);
 }
 
 static gboolean user_tree_view_on_popup(GtkWidget *widget,
@@ -286,6 +394,10 @@ static void user_list_store_on_row_changed(GtkTreeModel *tree_model,
     SuiUserList *self;
 
     self = SUI_USER_LIST(user_data);
+    if (self->bulk_depth > 0){
+        // Updated by sui_user_list_end_bulk()
+        return;
+    }
     stat_label_update_stat(self);
 }
 
@@ -298,6 +410,7 @@ static void on_style_updated(SuiUserList *self, gpointer user_data) {
         return;
     }
 
+    sui_user_list_begin_bulk(self);
     do {
         SuiUser *user;
         user = sui_user_new_from_iter(GTK_LIST_STORE(model), &iter);
@@ -305,4 +418,110 @@ static void on_style_updated(SuiUserList *self, gpointer user_data) {
         sui_user_list_update_user(self, user);
         sui_user_free(user);
     } while (gtk_tree_model_iter_next(model, &iter));
+    sui_user_list_end_bulk(self);
+}
+
+/**
+ * @brief Binary search the nickname index.
+ *
+ * @return Index of the first entry whose key is not less than the given key
+ */
+static unsigned int nick_index_lower_bound(SuiUserList *self, const char *key){
+    unsigned int low;
+    unsigned int high;
+
+    low = 0;
+    high = self->nick_index->len;
+    while (low < high){
+        unsigned int mid;
+        NickIndexEntry *entry;
+
+        mid = low + (high - low) / 2;
+        entry = g_ptr_array_index(self->nick_index, mid);
+        if (strcmp(entry->key, key) < 0){
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * @brief Take the entry out of nickname index array without freeing it.
+ */
+static void nick_index_take(SuiUserList *self, NickIndexEntry *entry){
+    unsigned int i;
+
+    // Different users may have the same casefolded nickname
+    for (i = nick_index_lower_bound(self, entry->key);
+            i < self->nick_index->len; i++){
+        if (g_ptr_array_index(self->nick_index, i) == entry){
+            g_ptr_array_remove_index(self->nick_index, i);
+            return;
+        }
+    }
+    g_warn_if_reached();
+}
+
+/**
+ * @brief Add user to nickname index, or re-index it if its nickname changed.
+ */
+static void nick_index_update(SuiUserList *self, SrnChatUser *ctx){
+    char *key;
+    NickIndexEntry *entry;
+
+    key = g_utf8_casefold(ctx->srv_user->nick, -1);
+    entry = g_hash_table_lookup(self->nick_index_table, ctx);
+    if (entry){
+        if (strcmp(entry->key, key) == 0){
+            g_free(key);
+            return;
+        }
+        // Nickname changed, re-index it but keep its activity
+        nick_index_take(self, entry);
+        g_free(entry->key);
+    } else {
+        entry = g_malloc0(sizeof(NickIndexEntry));
+        entry->ctx = ctx;
+        g_hash_table_insert(self->nick_index_table, ctx, entry);
+    }
+    entry->key = key;
+
+    g_ptr_array_insert(self->nick_index,
+            nick_index_lower_bound(self, entry->key), entry);
+}
+
+static void nick_index_remove(SuiUserList *self, SrnChatUser *ctx){
+    NickIndexEntry *entry;
+
+    entry = g_hash_table_lookup(self->nick_index_table, ctx);
+    if (!entry){
+        return;
+    }
+    nick_index_take(self, entry);
+    g_hash_table_remove(self->nick_index_table, ctx); // Entry is freed here
+}
+
+static void nick_index_entry_free(NickIndexEntry *entry){
+    g_free(entry->key);
+    g_free(entry);
+}
+
+/**
+ * @brief Sort completion candidates, recent speakers first, then in
+ * alphabetical order.
+ */
+static int nick_index_entry_activity_cmp(gconstpointer a, gconstpointer b){
+    const NickIndexEntry *entry1;
+    const NickIndexEntry *entry2;
+
+    entry1 = *(NickIndexEntry **)a;
+    entry2 = *(NickIndexEntry **)b;
+
+    if (entry1->last_active != entry2->last_active){
+        return entry1->last_active > entry2->last_active ? -1 : 1;
+    }
+    return strcmp(entry1->key, entry2->key);
 }
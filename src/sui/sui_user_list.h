@@ -35,6 +35,9 @@ SuiUserList *sui_user_list_new(void);
 void sui_user_list_add_user(SuiUserList *list, SuiUser *user);
 void sui_user_list_rm_user(SuiUserList *list, SuiUser *user);
 void sui_user_list_update_user(SuiUserList *list, SuiUser *user);
+void sui_user_list_touch_user(SuiUserList *list, SuiUser *user);
+void sui_user_list_begin_bulk(SuiUserList *list);
+void sui_user_list_end_bulk(SuiUserList *list);
 void sui_user_list_clear(SuiUserList *list);
 GList* sui_user_list_get_users_by_prefix(SuiUserList *self, const char *prefix);
 
@@ -39,8 +39,10 @@
 #include "sui_window.h"
 #include "sui_connect_panel.h"
 #include "sui_join_panel.h"
+#include "sui_search_panel.h"
 #include "sui_side_bar.h"
 #include "sui_server_buffer.h"
+#include "sui_dialog_buffer.h"
 
 #define SEND_MESSAGE_INTERVAL       100
 
@@ -70,6 +72,7 @@ struct _SuiWindow {
     GtkMenuButton *start_menu_button;
     GtkButton *connect_button;
     GtkButton *join_button;
+    GtkButton *search_button;
 
     /* Buffer header */
     GtkHeaderBar *buffer_header_bar;
@@ -125,6 +128,7 @@ static void buffer_stack_on_child_changed(GtkWidget *widget, GParamSpec *pspec,
         gpointer user_data);
 static void popover_button_on_click(GtkButton *button, gpointer user_data);
 static void join_button_on_click(GtkButton *button, gpointer user_data);
+static void search_button_on_click(GtkButton *button, gpointer user_data);
 static gboolean CTRL_J_K_on_press(GtkAccelGroup *group, GObject *obj,
         guint keyval, GdkModifierType mod, gpointer user_data);
 static gboolean input_text_view_on_key_press(GtkTextView *text_view,
@@ -239,6 +243,8 @@ static void sui_window_init(SuiWindow *self){
             G_CALLBACK(popover_button_on_click), self->connect_panel);
     g_signal_connect(self->join_button, "clicked",
             G_CALLBACK(join_button_on_click), self);
+    g_signal_connect(self->search_button, "clicked",
+            G_CALLBACK(search_button_on_click), self);
 
     g_signal_connect(self->window_stack, "notify::visible-child",
             G_CALLBACK(window_stack_on_child_changed), self);
@@ -371,6 +377,7 @@ static void sui_window_class_init(SuiWindowClass *class){
     gtk_widget_class_bind_template_child(widget_class, SuiWindow, start_menu_button);
     gtk_widget_class_bind_template_child(widget_class, SuiWindow, connect_button);
     gtk_widget_class_bind_template_child(widget_class, SuiWindow, join_button);
+    gtk_widget_class_bind_template_child(widget_class, SuiWindow, search_button);
 
     gtk_widget_class_bind_template_child(widget_class, SuiWindow, buffer_header_bar);
     gtk_widget_class_bind_template_child(widget_class, SuiWindow, buffer_header_box);
@@ -496,6 +503,38 @@ void sui_window_set_subtitle(SuiWindow *self, const char *subtitle){
     gtk_label_set_text(self->buffer_subtitle_label, subtitle);
 }
 
+/**
+ * @brief ``sui_window_update_subtitle`` shows remark of current buffer in
+ * header, and the online state of peer if it is a dialog.
+ *
+ * @param self
+ */
+void sui_window_update_subtitle(SuiWindow *self){
+    const char *status;
+    SuiBuffer *buf;
+
+    buf = sui_window_get_cur_buffer(self);
+    if (!SUI_IS_BUFFER(buf)){
+        return;
+    }
+
+    status = NULL;
+    if (SUI_IS_DIALOG_BUFFER(buf)){
+        status = sui_dialog_buffer_get_status(SUI_DIALOG_BUFFER(buf));
+    }
+    if (status){
+        char *subtitle;
+
+        subtitle = g_strdup_printf("%s (%s)",
+                sui_buffer_get_remark(buf), status);
+        sui_window_set_subtitle(self, subtitle);
+        g_free(subtitle);
+    } else {
+        sui_window_set_subtitle(self, sui_buffer_get_remark(buf));
+    }
+    update_title(self);
+}
+
 
 /*****************************************************************************
  * Static functions
@@ -512,6 +551,7 @@ static void update_header(SuiWindow *self){
     if (g_strcmp0(page, WINDOW_STACK_PAGE_WELCOME) == 0){
         gtk_widget_set_visible(GTK_WIDGET(self->connect_button), FALSE);
         gtk_widget_set_visible(GTK_WIDGET(self->join_button), FALSE);
+        gtk_widget_set_visible(GTK_WIDGET(self->search_button), FALSE);
         if (self->cfg->csd){
             gtk_widget_set_visible(GTK_WIDGET(self->buffer_header_bar), FALSE);
             gtk_header_bar_set_show_close_button(self->side_header_bar, TRUE);
@@ -525,6 +565,7 @@ static void update_header(SuiWindow *self){
     } else if (g_strcmp0(page, WINDOW_STACK_PAGE_MAIN) == 0){
         gtk_widget_set_visible(GTK_WIDGET(self->connect_button), TRUE);
         gtk_widget_set_visible(GTK_WIDGET(self->join_button), TRUE);
+        gtk_widget_set_visible(GTK_WIDGET(self->search_button), TRUE);
         if (self->cfg->csd){
             gtk_header_bar_set_show_close_button(self->side_header_bar, FALSE);
             gtk_widget_set_visible(GTK_WIDGET(self->buffer_header_bar), TRUE);
@@ -668,6 +709,22 @@ static void join_button_on_click(GtkButton *button, gpointer user_data){
     sui_common_popup_panel(GTK_WIDGET(button), GTK_WIDGET(panel));
 }
 
+static void search_button_on_click(GtkButton *button, gpointer user_data){
+    SuiBuffer *buf;
+    SuiSearchPanel *panel;
+    SrnChat *chat;
+
+    buf = sui_common_get_cur_buffer();
+    g_return_if_fail(buf);
+    chat = sui_buffer_get_ctx(buf);
+    g_return_if_fail(chat);
+
+    // Panel is destroyed when popover is hidden
+    panel = sui_search_panel_new(chat->srv->name,
+            chat->type == SRN_CHAT_TYPE_SERVER ? NULL : chat->name);
+    sui_common_popup_panel(GTK_WIDGET(button), GTK_WIDGET(panel));
+}
+
 static gboolean CTRL_J_K_on_press(GtkAccelGroup *group, GObject *obj,
         guint keyval, GdkModifierType mod, gpointer user_data){
     SuiSideBar *side_bar;
@@ -825,8 +882,7 @@ static void buffer_stack_on_child_changed(GtkWidget *widget, GParamSpec *pspec,
     }
 
     sui_window_set_title(self, sui_buffer_get_name(buf));
-    sui_window_set_subtitle(self, sui_buffer_get_remark(buf));
-    update_title(self);
+    sui_window_update_subtitle(self);
     gtk_text_view_set_buffer(self->input_text_view,
             sui_buffer_get_input_text_buffer(buf));
     gtk_menu_button_set_popup(self->buffer_menu_button,